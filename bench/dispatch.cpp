@@ -0,0 +1,73 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/compiler.h"
+#include "../src/dialect.h"
+#include "../src/cppvariable.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Times the interpreter's instruction dispatch. The dispatch is chosen when the library is built, so this is built twice; once as is, and
+// once with LIQUID_INTERPRETER_SWITCH_DISPATCH, and the two runs compared. `make bench` does both.
+
+using namespace Liquid;
+
+static double timeProgram(Interpreter& interpreter, const Program& program, CPPVariable& store, int iterations) {
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        interpreter.renderTemplate(program, store, +[](const char* chunk, size_t len, void* data) {
+            *static_cast<size_t*>(data) += len;
+        }, &total);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    int count = 1000000;
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    Parser parser(context);
+    Interpreter interpreter(context, CPPVariableResolver());
+    CPPVariable store;
+
+    // A countdown that's nothing but moves, arithmetic, comparisons and jumps; this is about as close to pure dispatch as we get.
+    Compiler assembler(context);
+    assembler.add(OP_MOVINT, 0x0, count);
+    int top = assembler.add(OP_MOVINT, 0x1, 1);
+    assembler.add(OP_SUB, 0x1);
+    assembler.add(OP_MOV, 0x0, 0x2);
+    assembler.add(OP_MOVINT, 0x1, 0);
+    assembler.add(OP_EQL, 0x1);
+    int done = assembler.add(OP_JMPTRUE, 0x0, 0x0);
+    assembler.add(OP_MOV, 0x2, 0x0);
+    assembler.add(OP_JMP, 0x0, top);
+    assembler.modify(done, OP_JMPTRUE, 0x0, assembler.currentOffset());
+    assembler.add(OP_EXIT, 0x0);
+    Program countdown;
+    countdown.codeOffset = 0;
+    countdown.code = assembler.code;
+
+    // A loop body that stays out of OP_CALL; conditionals, cycles, forloop properties, counters and output.
+    CPPVariable list;
+    for (int i = 0; i < 10000; ++i)
+        list[(size_t)i] = i;
+    store["list"] = std::move(list);
+    Compiler compiler(context);
+    Node ast = parser.parse("{% for i in list %}{% if i == 3 %}{{ i }}{% endif %}{% cycle 'a', 'b', 'c' %}{{ forloop.index }}{% increment counter %}{% endfor %}");
+    Program loop = compiler.compile(ast);
+
+    #ifdef LIQUID_INTERPRETER_SWITCH_DISPATCH
+        const char* dispatch = "switch";
+    #else
+        const char* dispatch = "computed goto";
+    #endif
+    fprintf(stdout, "Dispatch: %s\n", dispatch);
+    fprintf(stdout, "Countdown from %d: %.3fms\n", count, timeProgram(interpreter, countdown, store, iterations));
+    fprintf(stdout, "Loop over 10000 elements: %.3fms\n", timeProgram(interpreter, loop, store, iterations));
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/compiler.h"
+#include "../src/dialect.h"
+#include "../src/web.h"
+#include "../src/cppvariable.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Times the escaping filters over product-description HTML, against the character-at-a-time loop they used to be.
+
+using namespace Liquid;
+
+static std::string escapeByCharacter(const std::string& incoming) {
+    std::string result;
+    result.reserve(int(incoming.size()*1.10));
+    for (size_t i = 0; i < incoming.size(); ++i) {
+        switch (incoming[i]) {
+            case '\'': result += "&apos;"; break;
+            case '"': result += "&quot;"; break;
+            case '<': result += "&lt;"; break;
+            case '>': result += "&gt;"; break;
+            case '&': result += "&amp;"; break;
+            default: result += incoming[i];
+        }
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    WebDialect::implement(context);
+    Parser parser(context);
+    Compiler compiler(context);
+    Interpreter interpreter(context, CPPVariableResolver());
+    CPPVariable store;
+
+    std::string description;
+    for (int i = 0; i < 20; ++i) {
+        description += "<p>Our bestselling ceramic mug, hand-glazed in small batches. Holds 12oz of coffee, tea, or whatever gets you going in the morning.</p>\n"
+            "<ul>\n<li>Dishwasher &amp; microwave safe</li>\n<li>Lead-free glaze</li>\n<li>Ships in recyclable packaging</li>\n</ul>\n"
+            "<p class=\"note\">Each one's a little different; that's the point.</p>\n";
+    }
+    store["description"] = description;
+
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        total += escapeByCharacter(description).size();
+    auto end = std::chrono::steady_clock::now();
+    fprintf(stdout, "escape, by character: %.2fus\n", std::chrono::duration<double, std::micro>(end - start).count() / iterations);
+
+    const char* filters[] = { "escape", "url_encode", "newline_to_br" };
+    for (auto filter : filters) {
+        Program program = compiler.compile(parser.parse(std::string("{{ description | ") + filter + " }}"));
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            interpreter.renderTemplate(program, store, +[](const char* chunk, size_t len, void* data) {
+                *static_cast<size_t*>(data) += len;
+            }, &total);
+        }
+        end = std::chrono::steady_clock::now();
+        fprintf(stdout, "%s: %.2fus\n", filter, std::chrono::duration<double, std::micro>(end - start).count() / iterations);
+    }
+    fprintf(stdout, "(%lu bytes of HTML, %lu out)\n", description.size(), total / iterations);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/compiler.h"
+#include "../src/dialect.h"
+#include "../src/cppvariable.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Times chains of array filters, where most of the work is copying variants from one array to the next; strings and arrays are shared
+// between copies, so this is mostly a measure of how cheaply that happens.
+
+using namespace Liquid;
+
+static double timeProgram(Interpreter& interpreter, const Program& program, CPPVariable& store, int iterations) {
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        interpreter.renderTemplate(program, store, +[](const char* chunk, size_t len, void* data) {
+            *static_cast<size_t*>(data) += len;
+        }, &total);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    Parser parser(context);
+    Compiler compiler(context);
+    Interpreter interpreter(context, CPPVariableResolver());
+    CPPVariable store;
+
+    CPPVariable numbers, strings;
+    for (int i = 0; i < 10000; ++i) {
+        numbers[(size_t)i] = 10000 - i;
+        strings[(size_t)i] = "a string long enough that it won't fit inline: " + std::to_string(i % 100);
+    }
+    store["numbers"] = std::move(numbers);
+    store["strings"] = std::move(strings);
+
+    const char* chains[] = {
+        "{% assign a = numbers | sort | reverse %}{% assign b = a | concat: a %}{{ b | size }}",
+        "{% assign a = strings | sort | reverse %}{% assign b = a | concat: a | uniq %}{{ b | size }}",
+        "{% assign a = strings | reverse %}{% for i in (1..10) %}{% assign b = a | reverse %}{% endfor %}{{ b | first }}"
+    };
+    for (auto chain : chains) {
+        Program program = compiler.compile(parser.parse(chain));
+        fprintf(stdout, "%s: %.3fms\n", chain, timeProgram(interpreter, program, store, iterations));
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/dialect.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Times parsing a large, mostly literal page with sparse tags, where nearly all the lexer's time goes in skipping text.
+
+using namespace Liquid;
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    Parser parser(context);
+
+    std::string page;
+    for (int i = 0; i < 2000; ++i) {
+        page += "<div class=\"product-card\"><a href=\"/products/item\">A fairly ordinary run of markup, as most pages are.</a></div>\n";
+        if (i % 10 == 0)
+            page += "<span>{{ product.title }}</span>\n";
+        if (i % 100 == 0)
+            page += "{% comment %}Left in by someone a while ago; { braces } and all.\n{% endcomment %}";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        parser.parse(page.data(), page.size(), "bench");
+    auto end = std::chrono::steady_clock::now();
+    fprintf(stdout, "%lu bytes: %.3fms\n", page.size(), std::chrono::duration<double, std::milli>(end - start).count() / iterations);
+    return 0;
+}
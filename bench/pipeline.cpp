@@ -0,0 +1,186 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/optimizer.h"
+#include "../src/compiler.h"
+#include "../src/dialect.h"
+#include "../src/cppvariable.h"
+#include "store.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <new>
+
+// Times each stage of the pipeline on its own, and all of them end to end, over a corpus of storefront templates rendered against a
+// store shaped like a shop's; a collection of products with variants and tags, and a cart. Each case is reported as time, bytes
+// allocated and allocations per run, so that a change that saves time by allocating more, or the reverse, shows up in the numbers.
+//
+//     pipeline [iterations] [--corpus dir] [--save file] [--compare file]
+//
+// --save writes the results as a baseline, one case to a line, and --compare reads one back and prints each case against it.
+
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    allocatedBytes += size;
+    if (void* pointer = malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+
+using namespace Liquid;
+
+// Does nothing with the tokens, so that lexing is timed without the parser's work on top.
+struct BareLexer : Lexer<BareLexer> {
+    BareLexer(const Context& context) : Lexer<BareLexer>(context) { }
+};
+
+struct Result {
+    double nanoseconds = 0;
+    double bytes = 0;
+    double allocations = 0;
+};
+
+template <class T>
+static Result measure(int iterations, T callback) {
+    size_t startAllocations = allocations, startBytes = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        callback(i);
+    auto end = std::chrono::steady_clock::now();
+    Result result;
+    result.nanoseconds = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    result.bytes = (double)(allocatedBytes - startBytes) / iterations;
+    result.allocations = (double)(allocations - startAllocations) / iterations;
+    return result;
+}
+
+static std::map<std::string, Result> readBaseline(const std::string& path) {
+    std::map<std::string, Result> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        char name[256];
+        Result result;
+        if (sscanf(line.c_str(), "%255s %lf %lf %lf", name, &result.nanoseconds, &result.bytes, &result.allocations) == 4)
+            baseline[name] = result;
+    }
+    return baseline;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 200;
+    std::string corpus = "bench/corpus", save, compare;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc)
+            corpus = argv[++i];
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            save = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            compare = argv[++i];
+        else
+            iterations = atoi(argv[i]);
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations] [--corpus dir] [--save file] [--compare file]\n", argv[0]);
+        return 1;
+    }
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    Parser parser(context);
+    Renderer renderer(context, CPPVariableResolver());
+    Optimizer optimizer(renderer);
+    // Settings are the same for every page of a shop, so they're what would be frozen in; the rest is left to be rendered.
+    optimizer.frozenVariables.insert("settings");
+    Compiler compiler(context);
+    Interpreter interpreter(context, CPPVariableResolver());
+    CPPVariable store = makeStore();
+
+    std::map<std::string, Result> baseline;
+    if (!compare.empty())
+        baseline = readBaseline(compare);
+    std::vector<std::pair<std::string, Result>> results;
+
+    const char* templates[] = { "collection", "product", "cart", "filters" };
+    for (auto name : templates) {
+        std::string source;
+        if (!readFile(corpus + "/" + name + ".liquid", source)) {
+            fprintf(stderr, "Can't read %s/%s.liquid.\n", corpus.c_str(), name);
+            return 1;
+        }
+        Node ast, optimized;
+        try {
+            ast = parser.parse(source, name);
+            optimized = ast;
+            optimizer.optimize(optimized, store);
+        } catch (Liquid::Exception& exception) {
+            fprintf(stderr, "%s: %s\n", name, exception.what());
+            return 1;
+        }
+        Program program = compiler.compile(optimized);
+        // The interpreter is given its own copy, as templates can assign to the store.
+        CPPVariable interpreterStore = store;
+        if (renderer.render(optimized, store) != interpreter.renderTemplate(program, interpreterStore)) {
+            fprintf(stderr, "%s: the renderer and interpreter disagree.\n", name);
+            return 1;
+        }
+
+        size_t total = 0;
+        auto output = +[](const char* chunk, size_t len, void* data) { *static_cast<size_t*>(data) += len; };
+        std::vector<Node> copies(iterations, ast);
+        BareLexer lexer(context);
+
+        results.emplace_back(std::string(name) + "/lex", measure(iterations, [&](int) { lexer.parse(source.data(), source.size()); }));
+        results.emplace_back(std::string(name) + "/parse", measure(iterations, [&](int) { parser.parse(source, name); }));
+        results.emplace_back(std::string(name) + "/optimize", measure(iterations, [&](int i) { optimizer.optimize(copies[i], store); }));
+        copies.clear();
+        results.emplace_back(std::string(name) + "/compile", measure(iterations, [&](int) { compiler.compile(optimized); }));
+        results.emplace_back(std::string(name) + "/render", measure(iterations, [&](int) { renderer.render(optimized, store); }));
+        results.emplace_back(std::string(name) + "/interpret", measure(iterations, [&](int) {
+            interpreter.renderTemplate(program, interpreterStore, output, &total);
+        }));
+        results.emplace_back(std::string(name) + "/total", measure(iterations, [&](int) {
+            Node tmpl = parser.parse(source, name);
+            optimizer.optimize(tmpl, store);
+            interpreter.renderTemplate(compiler.compile(tmpl), interpreterStore, output, &total);
+        }));
+    }
+
+    fprintf(stdout, "%-24s %12s %12s %12s\n", "case", "ns/op", "bytes/op", "allocs/op");
+    for (auto& it : results) {
+        fprintf(stdout, "%-24s %12.0f %12.0f %12.1f", it.first.c_str(), it.second.nanoseconds, it.second.bytes, it.second.allocations);
+        auto previous = baseline.find(it.first);
+        if (previous != baseline.end() && previous->second.nanoseconds > 0) {
+            fprintf(stdout, "   %+6.1f%% time, %+.0f bytes, %+.1f allocs", (it.second.nanoseconds / previous->second.nanoseconds - 1) * 100,
+                it.second.bytes - previous->second.bytes, it.second.allocations - previous->second.allocations);
+        }
+        fprintf(stdout, "\n");
+    }
+
+    if (!save.empty()) {
+        FILE* file = fopen(save.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "Can't write %s.\n", save.c_str());
+            return 1;
+        }
+        fprintf(file, "# case ns/op bytes/op allocs/op, from %d iterations\n", iterations);
+        for (auto& it : results)
+            fprintf(file, "%s %.0f %.0f %.1f\n", it.first.c_str(), it.second.nanoseconds, it.second.bytes, it.second.allocations);
+        fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef LIQUIDBENCHSTORE_H
+#define LIQUIDBENCHSTORE_H
+
+#include "../src/cppvariable.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// What the benchmarks over bench/corpus render against; a store shaped like a shop's, with a collection of products with variants and
+// tags, and a cart.
+static Liquid::CPPVariable makeStore() {
+    using Liquid::CPPVariable;
+
+    static const char* vendors[] = { "Northwind", "Acme Outfitters", "Blue Harbor", "Fieldhouse" };
+    static const char* types[] = { "Shirt", "Shoes", "Bag" };
+    static const char* sizes[] = { "Small", "Medium", "Large", "X-Large" };
+    static const char* tags[] = { "New Arrival", "Cotton", "Sale", "Summer", "Organic", "Limited Edition" };
+
+    CPPVariable store;
+    store["settings"]["currency"] = "$";
+    store["settings"]["free_shipping_threshold"] = 5000;
+    store["settings"]["show_vendor"] = true;
+
+    CPPVariable& collection = store["collection"];
+    collection["title"] = "  summer essentials ";
+    collection["handle"] = "summer-essentials";
+    collection["description"] = "Everything you need for the warmer months,\nfrom breathable shirts to shoes you can walk in all day.\n";
+    for (int i = 0; i < 48; ++i) {
+        CPPVariable& product = collection["products"][(size_t)i];
+        product["id"] = 1000 + i;
+        product["title"] = " Classic Everyday Item Number " + std::to_string(i) + " ";
+        product["handle"] = "classic-everyday-item-" + std::to_string(i);
+        product["vendor"] = vendors[i % 4];
+        product["type"] = types[i % 3];
+        product["price"] = 1500 + (i * 250) % 4000;
+        product["compare_at_price"] = i % 5 == 0 ? 6000 : 0;
+        product["available"] = i % 7 != 3;
+        product["description"] = "A dependable piece made to last,\nwith care taken over every seam and a fit that suits most.\n";
+        if (i % 6 != 0)
+            product["featured_image"] = "/files/" + std::to_string(i) + "-front.jpg";
+        product["options"][0ul] = "Size";
+        product["options"][1ul] = "Color";
+        for (int j = 0; j < 3; ++j)
+            product["images"][(size_t)j] = "/files/" + std::to_string(i) + "-" + std::to_string(j) + ".jpg";
+        for (int j = 0; j < 3; ++j)
+            product["tags"][(size_t)j] = tags[(i + j * 2) % 6];
+        for (int j = 0; j < 4; ++j) {
+            CPPVariable& variant = product["variants"][(size_t)j];
+            variant["id"] = 100000 + i * 10 + j;
+            variant["title"] = sizes[j];
+            variant["price"] = 1500 + (i * 250) % 4000 + j * 100;
+            variant["available"] = (i + j) % 4 != 0;
+            variant["inventory_quantity"] = (i * 3 + j) % 12;
+        }
+    }
+    store["product"].assign(collection["products"][5ul]);
+
+    for (int i = 0; i < 6; ++i) {
+        CPPVariable& item = store["cart"]["items"][(size_t)i];
+        item["title"] = "Classic Everyday Item Number " + std::to_string(i * 3);
+        item["handle"] = "classic-everyday-item-" + std::to_string(i * 3);
+        item["variant_title"] = i % 2 ? sizes[i % 4] : "";
+        item["price"] = 1500 + i * 375;
+        item["quantity"] = 1 + i % 3;
+    }
+    return store;
+}
+
+static bool readFile(const std::string& path, std::string& contents) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+#endif
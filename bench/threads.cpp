@@ -0,0 +1,111 @@
+#include "../src/context.h"
+#include "../src/parser.h"
+#include "../src/compiler.h"
+#include "../src/dialect.h"
+#include "../src/cppvariable.h"
+#include "store.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Renders the corpus of storefront templates from 1 thread up to N at once, each through its own interpreter from a RendererPool, with the
+// compiled programs shared between all of them; reporting renders per second at each count, and how that scales against a single thread.
+//
+//     threads [iterations] [--threads n] [--corpus dir]
+//
+// Each thread renders every template the given number of times, against its own copy of the store, as templates can assign to it.
+
+using namespace Liquid;
+
+int main(int argc, char** argv) {
+    int iterations = 200;
+    int maxThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::string corpus = "bench/corpus";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            maxThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc)
+            corpus = argv[++i];
+        else
+            iterations = atoi(argv[i]);
+    }
+    if (iterations <= 0 || maxThreads <= 0) {
+        fprintf(stderr, "usage: %s [iterations] [--threads n] [--corpus dir]\n", argv[0]);
+        return 1;
+    }
+
+    Context context;
+    StandardDialect::implementPermissive(context);
+    Parser parser(context);
+    Compiler compiler(context);
+    CPPVariable store = makeStore();
+
+    std::vector<Program> programs;
+    const char* templates[] = { "collection", "product", "cart", "filters" };
+    for (auto name : templates) {
+        std::string source;
+        if (!readFile(corpus + "/" + name + ".liquid", source)) {
+            fprintf(stderr, "Can't read %s/%s.liquid.\n", corpus.c_str(), name);
+            return 1;
+        }
+        try {
+            programs.push_back(compiler.compile(parser.parse(source, name)));
+        } catch (Liquid::Exception& exception) {
+            fprintf(stderr, "%s: %s\n", name, exception.what());
+            return 1;
+        }
+    }
+
+    RendererPool pool(context);
+    std::vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    fprintf(stdout, "%-8s %14s %14s %10s\n", "threads", "renders/s", "MB/s", "scaling");
+    double single = 0;
+    for (int threads : counts) {
+        std::vector<CPPVariable> stores(threads, store);
+        std::vector<std::thread> workers;
+        std::atomic<size_t> bytes(0);
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back([&, i]() {
+                Interpreter& interpreter = pool.get();
+                size_t total = 0;
+                ++ready;
+                while (!go)
+                    std::this_thread::yield();
+                for (int j = 0; j < iterations; ++j) {
+                    for (auto& program : programs)
+                        interpreter.renderTemplate(program, stores[i], +[](const char* chunk, size_t len, void* data) { *static_cast<size_t*>(data) += len; }, &total);
+                }
+                bytes += total;
+            });
+        }
+        // Interpreters are created before the clock starts, so that only rendering is timed.
+        while (ready < threads)
+            std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        go = true;
+        for (auto& worker : workers)
+            worker.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = (double)threads * iterations * programs.size() / seconds;
+        if (threads == 1)
+            single = rate;
+        fprintf(stdout, "%-8d %14.0f %14.1f %9.2fx\n", threads, rate, bytes / seconds / (1024 * 1024), rate / single);
+    }
+    // Each worker's interpreter went with it.
+    if (pool.size() != 0) {
+        fprintf(stderr, "The pool still holds %zu interpreters.\n", pool.size());
+        return 1;
+    }
+    return 0;
+}
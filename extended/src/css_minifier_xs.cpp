@@ -4,6 +4,9 @@
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
+#include <algorithm>
+
+#include "minifier.h"
 
 namespace LiquidCSS {
 
@@ -84,16 +87,6 @@ namespace LiquidCSS {
         int         can_prune;
     };
 
-    typedef struct {
-        /* linked list pointers */
-        Node*       head;
-        Node*       tail;
-        /* doc internals */
-        const char* buffer;
-        size_t      length;
-        size_t      offset;
-    } CssDoc;
-
     /* ****************************************************************************
      * NODE CHECKING MACROS/FUNCTIONS
      * ****************************************************************************
@@ -108,7 +101,7 @@ namespace LiquidCSS {
     int nodeContains(Node* node, const char* str) {
         const char* haystack = node->contents;
         size_t len = strlen(str);
-        char ul_start[2] = { (char)tolower(*str), (char)toupper(*str) };
+        char ul_start[3] = { (char)tolower(*str), (char)toupper(*str), 0 };
 
         /* if node is shorter we know we're not going to have a match */
         if (len > node->length)
@@ -251,128 +244,84 @@ namespace LiquidCSS {
      * ****************************************************************************
      */
 
+    /* each of these returns the length of the token at the start of the buffer,
+     * or 0 if it could carry on past what's been written so far; leaving "offset"
+     * at where to carry on looking from, once there's more.
+     */
+
     /* extracts a quoted literal str */
-    void _CssExtractLiteral(CssDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        char delimiter  = buf[offset];
-        /* skip start of literal */
-        offset ++;
+    size_t _CssExtractLiteral(const char* buf, size_t length, size_t& offset) {
+        char delimiter = buf[0];
         /* search for end of literal */
-        while (offset < doc->length) {
+        while (offset < length) {
             if (buf[offset] == '\\') {
-                /* escaped character; skip */
+                /* escaped character; skip, once it's there */
+                if (offset + 1 >= length)
+                    return 0;
                 offset ++;
             }
-            else if (buf[offset] == delimiter) {
-                const char* start = buf + doc->offset;
-                size_t length     = offset - doc->offset + 1;
-                CssSetNodeContents(node, start, length);
-                node->type = NODE_LITERAL;
-                return;
-            }
+            else if (buf[offset] == delimiter)
+                return offset + 1;
             /* move onto next character */
             offset ++;
         }
-        // croak( "unterminated quoted str literal" );
+        return 0;
     }
 
     /* extracts a block comment */
-    void _CssExtractBlockComment(CssDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-
-        /* skip start of comment */
-        offset ++;  /* skip "/" */
-        offset ++;  /* skip "*" */
-
-        /* search for end of comment block */
-        while (offset < doc->length) {
-            if (buf[offset] == '*') {
-                if (buf[offset+1] == '/') {
-                    const char* start = buf + doc->offset;
-                    size_t length     = offset - doc->offset + 2;
-                    CssSetNodeContents(node, start, length);
-                    node->type = NODE_BLOCKCOMMENT;
-                    return;
-                }
-            }
-            /* move onto next character */
-            offset ++;
+    size_t _CssExtractBlockComment(const char* buf, size_t length, size_t& offset) {
+        /* search for end of comment block, past the opening "/" and "*" */
+        for (offset = std::max(offset, (size_t)2); offset + 1 < length; ++offset) {
+            if ((buf[offset] == '*') && (buf[offset+1] == '/'))
+                return offset + 2;
         }
-
-        // croak( "unterminated block comment" );
+        return 0;
     }
 
-    /* extracts a run of whitespace characters */
-    void _CssExtractWhitespace(CssDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        while ((offset < doc->length) && charIsWhitespace(buf[offset]))
+    /* extracts a run of whitespace, or identifier characters */
+    size_t _CssExtractRun(const char* buf, size_t length, size_t& offset, int (*inRun)(char)) {
+        while ((offset < length) && inRun(buf[offset]))
             offset ++;
-        CssSetNodeContents(node, doc->buffer+doc->offset, offset-doc->offset);
-        node->type = NODE_WHITESPACE;
-    }
-
-    /* extracts an identifier */
-    void _CssExtractIdentifier(CssDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        while ((offset < doc->length) && charIsIdentifier(buf[offset]))
-            offset++;
-        CssSetNodeContents(node, doc->buffer+doc->offset, offset-doc->offset);
-        node->type = NODE_IDENTIFIER;
-    }
-
-    /* extracts a -single- symbol/sigil */
-    void _CssExtractSigil(CssDoc* doc, Node* node) {
-        CssSetNodeContents(node, doc->buffer+doc->offset, 1);
-        node->type = NODE_SIGIL;
+        return offset < length ? offset : 0;
     }
 
-    /* tokenizes the given str and returns the list of nodes */
-    Node* CssTokenizestr(const char* str) {
-        CssDoc doc;
-
-        /* initialize our CSS document object */
-        doc.head = NULL;
-        doc.tail = NULL;
-        doc.buffer = str;
-        doc.length = strlen(str);
-        doc.offset = 0;
-
-        /* parse the CSS */
-        while ((doc.offset < doc.length) && (doc.buffer[doc.offset])) {
-            /* allocate a new node */
-            Node* node = CssAllocNode();
-            if (!doc.head)
-                doc.head = node;
-            if (!doc.tail)
-                doc.tail = node;
-
-            /* parse the next node out of the CSS */
-            if ((doc.buffer[doc.offset] == '/') && (doc.buffer[doc.offset+1] == '*'))
-                _CssExtractBlockComment(&doc, node);
-            else if ((doc.buffer[doc.offset] == '"') || (doc.buffer[doc.offset] == '\''))
-                _CssExtractLiteral(&doc, node);
-            else if (charIsWhitespace(doc.buffer[doc.offset]))
-                _CssExtractWhitespace(&doc, node);
-            else if (charIsIdentifier(doc.buffer[doc.offset]))
-                _CssExtractIdentifier(&doc, node);
-            else
-                _CssExtractSigil(&doc, node);
-
-            /* move ahead to the end of the parsed node */
-            doc.offset += node->length;
-
-            /* add the node to our list of nodes */
-            if (node != doc.tail)
-                CssAppendNode(doc.tail, node);
-            doc.tail = node;
+    /* works out how long the next token is, and what it is; "scanned" is how far
+     * into it has already been looked at, so that long tokens aren't looked over
+     * again each time another chunk comes in.  Once finished, unterminated literals
+     * and comments run to the end of the input.
+     */
+    size_t CssExtractToken(CssMinifier& minifier, const char* buf, size_t length, NodeType& type) {
+        size_t offset = std::max(minifier.scanned, (size_t)1);
+        size_t extracted = 0;
+        if ((buf[0] == '/') && (length < 2) && !minifier.finished)
+            return 0;
+        if ((buf[0] == '/') && (length > 1) && (buf[1] == '*')) {
+            type = NODE_BLOCKCOMMENT;
+            extracted = _CssExtractBlockComment(buf, length, offset);
         }
-
-        /* return the node list */
-        return doc.head;
+        else if ((buf[0] == '"') || (buf[0] == '\'')) {
+            type = NODE_LITERAL;
+            extracted = _CssExtractLiteral(buf, length, offset);
+        }
+        else if (charIsWhitespace(buf[0])) {
+            type = NODE_WHITESPACE;
+            extracted = _CssExtractRun(buf, length, offset, charIsWhitespace);
+        }
+        else if (charIsIdentifier(buf[0])) {
+            type = NODE_IDENTIFIER;
+            extracted = _CssExtractRun(buf, length, offset, charIsIdentifier);
+        }
+        else {
+            /* -single- symbol/sigil */
+            type = NODE_SIGIL;
+            return 1;
+        }
+        if (!extracted) {
+            if (minifier.finished)
+                return length;
+            minifier.scanned = offset;
+        }
+        return extracted;
     }
 
     /* ****************************************************************************
@@ -424,37 +373,34 @@ namespace LiquidCSS {
         return 0;
     }
 
-    /* collapses all of the nodes to their shortest possible representation */
-    void CssCollapseNodes(Node* curr) {
-        int inMacIeCommentHack = 0;
-        while (curr) {
-            Node* next = curr->next;
-            switch (curr->type) {
-                case NODE_WHITESPACE:
-                    CssCollapseNodeToWhitespace(curr);
-                    break;
-                case NODE_BLOCKCOMMENT: {
-                    if (!inMacIeCommentHack && nodeIsMACIECOMMENTHACK(curr)) {
-                        /* START of mac/ie hack */
-                        CssSetNodeContents(curr, "/*\\*/", 5);
-                        curr->can_prune = 0;
-                        inMacIeCommentHack = 1;
-                    }
-                    else if (inMacIeCommentHack && !nodeIsMACIECOMMENTHACK(curr)) {
-                        /* END of mac/ie hack */
-                        CssSetNodeContents(curr, "/**/", 4);
-                        curr->can_prune = 0;
-                        inMacIeCommentHack = 0;
-                    }
-                    } break;
-                case NODE_IDENTIFIER:
-                    if (CssIsZeroUnit(curr->contents)) {
-                        CssSetNodeContents(curr, "0", 1);
-                    }
-                default:
-                    break;
-            }
-            curr = next;
+    /* collapses the node to its shortest possible representation; nodes are
+     * collapsed in order, as they're tokenized.
+     */
+    void CssCollapseNode(Node* curr, int& inMacIeCommentHack) {
+        switch (curr->type) {
+            case NODE_WHITESPACE:
+                CssCollapseNodeToWhitespace(curr);
+                break;
+            case NODE_BLOCKCOMMENT: {
+                if (!inMacIeCommentHack && nodeIsMACIECOMMENTHACK(curr)) {
+                    /* START of mac/ie hack */
+                    CssSetNodeContents(curr, "/*\\*/", 5);
+                    curr->can_prune = 0;
+                    inMacIeCommentHack = 1;
+                }
+                else if (inMacIeCommentHack && !nodeIsMACIECOMMENTHACK(curr)) {
+                    /* END of mac/ie hack */
+                    CssSetNodeContents(curr, "/**/", 4);
+                    curr->can_prune = 0;
+                    inMacIeCommentHack = 0;
+                }
+                } break;
+            case NODE_IDENTIFIER:
+                if (CssIsZeroUnit(curr->contents)) {
+                    CssSetNodeContents(curr, "0", 1);
+                }
+            default:
+                break;
         }
     }
 
@@ -524,34 +470,52 @@ namespace LiquidCSS {
         return PRUNE_NO;
     }
 
-    /* prune nodes from the list */
-    Node* CssPruneNodes(Node *head) {
-        Node* curr = head;
-        while (curr) {
+    /* ****************************************************************************
+     * STREAMING FUNCTIONS
+     * ****************************************************************************
+     */
+
+    CssMinifier::~CssMinifier() {
+        CssFreeNodeList(head);
+        if (emitted)
+            CssFreeNode(emitted);
+    }
+
+    /* prunes from the cursor on, for as long as there's a node after it to look at.
+     * Nodes that have been handed over can be looked at, but not pruned; so the
+     * cursor never backs up onto them.
+     */
+    static void CssPruneNodes(CssMinifier& minifier) {
+        Node*& curr = minifier.curr;
+        while (curr && (curr->next || minifier.finished)) {
             /* see if/how we can prune this node */
             int prune = CssCanPrune(curr);
             /* prune.  each block is responsible for moving onto the next node */
             Node* prev = curr->prev;
             Node* next = curr->next;
+            if (prune == PRUNE_PREVIOUS && prev == minifier.emitted)
+                prune = PRUNE_NO;
             switch (prune) {
                 case PRUNE_PREVIOUS:
                     /* discard previous node */
+                    if (prev == minifier.head)
+                        minifier.head = curr;
                     CssDiscardNode(prev);
-                    /* reset "head" if that's what got pruned */
-                    if (prev == head)
-                        head = curr;
                     break;
                 case PRUNE_CURRENT:
                     /* discard current node */
+                    if (curr == minifier.head)
+                        minifier.head = next;
+                    if (curr == minifier.tail)
+                        minifier.tail = prev != minifier.emitted ? prev : NULL;
                     CssDiscardNode(curr);
-                    /* reset "head" if that's what got pruned */
-                    if (curr == head)
-                        head = prev ? prev : next;
                     /* backup and try again if possible */
-                    curr = prev ? prev : next;
+                    curr = (prev && prev != minifier.emitted) ? prev : next;
                     break;
                 case PRUNE_NEXT:
                     /* discard next node */
+                    if (next == minifier.tail)
+                        minifier.tail = curr;
                     CssDiscardNode(next);
                     /* stay on current node, and try again */
                     break;
@@ -561,49 +525,82 @@ namespace LiquidCSS {
                     break;
             }
         }
-
-        /* return the (possibly new) head node back to the caller */
-        return head;
     }
 
-    /* ****************************************************************************
-     * Minifies the given CSS, returning a newly allocated str back to the
-     * caller (YOU'RE responsible for freeing its memory).
-     * ****************************************************************************
+    /* hands over everything more than WINDOW nodes behind the cursor; or everything,
+     * once there's nothing left to prune.
      */
-    std::string CssMinify(const std::string& str) {
-        std::string results;
-        /* PASS 1: tokenize CSS into a list of nodes */
-        Node* head = CssTokenizestr(str.c_str());
-        if (!head) return NULL;
-        /* PASS 2: collapse nodes */
-        CssCollapseNodes(head);
-        /* PASS 3: prune nodes */
-        head = CssPruneNodes(head);
-        if (!head)
-            return std::string();
-        char* ptr;
-        /* PASS 4: re-assemble CSS into single str */
-        {
-            Node* curr;
-            /* allocate the result buffer to the same size as the original CSS; in
-             * a worst case scenario that's how much memory we'll need for it.
-             */
-            results.resize(str.size()+1);
-            ptr = &results[0];
-            /* copy node contents into result buffer */
-            curr = head;
-            while (curr) {
-                memcpy(ptr, curr->contents, curr->length);
-                ptr += curr->length;
-                curr = curr->next;
+    static void CssEmitNodes(CssMinifier& minifier) {
+        Node* keep = minifier.curr;
+        for (int i = 0; keep && keep != minifier.head && i < CssMinifier::WINDOW; ++i)
+            keep = keep->prev;
+        while (minifier.head && minifier.head != keep) {
+            Node* node = minifier.head;
+            minifier.callback(node->contents, node->length, minifier.data);
+            minifier.head = node->next;
+            if (minifier.emitted) {
+                node->prev = NULL;
+                CssFreeNode(minifier.emitted);
             }
-            *ptr = 0;
+            minifier.emitted = node;
         }
-        /* free memory used by node list */
-        CssFreeNodeList(head);
-        /* return resulting minified CSS back to caller */
-        results.resize(ptr - &results[0]);
+        if (!minifier.head)
+            minifier.tail = NULL;
+    }
+
+    void CssMinifier::write(const char* chunk, size_t size) {
+        /* tokenized straight out of the chunk, unless there's a token in progress from the last one */
+        const char* buffer = chunk;
+        size_t buffered = size;
+        if (!input.empty()) {
+            input.append(chunk, size);
+            buffer = input.data();
+            buffered = input.size();
+        }
+        size_t offset = 0;
+        while (offset < buffered) {
+            NodeType type;
+            size_t length = CssExtractToken(*this, buffer + offset, buffered - offset, type);
+            if (!length)
+                break;
+            scanned = 0;
+            Node* node = CssAllocNode();
+            CssSetNodeContents(node, buffer + offset, length);
+            node->type = type;
+            offset += length;
+            CssCollapseNode(node, inMacIeCommentHack);
+            /* add the node to our list of nodes */
+            if (tail)
+                CssAppendNode(tail, node);
+            else {
+                head = node;
+                node->prev = emitted;
+                if (emitted)
+                    emitted->next = node;
+            }
+            tail = node;
+            if (!curr)
+                curr = node;
+            CssPruneNodes(*this);
+        }
+        if (buffer == chunk)
+            input.assign(chunk + offset, size - offset);
+        else
+            input.erase(0, offset);
+        CssPruneNodes(*this);
+        CssEmitNodes(*this);
+    }
+
+    void CssMinifier::finish() {
+        finished = true;
+        write("", 0);
+    }
+
+    std::string CssMinify(const std::string& str) {
+        std::string results;
+        CssMinifier minifier(+[](const char* chunk, size_t size, void* data) { static_cast<std::string*>(data)->append(chunk, size); }, &results);
+        minifier.write(str.data(), str.size());
+        minifier.finish();
         return results;
     }
 }
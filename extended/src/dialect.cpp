@@ -1,17 +1,52 @@
+#include "minifier.h"
+
+    // Renders the body a chunk at a time into the minifier, which hands its output on to the enclosing sink while streaming, or collects it
+    // otherwise. Bodies small enough to cache are looked up by what they rendered to, so unchanged assets aren't minified again.
+    template <class Minifier>
+    Node renderMinified(Renderer& renderer, const Node& node, Variable store, MinifierCache* cache) {
+        string result;
+        Renderer::OutputSink* parent = renderer.sink;
+        Minifier minifier(cache, parent ? +[](const char* chunk, size_t size, void* data) {
+            static_cast<Renderer::OutputSink*>(data)->write(chunk, size);
+        } : +[](const char* chunk, size_t size, void* data) {
+            static_cast<string*>(data)->append(chunk, size);
+        }, parent ? (void*)parent : (void*)&result);
+        Renderer::OutputSink sink(+[](const char* chunk, size_t size, void* data) {
+            static_cast<Minifier*>(data)->write(chunk, size);
+        }, &minifier, renderer.outputChunkSize);
+        {
+            Renderer::SinkScope scope(renderer, &sink);
+            Node body = renderer.retrieveRenderedNode(*node.children.back().get(), store);
+            // Bodies the optimizer can only partly render are left for the render proper.
+            if (body.type)
+                return node;
+            renderer.write(body);
+            sink.flush();
+        }
+        minifier.finish();
+        if (parent)
+            return Node();
+        return Variant(move(result));
+    }
 
     struct MinifyJSNode : TagNodeType {
-	            MinifyJSNode() : TagNodeType(Composition::ENCLOSED, "minify_js", 0, 1) { }
-		            Node render(Renderer& renderer, const Node& node, Variable store) const {
-				                return Variant(LiquidJS::JsMinify(renderer.retrieveRenderedNode(*node.children.back().get(), store).getString()));
-						        }
-			        };
+        // Shared between contexts, and renders; owned by whoever registers the tag. Nothing's cached without one.
+        MinifierCache* cache = nullptr;
+
+        MinifyJSNode() : TagNodeType(Composition::ENCLOSED, "minify_js", 0, 1) { }
+        Node render(Renderer& renderer, const Node& node, Variable store) const {
+            return renderMinified<CachedJsMinifier>(renderer, node, store, cache);
+        }
+    };
 
     struct MinifyCSSNode : TagNodeType {
-	            MinifyCSSNode() : TagNodeType(Composition::ENCLOSED, "minify_css", 0, 1) { }
-		            Node render(Renderer& renderer, const Node& node, Variable store) const {
-				                return Variant(LiquidCSS::CssMinify(renderer.retrieveRenderedNode(*node.children.back().get(), store).getString()));
-						        }
-			        };
+        MinifierCache* cache = nullptr;
+
+        MinifyCSSNode() : TagNodeType(Composition::ENCLOSED, "minify_css", 0, 1) { }
+        Node render(Renderer& renderer, const Node& node, Variable store) const {
+            return renderMinified<CachedCssMinifier>(renderer, node, store, cache);
+        }
+    };
 
     struct MinifyHTMLNode : TagNodeType {
 	            MinifyHTMLNode() : TagNodeType(Composition::ENCLOSED, "minify_html", 0, 1) { }
@@ -25,7 +60,7 @@
 	            SCSSNode() : TagNodeType(Composition::ENCLOSED, "scss", 0, 1) { }
 
 		            Node render(Renderer& renderer, const Node& node, Variable store) const {
-				                string s = renderer.retrieveRenderedNode(*node.children.back().get(), store).getString();
+				                string s = renderer.retrieveBufferedNode(*node.children.back().get(), store).getString();
 
 						            char* text = sass_copy_c_string(s.c_str());
 							                struct Sass_Data_Context* data_ctx = sass_make_data_context(text);
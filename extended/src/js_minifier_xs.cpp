@@ -4,12 +4,11 @@
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
+#include <algorithm>
 
+#include "minifier.h"
 
 namespace LiquidJS {
-    /* uncomment to enable debugging output */
-    /* #define DEBUG 1 */
-
     /* ****************************************************************************
      * CHARACTER CLASS METHODS
      * ****************************************************************************
@@ -94,19 +93,10 @@ namespace LiquidJS {
         char*       contents;
         size_t      length;
         NodeType    type;
+        /* whether the node has been collapsed yet */
+        int         collapsed;
     };
 
-    typedef struct {
-        /* linked list pointers */
-        Node*       head;
-        Node*       tail;
-        /* doc internals */
-        const char* buffer;
-        size_t      length;
-        size_t      offset;
-    } JsDoc;
-
-
     /* ****************************************************************************
      * NODE CHECKING MACROS/FUNCTIONS
      * ****************************************************************************
@@ -121,7 +111,7 @@ namespace LiquidJS {
     int nodeContains(Node* node, const char* string) {
         const char* haystack = node->contents;
         size_t len = strlen(string);
-        char ul_start[2] = { (char)tolower(*string), (char)toupper(*string) };
+        char ul_start[3] = { (char)tolower(*string), (char)toupper(*string), 0 };
 
         /* if node is shorter we know we're not going to have a match */
         if (len > node->length)
@@ -190,6 +180,7 @@ namespace LiquidJS {
         node->contents = NULL;
         node->length = 0;
         node->type = NODE_EMPTY;
+        node->collapsed = 0;
         return node;
     }
 
@@ -287,197 +278,114 @@ namespace LiquidJS {
      * ****************************************************************************
      */
 
+    /* each of these returns the length of the token at the start of the buffer,
+     * or 0 if it could carry on past what's been written so far; leaving "offset"
+     * at where to carry on looking from, once there's more.
+     */
+
     /* extracts a quoted literal string */
-    void _JsExtractLiteral(JsDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        char delimiter  = buf[offset];
-        /* skip start of literal */
-        offset ++;
+    size_t _JsExtractLiteral(const char* buf, size_t length, size_t& offset) {
+        char delimiter = buf[0];
         /* search for end of literal */
-        while (offset < doc->length) {
+        while (offset < length) {
             if (buf[offset] == '\\') {
-                /* escaped character; skip */
+                /* escaped character; skip, once it's there */
+                if (offset + 1 >= length)
+                    return 0;
                 offset ++;
             }
-            else if (buf[offset] == delimiter) {
-                const char* start = buf + doc->offset;
-                size_t length     = offset - doc->offset + 1;
-                JsSetNodeContents(node, start, length);
-                node->type = NODE_LITERAL;
-                return;
-            }
+            else if (buf[offset] == delimiter)
+                return offset + 1;
             /* move onto next character */
             offset ++;
         }
-        // croak( "unterminated quoted string literal" );
+        return 0;
     }
 
     /* extracts a block comment */
-    void _JsExtractBlockComment(JsDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-
-        /* skip start of comment */
-        offset ++;  /* skip "/" */
-        offset ++;  /* skip "*" */
-
-        /* search for end of comment block */
-        while (offset < doc->length) {
-            if (buf[offset] == '*') {
-                if (buf[offset+1] == '/') {
-                    const char* start = buf + doc->offset;
-                    size_t length     = offset - doc->offset + 2;
-                    JsSetNodeContents(node, start, length);
-                    node->type = NODE_BLOCKCOMMENT;
-                    return;
-                }
-            }
-            /* move onto next character */
-            offset ++;
+    size_t _JsExtractBlockComment(const char* buf, size_t length, size_t& offset) {
+        /* search for end of comment block, past the opening "/" and "*" */
+        for (offset = std::max(offset, (size_t)2); offset + 1 < length; ++offset) {
+            if ((buf[offset] == '*') && (buf[offset+1] == '/'))
+                return offset + 2;
         }
-
-        // croak( "unterminated block comment" );
+        return 0;
     }
 
     /* extracts a line comment */
-    void _JsExtractLineComment(JsDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-
-        /* skip start of comment */
-        offset ++;  /* skip "/" */
-        offset ++;  /* skip "/" */
-
-        /* search for end of line */
-        while ((offset < doc->length) && !charIsEndspace(buf[offset]))
-            offset ++;
-
-        /* found it ! */
-        {
-            const char* start = buf + doc->offset;
-            size_t length = offset - doc->offset;
-            JsSetNodeContents(node, start, length);
-            node->type = NODE_LINECOMMENT;
+    size_t _JsExtractLineComment(const char* buf, size_t length, size_t& offset) {
+        /* search for end of line, past the opening "//" */
+        for (offset = std::max(offset, (size_t)2); offset < length; ++offset) {
+            if (charIsEndspace(buf[offset]))
+                return offset;
         }
+        return 0;
     }
 
-    /* extracts a run of whitespace characters */
-    void _JsExtractWhitespace(JsDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        while ((offset < doc->length) && charIsWhitespace(buf[offset]))
-            offset ++;
-        JsSetNodeContents(node, doc->buffer+doc->offset, offset-doc->offset);
-        node->type = NODE_WHITESPACE;
-    }
-
-    /* extracts an identifier */
-    void _JsExtractIdentifier(JsDoc* doc, Node* node) {
-        const char* buf = doc->buffer;
-        size_t offset   = doc->offset;
-        while ((offset < doc->length) && charIsIdentifier(buf[offset]))
+    /* extracts a run of whitespace, or identifier characters */
+    size_t _JsExtractRun(const char* buf, size_t length, size_t& offset, int (*inRun)(char)) {
+        while ((offset < length) && inRun(buf[offset]))
             offset ++;
-        JsSetNodeContents(node, doc->buffer+doc->offset, offset-doc->offset);
-        node->type = NODE_IDENTIFIER;
-    }
-
-    /* extracts a -single- symbol/sigil */
-    void _JsExtractSigil(JsDoc* doc, Node* node) {
-        JsSetNodeContents(node, doc->buffer+doc->offset, 1);
-        node->type = NODE_SIGIL;
+        return offset < length ? offset : 0;
     }
 
-    /* tokenizes the given string and returns the list of nodes */
-    Node* JsTokenizeString(const char* string) {
-        JsDoc doc;
-
-        /* initialize our JS document object */
-        doc.head = NULL;
-        doc.tail = NULL;
-        doc.buffer = string;
-        doc.length = strlen(string);
-        doc.offset = 0;
-
-        /* parse the JS */
-        while ((doc.offset < doc.length) && (doc.buffer[doc.offset])) {
-            /* allocate a new node */
-            Node* node = JsAllocNode();
-            if (!doc.head)
-                doc.head = node;
-            if (!doc.tail)
-                doc.tail = node;
-
-            /* parse the next node out of the JS */
-            if (doc.buffer[doc.offset] == '/') {
-                if (doc.buffer[doc.offset+1] == '*')
-                    _JsExtractBlockComment(&doc, node);
-                else if (doc.buffer[doc.offset+1] == '/')
-                    _JsExtractLineComment(&doc, node);
-                else {
-                    /* could be "division" or "regexp", but need to know more about
-                     * our context...
-                     */
-                    Node* last = doc.tail;
-                    char ch = 0;
-
-                    /* find last non-whitespace, non-comment node */
-                    while (nodeIsWHITESPACE(last) || nodeIsCOMMENT(last))
-                        last = last->prev;
-
-                    ch = last->contents[last->length-1];
-
-                    /* see if we're "division" or "regexp" */
-                    if (nodeIsIDENTIFIER(last) && nodeEquals(last, "return")) {
-                        /* returning a regexp from a function */
-                        _JsExtractLiteral(&doc, node);
-                    }
-                    else if (ch && ((ch == ')') || (ch == '.') || (ch == ']') || (charIsIdentifier(ch)))) {
-                        /* looks like an identifier; guess its division */
-                        _JsExtractSigil(&doc, node);
-                    }
-                    else {
-                        /* presume its a regexp */
-                        _JsExtractLiteral(&doc, node);
-                    }
-                }
+    /* works out how long the next token is, and what it is; "scanned" is how far
+     * into it has already been looked at, so that long tokens aren't looked over
+     * again each time another chunk comes in.  Once finished, unterminated literals
+     * and comments run to the end of the input.
+     */
+    size_t JsExtractToken(JsMinifier& minifier, const char* buf, size_t length, NodeType& type) {
+        size_t offset = std::max(minifier.scanned, (size_t)1);
+        size_t extracted = 0;
+        if (buf[0] == '/') {
+            if ((length < 2) && !minifier.finished)
+                return 0;
+            if ((length > 1) && (buf[1] == '*')) {
+                type = NODE_BLOCKCOMMENT;
+                extracted = _JsExtractBlockComment(buf, length, offset);
             }
-            else if ((doc.buffer[doc.offset] == '"') || (doc.buffer[doc.offset] == '\''))
-                _JsExtractLiteral(&doc, node);
-            else if (charIsWhitespace(doc.buffer[doc.offset]))
-                _JsExtractWhitespace(&doc, node);
-            else if (charIsIdentifier(doc.buffer[doc.offset]))
-                _JsExtractIdentifier(&doc, node);
-            else
-                _JsExtractSigil(&doc, node);
-
-            /* move ahead to the end of the parsed node */
-            doc.offset += node->length;
-
-            /* add the node to our list of nodes */
-            if (node != doc.tail)
-                JsAppendNode(doc.tail, node);
-            doc.tail = node;
-
-            /* some debugging info */
-    #ifdef DEBUG
-            {
-                int idx;
-                printf("----------------------------------------------------------------\n");
-                printf("%s: %s\n", strNodeTypes[node->type], node->contents);
-                printf("next: '");
-                for (idx=0; idx<=10; idx++) {
-                    if ((doc.offset+idx) >= doc.length) break;
-                    if (!doc.buffer[doc.offset+idx])    break;
-                    printf("%c", doc.buffer[doc.offset+idx]);
+            else if ((length > 1) && (buf[1] == '/')) {
+                type = NODE_LINECOMMENT;
+                extracted = _JsExtractLineComment(buf, length, offset);
+            }
+            else {
+                /* could be "division" or "regexp", but need to know more about
+                 * our context; the last non-whitespace, non-comment token.
+                 */
+                char ch = minifier.lastChar;
+                if (!minifier.lastReturn && ch && ((ch == ')') || (ch == '.') || (ch == ']') || (charIsIdentifier(ch)))) {
+                    /* looks like an identifier; guess its division */
+                    type = NODE_SIGIL;
+                    return 1;
                 }
-                printf("'\n");
+                /* presume its a regexp, or one being returned from a function */
+                type = NODE_LITERAL;
+                extracted = _JsExtractLiteral(buf, length, offset);
             }
-    #endif
         }
-
-        /* return the node list */
-        return doc.head;
+        else if ((buf[0] == '"') || (buf[0] == '\'')) {
+            type = NODE_LITERAL;
+            extracted = _JsExtractLiteral(buf, length, offset);
+        }
+        else if (charIsWhitespace(buf[0])) {
+            type = NODE_WHITESPACE;
+            extracted = _JsExtractRun(buf, length, offset, charIsWhitespace);
+        }
+        else if (charIsIdentifier(buf[0])) {
+            type = NODE_IDENTIFIER;
+            extracted = _JsExtractRun(buf, length, offset, charIsIdentifier);
+        }
+        else {
+            /* -single- symbol/sigil */
+            type = NODE_SIGIL;
+            return 1;
+        }
+        if (!extracted) {
+            if (minifier.finished)
+                return length;
+            minifier.scanned = offset;
+        }
+        return extracted;
     }
 
     /* ****************************************************************************
@@ -485,10 +393,13 @@ namespace LiquidJS {
      * ****************************************************************************
      */
 
-    /* collapses all of the nodes to their shortest possible representation */
-    void JsCollapseNodes(Node* curr) {
-        while (curr) {
-            Node* next = curr->next;
+    /* collapses nodes to their shortest possible representation, in order, from
+     * the collapse cursor on.  Block comments can't be collapsed until the next
+     * node that isn't whitespace has been tokenized, or there aren't any more.
+     */
+    void JsCollapseNodes(JsMinifier& minifier) {
+        while (minifier.collapse) {
+            Node* curr = minifier.collapse;
             switch (curr->type) {
                 case NODE_WHITESPACE:
                     /* all WS gets collapsed */
@@ -500,22 +411,24 @@ namespace LiquidJS {
                      */
                     if (!nodeIsIECONDITIONALBLOCKCOMMENT(curr)) {
                         int convert_to_ws = 0;
-                        /* find surrounding non-WS nodes */
-                        Node* nonws_prev = curr->prev;
+                        /* find surrounding non-WS nodes; the last one before is
+                         * kept track of, as those before it may have been pruned.
+                         */
                         Node* nonws_next = curr->next;
-                        while (nonws_prev && nodeIsWHITESPACE(nonws_prev))
-                            nonws_prev = nonws_prev->prev;
                         while (nonws_next && nodeIsWHITESPACE(nonws_next))
                             nonws_next = nonws_next->next;
+                        if (!nonws_next && !minifier.finished)
+                            return;
                         /* check what we're between... */
-                        if (nonws_prev && nonws_next) {
+                        if ((minifier.lastSolidType != -1) && nonws_next) {
+                            char prev_ch = minifier.lastSolidChar;
                             /* between identifiers? convert to WS */
-                            if (nodeIsIDENTIFIER(nonws_prev) && nodeIsIDENTIFIER(nonws_next))
+                            if ((minifier.lastSolidType == NODE_IDENTIFIER) && nodeIsIDENTIFIER(nonws_next))
                                 convert_to_ws = 1;
                             /* between possible pre/post increment? convert to WS */
-                            if (nodeIsCHAR(nonws_prev,'-') && nodeIsCHAR(nonws_next,'-'))
+                            if ((prev_ch == '-') && nodeIsCHAR(nonws_next,'-'))
                                 convert_to_ws = 1;
-                            if (nodeIsCHAR(nonws_prev,'+') && nodeIsCHAR(nonws_next,'+'))
+                            if ((prev_ch == '+') && nodeIsCHAR(nonws_next,'+'))
                                 convert_to_ws = 1;
                         }
                         /* convert to WS */
@@ -528,7 +441,12 @@ namespace LiquidJS {
                 default:
                     break;
             }
-            curr = next;
+            curr->collapsed = 1;
+            if (!nodeIsWHITESPACE(curr)) {
+                minifier.lastSolidType = curr->type;
+                minifier.lastSolidChar = curr->length == 1 ? curr->contents[0] : 0;
+            }
+            minifier.collapse = curr->next;
         }
     }
 
@@ -625,34 +543,65 @@ namespace LiquidJS {
         return PRUNE_NO;
     }
 
-    /* prune nodes from the list */
-    Node* JsPruneNodes(Node *head) {
-        Node* curr = head;
-        while (curr) {
+    /* ****************************************************************************
+     * STREAMING FUNCTIONS
+     * ****************************************************************************
+     */
+
+    JsMinifier::~JsMinifier() {
+        JsFreeNodeList(head);
+        if (emitted)
+            JsFreeNode(emitted);
+    }
+
+    /* checks that the node, and the two after it, have been collapsed; or that
+     * there won't be any more after it.
+     */
+    static int JsCanLookAhead(JsMinifier& minifier, Node* node) {
+        for (int i = 0; i < 3; ++i, node = node->next) {
+            if (!node)
+                return minifier.finished;
+            if (!node->collapsed)
+                return 0;
+        }
+        return 1;
+    }
+
+    /* prunes from the cursor on, for as long as what's after it has been collapsed.
+     * Nodes that have been handed over can be looked at, but not pruned; so the
+     * cursor never backs up onto them.
+     */
+    static void JsPruneNodes(JsMinifier& minifier) {
+        Node*& curr = minifier.curr;
+        while (curr && JsCanLookAhead(minifier, curr)) {
             /* see if/howe we can prune this node */
             int prune = JsCanPrune(curr);
             /* prune.  each block is responsible for moving onto the next node */
             Node* prev = curr->prev;
             Node* next = curr->next;
+            if (prune == PRUNE_PREVIOUS && prev == minifier.emitted)
+                prune = PRUNE_NO;
             switch (prune) {
                 case PRUNE_PREVIOUS:
                     /* discard previous node */
+                    if (prev == minifier.head)
+                        minifier.head = curr;
                     JsDiscardNode(prev);
-                    /* reset "head" if that's what got pruned */
-                    if (prev == head)
-                        prev = curr;
                     break;
                 case PRUNE_CURRENT:
                     /* discard current node */
+                    if (curr == minifier.head)
+                        minifier.head = next;
+                    if (curr == minifier.tail)
+                        minifier.tail = prev != minifier.emitted ? prev : NULL;
                     JsDiscardNode(curr);
-                    /* reset "head" if that's what got pruned */
-                    if (curr == head)
-                        head = prev ? prev : next;
                     /* backup and try again if possible */
-                    curr = prev ? prev : next;
+                    curr = (prev && prev != minifier.emitted) ? prev : next;
                     break;
                 case PRUNE_NEXT:
                     /* discard next node */
+                    if (next == minifier.tail)
+                        minifier.tail = curr;
                     JsDiscardNode(next);
                     /* stay on current node, and try again */
                     break;
@@ -662,51 +611,89 @@ namespace LiquidJS {
                     break;
             }
         }
-
-        /* return the (possibly new) head node back to the caller */
-        return head;
     }
 
-    /* ****************************************************************************
-     * Minifies the given JavaScript, returning a newly allocated string back to
-     * the caller (YOU'RE responsible for freeing its memory).
-     * ****************************************************************************
+    /* hands over everything more than WINDOW nodes behind the cursor; or everything,
+     * once there's nothing left to prune.
      */
-    std::string JsMinify(const std::string& str) {
-        std::string results;
-        /* PASS 1: tokenize JS into a list of nodes */
-        Node* head = JsTokenizeString(str.c_str());
-        if (!head)
-            return std::string();
-        /* PASS 2: collapse nodes */
-        JsCollapseNodes(head);
-        /* PASS 3: prune nodes */
-        head = JsPruneNodes(head);
-        if (!head)
-            return std::string();
-        /* PASS 4: re-assemble JS into single string */
-        char* ptr;
-        {
-            Node* curr;
-            /* allocate the result buffer to the same size as the original JS; in a
-             * worst case scenario that's how much memory we'll need for it.
-             */
-            results.resize(str.size());
-            ptr = &results[0];
-            /* copy node contents into result buffer */
-            curr = head;
-            while (curr) {
-                memcpy(ptr, curr->contents, curr->length);
-                ptr += curr->length;
-                curr = curr->next;
+    static void JsEmitNodes(JsMinifier& minifier) {
+        Node* keep = minifier.curr;
+        for (int i = 0; keep && keep != minifier.head && i < JsMinifier::WINDOW; ++i)
+            keep = keep->prev;
+        while (minifier.head && minifier.head != keep) {
+            Node* node = minifier.head;
+            minifier.callback(node->contents, node->length, minifier.data);
+            minifier.head = node->next;
+            if (minifier.emitted) {
+                node->prev = NULL;
+                JsFreeNode(minifier.emitted);
             }
-            *ptr = 0;
+            minifier.emitted = node;
         }
-        results.resize(ptr - &results[0]);
-        /* free memory used by node list */
-        JsFreeNodeList(head);
-        /* return resulting minified JS back to caller */
+        if (!minifier.head)
+            minifier.tail = NULL;
+    }
+
+    void JsMinifier::write(const char* chunk, size_t size) {
+        /* tokenized straight out of the chunk, unless there's a token in progress from the last one */
+        const char* buffer = chunk;
+        size_t buffered = size;
+        if (!input.empty()) {
+            input.append(chunk, size);
+            buffer = input.data();
+            buffered = input.size();
+        }
+        size_t offset = 0;
+        while (offset < buffered) {
+            NodeType type;
+            size_t length = JsExtractToken(*this, buffer + offset, buffered - offset, type);
+            if (!length)
+                break;
+            scanned = 0;
+            Node* node = JsAllocNode();
+            JsSetNodeContents(node, buffer + offset, length);
+            node->type = type;
+            offset += length;
+            if (!nodeIsWHITESPACE(node) && !nodeIsCOMMENT(node)) {
+                lastChar = node->contents[node->length-1];
+                lastReturn = nodeIsIDENTIFIER(node) && nodeEquals(node, "return");
+            }
+            /* add the node to our list of nodes */
+            if (tail)
+                JsAppendNode(tail, node);
+            else {
+                head = node;
+                node->prev = emitted;
+                if (emitted)
+                    emitted->next = node;
+            }
+            tail = node;
+            if (!collapse)
+                collapse = node;
+            if (!curr)
+                curr = node;
+            JsCollapseNodes(*this);
+            JsPruneNodes(*this);
+        }
+        if (buffer == chunk)
+            input.assign(chunk + offset, size - offset);
+        else
+            input.erase(0, offset);
+        JsCollapseNodes(*this);
+        JsPruneNodes(*this);
+        JsEmitNodes(*this);
+    }
+
+    void JsMinifier::finish() {
+        finished = true;
+        write("", 0);
+    }
+
+    std::string JsMinify(const std::string& str) {
+        std::string results;
+        JsMinifier minifier(+[](const char* chunk, size_t size, void* data) { static_cast<std::string*>(data)->append(chunk, size); }, &results);
+        minifier.write(str.data(), str.size());
+        minifier.finish();
         return results;
     }
 }
-
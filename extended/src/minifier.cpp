@@ -0,0 +1,76 @@
+#include "minifier.h"
+
+#include <openssl/evp.h>
+
+namespace Liquid {
+    MinifierCache::MinifierCache(size_t maxSize, size_t maxEntrySize) : maxSize(maxSize), maxEntrySize(maxEntrySize) { }
+
+    MinifierCache::Key MinifierCache::hash(Language language, const char* input, size_t length) {
+        Key key;
+        unsigned char prefix = (unsigned char)language;
+        EVP_MD_CTX* context = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+        EVP_DigestUpdate(context, &prefix, sizeof(prefix));
+        EVP_DigestUpdate(context, input, length);
+        EVP_DigestFinal_ex(context, key.digest, nullptr);
+        EVP_MD_CTX_free(context);
+        return key;
+    }
+
+    std::shared_ptr<const MinifierCache::Entry> MinifierCache::get(Language language, const char* input, size_t length) {
+        Key key = hash(language, input, length);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                ++hits;
+                entries.splice(entries.begin(), entries, it->second);
+                return entries.front();
+            }
+            ++misses;
+        }
+        // Minified outside of the lock; two threads that miss on the same input at once both do the work, and the last one in is kept.
+        auto entry = std::make_shared<Entry>();
+        entry->key = key;
+        auto append = +[](const char* chunk, size_t size, void* data) { static_cast<std::string*>(data)->append(chunk, size); };
+        if (language == Language::CSS) {
+            LiquidCSS::CssMinifier minifier(append, &entry->output);
+            minifier.write(input, length);
+            minifier.finish();
+        } else {
+            LiquidJS::JsMinifier minifier(append, &entry->output);
+            minifier.write(input, length);
+            minifier.finish();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            size -= (*it->second)->output.size();
+            entries.erase(it->second);
+        }
+        entries.push_front(entry);
+        index[key] = entries.begin();
+        size += entry->output.size();
+        // The entry that's just been added is always kept, however big it is.
+        while (size > maxSize && entries.size() > 1) {
+            size -= entries.back()->output.size();
+            index.erase(entries.back()->key);
+            entries.pop_back();
+            ++evictions;
+        }
+        return entry;
+    }
+
+    MinifierCache::Statistics MinifierCache::getStatistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Statistics { hits, misses, evictions, entries.size(), size };
+    }
+
+    void MinifierCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        size = 0;
+    }
+}
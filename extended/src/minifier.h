@@ -0,0 +1,172 @@
+#ifndef LIQUIDMINIFIER_H
+#define LIQUIDMINIFIER_H
+
+#include <string>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Both minifiers take their input a chunk at a time, in whatever pieces it comes in, and hand what they've minified to the callback as soon
+// as nothing after it can change it; so that only the token in progress, and a short window of tokens behind it, are ever held. Output is
+// the same as minifying the whole thing at once, other than where more than WINDOW tokens in a row would be pruned, one after the other.
+
+namespace LiquidCSS {
+    struct _Node;
+
+    struct CssMinifier {
+        static constexpr int WINDOW = 16;
+
+        void (*callback)(const char* chunk, size_t size, void* data);
+        void* data;
+        // What's been written, but not tokenized; only ever the token in progress, and how far into it's been looked at.
+        std::string input;
+        size_t scanned = 0;
+        // The last node handed to the callback, kept so that what comes after it can look at it.
+        _Node* emitted = nullptr;
+        _Node* head = nullptr;
+        _Node* tail = nullptr;
+        // The next node to see if it can be pruned.
+        _Node* curr = nullptr;
+        int inMacIeCommentHack = 0;
+        bool finished = false;
+
+        CssMinifier(void (*callback)(const char* chunk, size_t size, void* data), void* data) : callback(callback), data(data) { }
+        CssMinifier(const CssMinifier&) = delete;
+        ~CssMinifier();
+
+        void write(const char* chunk, size_t size);
+        // Minifies, and hands over, whatever's left.
+        void finish();
+    };
+
+    std::string CssMinify(const std::string& str);
+}
+
+namespace LiquidJS {
+    struct _Node;
+
+    struct JsMinifier {
+        static constexpr int WINDOW = 16;
+
+        void (*callback)(const char* chunk, size_t size, void* data);
+        void* data;
+        std::string input;
+        size_t scanned = 0;
+        _Node* emitted = nullptr;
+        _Node* head = nullptr;
+        _Node* tail = nullptr;
+        // The next node to collapse, and the next to see if it can be pruned; nodes are only pruned once they, and the two after them,
+        // have been collapsed.
+        _Node* collapse = nullptr;
+        _Node* curr = nullptr;
+        // What the last token that wasn't whitespace, or a comment, was; for telling division from regular expressions.
+        char lastChar = 0;
+        bool lastReturn = false;
+        // What the last collapsed node that wasn't whitespace was; for collapsing the block comments after it.
+        int lastSolidType = -1;
+        char lastSolidChar = 0;
+        bool finished = false;
+
+        JsMinifier(void (*callback)(const char* chunk, size_t size, void* data), void* data) : callback(callback), data(data) { }
+        JsMinifier(const JsMinifier&) = delete;
+        ~JsMinifier();
+
+        void write(const char* chunk, size_t size);
+        void finish();
+    };
+
+    std::string JsMinify(const std::string& str);
+}
+
+namespace Liquid {
+    // Minifies each distinct stylesheet, or script, once, for as long as it stays among the most recently used; so unchanged assets aren't
+    // minified again on every render. Entries are keyed on a SHA-256 of the input, along with which minifier it's for, and are shared; holding
+    // one keeps it valid after it's been evicted. Least recently used entries are evicted once their output comes to more than maxSize bytes.
+    // Lookups can come from any number of threads.
+    struct MinifierCache {
+        enum class Language {
+            CSS,
+            JS
+        };
+
+        struct Key {
+            unsigned char digest[32];
+
+            bool operator == (const Key& key) const { return memcmp(digest, key.digest, sizeof(digest)) == 0; }
+        };
+        struct KeyHash {
+            size_t operator()(const Key& key) const { size_t hash; memcpy(&hash, key.digest, sizeof(hash)); return hash; }
+        };
+        struct Entry {
+            Key key;
+            std::string output;
+        };
+        struct Statistics {
+            size_t hits;
+            size_t misses;
+            size_t evictions;
+            size_t entries;
+            size_t size;
+        };
+
+        size_t maxSize;
+        // Inputs bigger than this aren't cached; they're minified as they're rendered, without ever being held in full.
+        size_t maxEntrySize;
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<std::shared_ptr<const Entry>> entries;
+        std::unordered_map<Key, std::list<std::shared_ptr<const Entry>>::iterator, KeyHash> index;
+        size_t size = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+
+        MinifierCache(size_t maxSize = 64*1024*1024, size_t maxEntrySize = 4*1024*1024);
+
+        static Key hash(Language language, const char* input, size_t length);
+        std::shared_ptr<const Entry> get(Language language, const char* input, size_t length);
+        Statistics getStatistics();
+        void clear();
+    };
+
+    // Takes what's rendered under a minifying tag a chunk at a time, and hands the minified output on to the callback. Inputs small enough to
+    // cache are held until they're finished, and looked up; anything bigger goes straight through the minifier, as it's written.
+    template <class Minifier, MinifierCache::Language language>
+    struct CachedMinifier {
+        void (*callback)(const char* chunk, size_t size, void* data);
+        void* data;
+        MinifierCache* cache;
+        Minifier minifier;
+        std::string buffered;
+        bool buffering;
+
+        CachedMinifier(MinifierCache* cache, void (*callback)(const char* chunk, size_t size, void* data), void* data) : callback(callback), data(data), cache(cache), minifier(callback, data), buffering(cache != nullptr) { }
+
+        void write(const char* chunk, size_t size) {
+            if (buffering) {
+                if (buffered.size() + size <= cache->maxEntrySize) {
+                    buffered.append(chunk, size);
+                    return;
+                }
+                buffering = false;
+                minifier.write(buffered.data(), buffered.size());
+                std::string().swap(buffered);
+            }
+            minifier.write(chunk, size);
+        }
+
+        void finish() {
+            if (!buffering)
+                return minifier.finish();
+            std::shared_ptr<const MinifierCache::Entry> entry = cache->get(language, buffered.data(), buffered.size());
+            callback(entry->output.data(), entry->output.size(), data);
+        }
+    };
+
+    typedef CachedMinifier<LiquidCSS::CssMinifier, MinifierCache::Language::CSS> CachedCssMinifier;
+    typedef CachedMinifier<LiquidJS::JsMinifier, MinifierCache::Language::JS> CachedJsMinifier;
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "../src/renderer.h"
 #include "../src/dialect.h"
 #include "../src/cppvariable.h"
+#include "../src/minifier.h"
 
 #include <gtest/gtest.h>
 #include <sys/time.h>
@@ -54,6 +55,91 @@ TEST(sanity, extended) {
 
 }
 
+TEST(sanity, minifier) {
+    auto append = +[](const char* chunk, size_t size, void* data) {
+        static_cast<std::string*>(data)->append(chunk, size);
+    };
+    std::string css = "/* header */\n.a  .b { margin : 0px ; color: 'red' ; }\n@media (max-width: 10px) { .c { padding: 0.0em 1px; } }\n";
+    std::string js = "// header\nvar a = 1 + 2 + 3 + 4; /* note */ var b = a / 2, c = /ab+c/g;\nfunction d() { return /x/; }\n";
+    std::string expectedCSS = LiquidCSS::CssMinify(css);
+    std::string expectedJS = LiquidJS::JsMinify(js);
+    ASSERT_EQ(expectedCSS, ".a .b{margin:0;color:'red'}@media (max-width:10px){.c{padding:0 1px}}");
+    ASSERT_EQ(expectedJS, "var a=1+2+3+4;var b=a/2,c=/ab+c/g;function d(){return/x/;}");
+
+    // However the input's split up, the output's the same.
+    for (size_t chunkSize = 1; chunkSize < 16; ++chunkSize) {
+        std::string str;
+        LiquidCSS::CssMinifier cssMinifier(append, &str);
+        for (size_t i = 0; i < css.size(); i += chunkSize)
+            cssMinifier.write(&css[i], std::min(chunkSize, css.size() - i));
+        cssMinifier.finish();
+        ASSERT_EQ(str, expectedCSS);
+
+        str.clear();
+        LiquidJS::JsMinifier jsMinifier(append, &str);
+        for (size_t i = 0; i < js.size(); i += chunkSize)
+            jsMinifier.write(&js[i], std::min(chunkSize, js.size() - i));
+        jsMinifier.finish();
+        ASSERT_EQ(str, expectedJS);
+    }
+
+    // Output comes out as it's minified, and only what's in progress is held.
+    std::string bundle, str;
+    for (int i = 0; i < 1000; ++i)
+        bundle += css;
+    LiquidCSS::CssMinifier cssMinifier(append, &str);
+    for (size_t i = 0; i < bundle.size(); i += 1024)
+        cssMinifier.write(&bundle[i], std::min((size_t)1024, bundle.size() - i));
+    ASSERT_GT(str.size(), expectedCSS.size() * 999);
+    ASSERT_LT(cssMinifier.input.size(), 1024);
+    cssMinifier.finish();
+    ASSERT_EQ(str, LiquidCSS::CssMinify(bundle));
+
+    // Unterminated literals and comments run to the end.
+    ASSERT_EQ(LiquidCSS::CssMinify(".a { content: 'b"), ".a{content:'b");
+    ASSERT_EQ(LiquidJS::JsMinify("var a = 1; /* b"), "var a=1;");
+    ASSERT_EQ(LiquidCSS::CssMinify(""), "");
+
+    MinifierCache cache(1024, 512);
+    auto entry = cache.get(MinifierCache::Language::CSS, css.data(), css.size());
+    ASSERT_EQ(entry->output, expectedCSS);
+    ASSERT_EQ(cache.get(MinifierCache::Language::CSS, css.data(), css.size()), entry);
+    // The same input, minified as something else, is a different entry.
+    ASSERT_NE(cache.get(MinifierCache::Language::JS, css.data(), css.size()), entry);
+    MinifierCache::Statistics statistics = cache.getStatistics();
+    ASSERT_EQ(statistics.hits, 1);
+    ASSERT_EQ(statistics.misses, 2);
+    ASSERT_EQ(statistics.entries, 2);
+
+    str.clear();
+    CachedCssMinifier cached(&cache, append, &str);
+    for (size_t i = 0; i < css.size(); i += 7)
+        cached.write(&css[i], std::min((size_t)7, css.size() - i));
+    cached.finish();
+    ASSERT_EQ(str, expectedCSS);
+    ASSERT_EQ(cache.getStatistics().hits, 2);
+
+    // Anything bigger than an entry can be is streamed straight through, and never cached.
+    str.clear();
+    CachedCssMinifier uncached(&cache, append, &str);
+    uncached.write(bundle.data(), bundle.size());
+    uncached.finish();
+    ASSERT_EQ(str, LiquidCSS::CssMinify(bundle));
+    ASSERT_EQ(cache.getStatistics().misses, 2);
+
+    // Least recently used entries go, once the output held comes to more than the cache's size.
+    for (int i = 0; i < 64; ++i) {
+        std::string input = ".a" + std::to_string(i) + " { margin: 1px; }";
+        cache.get(MinifierCache::Language::CSS, input.data(), input.size());
+    }
+    statistics = cache.getStatistics();
+    ASSERT_LE(statistics.size, 1024);
+    ASSERT_GT(statistics.evictions, 0);
+    ASSERT_EQ(statistics.entries, statistics.misses - statistics.evictions);
+    cache.clear();
+    ASSERT_EQ(cache.getStatistics().entries, 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
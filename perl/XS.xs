@@ -9,6 +9,13 @@
 struct RendererCustomData {
     SV* parent;
     bool makeMethodCalls;
+    // Set for renderers that read snapshots, rather than perl variables; see createSnapshotRenderer.
+    bool snapshots;
+    LiquidVariableResolver resolver;
+    // Snapshots made from what callbacks return, freed after each render.
+    LiquidSnapshot* temporaries;
+    int temporaryCount;
+    int temporaryCapacity;
 };
 
 LiquidVariableType lpGetType(LiquidRenderer renderer, void* variable) {
@@ -339,6 +346,143 @@ int lpCompare(void* a, void* b) {
     return sv_cmp((SV*)a, (SV*)b);
 }
 
+static void lpSnapshotCopy(pTHX_ LiquidSnapshot target, SV* sv);
+
+// Copies one level of a hash, or array, into a snapshot; the containers under it are copied in turn, as they're looked in.
+static void lpSnapshotExpand(LiquidSnapshot container, void* host, void* data) {
+    dTHX;
+    SV* sv = SvRV((SV*)host);
+    if (SvTYPE(sv) == SVt_PVHV) {
+        HV* hv = (HV*)sv;
+        HE* entry;
+        hv_iterinit(hv);
+        while ((entry = hv_iternext(hv))) {
+            I32 length;
+            const char* key = hv_iterkey(entry, &length);
+            lpSnapshotCopy(aTHX_ liquidSnapshotAddKey(container, key, length), hv_iterval(hv, entry));
+        }
+    } else {
+        AV* av = (AV*)sv;
+        int length = av_top_index(av)+1;
+        for (int i = 0; i < length; ++i) {
+            SV** element = av_fetch(av, i, 0);
+            LiquidSnapshot target = liquidSnapshotAddElement(container);
+            if (element)
+                lpSnapshotCopy(aTHX_ target, *element);
+        }
+    }
+}
+
+static void lpSnapshotRelease(void* host, void* data) {
+    dTHX;
+    SvREFCNT_dec((SV*)host);
+}
+
+// Objects are copied like the hashes, or arrays, they are, without any method calls; for those, render the perl variables themselves.
+static void lpSnapshotCopy(pTHX_ LiquidSnapshot target, SV* sv) {
+    if (SvROK(sv)) {
+        if (SvTYPE(SvRV(sv)) == SVt_PVHV) {
+            liquidSnapshotSetDictionary(target, SvREFCNT_inc(sv));
+            return;
+        }
+        if (SvTYPE(SvRV(sv)) == SVt_PVAV) {
+            liquidSnapshotSetArray(target, SvREFCNT_inc(sv));
+            return;
+        }
+    }
+    LiquidRenderer renderer = { NULL };
+    switch (lpGetType(renderer, sv)) {
+        case LIQUID_VARIABLE_TYPE_INT:
+            liquidSnapshotSetInteger(target, (long long)SvIV(sv));
+        break;
+        case LIQUID_VARIABLE_TYPE_FLOAT:
+            liquidSnapshotSetFloat(target, SvNV(sv));
+        break;
+        case LIQUID_VARIABLE_TYPE_NIL:
+            liquidSnapshotSetNil(target);
+        break;
+        default: {
+            STRLEN len;
+            const char* ptr = SvPV(sv, len);
+            liquidSnapshotSetString(target, ptr, len);
+        } break;
+    }
+}
+
+static LiquidSnapshot lpCreateSnapshot(pTHX_ SV* sv) {
+    LiquidSnapshot snapshot = liquidCreateSnapshot(lpSnapshotExpand, lpSnapshotRelease, NULL);
+    lpSnapshotCopy(aTHX_ snapshot, sv);
+    return snapshot;
+}
+
+// Turns a snapshot's value back into a perl one; containers that were copied from perl are the perl variables they were copied from.
+static SV* lpSnapshotToSV(pTHX_ struct RendererCustomData* customData, LiquidRenderer renderer, void* variable) {
+    LiquidSnapshot snapshot = { variable };
+    switch (customData->resolver.getType(renderer, variable)) {
+        case LIQUID_VARIABLE_TYPE_STRING: {
+            const char* view;
+            size_t length;
+            customData->resolver.getStringView(renderer, variable, &view, &length);
+            return newSVpvn(view, length);
+        }
+        case LIQUID_VARIABLE_TYPE_INT: {
+            long long i;
+            customData->resolver.getInteger(renderer, variable, &i);
+            return newSViv(i);
+        }
+        case LIQUID_VARIABLE_TYPE_FLOAT: {
+            double f;
+            customData->resolver.getFloat(renderer, variable, &f);
+            return newSVnv(f);
+        }
+        case LIQUID_VARIABLE_TYPE_BOOL: {
+            bool b;
+            customData->resolver.getBool(renderer, variable, &b);
+            return newSViv(b ? 1 : 0);
+        }
+        case LIQUID_VARIABLE_TYPE_DICTIONARY: {
+            if (liquidSnapshotGetHost(snapshot))
+                return SvREFCNT_inc((SV*)liquidSnapshotGetHost(snapshot));
+            HV* hv = newHV();
+            size_t size = liquidSnapshotGetSize(snapshot);
+            for (size_t i = 0; i < size; ++i) {
+                const char* key;
+                size_t length;
+                LiquidSnapshot element = liquidSnapshotGetElement(snapshot, i, &key, &length);
+                hv_store(hv, key, length, lpSnapshotToSV(aTHX_ customData, renderer, element.snapshot), 0);
+            }
+            return newRV_noinc((SV*)hv);
+        }
+        case LIQUID_VARIABLE_TYPE_ARRAY: {
+            if (liquidSnapshotGetHost(snapshot))
+                return SvREFCNT_inc((SV*)liquidSnapshotGetHost(snapshot));
+            AV* av = newAV();
+            size_t size = liquidSnapshotGetSize(snapshot);
+            for (size_t i = 0; i < size; ++i)
+                av_push(av, lpSnapshotToSV(aTHX_ customData, renderer, liquidSnapshotGetElement(snapshot, i, NULL, NULL).snapshot));
+            return newRV_noinc((SV*)av);
+        }
+        default:
+            return newSV(0);
+    }
+}
+
+// For snapshot renderers, what callbacks are given in place of a variable; a new perl value, after which the variable's freed, if it was made for the call.
+static SV* lpSnapshotTake(pTHX_ LiquidRenderer renderer, void* variable) {
+    struct RendererCustomData* customData = liquidRendererGetCustomData(renderer);
+    if (!variable)
+        return newSV(0);
+    SV* sv = lpSnapshotToSV(aTHX_ customData, renderer, variable);
+    customData->resolver.freeVariable(renderer, variable);
+    return sv;
+}
+
+static void lpFreeTemporaries(struct RendererCustomData* customData) {
+    for (int i = 0; i < customData->temporaryCount; ++i)
+        liquidFreeSnapshot(customData->temporaries[i]);
+    customData->temporaryCount = 0;
+}
+
 void lpSetReturnValue(PerlInterpreter* my_perl, LiquidRenderer renderer, SV* sv) {
     switch (lpGetType(renderer, (void*)sv)) {
         case LIQUID_VARIABLE_TYPE_STRING: {
@@ -365,7 +509,17 @@ void lpSetReturnValue(PerlInterpreter* my_perl, LiquidRenderer renderer, SV* sv)
             liquidRendererSetReturnValueInteger(renderer, i);
         } break;
         default:{
-            liquidRendererSetReturnValueVariable(renderer, SvREFCNT_inc(sv));
+            struct RendererCustomData* customData = liquidRendererGetCustomData(renderer);
+            if (customData->snapshots) {
+                if (customData->temporaryCount == customData->temporaryCapacity) {
+                    customData->temporaryCapacity = customData->temporaryCapacity ? customData->temporaryCapacity * 2 : 8;
+                    customData->temporaries = realloc(customData->temporaries, sizeof(LiquidSnapshot)*customData->temporaryCapacity);
+                }
+                LiquidSnapshot snapshot = lpCreateSnapshot(aTHX_ sv);
+                customData->temporaries[customData->temporaryCount++] = snapshot;
+                liquidRendererSetReturnValueVariable(renderer, snapshot.snapshot);
+            } else
+                liquidRendererSetReturnValueVariable(renderer, SvREFCNT_inc(sv));
         } break;
     }
 }
@@ -390,6 +544,14 @@ static void lpRenderEnclosingTag(LiquidRenderer renderer, LiquidNode node, void*
 
     ENTER;
     SAVETMPS;
+
+    if (customData->snapshots) {
+        variableStore = sv_2mortal(lpSnapshotTake(aTHX_ renderer, variableStore));
+        child = sv_2mortal(lpSnapshotTake(aTHX_ renderer, child));
+        for (int i = 0; i < argMax; ++i)
+            arguments[i] = sv_2mortal(lpSnapshotTake(aTHX_ renderer, arguments[i]));
+    }
+
     PUSHMARK(SP);
 
     EXTEND(SP, 4+argMax);
@@ -439,6 +601,13 @@ static void lpRenderFreeTag(LiquidRenderer renderer, LiquidNode node, void* vari
 
     ENTER;
     SAVETMPS;
+
+    if (customData->snapshots) {
+        variableStore = sv_2mortal(lpSnapshotTake(aTHX_ renderer, variableStore));
+        for (int i = 0; i < argMax; ++i)
+            arguments[i] = sv_2mortal(lpSnapshotTake(aTHX_ renderer, arguments[i]));
+    }
+
     PUSHMARK(SP);
 
     EXTEND(SP, 3+argMax);
@@ -488,6 +657,14 @@ static void lpRenderFilter(LiquidRenderer renderer, LiquidNode node, void* varia
 
     ENTER;
     SAVETMPS;
+
+    if (customData->snapshots) {
+        variableStore = sv_2mortal(lpSnapshotTake(aTHX_ renderer, variableStore));
+        operand = sv_2mortal(lpSnapshotTake(aTHX_ renderer, operand));
+        for (int i = 0; i < argMax; ++i)
+            arguments[i] = sv_2mortal(lpSnapshotTake(aTHX_ renderer, arguments[i]));
+    }
+
     PUSHMARK(SP);
 
     EXTEND(SP, 4+argMax);
@@ -541,6 +718,14 @@ static void lpRenderBinaryInfixOperator(LiquidRenderer renderer, LiquidNode node
 
     ENTER;
     SAVETMPS;
+
+    // Both operands are taken by the call below.
+    if (customData->snapshots) {
+        variableStore = sv_2mortal(lpSnapshotTake(aTHX_ renderer, variableStore));
+        op1 = lpSnapshotTake(aTHX_ renderer, op1);
+        op2 = lpSnapshotTake(aTHX_ renderer, op2);
+    }
+
     PUSHMARK(SP);
 
     EXTEND(SP, 5);
@@ -583,6 +768,12 @@ static void lpRenderDotFilter(LiquidRenderer renderer, LiquidNode node, void* va
 
     ENTER;
     SAVETMPS;
+
+    if (customData->snapshots) {
+        variableStore = sv_2mortal(lpSnapshotTake(aTHX_ renderer, variableStore));
+        operand = sv_2mortal(lpSnapshotTake(aTHX_ renderer, operand));
+    }
+
     PUSHMARK(SP);
 
     EXTEND(SP, 4);
@@ -716,6 +907,32 @@ createRenderer(context, parent)
         // TODO: Fix this. We shouldn't be incrementing the reference here, but for some reason the reference goes out of scope if I don't do this.
         customData->parent = SvREFCNT_inc(parent);
         customData->makeMethodCalls = false;
+        customData->snapshots = false;
+        customData->resolver = resolver;
+        customData->temporaries = NULL;
+        customData->temporaryCount = 0;
+        customData->temporaryCapacity = 0;
+        liquidRendererSetCustomData(renderer, customData);
+        RETVAL = renderer.renderer;
+    OUTPUT:
+        RETVAL
+
+void*
+createSnapshotRenderer(context, parent)
+    void* context;
+    SV* parent;
+    CODE:
+        LiquidRenderer renderer = liquidCreateRenderer(*(LiquidContext*)&context);
+        LiquidVariableResolver resolver = liquidGetSnapshotVariableResolver();
+        liquidRegisterVariableResolver(renderer, resolver);
+        struct RendererCustomData* customData = malloc(sizeof(struct RendererCustomData));
+        customData->parent = SvREFCNT_inc(parent);
+        customData->makeMethodCalls = false;
+        customData->snapshots = true;
+        customData->resolver = resolver;
+        customData->temporaries = NULL;
+        customData->temporaryCount = 0;
+        customData->temporaryCapacity = 0;
         liquidRendererSetCustomData(renderer, customData);
         RETVAL = renderer.renderer;
     OUTPUT:
@@ -725,9 +942,26 @@ void
 freeRenderer(renderer)
     void* renderer;
     CODE:
-        free(liquidRendererGetCustomData(*(LiquidRenderer*)&renderer));
+        struct RendererCustomData* customData = liquidRendererGetCustomData(*(LiquidRenderer*)&renderer);
+        lpFreeTemporaries(customData);
+        free(customData->temporaries);
+        free(customData);
         liquidFreeRenderer(*(LiquidRenderer*)&renderer);
 
+void*
+createSnapshot(store)
+    SV* store;
+    CODE:
+        RETVAL = lpCreateSnapshot(aTHX_ store).snapshot;
+    OUTPUT:
+        RETVAL
+
+void
+freeSnapshot(snapshot)
+    void* snapshot;
+    CODE:
+        liquidFreeSnapshot(*(LiquidSnapshot*)&snapshot);
+
 
 
 void*
@@ -855,7 +1089,11 @@ renderTemplate(renderer, store, tmpl, error)
     CODE:
         LiquidRendererError rendererError;
         int i;
-        LiquidTemplateRender render = liquidRendererRenderTemplate(*(LiquidRenderer*)&renderer, store, *(LiquidTemplate*)&tmpl, &rendererError);
+        struct RendererCustomData* customData = liquidRendererGetCustomData(*(LiquidRenderer*)&renderer);
+        // Snapshot renderers are given the snapshot made by createSnapshot.
+        void* variableStore = customData->snapshots ? INT2PTR(void*, SvIV(store)) : (void*)store;
+        LiquidTemplateRender render = liquidRendererRenderTemplate(*(LiquidRenderer*)&renderer, variableStore, *(LiquidTemplate*)&tmpl, &rendererError);
+        lpFreeTemporaries(customData);
         if (SvROK(error)) {
             if (rendererError.type) {
                 AV* av = (AV*)SvRV(error);
@@ -866,8 +1104,58 @@ renderTemplate(renderer, store, tmpl, error)
                     av_push(av, newSVpvn(rendererError.details.args[0], strlen(rendererError.details.args[i])));
             }
         }
-        RETVAL = newSVpvn(liquidTemplateRenderGetBuffer(render), liquidTemplateRenderGetSize(render));
-        liquidFreeTemplateRender(render);
+        if (render.internal) {
+            RETVAL = newSVpvn(liquidTemplateRenderGetBuffer(render), liquidTemplateRenderGetSize(render));
+            liquidFreeTemplateRender(render);
+        } else
+            RETVAL = newSV(0);
+    OUTPUT:
+        RETVAL
+
+AV*
+renderTemplates(renderer, stores, templates, errors)
+    void* renderer;
+    AV* stores;
+    AV* templates;
+    AV* errors;
+    CODE:
+        int i, j;
+        struct RendererCustomData* customData = liquidRendererGetCustomData(*(LiquidRenderer*)&renderer);
+        int count = av_top_index(templates)+1;
+        void** variableStores = malloc(sizeof(void*)*count);
+        LiquidTemplate* tmpls = malloc(sizeof(LiquidTemplate)*count);
+        LiquidTemplateRender* renders = malloc(sizeof(LiquidTemplateRender)*count);
+        LiquidRendererError* rendererErrors = malloc(sizeof(LiquidRendererError)*count);
+        for (i = 0; i < count; ++i) {
+            SV** store = av_fetch(stores, i, 0);
+            SV** tmpl = av_fetch(templates, i, 0);
+            variableStores[i] = customData->snapshots ? INT2PTR(void*, SvIV(*store)) : (void*)*store;
+            tmpls[i].ast = INT2PTR(void*, SvIV(*tmpl));
+        }
+        liquidRendererRenderTemplates(*(LiquidRenderer*)&renderer, count, variableStores, tmpls, renders, rendererErrors);
+        lpFreeTemporaries(customData);
+        RETVAL = newAV();
+        sv_2mortal((SV*)RETVAL);
+        for (i = 0; i < count; ++i) {
+            if (renders[i].internal) {
+                av_push(RETVAL, newSVpvn(liquidTemplateRenderGetBuffer(renders[i]), liquidTemplateRenderGetSize(renders[i])));
+                av_push(errors, newSV(0));
+                liquidFreeTemplateRender(renders[i]);
+            } else {
+                AV* av = newAV();
+                av_push(av, newSVnv(rendererErrors[i].type));
+                av_push(av, newSVnv(rendererErrors[i].details.line));
+                av_push(av, newSVnv(rendererErrors[i].details.column));
+                for (j = 0; j < LIQUID_ERROR_ARGS_MAX; ++j)
+                    av_push(av, newSVpvn(rendererErrors[i].details.args[j], strlen(rendererErrors[i].details.args[j])));
+                av_push(RETVAL, newSV(0));
+                av_push(errors, newRV_noinc((SV*)av));
+            }
+        }
+        free(variableStores);
+        free(tmpls);
+        free(renders);
+        free(rendererErrors);
     OUTPUT:
         RETVAL
 
@@ -101,6 +101,14 @@ sub parent { return $_[0]->{liquid}; }
 sub DESTROY {
     my ($self) = @_;
     WWW::Shopify::Liquid::XS::freeRenderer($self->{renderer});
+    WWW::Shopify::Liquid::XS::freeRenderer($self->{snapshot_renderer}) if $self->{snapshot_renderer};
+}
+
+# Snapshots are read by a renderer of their own, made the first time one's rendered; it shares everything registered on the context.
+sub snapshot_renderer {
+    my ($self) = @_;
+    $self->{snapshot_renderer} = WWW::Shopify::Liquid::XS::createSnapshotRenderer($self->{liquid}->{context}, $self) if !$self->{snapshot_renderer};
+    return $self->{snapshot_renderer};
 }
 
 use Encode;
@@ -109,11 +117,30 @@ sub render {
     my ($self, $hash, $template) = @_;
     my $error = [];
     $self->inclusion_depth(0);
-    my $result = WWW::Shopify::Liquid::XS::renderTemplate($self->{renderer}, $hash, $template->{template}, $error);
+    my $result = ref($hash) && ref($hash) eq 'WWW::Shopify::Liquid::XS::Snapshot' ?
+        WWW::Shopify::Liquid::XS::renderTemplate($self->snapshot_renderer, $hash->{snapshot}, $template->{template}, $error) :
+        WWW::Shopify::Liquid::XS::renderTemplate($self->{renderer}, $hash, $template->{template}, $error);
     die WWW::Shopify::Liquid::XS::Exception->new($error->[0]) if !$self->{silence_exceptions} && int(@$error) > 0;
     return decode("UTF-8", $result);
 }
 
+# Renders each template with the hash, or snapshot, at the same index, in one call. Either all of the stores are snapshots, or none of
+# them are. Returns the renders, in order; unless exceptions are silenced, dies with the error of the first that failed, once they're done.
+sub render_batch {
+    my ($self, $hashes, $templates) = @_;
+    die WWW::Shopify::Liquid::XS::Exception->new("Batches need a store for every template.") if int(@$hashes) != int(@$templates);
+    my $snapshots = int(grep { ref($_) && ref($_) eq 'WWW::Shopify::Liquid::XS::Snapshot' } @$hashes);
+    die WWW::Shopify::Liquid::XS::Exception->new("Batches can't mix snapshots and hashes.") if $snapshots && $snapshots != int(@$hashes);
+    my $errors = [];
+    $self->inclusion_depth(0);
+    my $results = $snapshots ?
+        WWW::Shopify::Liquid::XS::renderTemplates($self->snapshot_renderer, [map { $_->{snapshot} } @$hashes], [map { $_->{template} } @$templates], $errors) :
+        WWW::Shopify::Liquid::XS::renderTemplates($self->{renderer}, $hashes, [map { $_->{template} } @$templates], $errors);
+    my ($error) = grep { defined $_ } @$errors;
+    die WWW::Shopify::Liquid::XS::Exception->new($error) if !$self->{silence_exceptions} && $error;
+    return map { defined $_ ? decode("UTF-8", $_) : undef } @$results;
+}
+
 sub silence_exceptions { $_[0]->{silence_exceptions} = $_[1] if @_ > 1; return $_[0]->{silence_exceptions}; }
 sub print_exceptions { $_[0]->{print_exceptions} = $_[1] if @_ > 1; return $_[0]->{print_exceptions}; }
 sub inclusion_context { $_[0]->{inclusion_context} = $_[1] if @_ > 1; return $_[0]->{inclusion_context}; }
@@ -168,6 +195,21 @@ sub optimize {
     return $template;
 }
 
+package WWW::Shopify::Liquid::XS::Snapshot;
+
+# A native copy of a hash, for rendering with; only what's read while rendering is ever copied, the first time it's read. Changes to the
+# hash after something under it's been read aren't seen by later renders; nor are assigns made while rendering seen by the hash, though,
+# like with a hash, they're seen by later renders of the same snapshot.
+sub new {
+    my ($package, $hash) = @_;
+    return bless { snapshot => WWW::Shopify::Liquid::XS::createSnapshot($hash) }, $package;
+}
+
+sub DESTROY {
+    my ($self) = @_;
+    WWW::Shopify::Liquid::XS::freeSnapshot($self->{snapshot});
+}
+
 package WWW::Shopify::Liquid::XS::Template;
 
 sub new {
@@ -455,6 +497,16 @@ sub render_ast {
     return $self->renderer->render($hash, $template);
 }
 
+sub render_batch {
+    my ($self, $hashes, $templates) = @_;
+    return $self->renderer->render_batch($hashes, $templates);
+}
+
+sub snapshot {
+    my ($self, $hash) = @_;
+    return WWW::Shopify::Liquid::XS::Snapshot->new($hash);
+}
+
 sub optimize_ast {
     my ($self, $hash, $template) = @_;
     return $self->optimizer->optimize($hash, $template);
@@ -533,6 +585,14 @@ WWW::Shopify::Liquid::XS - Perl interface to the libliquid library.
 
 Presents an identical interface to WWW::Shopify::Liquid; but should be many times faster, and less memory-consuming.
 
+Rendering a perl hash calls back into perl for every variable that's read. For stores that are rendered more than once, or with many
+templates, C<snapshot> makes a native copy of the hash, which is only ever copied as far as renders read into it, and can be passed
+anywhere a hash can. Filters, tags and operators registered in perl are given perl values; the hashes, and arrays, a snapshot was made
+from, where they are. Objects in a snapshot are copied like the hashes they are; their methods aren't called.
+
+    my $snapshot = $liquid->snapshot({ products => \@products });
+    my @texts = $liquid->render_batch([($snapshot) x 2], [$listing, $feed]);
+
 =head1 SEE ALSO
 
 L<WWW::Shopify::Liquid>
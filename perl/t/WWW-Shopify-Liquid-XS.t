@@ -270,6 +270,21 @@ is($text, 2);
 $text = $liquid->render_text({ settings => { productspg_featured_limit => 3 } }, '{% for product in (1..10) limit: settings.productspg_featured_limit offset: 5 %}{{ forloop.index }}{% endfor %}');
 is($text, '678');
 
+my $snapshot = $liquid->snapshot({ order => $order, email => 'test2@gmail.com' });
+$text = $liquid->render_ast($snapshot, $ast);
+is($text, 2);
+
+my @texts = $liquid->render_batch([$snapshot, $snapshot], [$ast, $liquid->parse_text('{{ order.line_items | map: "id" | join: "," }}{{ "123" | test }}')]);
+is_deeply(\@texts, [2, '1,2321']);
+
+my $hash = { order => $order, email => 'test1@gmail.com' };
+@texts = $liquid->render_batch([$hash, { order => $order, email => 'test2@gmail.com' }], [$ast, $ast]);
+is_deeply(\@texts, [1, 2]);
+
+$text = $liquid->render_ast($liquid->snapshot($hash), $liquid->parse_text('{% assign email = "none" %}{{ email }}'));
+is($text, 'none');
+is($hash->{email}, 'test1@gmail.com');
+
 done_testing();
 
 # my $pattern = "{{ a | replace: \"\r\n\", \"\" }}";
@@ -4,7 +4,7 @@
 
 // Global definitions.
 
-static VALUE liquidCParserError, liquidCRendererError, liquidCTemplate, liquidCProgram;
+static VALUE liquidCParserError, liquidCRendererError, liquidCTemplate, liquidCProgram, liquidCSnapshot, liquidCSnapshotRenderer;
 
 struct SLiquidCRubyContext {
     LiquidContext context;
@@ -211,6 +211,237 @@ VALUE liquidC_alloc(VALUE self) {
     return TypedData_Wrap_Struct(self, &liquidC_type, data);
 }
 
+// Snapshots. Every hash, and array, a snapshot's given is kept in an array, so that they're marked until the snapshot's freed.
+
+struct SLiquidCRubySnapshot {
+    LiquidSnapshot snapshot;
+    VALUE hosts;
+};
+typedef struct SLiquidCRubySnapshot LiquidCRubySnapshot;
+
+// Snapshot renderers read snapshots, rather than ruby values; what callbacks return is copied into snapshots of its own, freed after each render.
+struct SLiquidCRubySnapshotRenderer {
+    LiquidRenderer renderer;
+    LiquidVariableResolver resolver;
+    LiquidSnapshot* temporaries;
+    int temporaryCount;
+    int temporaryCapacity;
+    VALUE hosts;
+};
+typedef struct SLiquidCRubySnapshotRenderer LiquidCRubySnapshotRenderer;
+
+static void liquidCSnapshotCopy(LiquidSnapshot target, VALUE value, VALUE hosts) {
+    switch (TYPE(value)) {
+        case T_HASH:
+            rb_ary_push(hosts, value);
+            liquidSnapshotSetDictionary(target, (void*)value);
+        break;
+        case T_ARRAY:
+            rb_ary_push(hosts, value);
+            liquidSnapshotSetArray(target, (void*)value);
+        break;
+        case T_FIXNUM:
+        case T_BIGNUM:
+            liquidSnapshotSetInteger(target, NUM2LL(value));
+        break;
+        case T_FLOAT:
+            liquidSnapshotSetFloat(target, NUM2DBL(value));
+        break;
+        case T_STRING:
+            liquidSnapshotSetString(target, RSTRING_PTR(value), RSTRING_LEN(value));
+        break;
+        case T_TRUE:
+        case T_FALSE:
+            liquidSnapshotSetBool(target, RTEST(value));
+        break;
+        default:
+            liquidSnapshotSetNil(target);
+        break;
+    }
+}
+
+struct SLiquidCSnapshotExpansion {
+    LiquidSnapshot container;
+    VALUE hosts;
+};
+
+// Like the ruby resolver, only string keys can be looked up.
+static int liquidCSnapshotExpandPair(VALUE key, VALUE value, VALUE data) {
+    struct SLiquidCSnapshotExpansion* expansion = (struct SLiquidCSnapshotExpansion*)data;
+    if (TYPE(key) == T_STRING)
+        liquidCSnapshotCopy(liquidSnapshotAddKey(expansion->container, RSTRING_PTR(key), RSTRING_LEN(key)), value, expansion->hosts);
+    return ST_CONTINUE;
+}
+
+static void liquidCSnapshotExpand(LiquidSnapshot container, void* host, void* data) {
+    struct SLiquidCSnapshotExpansion expansion = { container, (VALUE)data };
+    long i, length;
+    if (TYPE((VALUE)host) == T_HASH) {
+        rb_hash_foreach((VALUE)host, liquidCSnapshotExpandPair, (VALUE)&expansion);
+    } else {
+        length = RARRAY_LEN((VALUE)host);
+        for (i = 0; i < length; ++i)
+            liquidCSnapshotCopy(liquidSnapshotAddElement(container), rb_ary_entry((VALUE)host, i), (VALUE)data);
+    }
+}
+
+// What callbacks are given in place of a variable; hashes, and arrays, from a snapshot are what they were copied from.
+static VALUE liquidCSnapshotToValue(LiquidCRubySnapshotRenderer* renderer, void* variable) {
+    LiquidSnapshot snapshot = { variable };
+    const char* view;
+    const char* key;
+    size_t length, size, i;
+    long long integer;
+    double f;
+    bool b;
+    VALUE value;
+    switch (renderer->resolver.getType(renderer->renderer, variable)) {
+        case LIQUID_VARIABLE_TYPE_STRING:
+            renderer->resolver.getStringView(renderer->renderer, variable, &view, &length);
+            return rb_enc_str_new(view, length, rb_utf8_encoding());
+        case LIQUID_VARIABLE_TYPE_INT:
+            renderer->resolver.getInteger(renderer->renderer, variable, &integer);
+            return LL2NUM(integer);
+        case LIQUID_VARIABLE_TYPE_FLOAT:
+            renderer->resolver.getFloat(renderer->renderer, variable, &f);
+            return DBL2NUM(f);
+        case LIQUID_VARIABLE_TYPE_BOOL:
+            renderer->resolver.getBool(renderer->renderer, variable, &b);
+            return b ? Qtrue : Qfalse;
+        case LIQUID_VARIABLE_TYPE_DICTIONARY:
+            if (liquidSnapshotGetHost(snapshot))
+                return (VALUE)liquidSnapshotGetHost(snapshot);
+            value = rb_hash_new();
+            size = liquidSnapshotGetSize(snapshot);
+            for (i = 0; i < size; ++i) {
+                LiquidSnapshot element = liquidSnapshotGetElement(snapshot, i, &key, &length);
+                rb_hash_aset(value, rb_enc_str_new(key, length, rb_utf8_encoding()), liquidCSnapshotToValue(renderer, element.snapshot));
+            }
+            return value;
+        case LIQUID_VARIABLE_TYPE_ARRAY:
+            if (liquidSnapshotGetHost(snapshot))
+                return (VALUE)liquidSnapshotGetHost(snapshot);
+            value = rb_ary_new();
+            size = liquidSnapshotGetSize(snapshot);
+            for (i = 0; i < size; ++i)
+                rb_ary_push(value, liquidCSnapshotToValue(renderer, liquidSnapshotGetElement(snapshot, i, NULL, NULL).snapshot));
+            return value;
+        default:
+            return Qnil;
+    }
+}
+
+static LiquidCRubySnapshotRenderer* liquidCGetSnapshotRenderer(LiquidRenderer renderer);
+
+// For plain renderers, the variable itself; for snapshot renderers, a ruby value, after which the variable's freed, if it was made for the call.
+static VALUE liquidCTake(LiquidRenderer renderer, void* variable) {
+    LiquidCRubySnapshotRenderer* snapshotRenderer = liquidCGetSnapshotRenderer(renderer);
+    VALUE value;
+    if (!snapshotRenderer)
+        return (VALUE)variable;
+    if (!variable)
+        return Qnil;
+    value = liquidCSnapshotToValue(snapshotRenderer, variable);
+    snapshotRenderer->resolver.freeVariable(renderer, variable);
+    return value;
+}
+
+static void liquidCSetReturnValue(LiquidRenderer renderer, VALUE result) {
+    LiquidCRubySnapshotRenderer* snapshotRenderer = liquidCGetSnapshotRenderer(renderer);
+    LiquidSnapshot snapshot;
+    if (!snapshotRenderer) {
+        liquidRendererSetReturnValueVariable(renderer, (void*)result);
+        return;
+    }
+    if (snapshotRenderer->temporaryCount == snapshotRenderer->temporaryCapacity) {
+        snapshotRenderer->temporaryCapacity = snapshotRenderer->temporaryCapacity ? snapshotRenderer->temporaryCapacity * 2 : 8;
+        snapshotRenderer->temporaries = (LiquidSnapshot*)realloc(snapshotRenderer->temporaries, sizeof(LiquidSnapshot)*snapshotRenderer->temporaryCapacity);
+    }
+    snapshot = liquidCreateSnapshot(liquidCSnapshotExpand, NULL, (void*)snapshotRenderer->hosts);
+    liquidCSnapshotCopy(snapshot, result, snapshotRenderer->hosts);
+    snapshotRenderer->temporaries[snapshotRenderer->temporaryCount++] = snapshot;
+    liquidRendererSetReturnValueVariable(renderer, snapshot.snapshot);
+}
+
+static void liquidCFreeTemporaries(LiquidCRubySnapshotRenderer* renderer) {
+    int i;
+    for (i = 0; i < renderer->temporaryCount; ++i)
+        liquidFreeSnapshot(renderer->temporaries[i]);
+    renderer->temporaryCount = 0;
+    rb_ary_clear(renderer->hosts);
+}
+
+void liquidCSnapshot_free(void* data) {
+    if (((LiquidCRubySnapshot*)data)->snapshot.snapshot)
+        liquidFreeSnapshot(((LiquidCRubySnapshot*)data)->snapshot);
+    free(data);
+}
+void liquidCSnapshot_mark(void* data) {
+    rb_gc_mark(((LiquidCRubySnapshot*)data)->hosts);
+}
+size_t liquidCSnapshot_size(const void* data) { return sizeof(LiquidCRubySnapshot); }
+static const rb_data_type_t liquidCSnapshot_type = {
+    .wrap_struct_name = "Snapshot",
+    .function = {
+            .dmark = liquidCSnapshot_mark,
+            .dfree = liquidCSnapshot_free,
+            .dsize = liquidCSnapshot_size,
+    },
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+VALUE liquidCSnapshot_alloc(VALUE self) {
+    LiquidCRubySnapshot* data = (LiquidCRubySnapshot*)malloc(sizeof(LiquidCRubySnapshot));
+    data->snapshot.snapshot = NULL;
+    data->hosts = rb_ary_new();
+    return TypedData_Wrap_Struct(self, &liquidCSnapshot_type, data);
+}
+
+void liquidCSnapshotRenderer_free(void* data) {
+    LiquidCRubySnapshotRenderer* renderer = (LiquidCRubySnapshotRenderer*)data;
+    int i;
+    for (i = 0; i < renderer->temporaryCount; ++i)
+        liquidFreeSnapshot(renderer->temporaries[i]);
+    free(renderer->temporaries);
+    if (renderer->renderer.renderer)
+        liquidFreeRenderer(renderer->renderer);
+    free(data);
+}
+void liquidCSnapshotRenderer_mark(void* data) {
+    rb_gc_mark(((LiquidCRubySnapshotRenderer*)data)->hosts);
+}
+size_t liquidCSnapshotRenderer_size(const void* data) { return sizeof(LiquidCRubySnapshotRenderer); }
+static const rb_data_type_t liquidCSnapshotRenderer_type = {
+    .wrap_struct_name = "SnapshotRenderer",
+    .function = {
+            .dmark = liquidCSnapshotRenderer_mark,
+            .dfree = liquidCSnapshotRenderer_free,
+            .dsize = liquidCSnapshotRenderer_size,
+    },
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+VALUE liquidCSnapshotRenderer_alloc(VALUE self) {
+    LiquidCRubySnapshotRenderer* data = (LiquidCRubySnapshotRenderer*)malloc(sizeof(LiquidCRubySnapshotRenderer));
+    data->renderer.renderer = NULL;
+    data->temporaries = NULL;
+    data->temporaryCount = 0;
+    data->temporaryCapacity = 0;
+    data->hosts = rb_ary_new();
+    return TypedData_Wrap_Struct(self, &liquidCSnapshotRenderer_type, data);
+}
+
+static LiquidCRubySnapshotRenderer* liquidCGetSnapshotRenderer(LiquidRenderer renderer) {
+    VALUE self = (VALUE)liquidRendererGetCustomData(renderer);
+    LiquidCRubySnapshotRenderer* snapshotRenderer;
+    if (!rb_obj_is_kind_of(self, liquidCSnapshotRenderer))
+        return NULL;
+    TypedData_Get_Struct(self, LiquidCRubySnapshotRenderer, &liquidCSnapshotRenderer_type, snapshotRenderer);
+    return snapshotRenderer;
+}
+
 // Type boilerplate.
 #define LIQUID_STRUCT_BOILERPLATE(class, internal)\
 void liquidC##class##_free(void* data) {\
@@ -311,6 +542,27 @@ VALUE liquidCRendererSetStrictFilters(VALUE self, VALUE strict) {
     return self;
 }
 
+VALUE liquidCSnapshotRenderer_m_initialize(VALUE self, VALUE contextValue) {
+    LiquidCRubySnapshotRenderer* renderer;
+    LiquidCRubyContext* context;
+    TypedData_Get_Struct(self, LiquidCRubySnapshotRenderer, &liquidCSnapshotRenderer_type, renderer);
+    TypedData_Get_Struct(contextValue, LiquidCRubyContext, &liquidC_type, context);
+    renderer->renderer = liquidCreateRenderer(context->context);
+    renderer->resolver = liquidGetSnapshotVariableResolver();
+    liquidRendererSetCustomData(renderer->renderer, (void*)self);
+    liquidRegisterVariableResolver(renderer->renderer, renderer->resolver);
+    return self;
+}
+
+VALUE liquidCSnapshot_m_initialize(VALUE self, VALUE stash) {
+    LiquidCRubySnapshot* snapshot;
+    Check_Type(stash, T_HASH);
+    TypedData_Get_Struct(self, LiquidCRubySnapshot, &liquidCSnapshot_type, snapshot);
+    snapshot->snapshot = liquidCreateSnapshot(liquidCSnapshotExpand, NULL, (void*)snapshot->hosts);
+    liquidCSnapshotCopy(snapshot->snapshot, stash, snapshot->hosts);
+    return self;
+}
+
 VALUE liquidCParser_m_initialize(VALUE self, VALUE incomingContext) {
     LiquidParser* parser;
     LiquidCRubyContext* context;
@@ -390,6 +642,141 @@ VALUE method_liquidCTemplateRender(VALUE self, VALUE stash, VALUE tmpl) {
     return str;
 }
 
+// Renders every template with the store at the same index, in one call; the exception's that of the first that failed, if any did, for
+// the caller to raise once it's cleaned up.
+static VALUE liquidCRenderBatch(LiquidRenderer renderer, long count, void** stores, VALUE templates, VALUE* exception) {
+    VALUE results, exceptionInit[PACK_EXCEPTION_LENGTH];
+    LiquidTemplate* liquidTemplates;
+    LiquidTemplateRender* renders;
+    LiquidRendererError* errors;
+    LiquidTemplate* liquidTemplate;
+    char buffer[512];
+    long i, failed;
+    int j, enc;
+    liquidTemplates = (LiquidTemplate*)malloc(sizeof(LiquidTemplate)*count);
+    renders = (LiquidTemplateRender*)malloc(sizeof(LiquidTemplateRender)*count);
+    errors = (LiquidRendererError*)malloc(sizeof(LiquidRendererError)*count);
+    for (i = 0; i < count; ++i) {
+        TypedData_Get_Struct(rb_ary_entry(templates, i), LiquidTemplate, &liquidCTemplate_type, liquidTemplate);
+        liquidTemplates[i] = *liquidTemplate;
+    }
+    liquidRendererRenderTemplates(renderer, count, stores, liquidTemplates, renders, errors);
+    results = rb_ary_new2(count);
+    enc = rb_enc_find_index("UTF-8");
+    failed = -1;
+    for (i = 0; i < count; ++i) {
+        if (renders[i].internal) {
+            rb_ary_push(results, rb_enc_associate_index(rb_str_new(liquidTemplateRenderGetBuffer(renders[i]), liquidTemplateRenderGetSize(renders[i])), enc));
+            liquidFreeTemplateRender(renders[i]);
+        } else {
+            rb_ary_push(results, Qnil);
+            if (failed == -1)
+                failed = i;
+        }
+    }
+    if (failed != -1) {
+        liquidGetRendererErrorMessage(errors[failed], buffer, sizeof(buffer));
+        PACK_EXCEPTION(liquidCRendererError, errors[failed], exceptionInit, buffer, *exception);
+    } else
+        *exception = Qnil;
+    free(liquidTemplates);
+    free(renders);
+    free(errors);
+    return results;
+}
+
+static void liquidCCheckBatchTemplates(VALUE templates, long count) {
+    long i;
+    for (i = 0; i < count; ++i) {
+        if (!rb_obj_is_kind_of(rb_ary_entry(templates, i), liquidCTemplate))
+            rb_raise(rb_eTypeError, "Batches can only render templates.");
+    }
+}
+
+VALUE method_liquidCTemplateRenderBatch(VALUE self, VALUE stashes, VALUE templates) {
+    LiquidRenderer* liquidRenderer;
+    VALUE results, exception;
+    void** stores;
+    long i, count;
+    Check_Type(stashes, T_ARRAY);
+    Check_Type(templates, T_ARRAY);
+    count = RARRAY_LEN(templates);
+    if (RARRAY_LEN(stashes) != count)
+        rb_raise(rb_eArgError, "Batches need a stash for every template.");
+    liquidCCheckBatchTemplates(templates, count);
+    TypedData_Get_Struct(self, LiquidRenderer, &liquidCRenderer_type, liquidRenderer);
+    stores = (void**)malloc(sizeof(void*)*count);
+    for (i = 0; i < count; ++i) {
+        stores[i] = (void*)rb_ary_entry(stashes, i);
+        if (TYPE((VALUE)stores[i]) != T_HASH) {
+            free(stores);
+            rb_raise(rb_eTypeError, "Batches can only be rendered with hashes.");
+        }
+    }
+    results = liquidCRenderBatch(*liquidRenderer, count, stores, templates, &exception);
+    free(stores);
+    if (exception != Qnil)
+        rb_exc_raise(exception);
+    return results;
+}
+
+VALUE method_liquidCSnapshotRender(VALUE self, VALUE incomingSnapshot, VALUE tmpl) {
+    VALUE str, exceptionInit[PACK_EXCEPTION_LENGTH], exception;
+    LiquidCRubySnapshotRenderer* renderer;
+    LiquidCRubySnapshot* snapshot;
+    LiquidTemplate* liquidTemplate;
+    LiquidRendererError error;
+    LiquidTemplateRender templateResult;
+    char buffer[512];
+    int j, enc;
+    TypedData_Get_Struct(self, LiquidCRubySnapshotRenderer, &liquidCSnapshotRenderer_type, renderer);
+    TypedData_Get_Struct(incomingSnapshot, LiquidCRubySnapshot, &liquidCSnapshot_type, snapshot);
+    TypedData_Get_Struct(tmpl, LiquidTemplate, &liquidCTemplate_type, liquidTemplate);
+    templateResult = liquidRendererRenderTemplate(renderer->renderer, snapshot->snapshot.snapshot, *liquidTemplate, &error);
+    liquidCFreeTemporaries(renderer);
+    if (error.type != LIQUID_RENDERER_ERROR_TYPE_NONE) {
+        liquidGetRendererErrorMessage(error, buffer, sizeof(buffer));
+        PACK_EXCEPTION(liquidCRendererError, error, exceptionInit, buffer, exception);
+        rb_exc_raise(exception);
+        return self;
+    }
+    str = rb_str_new(liquidTemplateRenderGetBuffer(templateResult), liquidTemplateRenderGetSize(templateResult));
+    liquidFreeTemplateRender(templateResult);
+    enc = rb_enc_find_index("UTF-8");
+    rb_enc_associate_index(str, enc);
+    return str;
+}
+
+VALUE method_liquidCSnapshotRenderBatch(VALUE self, VALUE snapshots, VALUE templates) {
+    LiquidCRubySnapshotRenderer* renderer;
+    LiquidCRubySnapshot* snapshot;
+    VALUE results, exception;
+    void** stores;
+    long i, count;
+    Check_Type(snapshots, T_ARRAY);
+    Check_Type(templates, T_ARRAY);
+    count = RARRAY_LEN(templates);
+    if (RARRAY_LEN(snapshots) != count)
+        rb_raise(rb_eArgError, "Batches need a snapshot for every template.");
+    liquidCCheckBatchTemplates(templates, count);
+    TypedData_Get_Struct(self, LiquidCRubySnapshotRenderer, &liquidCSnapshotRenderer_type, renderer);
+    stores = (void**)malloc(sizeof(void*)*count);
+    for (i = 0; i < count; ++i) {
+        if (!rb_obj_is_kind_of(rb_ary_entry(snapshots, i), liquidCSnapshot)) {
+            free(stores);
+            rb_raise(rb_eTypeError, "Snapshot renderers can only render snapshots.");
+        }
+        TypedData_Get_Struct(rb_ary_entry(snapshots, i), LiquidCRubySnapshot, &liquidCSnapshot_type, snapshot);
+        stores[i] = snapshot->snapshot.snapshot;
+    }
+    results = liquidCRenderBatch(renderer->renderer, count, stores, templates, &exception);
+    free(stores);
+    liquidCFreeTemporaries(renderer);
+    if (exception != Qnil)
+        rb_exc_raise(exception);
+    return results;
+}
+
 VALUE method_liquidCParserParseTemplate(int argc, VALUE* argv, VALUE self) {
     LiquidParser* parser;
     LiquidTemplate tmpl;
@@ -657,13 +1044,14 @@ static void liquidCRenderTag(LiquidRenderer renderer, LiquidNode node, void* var
     argMax = liquidGetArgumentCount(node);
     arguments[0] = (VALUE)liquidRendererGetCustomData(renderer);
     arguments[1] = LL2NUM((long long)node.node);
-    arguments[2] = (VALUE)variableStore;
+    arguments[2] = liquidCTake(renderer, variableStore);
     liquidGetChild((void**)&arguments[3], renderer, node, variableStore, 1);
+    arguments[3] = liquidCTake(renderer, (void*)arguments[3]);
     arguments[4] = rb_ary_new2(argMax);
     for (i = 0; i < argMax; ++i) {
         VALUE argument;
         liquidGetArgument((void**)&argument, renderer, node, variableStore, i);
-        rb_ary_push(arguments[4], argument);
+        rb_ary_push(arguments[4], liquidCTake(renderer, (void*)argument));
     }
     result = rb_funcallv(renderProc, rb_intern("call"), 4+argMax, arguments);
     StringValue(result);
@@ -680,17 +1068,17 @@ static void liquidCRenderFilter(LiquidRenderer renderer, LiquidNode node, void*
     arguments = rb_ary_new2(argMax+4);
     rb_ary_push(arguments, (VALUE)liquidRendererGetCustomData(renderer));
     rb_ary_push(arguments, LL2NUM((long long)node.node));
-    rb_ary_push(arguments, (VALUE)variableStore);
+    rb_ary_push(arguments, liquidCTake(renderer, variableStore));
     liquidFilterGetOperand((void**)&operand, renderer, node, variableStore);
-    rb_ary_push(arguments, operand);
+    rb_ary_push(arguments, liquidCTake(renderer, (void*)operand));
     arry = rb_ary_new2(argMax);
     for (i = 0; i < argMax; ++i) {
         liquidGetArgument((void**)&argument, renderer, node, variableStore, i);
-        rb_ary_push(arry, argument);
+        rb_ary_push(arry, liquidCTake(renderer, (void*)argument));
     }
     rb_ary_push(arguments, arry);
     result = rb_proc_call(renderProc, arguments);
-    liquidRendererSetReturnValueVariable(renderer, (void*)result);
+    liquidCSetReturnValue(renderer, result);
 }
 
 
@@ -704,15 +1092,15 @@ static void liquidCRenderBinaryInfixOperator(LiquidRenderer renderer, LiquidNode
     arguments = rb_ary_new2(argMax+3);
     rb_ary_push(arguments, (VALUE)liquidRendererGetCustomData(renderer));
     rb_ary_push(arguments, LL2NUM((long long)node.node));
-    rb_ary_push(arguments, (VALUE)variableStore);
+    rb_ary_push(arguments, liquidCTake(renderer, variableStore));
     arry = rb_ary_new2(argMax);
     for (i = 0; i < argMax; ++i) {
         liquidGetArgument((void**)&argument, renderer, node, variableStore, i);
-        rb_ary_push(arry, argument);
+        rb_ary_push(arry, liquidCTake(renderer, (void*)argument));
     }
     rb_ary_push(arguments, arry);
     result = rb_proc_call(renderProc, arguments);
-    liquidRendererSetReturnValueVariable(renderer, (void*)result);
+    liquidCSetReturnValue(renderer, result);
 }
 
 static void liquidCRenderDotFilter(LiquidRenderer renderer, LiquidNode node, void* variableStore, void* data) {
@@ -725,11 +1113,11 @@ static void liquidCRenderDotFilter(LiquidRenderer renderer, LiquidNode node, voi
     arguments = rb_ary_new2(4);
     rb_ary_push(arguments, (VALUE)liquidRendererGetCustomData(renderer));
     rb_ary_push(arguments, LL2NUM((long long)node.node));
-    rb_ary_push(arguments, (VALUE)variableStore);
-    rb_ary_push(arguments, operand);
+    rb_ary_push(arguments, liquidCTake(renderer, variableStore));
+    rb_ary_push(arguments, liquidCTake(renderer, (void*)operand));
 
     result = rb_proc_call(renderProc, arguments);
-    liquidRendererSetReturnValueVariable(renderer, (void*)result);
+    liquidCSetReturnValue(renderer, result);
 }
 
 VALUE method_liquidC_registerTag(VALUE self, VALUE symbol, VALUE type, VALUE minArguments, VALUE maxArguments, VALUE optimization, VALUE renderFunction) {
@@ -787,6 +1175,8 @@ void Init_liquidcpp() {
     liquidCParser = rb_define_class_under(liquidC, "Parser", rb_cData);
     liquidCCompiler = rb_define_class_under(liquidC, "Compiler", rb_cData);
     liquidCProgram = rb_define_class_under(liquidC, "Program", rb_cData);
+    liquidCSnapshot = rb_define_class_under(liquidC, "Snapshot", rb_cData);
+    liquidCSnapshotRenderer = rb_define_class_under(liquidC, "SnapshotRenderer", rb_cData);
 
     liquidCError = rb_define_class_under(liquidC, "Error", rb_eStandardError);
     rb_define_attr(liquidCError, "type", 1, 0);
@@ -824,8 +1214,17 @@ void Init_liquidcpp() {
     rb_define_method(liquidCRenderer, "setStrictVariables", liquidCRendererSetStrictVariables, 1);
     rb_define_method(liquidCRenderer, "setStrictFilters", liquidCRendererSetStrictFilters, 1);
     rb_define_method(liquidCRenderer, "render", method_liquidCTemplateRender, 2);
+    rb_define_method(liquidCRenderer, "renderBatch", method_liquidCTemplateRenderBatch, 2);
     rb_define_method(liquidCRenderer, "warnings", method_liquidCRendererWarnings, 0);
 
+    rb_define_alloc_func(liquidCSnapshotRenderer, liquidCSnapshotRenderer_alloc);
+    rb_define_method(liquidCSnapshotRenderer, "initialize", liquidCSnapshotRenderer_m_initialize, 1);
+    rb_define_method(liquidCSnapshotRenderer, "render", method_liquidCSnapshotRender, 2);
+    rb_define_method(liquidCSnapshotRenderer, "renderBatch", method_liquidCSnapshotRenderBatch, 2);
+
+    rb_define_alloc_func(liquidCSnapshot, liquidCSnapshot_alloc);
+    rb_define_method(liquidCSnapshot, "initialize", liquidCSnapshot_m_initialize, 1);
+
     rb_define_alloc_func(liquidCOptimizer, liquidCOptimizer_alloc);
     rb_define_method(liquidCOptimizer, "initialize", liquidCOptimizer_m_initialize, 1);
     rb_define_method(liquidCOptimizer, "optimize", method_liquidCOptimizer_optimize, 2);
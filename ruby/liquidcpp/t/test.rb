@@ -27,6 +27,13 @@ json = JSON.parse('{"product":{"id":1}}')
 
 puts "TEST1: " + renderer.render(json, tmpl)
 
+snapshotRenderer = LiquidCPP::SnapshotRenderer.new(context)
+snapshot = LiquidCPP::Snapshot.new(json)
+texts = snapshotRenderer.renderBatch([snapshot, snapshot], [tmpl, parser.parseTemplate("{{ \"a\" | test }}{{ product.id }}")])
+raise "Bad snapshot render: " + texts.to_json + "." if texts != ["1", "operanda1"]
+texts = renderer.renderBatch([json, { "product" => { "id" => 2 } }], [tmpl, tmpl])
+raise "Bad batch render: " + texts.to_json + "." if texts != ["1", "2"]
+
 
 
 text = renderer.render({ }, parser.parseTemplate("{% freetag %}"))
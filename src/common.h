@@ -5,11 +5,17 @@
 #include <unordered_set>
 #include <stack>
 #include <string>
+#include <cstring>
+#include <iterator>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <cassert>
 #include <cstdarg>
 #include <chrono>
+#include <atomic>
+#include <cstddef>
+#include <new>
 
 #include "interface.h"
 
@@ -49,6 +55,53 @@ namespace Liquid {
         }
     };
 
+    // What a render has left to spend. A renderer with limits, or a profiler, makes its own current on the thread for the length of a render,
+    // and strings, arrays and nodes charge what they take from, and give back to, the heap against whichever is current.
+    struct Budget {
+        // Counts down, once for every node rendered, or call or iteration interpreted, to the next time the renderer checks its limits.
+        // Going over maximumBytes brings that forward to the next node.
+        long long fuel = 0;
+        size_t allocations = 0;
+        // What's been allocated and not freed since the render started. Freeing what was there before can't take it below 0.
+        size_t bytes = 0;
+        size_t maximumBytes = 0;
+        // Whether bytes has gone over maximumBytes at any point; it may well be back under by the time the renderer checks.
+        bool exceeded = false;
+
+        static thread_local Budget* current;
+
+        void allocate(size_t size) {
+            ++allocations;
+            bytes += size;
+            if (maximumBytes && bytes > maximumBytes) {
+                exceeded = true;
+                fuel = 0;
+            }
+        }
+        void free(size_t size) { bytes = size < bytes ? bytes - size : 0; }
+
+        // Makes a budget current for the lifetime of the scope; a null one leaves whatever's current as it is.
+        struct Scope {
+            Budget* previous;
+
+            Scope(Budget* budget) : previous(current) {
+                if (budget)
+                    current = budget;
+            }
+            ~Scope() { current = previous; }
+        };
+    };
+    inline thread_local Budget* Budget::current = nullptr;
+
+    inline void countAllocation(size_t size) {
+        if (Budget::current)
+            Budget::current->allocate(size);
+    }
+    inline void countFree(size_t size) {
+        if (Budget::current)
+            Budget::current->free(size);
+    }
+
     // Represents the underlying variable implementation that is passed in to liquid.
     struct Variable {
         void* pointer;
@@ -70,10 +123,135 @@ namespace Liquid {
         FALSY_EMPTY_STRING      = 2,
         FALSY_NIL               = 4
     };
-    // Represents everything that can be addressed by textual liquid. A built-in type.
+    struct Variant;
+
+    // Strings of up to INLINE_SIZE bytes are kept inline. Anything longer goes in a block of its own that's never changed once it's made,
+    // and is shared between copies by reference count. Either way, they're null terminated.
+    struct String {
+        static constexpr size_t INLINE_SIZE = 15;
+
+        struct Block {
+            std::atomic<size_t> references;
+            size_t size;
+            char data[1];
+        };
+
+        // Inline, the last byte is how much room is left, so a full buffer ends with its own terminator. Otherwise, it's HEAP.
+        static constexpr unsigned char HEAP = 0xFF;
+        union {
+            char buffer[INLINE_SIZE + 1];
+            struct {
+                Block* block;
+                char unused[INLINE_SIZE - sizeof(Block*)];
+                unsigned char tag;
+            };
+        };
+
+        String() { buffer[0] = 0; tag = INLINE_SIZE; }
+        String(const char* str, size_t length) {
+            if (length <= INLINE_SIZE) {
+                memcpy(buffer, str, length);
+                buffer[length] = 0;
+                tag = INLINE_SIZE - length;
+            } else {
+                block = new(::operator new(offsetof(Block, data) + length + 1)) Block;
+                countAllocation(offsetof(Block, data) + length + 1);
+                block->references.store(1, std::memory_order_relaxed);
+                block->size = length;
+                memcpy(block->data, str, length);
+                block->data[length] = 0;
+                tag = HEAP;
+            }
+        }
+        String(std::string_view str) : String(str.data(), str.size()) { }
+        String(const String& str) {
+            memcpy(buffer, str.buffer, sizeof(buffer));
+            if (tag == HEAP)
+                block->references.fetch_add(1, std::memory_order_relaxed);
+        }
+        String(String&& str) {
+            memcpy(buffer, str.buffer, sizeof(buffer));
+            str.buffer[0] = 0;
+            str.tag = INLINE_SIZE;
+        }
+        ~String() { release(); }
+
+        String& operator = (const String& str) {
+            if (this != &str) {
+                String copy(str);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+        String& operator = (String&& str) {
+            if (this != &str) {
+                release();
+                memcpy(buffer, str.buffer, sizeof(buffer));
+                str.buffer[0] = 0;
+                str.tag = INLINE_SIZE;
+            }
+            return *this;
+        }
+
+        void release() {
+            if (tag == HEAP && block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                countFree(offsetof(Block, data) + block->size + 1);
+                block->~Block();
+                ::operator delete(block);
+            }
+        }
+
+        const char* data() const { return tag == HEAP ? block->data : buffer; }
+        const char* c_str() const { return data(); }
+        size_t size() const { return tag == HEAP ? block->size : INLINE_SIZE - tag; }
+        bool empty() const { return size() == 0; }
+        operator std::string_view() const { return std::string_view(data(), size()); }
+
+        bool operator == (std::string_view str) const { return std::string_view(*this) == str; }
+        bool operator != (std::string_view str) const { return std::string_view(*this) != str; }
+        bool operator < (std::string_view str) const { return std::string_view(*this) < str; }
+    };
+
+    // Shared between copies by reference count, and copied the first time a shared one is written to; so whatever's changed only ever
+    // belongs to the one variant. Only reserve, push_back and modify write.
+    struct Array {
+        struct Block;
+        Block* block = nullptr;
+
+        Array() { }
+        Array(const vector<Variant>& items);
+        Array(vector<Variant>&& items);
+        Array(const Array& array);
+        Array(Array&& array) : block(array.block) { array.block = nullptr; }
+        ~Array() { release(); }
+
+        Array& operator = (const Array& array);
+        Array& operator = (Array&& array);
+
+        void release();
+        // Makes sure this is the only variant with the block, so it can be written to.
+        void detach();
+
+        size_t size() const;
+        bool empty() const { return size() == 0; }
+        const Variant* begin() const;
+        const Variant* end() const;
+        std::reverse_iterator<const Variant*> rbegin() const { return std::reverse_iterator<const Variant*>(end()); }
+        std::reverse_iterator<const Variant*> rend() const { return std::reverse_iterator<const Variant*>(begin()); }
+        const Variant& operator [](size_t idx) const;
+
+        void reserve(size_t size);
+        void push_back(const Variant& variant);
+        void push_back(Variant&& variant);
+        vector<Variant>& modify();
+
+        bool operator == (const Array& array) const;
+    };
+
+    // Represents everything that can be addressed by textual liquid. A built-in type. Copies are cheap; strings and arrays are shared.
     struct Variant {
 
-        enum class Type {
+        enum class Type : unsigned char {
             NIL,
             BOOL,
             FLOAT,
@@ -90,10 +268,10 @@ namespace Liquid {
             bool b;
             double f;
             long long i;
-            string s;
+            String s;
             void* p;
             Variable v;
-            vector<Variant> a;
+            Array a;
             struct {
                 const char* view;
                 size_t len;
@@ -106,10 +284,10 @@ namespace Liquid {
         Variant(const Variant& v) : type(v.type) {
             switch (type) {
                 case Type::STRING:
-                    new(&s) std::string(v.s);
+                    new(&s) String(v.s);
                 break;
                 case Type::ARRAY:
-                    new(&a) std::vector<Variant>(v.a);
+                    new(&a) Array(v.a);
                 break;
                 case Type::STRING_VIEW:
                     view = v.view;
@@ -137,10 +315,10 @@ namespace Liquid {
         Variant(Variant&& v) : type(v.type) {
             switch (type) {
                 case Type::STRING:
-                    new(&s) std::string(std::move(v.s));
+                    new(&s) String(std::move(v.s));
                 break;
                 case Type::ARRAY:
-                    new(&a) vector<Variant>(std::move(v.a));
+                    new(&a) Array(std::move(v.a));
                 break;
                 case Type::STRING_VIEW:
                     view = v.view;
@@ -169,22 +347,27 @@ namespace Liquid {
         Variant(double f) : f(f), type(Type::FLOAT) {  }
         Variant(long long i) : i(i), type(Type::INT) { }
         Variant(const std::string& s) : s(s), type(Type::STRING) { }
-        Variant(std::string&& s) : s(std::move(s)), type(Type::STRING) { }
-        Variant(const char* s) : s(s), type(Type::STRING) { }
+        // Leaves the string empty, the same as moving it would.
+        Variant(std::string&& str) : s(std::string_view(str)), type(Type::STRING) { str.clear(); }
+        Variant(const char* s) : s(std::string_view(s)), type(Type::STRING) { }
+        Variant(const String& s) : s(s), type(Type::STRING) { }
+        Variant(String&& s) : s(std::move(s)), type(Type::STRING) { }
         Variant(const char* view, size_t len) : view(view), len(len), type(Type::STRING_VIEW) { }
         Variant(Variable v) : v(v), type(Type::VARIABLE) { }
         Variant(void* p) : p(p), type(p ? Type::POINTER : Type::NIL) { }
         Variant(std::nullptr_t) : p(nullptr), type(Type::NIL) { }
         Variant(const std::vector<Variant>& a) : a(a), type(Type::ARRAY) { }
         Variant(vector<Variant>&& a) : a(std::move(a)), type(Type::ARRAY) { }
+        Variant(const Array& a) : a(a), type(Type::ARRAY) { }
+        Variant(Array&& a) : a(std::move(a)), type(Type::ARRAY) { }
 
         ~Variant() {
             switch (type) {
                 case Type::STRING:
-                    s.~string();
+                    s.~String();
                 break;
                 case Type::ARRAY:
-                    a.~vector<Variant>();
+                    a.~Array();
                 break;
                 default:
                 break;
@@ -205,84 +388,40 @@ namespace Liquid {
                     return !(falsiness & FALSY_NIL);
                 case Variant::Type::STRING:
                     return !((falsiness & FALSY_EMPTY_STRING) && s.size() == 0);
+                case Variant::Type::STRING_VIEW:
+                    return !((falsiness & FALSY_EMPTY_STRING) && len == 0);
                 default:
                     return true;
             }
             return true;
         }
 
+        // Whatever's being assigned can be part of this variant, like one of its elements, so it's taken first.
         Variant& operator = (const Variant& v) {
-            switch (v.type) {
-                case Type::STRING:
-                    if (type != Type::STRING) {
-                        if (v.type == Type::ARRAY)
-                            a.~vector<Variant>();
-                        else
-                            i = 0;
-                        new(&s) string;
-                    }
-                    s = v.s;
-                break;
-                case Type::ARRAY:
-                    if (type != Type::ARRAY) {
-                        if (v.type == Type::STRING)
-                            s.~string();
-                        else
-                            i = 0;
-                        new(&a) vector<Variant>();
-                    }
-                    a = v.a;
-                break;
-                case Type::STRING_VIEW:
-                    view = v.view;
-                    len = v.len;
-                break;
-                default:
-                    f = v.f;
-                break;
+            if (this != &v) {
+                Variant copy(v);
+                this->~Variant();
+                new(this) Variant(std::move(copy));
             }
             return *this;
         }
 
         Variant& operator = (Variant&& v) {
-            switch (v.type) {
-                case Type::STRING:
-                    if (type != Type::STRING) {
-                        if (v.type == Type::ARRAY)
-                            a.~vector<Variant>();
-                        else
-                            i = 0;
-                        new(&s) string;
-                    }
-                    s = move(v.s);
-                break;
-                case Type::ARRAY:
-                    if (type != Type::ARRAY) {
-                        if (v.type == Type::STRING)
-                            s.~string();
-                        else
-                            i = 0;
-                        new(&a) vector<Variant>();
-                    }
-                    a = move(v.a);
-                break;
-                case Type::STRING_VIEW:
-                    view = v.view;
-                    len = v.len;
-                break;
-                default:
-                    f = v.f;
-                break;
+            if (this != &v) {
+                Variant moved(std::move(v));
+                this->~Variant();
+                new(this) Variant(std::move(moved));
             }
             return *this;
         }
 
         bool operator == (const Variant& v) const {
+            // Borrowed strings are the same as any other.
+            if (isString() && v.isString())
+                return getStringView() == v.getStringView();
             if (type != v.type)
                 return false;
             switch (type) {
-                case Type::STRING:
-                    return s == v.s;
                 case Type::INT:
                     return i == v.i;
                 case Type::ARRAY:
@@ -300,11 +439,18 @@ namespace Liquid {
         bool isNumeric() const {
             return type == Type::INT || type == Type::FLOAT;
         }
+        bool isString() const {
+            return type == Type::STRING || type == Type::STRING_VIEW;
+        }
+        // Either kind of string, without copying it.
+        std::string_view getStringView() const {
+            return type == Type::STRING ? std::string_view(s) : std::string_view(view, len);
+        }
 
         string getString() const {
             switch (type) {
                 case Type::STRING:
-                    return s;
+                    return string(s.data(), s.size());
                 case Type::STRING_VIEW:
                     return string(view, len);
                 case Type::FLOAT: {
@@ -333,7 +479,7 @@ namespace Liquid {
                 case Type::STRING:
                     return atoll(s.c_str());
                 case Type::STRING_VIEW:
-                    return atoll(view);
+                    return atoll(string(view, len).c_str());
                 default:
                     return 0;
             }
@@ -348,7 +494,7 @@ namespace Liquid {
                 case Type::STRING:
                     return atof(s.c_str());
                 case Type::STRING_VIEW:
-                    return atof(view);
+                    return atof(string(view, len).c_str());
                 default:
                     return 0.0;
             }
@@ -358,9 +504,8 @@ namespace Liquid {
         size_t hash() const {
             switch (type) {
                 case Type::STRING:
-                    return std::hash<string>{}(s);
                 case Type::STRING_VIEW:
-                    return std::hash<string>{}(getString());
+                    return std::hash<std::string_view>{}(getStringView());
                 case Type::INT:
                     return std::hash<long long>{}(i);
                 case Type::ARRAY:
@@ -385,12 +530,10 @@ namespace Liquid {
                     return f < v.getFloat();
                 break;
                 case Type::STRING:
-                    if (v.type == Type::STRING)
-                        return s < v.s;
-                    return s < v.getString();
-                break;
                 case Type::STRING_VIEW:
-                    return v.getString() < string(view, len);
+                    if (v.isString())
+                        return getStringView() < v.getStringView();
+                    return getStringView() < v.getString();
                 break;
                 default:
                     return p < v.p;
@@ -400,12 +543,211 @@ namespace Liquid {
         }
     };
 
+    struct Array::Block {
+        std::atomic<size_t> references;
+        vector<Variant> items;
+        // What's been counted against the budget for the block and its items; brought up to date when the items grow, bar through modify.
+        size_t charged;
+
+        Block(const vector<Variant>& items) : references(1), items(items) { charge(); }
+        Block(vector<Variant>&& items) : references(1), items(std::move(items)) { charge(); }
+        ~Block() { countFree(charged); }
+
+        void charge() {
+            charged = sizeof(Block) + items.capacity() * sizeof(Variant);
+            countAllocation(charged);
+        }
+        void recharge() {
+            size_t size = sizeof(Block) + items.capacity() * sizeof(Variant);
+            if (size != charged) {
+                countFree(charged);
+                countAllocation(size);
+                charged = size;
+            }
+        }
+    };
+
+    inline Array::Array(const vector<Variant>& items) : block(new Block(items)) { }
+    inline Array::Array(vector<Variant>&& items) : block(new Block(std::move(items))) { }
+    inline Array::Array(const Array& array) : block(array.block) {
+        if (block)
+            block->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    inline Array& Array::operator = (const Array& array) {
+        if (this != &array) {
+            Array copy(array);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+    inline Array& Array::operator = (Array&& array) {
+        if (this != &array) {
+            // The block being let go of could be what's holding the one being taken.
+            Block* taken = array.block;
+            array.block = nullptr;
+            release();
+            block = taken;
+        }
+        return *this;
+    }
+    inline void Array::release() {
+        if (block && block->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete block;
+        block = nullptr;
+    }
+    inline void Array::detach() {
+        if (!block)
+            block = new Block(vector<Variant>());
+        else if (block->references.load(std::memory_order_acquire) > 1) {
+            Block* copy = new Block(block->items);
+            release();
+            block = copy;
+        }
+    }
+    inline size_t Array::size() const { return block ? block->items.size() : 0; }
+    inline const Variant* Array::begin() const { return block ? block->items.data() : nullptr; }
+    inline const Variant* Array::end() const { return block ? block->items.data() + block->items.size() : nullptr; }
+    inline const Variant& Array::operator [](size_t idx) const { return block->items[idx]; }
+    inline void Array::reserve(size_t size) { detach(); block->items.reserve(size); block->recharge(); }
+    inline void Array::push_back(const Variant& variant) {
+        detach();
+        block->items.push_back(variant);
+        block->recharge();
+    }
+    inline void Array::push_back(Variant&& variant) {
+        detach();
+        block->items.push_back(std::move(variant));
+        block->recharge();
+    }
+    inline vector<Variant>& Array::modify() { detach(); return block->items; }
+    inline bool Array::operator == (const Array& array) const {
+        if (block == array.block)
+            return true;
+        if (size() != array.size())
+            return false;
+        for (size_t i = 0; i < size(); ++i) {
+            if (!((*this)[i] == array[i]))
+                return false;
+        }
+        return true;
+    }
+
     struct NodeType;
 
+    // Nodes allocated while an arena is active are bump-allocated out of its chunks, rather than one by one from the heap. This keeps the nodes
+    // of a template together in memory, and makes deleting them no more than a decrement; the chunks are all released at once when the last node
+    // allocated from them is destroyed. Every block is prefixed with the arena it came from (or nullptr for the heap), so nodes from different
+    // arenas can be freely mixed in the same tree.
+    struct NodeArena {
+        static constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+        struct Chunk {
+            Chunk* next;
+            size_t size;
+        };
+        static_assert(sizeof(Chunk) <= HEADER_SIZE, "chunk headers have to fit before the first block");
+
+        Chunk* chunks = nullptr;
+        char* head = nullptr;
+        char* end = nullptr;
+        size_t chunkSize;
+        // One for the scope that created it, and one for every live node.
+        std::atomic<size_t> references;
+
+        static thread_local NodeArena* current;
+
+        NodeArena(size_t chunkSize) : chunkSize(chunkSize), references(1) { }
+        NodeArena(const NodeArena&) = delete;
+        ~NodeArena() {
+            while (chunks) {
+                Chunk* next = chunks->next;
+                countFree(chunks->size);
+                free(chunks);
+                chunks = next;
+            }
+        }
+
+        void* allocate(size_t size) {
+            size = HEADER_SIZE + ((size + HEADER_SIZE - 1) & ~(HEADER_SIZE - 1));
+            if ((size_t)(end - head) < size) {
+                size_t allocation = std::max(chunkSize, size + HEADER_SIZE);
+                Chunk* chunk = (Chunk*)malloc(allocation);
+                if (!chunk)
+                    throw std::bad_alloc();
+                countAllocation(allocation);
+                chunk->next = chunks;
+                chunk->size = allocation;
+                chunks = chunk;
+                head = (char*)chunk + HEADER_SIZE;
+                end = (char*)chunk + allocation;
+            }
+            char* block = head;
+            head += size;
+            *(NodeArena**)block = this;
+            ++references;
+            return block + HEADER_SIZE;
+        }
+
+        void release() {
+            if (--references == 0)
+                delete this;
+        }
+
+        static void* allocateBlock(size_t size) {
+            if (current)
+                return current->allocate(size);
+            char* block = (char*)malloc(size + HEADER_SIZE);
+            if (!block)
+                throw std::bad_alloc();
+            countAllocation(size + HEADER_SIZE);
+            *(NodeArena**)block = nullptr;
+            return block + HEADER_SIZE;
+        }
+
+        static void freeBlock(void* pointer, size_t size) {
+            if (!pointer)
+                return;
+            char* block = (char*)pointer - HEADER_SIZE;
+            NodeArena* arena = *(NodeArena**)block;
+            if (arena)
+                arena->release();
+            else {
+                countFree(size + HEADER_SIZE);
+                free(block);
+            }
+        }
+
+        // Makes a new arena current for the lifetime of the scope. A chunk size of 0 means no arena; nodes come from the heap.
+        struct Scope {
+            NodeArena* previous;
+            NodeArena* arena;
+
+            Scope(size_t chunkSize) : previous(current), arena(chunkSize > 0 ? new NodeArena(chunkSize) : nullptr) {
+                current = arena;
+            }
+            ~Scope() {
+                current = previous;
+                if (arena)
+                    arena->release();
+            }
+        };
+    };
+    inline thread_local NodeArena* NodeArena::current = nullptr;
+
     struct Node {
         const NodeType* type;
         size_t line;
         size_t column;
+        union {
+            // For string literals that are part of a variable's path; the liquidHashKey of the string, worked out by the parser. 0 otherwise.
+            size_t keyHash = 0;
+            // For variables that name the variable of a loop they're in, or its forloop; one more than where the loop puts it in the
+            // renderer's slots, worked out by the parser. 0 otherwise.
+            size_t slot;
+        };
+
+        static void* operator new(size_t size) { return NodeArena::allocateBlock(size); }
+        static void operator delete(void* pointer, size_t size) { NodeArena::freeBlock(pointer, size); }
 
         union {
             Variant variant;
@@ -414,7 +756,7 @@ namespace Liquid {
 
         Node() : type(nullptr), line(0), column(0), variant() { }
         Node(const NodeType* type) : type(type), line(0), column(0), children() { }
-        Node(const Node& node) :type(node.type), line(node.line), column(node.column) {
+        Node(const Node& node) :type(node.type), line(node.line), column(node.column), keyHash(node.keyHash) {
             if (type) {
                 new(&children) vector<unique_ptr<Node>>();
                 children.reserve(node.children.size());
@@ -426,7 +768,7 @@ namespace Liquid {
         }
         Node(const Variant& v) : type(nullptr), line(0), column(0), variant(v) { }
         Node(Variant&& v) : type(nullptr), line(0), column(0), variant(std::move(v)) { }
-        Node(Node&& node) :type(node.type), line(node.line), column(node.column) {
+        Node(Node&& node) :type(node.type), line(node.line), column(node.column), keyHash(node.keyHash) {
             if (type) {
                 new(&children) vector<unique_ptr<Node>>(std::move(node.children));
             } else {
@@ -445,23 +787,18 @@ namespace Liquid {
             return variant.getString();
         }
 
+        // Copies first, so that copying one of your own descendants into yourself works.
         Node& operator = (const Node& n) {
-            if (type)
-                children.~vector<unique_ptr<Node>>();
-            if (n.type) {
-                new(&children) vector<unique_ptr<Node>>();
-                children.reserve(n.children.size());
-                for (auto it = n.children.begin(); it != n.children.end(); ++it)
-                    children.push_back(make_unique<Node>(*it->get()));
-            } else {
-                new(&variant) Variant();
+            if (this != &n) {
+                Node copy(n);
+                *this = move(copy);
             }
-            type = n.type;
             return *this;
         }
 
         // This is more complicated, because of the case where you move one of your children into yourself.
         Node& operator = (Node&& n) {
+            size_t hash = n.keyHash;
             if (type) {
                 if (!n.type) {
                     Variant v = move(n.variant);
@@ -473,8 +810,7 @@ namespace Liquid {
                     children = move(n.children);
                 }
             } else {
-                if (type)
-                    children.~vector<unique_ptr<Node>>();
+                variant.~Variant();
                 if (n.type) {
                     new(&children) vector<unique_ptr<Node>>();
                     children = move(n.children);
@@ -483,6 +819,7 @@ namespace Liquid {
                 }
                 type = n.type;
             }
+            keyHash = hash;
             return *this;
         }
 
@@ -526,6 +863,11 @@ namespace Liquid {
         void* userData = nullptr;
         LiquidRenderFunction userRenderFunction = nullptr;
         LiquidCompileFunction userCompileFunction = nullptr;
+        // Whether operands and arguments can be handed over as views of the variable resolver's strings; otherwise they're copied first.
+        bool borrowsStrings = false;
+        // Set by tags that read, and can write, variables that aren't anywhere in their tree, like include with its partial. The optimizer
+        // never renders out a branch with one in it, or hoists anything out of a loop that has one.
+        bool opaque = false;
 
         NodeType(Type type, string symbol = "", int maxChildren = -1, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : type(type), symbol(symbol), maxChildren(maxChildren), optimization(optimization) { }
         NodeType(const NodeType&) = default;
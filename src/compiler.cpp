@@ -1,8 +1,23 @@
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "compiler.h"
 #include "context.h"
+#include "parser.h"
+#include "cppvariable.h"
+
+// Computed goto is a GCC extension, which clang supports as well; anything else dispatches through the switch, as does defining
+// LIQUID_INTERPRETER_SWITCH_DISPATCH.
+#if defined(__GNUC__) && !defined(LIQUID_INTERPRETER_SWITCH_DISPATCH)
+    #define LIQUID_INTERPRETER_COMPUTED_GOTO
+#endif
 
 namespace Liquid {
 
@@ -13,21 +28,13 @@ namespace Liquid {
     // 4/12 bytes per instruction total.
 
     // This should probably be changed out, but am super lazy at present.
-    size_t hash(const char* s, int len) {
-        size_t h = 5381;
-        int c;
-        const char* end = s + len;
-        while (((c = *s++) && s <= end))
-            h = ((h << 5) + h) + c;
-        return h;
-    }
-
     size_t operandSize(OPCode opcode) {
         switch (opcode) {
             case OP_EXIT:
             case OP_OUTPUT:
             case OP_ADD:
             case OP_SUB:
+            case OP_MOD:
             case OP_PUSH:
             case OP_MOVNIL:
             case OP_INVERT:
@@ -40,6 +47,23 @@ namespace Liquid {
         }
     }
 
+    // Anything whose operand is an offset into the code.
+    bool isJump(OPCode opcode) {
+        switch (opcode) {
+            case OP_JMP:
+            case OP_JMPFALSE:
+            case OP_JMPTRUE:
+            case OP_EQLJMPFALSE:
+            case OP_EQLJMPTRUE:
+            case OP_LOOP:
+            case OP_ITERATE:
+            case OP_BREAK:
+                return true;
+            default:
+                return false;
+        }
+    }
+
     const char* getSymbolicOpcode(OPCode opcode) {
         switch (opcode) {
             case OP_MOV:
@@ -64,6 +88,8 @@ namespace Liquid {
                 return "OP_ADD";
             case OP_SUB:
                 return "OP_SUB";
+            case OP_MOD:
+                return "OP_MOD";
             case OP_LENGTH:
                 return "OP_LENGTH";
             case OP_EQL:
@@ -80,12 +106,22 @@ namespace Liquid {
                 return "OP_JMPFALSE";
             case OP_JMPTRUE:
                 return "OP_JMPTRUE";
+            case OP_EQLJMPFALSE:
+                return "OP_EQLJMPFALSE";
+            case OP_EQLJMPTRUE:
+                return "OP_EQLJMPTRUE";
             case OP_CALL:
                 return "OP_CALL";
             case OP_RESOLVE:
                 return "OP_RESOLVE";
+            case OP_RESOLVEPATH:
+                return "OP_RESOLVEPATH";
+            case OP_LOOP:
+                return "OP_LOOP";
             case OP_ITERATE:
                 return "OP_ITERATE";
+            case OP_BREAK:
+                return "OP_BREAK";
             case OP_INVERT:
                 return "OP_INVERT";
             case OP_PUSHBUFFER:
@@ -99,21 +135,24 @@ namespace Liquid {
         return nullptr;
     }
 
+    // Strings in the data segment are their liquidHashKey, their length, and then the string, null terminated, padded out to 8 bytes.
+    // Offsets point at the length; the hash is there for anything that looks the string up as a key.
     int Compiler::add(const char* str, int len) {
-        size_t hashValue = hash(str, len);
-        auto it = existingStrings.emplace(hashValue, data.size());
-        if (it.second) {
-            int offset = data.size();
-            int size = sizeof(len) + len + 1;
-            // Align on a 4 byte boundary.
-            data.resize(offset + size + ((offset + size) % 4));
-            *((int*)&data[offset]) = len;
-            memcpy(&data[offset+sizeof(int)], str, len);
-            data[offset+len+sizeof(int)] = 0;
-            return offset;
-        } else {
-            return it.first->second;
-        }
+        size_t hash = liquidHashKey(str, len);
+        auto it = existingStrings.find(hash);
+        if (it != existingStrings.end() && *(int*)&data[it->second] == len && memcmp(&data[it->second + sizeof(int)], str, len) == 0)
+            return it->second;
+        int start = data.size();
+        int size = sizeof(hash) + sizeof(len) + len + 1;
+        data.resize(start + size + (8 - (start + size) % 8) % 8);
+        int offset = start + sizeof(hash);
+        memcpy(&data[start], &hash, sizeof(hash));
+        memcpy(&data[offset], &len, sizeof(len));
+        memcpy(&data[offset+sizeof(int)], str, len);
+        data[offset+len+sizeof(int)] = 0;
+        // Collisions just get their own copy.
+        existingStrings.emplace(hash, offset);
+        return offset;
     }
 
     int Compiler::add(OPCode opcode, int target) {
@@ -124,6 +163,15 @@ namespace Liquid {
         return offset;
     }
 
+    int Compiler::add(OPCode opcode, int target, long long operand) {
+        int offset = code.size();
+        code.resize(offset + sizeof(int) + sizeof(long long));
+        *((int*)&code[offset]) = (opcode & 0xFF) | ((target << 8) & 0xFFFF00);
+        *((long long*)&code[offset+sizeof(int)]) = operand;
+        assert(operandSize(opcode));
+        return offset;
+    }
+
     int Compiler::addPush(int target) {
         int offset = add(OP_PUSH, target);
         stackSize++;
@@ -136,15 +184,67 @@ namespace Liquid {
         return offset;
     }
 
-    int Compiler::add(OPCode opcode, int target, long long operand) {
-        int offset = code.size();
-        code.resize(offset + sizeof(int) + sizeof(long long));
-        *((int*)&code[offset]) = (opcode & 0xFF) | ((target << 8) & 0xFFFF00);
-        *((long long*)&code[offset+sizeof(int)]) = operand;
-        assert(operandSize(opcode));
+    int Compiler::addSymbol(const NodeType* type) {
+        auto it = symbolIndices.find(type);
+        if (it == symbolIndices.end()) {
+            it = symbolIndices.emplace(type, (int)symbols.size()).first;
+            symbols.push_back(type);
+        }
+        return it->second;
+    }
+
+    int Compiler::addCall(const NodeType* type, int arguments) {
+        // The high half of the operand is where in the source the call was compiled from, for profiling; 20 bits of line, and 12 of column.
+        unsigned long long position = 0;
+        if (compiling)
+            position = (std::min<unsigned long long>(compiling->line, 0xFFFFF) << 12) | std::min<unsigned long long>(compiling->column, 0xFFF);
+        int offset = add(OP_CALL, arguments, (long long)((position << 32) | (unsigned int)addSymbol(type)));
+        stackSize -= arguments;
         return offset;
     }
 
+    void Compiler::addResolve(const Node& variableNode, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            const Node& part = *variableNode.children[i].get();
+            if (i == 0) {
+                compileBranch(part);
+                add(OP_RESOLVE, 0x0, -1);
+            } else if (!part.type) {
+                add(OP_MOV, 0x0, 0x1);
+                compileBranch(part);
+                add(OP_RESOLVE, 0x0, 0x1);
+            } else {
+                // Working out the key could use any of the registers, so the context waits on the stack.
+                addPush(0x0);
+                compileBranch(part);
+                add(OP_STACK, 0x1, -1);
+                addPop(1);
+                add(OP_RESOLVE, 0x0, 0x1);
+            }
+        }
+    }
+
+    void Compiler::addAssignment(const Node& variableNode) {
+        // Everything up to the last part of the name is the hash or array being assigned into. That goes on the stack, then the key goes into 0x0.
+        size_t parts = variableNode.children.size();
+        assert(parts > 0);
+        if (parts > 1) {
+            addResolve(variableNode, 0, parts - 1);
+            addPush(0x0);
+        }
+        compileBranch(*variableNode.children[parts - 1].get());
+        if (parts > 1) {
+            add(OP_STACK, 0x1, -1);
+            add(OP_STACK, 0x2, -2);
+            add(OP_ASSIGN, 0x1, 0x2);
+            addPop(2);
+        } else {
+            add(OP_STACK, 0x2, -1);
+            add(OP_ASSIGN, 0x0, 0x2);
+            addPop(1);
+        }
+    }
+
     void Compiler::modify(int offset, OPCode opcode, int target, long long operand) {
         *((int*)&code[offset]) = (opcode & 0xFF) | ((target << 8) & 0xFFFF00);
         *((long long*)&code[offset+sizeof(int)]) = operand;
@@ -165,62 +265,95 @@ namespace Liquid {
         int offset = code.size();
         if (!branch.type) {
             switch (branch.variant.type) {
-                case Variant::Type::STRING: {
-                    add(OP_MOVSTR, freeRegister, add(branch.variant.s.data(), branch.variant.s.size()));
-                    ++freeRegister;
-                } break;
-                case Variant::Type::INT: {
-                    add(OP_MOVINT, freeRegister, branch.variant.i);
-                    ++freeRegister;
-                } break;
-                case Variant::Type::NIL: {
-                    add(OP_MOVNIL, freeRegister);
-                    ++freeRegister;
-                } break;
+                case Variant::Type::STRING:
+                    add(OP_MOVSTR, 0x0, add(branch.variant.s.data(), branch.variant.s.size()));
+                break;
+                case Variant::Type::STRING_VIEW:
+                    add(OP_MOVSTR, 0x0, add(branch.variant.view, branch.variant.len));
+                break;
+                case Variant::Type::INT:
+                    add(OP_MOVINT, 0x0, branch.variant.i);
+                break;
+                case Variant::Type::BOOL:
+                    add(OP_MOVBOOL, 0x0, branch.variant.b ? 1 : 0);
+                break;
                 case Variant::Type::FLOAT: {
-                    // Intentionally i.
-                    add(OP_MOVFLOAT, freeRegister, branch.variant.i);
-                    ++freeRegister;
+                    long long operand;
+                    memcpy(&operand, &branch.variant.f, sizeof(double));
+                    add(OP_MOVFLOAT, 0x0, operand);
                 } break;
+                case Variant::Type::ARRAY:
+                    // Arrays the optimizer has folded into a literal are rebuilt the same way [] literals are.
+                    for (auto it = branch.variant.a.rbegin(); it != branch.variant.a.rend(); ++it) {
+                        compileBranch(Node(*it));
+                        addPush(0x0);
+                    }
+                    addCall(context.getArrayLiteralNodeType(), branch.variant.a.size());
+                break;
                 default:
-                    assert(false);
+                    // Pointers and variables only exist at render time.
+                    add(OP_MOVNIL, 0x0);
                 break;
             }
         } else {
+            const Node* parent = compiling;
+            compiling = &branch;
             branch.type->compile(*this, branch);
+            compiling = parent;
+        }
+        return offset;
+    }
+
+    int Compiler::compileBody(const Node& body) {
+        int offset = code.size();
+        if (body.type)
+            compileBranch(body);
+        else if (body.variant.type == Variant::Type::STRING)
+            add(OP_OUTPUTMEM, 0x0, add(body.variant.s.data(), body.variant.s.size()));
+        else if (body.variant.type != Variant::Type::NIL) {
+            compileBranch(body);
+            add(OP_OUTPUT, 0x0);
         }
         return offset;
     }
 
     Program Compiler::compile(const Node& tmpl) {
         Program program;
-        freeRegister = 0;
         stackSize = 0;
         data.clear();
         code.clear();
         existingStrings.clear();
+        symbols.clear();
+        symbolIndices.clear();
+        dropFrames.clear();
+        loops.clear();
+        compiling = nullptr;
 
         compileBranch(tmpl);
+        // Templates optimized all the way down to a literal leave it in 0x0, like any other expression.
+        if (!tmpl.type)
+            add(OP_OUTPUT, 0x0);
+        assert(stackSize == 0);
 
         add(OP_EXIT, 0x0);
+        if (peepholeOptimization)
+            peephole();
         program.code.resize(code.size() + data.size());
         memcpy(&program.code[0], data.data(), data.size());
         program.codeOffset = data.size();
         memcpy(&program.code[program.codeOffset], code.data(), code.size());
-        // Go and adjust the JMPs to JMP to the appropriate offsets now that we've shoved the data above.
+        program.symbols = symbols;
+        // Go and adjust the JMPs to JMP to the appropriate offsets now that we've shoved the data above, and hand out the inline caches.
         unsigned int i = program.codeOffset;
         while (i < program.code.size()) {
             OPCode instruction = (OPCode)((*(unsigned int*)&program.code[i]) & 0xFF);
             i += sizeof(unsigned int);
-            switch (instruction) {
-                case OP_JMP:
-                case OP_JMPFALSE:
-                case OP_JMPTRUE:
-                case OP_ITERATE:
-                    *((long long*)&program.code[i]) += program.codeOffset;
-                break;
-                default:
-                break;
+            if (isJump(instruction))
+                *((long long*)&program.code[i]) += program.codeOffset;
+            if (instruction == OP_RESOLVE || instruction == OP_RESOLVEPATH) {
+                long long& operand = *((long long*)&program.code[i]);
+                operand = ((long long)program.inlineCaches << 32) | (unsigned int)operand;
+                program.inlineCaches += instruction == OP_RESOLVE ? 1 : *(unsigned int*)&program.code[(unsigned int)operand] / sizeof(int);
             }
             if (operandSize(instruction))
                 i += sizeof(long long);
@@ -228,37 +361,408 @@ namespace Liquid {
         return program;
     }
 
+    // Runs over the code before it's relocated, so jumps are still offsets into `code`, and anything it needs can still go into the data segment.
+    // Fusing instructions assumes what the compiler guarantees; 0x0 is always written before it's read within a statement, so nothing
+    // looks at what an OP_OUTPUT has just written out, and the other registers are scratch.
+    void Compiler::peephole() {
+        struct Instruction {
+            OPCode opcode;
+            unsigned int target;
+            long long operand;
+            int offset;
+            bool removed;
+        };
+        vector<Instruction> instructions;
+        unordered_map<int, size_t> indices;
+        for (size_t i = 0; i < code.size(); ) {
+            unsigned int word = *(unsigned int*)&code[i];
+            Instruction instruction = { (OPCode)(word & 0xFF), word >> 8, 0, (int)i, false };
+            i += sizeof(unsigned int);
+            if (operandSize(instruction.opcode)) {
+                memcpy(&instruction.operand, &code[i], sizeof(long long));
+                i += sizeof(long long);
+            }
+            indices[instruction.offset] = instructions.size();
+            instructions.push_back(instruction);
+        }
+        // How many jumps that haven't been removed go to each offset; kept up to date as jumps are removed, fused and threaded.
+        vector<int> jumpsTo(code.size() + 1, 0);
+        for (auto& instruction : instructions) {
+            if (isJump(instruction.opcode))
+                ++jumpsTo[instruction.operand];
+        }
+        auto isTarget = [&jumpsTo](int offset) { return jumpsTo[offset] > 0; };
+        auto remove = [&jumpsTo](Instruction& instruction) {
+            if (isJump(instruction.opcode))
+                --jumpsTo[instruction.operand];
+            instruction.removed = true;
+        };
+        auto retarget = [&jumpsTo](Instruction& instruction, long long operand) {
+            --jumpsTo[instruction.operand];
+            ++jumpsTo[operand];
+            instruction.operand = operand;
+        };
+        // The instruction that actually runs after idx, if it is removed.
+        auto next = [&instructions](size_t idx) {
+            while (idx < instructions.size() && instructions[idx].removed)
+                ++idx;
+            return idx;
+        };
+        auto getString = [this](long long offset) {
+            return string((const char*)&data[offset + sizeof(int)], *(int*)&data[offset]);
+        };
+
+        // Superinstructions; only ever fuse onto an instruction that nothing jumps into the middle of.
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            Instruction& instruction = instructions[i];
+            if (instruction.removed)
+                continue;
+            size_t j = next(i + 1);
+            if (j >= instructions.size() || isTarget(instructions[j].offset))
+                continue;
+            Instruction& following = instructions[j];
+            if (instruction.opcode == OP_MOVSTR && following.opcode == OP_OUTPUT && following.target == instruction.target) {
+                instruction = { OP_OUTPUTMEM, 0x0, instruction.operand, instruction.offset, false };
+                remove(following);
+                // Goes back over any output just before it, so that it can be joined onto that.
+                size_t previous = i;
+                while (previous > 0 && instructions[previous - 1].removed)
+                    --previous;
+                i = previous > 0 && !isTarget(instruction.offset) && instructions[previous - 1].opcode == OP_OUTPUTMEM ? previous - 2 : i - 1;
+            } else if (instruction.opcode == OP_OUTPUTMEM && following.opcode == OP_OUTPUTMEM) {
+                // The whole run at once, so that it's only joined, and added to the data segment, the once.
+                string joined = getString(instruction.operand);
+                for (size_t k = j; k < instructions.size() && instructions[k].opcode == OP_OUTPUTMEM && !isTarget(instructions[k].offset); k = next(k + 1)) {
+                    joined += getString(instructions[k].operand);
+                    remove(instructions[k]);
+                }
+                instruction.operand = add(joined.data(), joined.size());
+                --i;
+            } else if (instruction.opcode == OP_EQL && (following.opcode == OP_JMPFALSE || following.opcode == OP_JMPTRUE) && following.target == 0) {
+                OPCode fused = following.opcode == OP_JMPFALSE ? OP_EQLJMPFALSE : OP_EQLJMPTRUE;
+                long long operand = following.operand;
+                remove(following);
+                instruction = { fused, instruction.target, operand, instruction.offset, false };
+                ++jumpsTo[operand];
+            } else if (instruction.opcode == OP_MOVSTR && instruction.target == 0 && following.opcode == OP_RESOLVE && following.target == 0 && following.operand == -1) {
+                // Lookups of literal keys from the top-level store; a.b.c is MOVSTR, RESOLVE, and then MOV, MOVSTR, RESOLVE for each further key.
+                vector<int> path = { (int)instruction.operand };
+                remove(following);
+                for (size_t k = next(j + 1); k < instructions.size(); k = next(k + 1)) {
+                    size_t keyIdx = next(k + 1);
+                    size_t resolveIdx = keyIdx < instructions.size() ? next(keyIdx + 1) : instructions.size();
+                    if (resolveIdx >= instructions.size())
+                        break;
+                    Instruction& move = instructions[k];
+                    Instruction& key = instructions[keyIdx];
+                    Instruction& resolve = instructions[resolveIdx];
+                    if (move.opcode != OP_MOV || move.target != 0 || move.operand != 1 || key.opcode != OP_MOVSTR || key.target != 0 || resolve.opcode != OP_RESOLVE || resolve.target != 0 || resolve.operand != 1)
+                        break;
+                    if (isTarget(move.offset) || isTarget(key.offset) || isTarget(resolve.offset))
+                        break;
+                    path.push_back(key.operand);
+                    remove(move);
+                    remove(key);
+                    remove(resolve);
+                }
+                instruction = { OP_RESOLVEPATH, 0x0, add((const char*)path.data(), path.size() * sizeof(int)), instruction.offset, false };
+            }
+        }
+
+        // Jumps; thread them through unconditional jumps, drop the ones that go to the next instruction anyway, and anything that can't be reached.
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = 0; i < instructions.size(); ++i) {
+                Instruction& instruction = instructions[i];
+                if (instruction.removed || !isJump(instruction.opcode) || instruction.opcode == OP_BREAK || instruction.opcode == OP_LOOP || instruction.opcode == OP_ITERATE)
+                    continue;
+                for (int hops = 0; hops < 8; ++hops) {
+                    size_t destination = next(indices[instruction.operand]);
+                    if (destination >= instructions.size() || instructions[destination].opcode != OP_JMP || instructions[destination].operand == instruction.operand)
+                        break;
+                    retarget(instruction, instructions[destination].operand);
+                    changed = true;
+                }
+                // Only plain jumps; the fused ones still have to compare.
+                if ((instruction.opcode == OP_JMP || instruction.opcode == OP_JMPFALSE || instruction.opcode == OP_JMPTRUE) && next(indices[instruction.operand]) == next(i + 1)) {
+                    remove(instruction);
+                    changed = true;
+                }
+            }
+            for (size_t i = 0; i < instructions.size(); ++i) {
+                if (instructions[i].removed || (instructions[i].opcode != OP_JMP && instructions[i].opcode != OP_BREAK))
+                    continue;
+                for (size_t j = i + 1; j < instructions.size() && instructions[j].opcode != OP_EXIT && !isTarget(instructions[j].offset); ++j) {
+                    if (!instructions[j].removed) {
+                        remove(instructions[j]);
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        // Lay it all back out; jumps to anything that was removed go to whatever's run in its place.
+        vector<int> offsets(instructions.size() + 1);
+        int offset = 0;
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            offsets[i] = offset;
+            if (!instructions[i].removed)
+                offset += sizeof(unsigned int) + (operandSize(instructions[i].opcode) ? sizeof(long long) : 0);
+        }
+        offsets[instructions.size()] = offset;
+
+        // The data segment's rebuilt out of only the strings that are still used; those that were joined into others, or only used by
+        // code that's been removed, are left behind.
+        vector<unsigned char> previous;
+        previous.swap(data);
+        existingStrings.clear();
+        unordered_map<long long, int> kept;
+        auto keep = [&](long long offset) {
+            auto it = kept.find(offset);
+            if (it != kept.end())
+                return it->second;
+            return kept[offset] = add((const char*)&previous[offset + sizeof(int)], *(int*)&previous[offset]);
+        };
+        for (auto& instruction : instructions) {
+            if (instruction.removed)
+                continue;
+            if (instruction.opcode == OP_MOVSTR || instruction.opcode == OP_OUTPUTMEM) {
+                instruction.operand = keep(instruction.operand);
+            } else if (instruction.opcode == OP_RESOLVEPATH) {
+                vector<int> path(*(int*)&previous[instruction.operand] / sizeof(int));
+                memcpy(path.data(), &previous[instruction.operand + sizeof(int)], path.size() * sizeof(int));
+                for (auto& key : path)
+                    key = keep(key);
+                instruction.operand = add((const char*)path.data(), path.size() * sizeof(int));
+            }
+        }
+
+        code.clear();
+        for (auto& instruction : instructions) {
+            if (instruction.removed)
+                continue;
+            if (!operandSize(instruction.opcode))
+                add(instruction.opcode, instruction.target);
+            else
+                add(instruction.opcode, instruction.target, isJump(instruction.opcode) ? offsets[indices[instruction.operand]] : instruction.operand);
+        }
+    }
+
     string Compiler::disassemble(const Program& program) {
         size_t i = 0;
         string result;
         char buffer[128];
+        const unsigned char* code = program.getCode();
         while (i < program.codeOffset) {
+            i += sizeof(size_t);
             sprintf(buffer, "0x%08x", (int)i);
-            int length = *((int*)&program.code[i]);
+            int length = *((int*)&code[i]);
             result.append(buffer);
             result.append(" \"");
-            result.append((const char*)&program.code[i+sizeof(int)], length);
+            for (int j = 0; j < length; ++j) {
+                unsigned char c = code[i+sizeof(int)+j];
+                if (c >= 0x20 && c < 0x7F) {
+                    result.push_back(c);
+                } else {
+                    sprintf(buffer, "\\x%02x", c);
+                    result.append(buffer);
+                }
+            }
             result.append("\"");
             result.append("\n");
             i += length + sizeof(int) + 1;
-            i += i % 4;
+            i += (8 - i % 8) % 8;
         }
-        while (i < program.code.size()) {
-            unsigned int instruction = *(unsigned int*)&program.code[i];
-            sprintf(buffer, "0x%08x %-14s REG%02d", (int)i, getSymbolicOpcode((OPCode)(program.code[i] & 0xFF)), instruction >> 8);
+        while (i < program.getSize()) {
+            unsigned int instruction = *(unsigned int*)&code[i];
+            sprintf(buffer, "0x%08x %-14s REG%02d", (int)i, getSymbolicOpcode((OPCode)(code[i] & 0xFF)), instruction >> 8);
             result.append(buffer);
             i += sizeof(int);
             if (operandSize((OPCode)(instruction & 0xFF))) {
-                long long number = *(long long*)&program.code[i];
+                long long number = *(long long*)&code[i];
                 sprintf(buffer, ", 0x%08x%08x", (unsigned int)(number >> 32), (unsigned int)(number & 0xFFFFFFFF));
                 result.append(buffer);
                 i += sizeof(long long);
+                if ((instruction & 0xFF) == OP_CALL && (unsigned int)number < program.symbols.size()) {
+                    result.append(" ; ");
+                    result.append(program.symbols[(unsigned int)number]->symbol);
+                } else if ((instruction & 0xFF) == OP_RESOLVEPATH) {
+                    result.append(" ;");
+                    number = (unsigned int)number;
+                    unsigned int count = *(unsigned int*)&code[number] / sizeof(int);
+                    for (unsigned int k = 0; k < count; ++k) {
+                        int key = *(int*)&code[number + sizeof(int) + k * sizeof(int)];
+                        result.append(k == 0 ? " " : ".");
+                        result.append((const char*)&code[key + sizeof(int)], *(int*)&code[key]);
+                    }
+                }
             }
             result.append("\n");
         }
         return result;
     }
 
+    // Saved programs are this, followed by the names of the node types in the symbol table, each NUL terminated, padded out to 8 bytes,
+    // and then the program, exactly as it is in memory. Nothing's converted, so programs only load on machines like the one that saved them.
+    struct ProgramFileHeader {
+        char magic[4];
+        unsigned int byteOrder;
+        unsigned int version;
+        unsigned int codeOffset;
+        unsigned int codeSize;
+        unsigned int symbolCount;
+        unsigned int symbolSize;
+        unsigned int inlineCaches;
+    };
+    static const char PROGRAM_FILE_MAGIC[4] = { 'L', 'Q', 'P', 'G' };
+    static constexpr unsigned int PROGRAM_FILE_BYTE_ORDER = 0x01020304;
+
+    static size_t getProgramCodeStart(const ProgramFileHeader& header) {
+        size_t end = sizeof(ProgramFileHeader) + header.symbolSize;
+        return end + (8 - end % 8) % 8;
+    }
+
+    void Program::save(const Context& context, const std::string& path) const {
+        auto names = context.getNodeTypeNames();
+        string symbolTable;
+        for (const NodeType* type : symbols) {
+            auto it = names.find(type);
+            if (it == names.end())
+                throw Exception("Can't save a program that calls '%s', which isn't registered with the context.", type->symbol.c_str());
+            symbolTable.append(it->second);
+            symbolTable.push_back(0);
+        }
+        ProgramFileHeader header;
+        memcpy(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic));
+        header.byteOrder = PROGRAM_FILE_BYTE_ORDER;
+        header.version = VERSION;
+        header.codeOffset = codeOffset;
+        header.codeSize = getSize();
+        header.symbolCount = symbols.size();
+        header.symbolSize = symbolTable.size();
+        header.inlineCaches = inlineCaches;
+        static const char padding[8] = { 0 };
+        size_t paddingSize = getProgramCodeStart(header) - sizeof(ProgramFileHeader) - symbolTable.size();
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            throw Exception("Can't open %s for writing: %s", path.c_str(), strerror(errno));
+        bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(symbolTable.data(), 1, symbolTable.size(), file) == symbolTable.size() &&
+            fwrite(padding, 1, paddingSize, file) == paddingSize &&
+            fwrite(getCode(), 1, getSize(), file) == getSize();
+        if (fclose(file) != 0)
+            success = false;
+        if (!success)
+            throw Exception("Can't write program to %s: %s", path.c_str(), strerror(errno));
+    }
+
+    static bool isDataString(const Program& program, long long offset) {
+        if (offset < (long long)sizeof(size_t) || offset + (long long)sizeof(unsigned int) > program.codeOffset)
+            return false;
+        unsigned int length;
+        memcpy(&length, &program.getCode()[offset], sizeof(length));
+        return offset + sizeof(unsigned int) + length < program.codeOffset;
+    }
+
+    Program Program::load(const Context& context, const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw Exception("Can't open %s: %s", path.c_str(), strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(ProgramFileHeader)) {
+            close(fd);
+            throw Exception("Can't load program from %s: not a program.", path.c_str());
+        }
+        size_t size = info.st_size;
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+            throw Exception("Can't map %s: %s", path.c_str(), strerror(errno));
+
+        Program program;
+        program.mapping = shared_ptr<void>(address, [size](void* address) { munmap(address, size); });
+        const unsigned char* bytes = static_cast<const unsigned char*>(address);
+        ProgramFileHeader header;
+        memcpy(&header, bytes, sizeof(header));
+        if (memcmp(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic)) != 0 || header.byteOrder != PROGRAM_FILE_BYTE_ORDER)
+            throw Exception("Can't load program from %s: not a program.", path.c_str());
+        if (header.version != VERSION)
+            throw Exception("Can't load program from %s: saved by version %u, rather than %u.", path.c_str(), header.version, VERSION);
+        size_t codeStart = getProgramCodeStart(header);
+        if (codeStart > size || size - codeStart != header.codeSize || header.codeOffset >= header.codeSize)
+            throw Exception("Can't load program from %s: truncated.", path.c_str());
+
+        std::unordered_map<string, const NodeType*> types;
+        for (auto& it : context.getNodeTypeNames())
+            types[it.second] = it.first;
+        const char* name = reinterpret_cast<const char*>(&bytes[sizeof(ProgramFileHeader)]);
+        const char* end = name + header.symbolSize;
+        for (unsigned int i = 0; i < header.symbolCount; ++i) {
+            const char* terminator = static_cast<const char*>(memchr(name, 0, end - name));
+            if (!terminator)
+                throw Exception("Can't load program from %s: truncated.", path.c_str());
+            auto it = types.find(string(name, terminator - name));
+            if (it == types.end())
+                throw Exception("Can't load program from %s: it calls '%s', which isn't registered with the context.", path.c_str(), name);
+            program.symbols.push_back(it->second);
+            name = terminator + 1;
+        }
+        program.codeOffset = header.codeOffset;
+        program.inlineCaches = header.inlineCaches;
+        program.mappedCode = &bytes[codeStart];
+        program.mappedSize = header.codeSize;
+
+        // Make sure that everything the interpreter's going to follow stays inside the program; this catches files that have been truncated, or
+        // mangled, not ones that have been deliberately crafted.
+        const unsigned char* code = program.mappedCode;
+        size_t i = program.codeOffset;
+        OPCode last = OP_EXIT;
+        while (i < program.mappedSize) {
+            unsigned int instruction;
+            if (i + sizeof(instruction) > program.mappedSize)
+                throw Exception("Can't load program from %s: truncated.", path.c_str());
+            memcpy(&instruction, &code[i], sizeof(instruction));
+            last = (OPCode)(instruction & 0xFF);
+            if (last > OP_EXIT)
+                throw Exception("Can't load program from %s: unknown instruction at 0x%08x.", path.c_str(), (unsigned int)i);
+            i += sizeof(instruction);
+            if (operandSize(last)) {
+                long long operand;
+                if (i + sizeof(operand) > program.mappedSize)
+                    throw Exception("Can't load program from %s: truncated.", path.c_str());
+                memcpy(&operand, &code[i], sizeof(operand));
+                bool valid = true;
+                if (isJump(last))
+                    valid = operand >= program.codeOffset && operand < (long long)program.mappedSize;
+                else if (last == OP_CALL)
+                    valid = (unsigned int)operand < program.symbols.size();
+                else if (last == OP_MOVSTR || last == OP_OUTPUTMEM)
+                    valid = isDataString(program, operand);
+                else if (last == OP_RESOLVE)
+                    valid = (unsigned long long)operand >> 32 < program.inlineCaches;
+                else if (last == OP_RESOLVEPATH) {
+                    unsigned int path = (unsigned int)operand;
+                    valid = isDataString(program, path);
+                    unsigned int length = valid ? *(const unsigned int*)&code[path] : 0;
+                    valid = valid && length > 0 && length % sizeof(int) == 0 && ((unsigned long long)operand >> 32) + length / sizeof(int) <= program.inlineCaches;
+                    for (unsigned int k = 0; valid && k < length / sizeof(int); ++k) {
+                        int key;
+                        memcpy(&key, &code[path + sizeof(int) + k * sizeof(int)], sizeof(key));
+                        valid = isDataString(program, key);
+                    }
+                }
+                if (!valid)
+                    throw Exception("Can't load program from %s: invalid operand at 0x%08x.", path.c_str(), (unsigned int)i);
+                i += sizeof(operand);
+            }
+        }
+        if (last != OP_EXIT)
+            throw Exception("Can't load program from %s: truncated.", path.c_str());
+        return program;
+    }
+
     Interpreter::Interpreter(const Context& context) : Renderer(context) {
         stackPointer = stackBlock;
     }
@@ -269,237 +773,542 @@ namespace Liquid {
 
     }
 
-    // -1 is top
-    // -2 is below top,e tc..
-    Node Interpreter::getStack(int idx) {
-        char* localPointer = stackPointer;
-        for (int i = -1; i >= idx; --i) {
-            unsigned int type = *(unsigned int*)(localPointer - sizeof(unsigned int));
-            switch ((Register::Type)(type & 0xFF)) {
-                case Register::Type::INT:
-                    localPointer -= sizeof(unsigned int) + sizeof(long long);
-                    if (idx == i)
-                        return Node(*(long long*)localPointer);
-                break;
-                case Register::Type::FLOAT:
-                    localPointer -= sizeof(unsigned int) + sizeof(double);
-                    if (idx == i)
-                        return Node(*(double*)localPointer);
-                break;
-                case Register::Type::BOOL: {
-                    unsigned int value = type >> 8;
-                    localPointer -= sizeof(unsigned int);
-                    if (idx == i)
-                        return Node(value ? true : false);
-                } break;
-                case Register::Type::NIL: {
-                    localPointer -= sizeof(unsigned int);
-                    if (idx == i)
-                        return Node(nullptr);
-                } break;
-                case Register::Type::SHORT_STRING:
-                case Register::Type::LONG_STRING: {
-                    unsigned int len = type >> 8;
-                    localPointer -= sizeof(unsigned int) + len + (len % 4);
-                    if (idx == i)
-                        return Node(string(localPointer, len));
-                } break;
-                case Register::Type::VARIABLE: {
-                    localPointer -= sizeof(unsigned int) + sizeof(void*);
-                    if (idx == i)
-                        return Node(Variable(localPointer));
-                } break;
-                case Register::Type::EXTRA_LONG_STRING:
-                    assert(false);
-                break;
+    // Every pool the thread has an interpreter from; on the way out, it frees each of those that's still around.
+    struct RendererPoolThread {
+        std::vector<std::weak_ptr<RendererPool::Registration>> registrations;
+
+        ~RendererPoolThread() {
+            for (auto& it : registrations) {
+                if (auto registration = it.lock()) {
+                    std::lock_guard<std::mutex> lock(registration->mutex);
+                    if (registration->pool)
+                        registration->pool->release();
+                }
+            }
+        }
+
+        void add(const shared_ptr<RendererPool::Registration>& registration) {
+            for (auto it = registrations.begin(); it != registrations.end(); ) {
+                auto existing = it->lock();
+                if (existing == registration)
+                    return;
+                it = existing ? it + 1 : registrations.erase(it);
+            }
+            registrations.push_back(registration);
+        }
+    };
+    static thread_local RendererPoolThread rendererPoolThread;
+
+    RendererPool::RendererPool(const Context& context) : RendererPool(context, CPPVariableResolver()) { }
+    RendererPool::RendererPool(const Context& context, LiquidVariableResolver variableResolver) : context(context), variableResolver(variableResolver), registration(std::make_shared<Registration>()) {
+        registration->pool = this;
+    }
+
+    RendererPool::~RendererPool() {
+        // Waits on any thread that's freeing its interpreter as it exits.
+        std::lock_guard<std::mutex> lock(registration->mutex);
+        registration->pool = nullptr;
+    }
+
+    Interpreter& RendererPool::get() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& interpreter = interpreters[std::this_thread::get_id()];
+        if (!interpreter) {
+            interpreter = make_unique<Interpreter>(context, variableResolver);
+            if (configure)
+                configure(*interpreter.get(), configureData);
+            rendererPoolThread.add(registration);
+        }
+        return *interpreter.get();
+    }
+
+    void RendererPool::release() {
+        // Destroyed outside of the lock.
+        unique_ptr<Interpreter> interpreter;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = interpreters.find(std::this_thread::get_id());
+            if (it == interpreters.end())
+                return;
+            interpreter = move(it->second);
+            interpreters.erase(it);
+        }
+    }
+
+    size_t RendererPool::size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return interpreters.size();
+    }
+
+    TemplateCache::TemplateCache(size_t maxSize) : maxSize(maxSize) { }
+
+    static bool isCachedTemplate(const TemplateCache::Entry& entry, const Context* context, const char* source, size_t size, const std::string& file) {
+        return entry.context == context && entry.file == file && entry.source.size() == size && memcmp(entry.source.data(), source, size) == 0;
+    }
+
+    shared_ptr<const TemplateCache::Entry> TemplateCache::get(Parser& parser, Compiler& compiler, const char* source, size_t size, const std::string& file) {
+        assert(&parser.context == &compiler.context);
+        size_t hash = std::hash<std::string_view>()(std::string_view(source, size));
+        hash ^= std::hash<std::string>()(file) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        hash ^= std::hash<const Context*>()(&parser.context) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(hash);
+            if (it != index.end() && isCachedTemplate(**it->second, &parser.context, source, size, file)) {
+                ++hits;
+                entries.splice(entries.begin(), entries, it->second);
+                return entries.front();
             }
+            ++misses;
+        }
+        // Parsed and compiled outside of the lock; two threads that miss on the same template at once both do the work, and the last one in is kept.
+        auto entry = std::make_shared<Entry>();
+        entry->hash = hash;
+        entry->context = &parser.context;
+        entry->file = file;
+        entry->source.assign(source, size);
+        entry->tmpl = parser.parse(source, size, file);
+        entry->program = compiler.compile(entry->tmpl);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(hash);
+        if (it != index.end())
+            entries.erase(it->second);
+        entries.push_front(entry);
+        index[hash] = entries.begin();
+        while (entries.size() > maxSize) {
+            index.erase(entries.back()->hash);
+            entries.pop_back();
+            ++evictions;
+        }
+        return entry;
+    }
+
+    LiquidTemplateCacheStatistics TemplateCache::getStatistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return LiquidTemplateCacheStatistics { hits, misses, evictions, entries.size() };
+    }
+
+    void TemplateCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+    }
+
+    PartialCache::PartialCache(const Context& context, LiquidFileSystem fileSystem) : context(context), fileSystem(fileSystem) { }
+
+    shared_ptr<const PartialCache::Partial> PartialCache::get(std::string_view name) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = partials.find(std::string(name));
+            if (it != partials.end()) {
+                ++hits;
+                return it->second;
+            }
+            ++misses;
+        }
+        // Read and parsed outside of the lock, as with the template cache; the last thread in is kept.
+        shared_ptr<Partial> partial;
+        std::string source;
+        if (fileSystem.readPartial(name.data(), name.size(), +[](const char* chunk, size_t size, void* target) {
+            static_cast<std::string*>(target)->append(chunk, size);
+        }, &source, fileSystem.data)) {
+            partial = std::make_shared<Partial>();
+            partial->name = std::string(name);
+            Parser parser(context);
+            partial->tmpl = parser.parse(source.data(), source.size(), partial->name);
+            partial->size = 0;
+            partial->tmpl.walk([&partial](const Node& node) { ++partial->size; });
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        partials[std::string(name)] = partial;
+        return partial;
+    }
+
+    void PartialCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        partials.clear();
+    }
+
+    // Every entry on the stack is its value, followed by a 4-byte tag; the register type in the low byte, and anything small enough (a bool, or
+    // the length of a short string) above it.
+    static size_t stackEntrySize(unsigned int tag) {
+        switch ((Interpreter::Register::Type)(tag & 0xFF)) {
+            case Interpreter::Register::Type::INT:
+            case Interpreter::Register::Type::FLOAT:
+                return sizeof(unsigned int) + sizeof(long long);
+            case Interpreter::Register::Type::BOOL:
+            case Interpreter::Register::Type::NIL:
+                return sizeof(unsigned int);
+            case Interpreter::Register::Type::SHORT_STRING:
+                return sizeof(unsigned int) + (((tag >> 8) + 3) & ~3);
+            case Interpreter::Register::Type::LONG_STRING:
+                return sizeof(unsigned int) + sizeof(const char*) + sizeof(size_t);
+            case Interpreter::Register::Type::VARIANT:
+            case Interpreter::Register::Type::VARIABLE:
+                return sizeof(unsigned int) + sizeof(void*);
         }
         assert(false);
-        return Node();
+        return 0;
+    }
+
+    // Long strings are always null terminated, even borrowed ones, so either kind can be handed straight to the variable resolver.
+    static bool getStringRegister(const Interpreter::Register& reg, const char*& str, size_t& length) {
+        switch (reg.type) {
+            case Interpreter::Register::Type::SHORT_STRING:
+                str = reg.buffer;
+                length = reg.length;
+                return true;
+            case Interpreter::Register::Type::LONG_STRING:
+                str = reg.str;
+                length = reg.size;
+                return true;
+            default:
+                return false;
+        }
     }
 
+    // The same as comparing variants.
+    static bool registersEqual(const Interpreter::Register& a, const Interpreter::Register& b) {
+        const char* s1, *s2;
+        size_t l1, l2;
+        if (getStringRegister(a, s1, l1))
+            return getStringRegister(b, s2, l2) && l1 == l2 && memcmp(s1, s2, l1) == 0;
+        if (a.type != b.type)
+            return false;
+        switch (a.type) {
+            case Interpreter::Register::Type::INT:
+                return a.i == b.i;
+            case Interpreter::Register::Type::FLOAT:
+                return a.f == b.f;
+            case Interpreter::Register::Type::BOOL:
+                return a.b == b.b;
+            case Interpreter::Register::Type::NIL:
+                return true;
+            case Interpreter::Register::Type::VARIANT:
+                return *static_cast<const Variant*>(a.pointer) == *static_cast<const Variant*>(b.pointer);
+            default:
+                return a.pointer == b.pointer;
+        }
+    }
 
+    // -1 is top
+    // -2 is below top,e tc..
+    // Entries are only 4-byte aligned, so anything wider is copied in and out.
     void Interpreter::getStack(Register& reg, int idx) {
         char* localPointer = stackPointer;
+        unsigned int tag = 0;
         for (int i = -1; i >= idx; --i) {
-            unsigned int type = *(unsigned int*)(localPointer - sizeof(unsigned int));
-            Register::Type regType = (Register::Type)(type & 0xFF);
-            switch (regType) {
-                case Register::Type::INT:
-                    localPointer -= sizeof(unsigned int) + sizeof(long long);
-                    if (idx == i) {
-                        reg.type = regType;
-                        reg.i = *(long long*)localPointer;
-                        return;
-                    }
-                break;
-                case Register::Type::FLOAT:
-                    localPointer -= sizeof(unsigned int) + sizeof(double);
-                    if (idx == i) {
-                        reg.type = regType;
-                        reg.f = *(double*)localPointer;
-                        return;
-                    }
-                break;
-                case Register::Type::BOOL: {
-                    unsigned int value = type >> 8;
-                    localPointer -= sizeof(unsigned int);
-                    if (idx == i) {
-                        reg.type = regType;
-                        reg.b = value ? true : false;
-                        return;
-                    }
-                } break;
-                case Register::Type::NIL: {
-                    localPointer -= sizeof(unsigned int);
-                    if (idx == i) {
-                        reg.type = regType;
-                        return;
-                    }
-                } break;
-                case Register::Type::SHORT_STRING: {
-                    unsigned int len = type >> 8;
-                    localPointer -= sizeof(unsigned int) + len + (len % 4);
-                    if (idx == i) {
-                        reg.type = regType;
-                        strncpy(reg.buffer, localPointer, SHORT_STRING_SIZE);
-                        return;
-                    }
-                } break;
-                case Register::Type::VARIABLE:
-                    localPointer -= sizeof(unsigned int) + sizeof(void*);
-                    if (idx == i) {
-                        reg.type = regType;
-                        reg.pointer = *(void**)localPointer;
-                        return;
-                    }
-                break;
-                case Register::Type::LONG_STRING:
-                case Register::Type::EXTRA_LONG_STRING:
-                    assert(false);
-                break;
-            }
+            assert(localPointer > stackBlock);
+            tag = *(unsigned int*)(localPointer - sizeof(unsigned int));
+            localPointer -= stackEntrySize(tag);
+        }
+        reg.type = (Register::Type)(tag & 0xFF);
+        switch (reg.type) {
+            case Register::Type::INT:
+                memcpy(&reg.i, localPointer, sizeof(long long));
+            break;
+            case Register::Type::FLOAT:
+                memcpy(&reg.f, localPointer, sizeof(double));
+            break;
+            case Register::Type::BOOL:
+                reg.b = (tag >> 8) ? true : false;
+            break;
+            case Register::Type::NIL:
+            break;
+            case Register::Type::SHORT_STRING:
+                reg.length = tag >> 8;
+                memcpy(reg.buffer, localPointer, reg.length);
+                reg.buffer[reg.length] = 0;
+            break;
+            case Register::Type::LONG_STRING:
+                memcpy(&reg.str, localPointer, sizeof(const char*));
+                memcpy(&reg.size, localPointer + sizeof(const char*), sizeof(size_t));
+            break;
+            case Register::Type::VARIANT:
+            case Register::Type::VARIABLE:
+                memcpy(&reg.pointer, localPointer, sizeof(void*));
+            break;
         }
-        assert(false);
     }
 
-    void Interpreter::pushStack(Register& reg) {
+    Node Interpreter::getStack(int idx, bool borrow) {
+        Register reg;
+        getStack(reg, idx);
+        return getNode(reg, borrow);
+    }
+
+    bool Interpreter::pushStack(Register& reg) {
+        // Room for the largest possible entry.
+        if (stackPointer + sizeof(unsigned int) + SHORT_STRING_SIZE + sizeof(size_t) > stackBlock + STACK_SIZE)
+            return false;
+        unsigned int tag = (unsigned int)reg.type;
         switch (reg.type) {
             case Register::Type::INT:
-                *((long long*)stackPointer) = reg.i;
+                memcpy(stackPointer, &reg.i, sizeof(long long));
                 stackPointer += sizeof(long long);
-                *((unsigned int*)stackPointer) = (unsigned int)Register::Type::INT;
-                stackPointer += sizeof(unsigned int);
+            break;
+            case Register::Type::FLOAT:
+                memcpy(stackPointer, &reg.f, sizeof(double));
+                stackPointer += sizeof(double);
             break;
             case Register::Type::BOOL:
-                *((unsigned int*)stackPointer) = (reg.b << 8) | (unsigned int)Register::Type::BOOL;
-                stackPointer += sizeof(unsigned int);
+                tag |= (reg.b ? 1 : 0) << 8;
             break;
             case Register::Type::NIL:
-                *((unsigned int*)stackPointer) = (unsigned int)Register::Type::NIL;
-                stackPointer += sizeof(unsigned int);
             break;
             case Register::Type::SHORT_STRING:
                 memcpy(stackPointer, reg.buffer, reg.length);
-                stackPointer += reg.length + (reg.length % 4);
-                *((unsigned int*)stackPointer) = ((unsigned int)Register::Type::SHORT_STRING | (reg.length << 8));
-                stackPointer += sizeof(unsigned int);
+                stackPointer += (reg.length + 3) & ~3;
+                tag |= reg.length << 8;
             break;
-            case Register::Type::FLOAT:
-                *((double*)stackPointer) = reg.f;
-                stackPointer += sizeof(double);
-                *((unsigned int*)stackPointer) = (unsigned int)Register::Type::FLOAT;
-                stackPointer += sizeof(unsigned int);
+            case Register::Type::LONG_STRING:
+                memcpy(stackPointer, &reg.str, sizeof(const char*));
+                memcpy(stackPointer + sizeof(const char*), &reg.size, sizeof(size_t));
+                stackPointer += sizeof(const char*) + sizeof(size_t);
             break;
+            case Register::Type::VARIANT:
             case Register::Type::VARIABLE:
-                *((void**)stackPointer) = reg.pointer;
+                memcpy(stackPointer, &reg.pointer, sizeof(void*));
                 stackPointer += sizeof(void*);
-                *((unsigned int*)stackPointer) = (unsigned int)Register::Type::VARIABLE;
-                stackPointer += sizeof(unsigned int);
-            break;
-            case Register::Type::LONG_STRING:
-            case Register::Type::EXTRA_LONG_STRING:
-                assert(false);
             break;
         }
+        *((unsigned int*)stackPointer) = tag;
+        stackPointer += sizeof(unsigned int);
+        return true;
     }
 
     void Interpreter::popStack(int popCount) {
-        assert(stackPointer > stackBlock);
         for (int i = 0; i < popCount; ++i) {
-            unsigned int type = *(unsigned int*)(stackPointer - sizeof(unsigned int));
-            switch ((Register::Type)(type & 0xFF)) {
-                case Register::Type::INT:
-                    stackPointer -= sizeof(unsigned int) + sizeof(long long);
-                break;
-                case Register::Type::NIL:
-                case Register::Type::BOOL:
-                    stackPointer -= sizeof(unsigned int);
-                break;
-                case Register::Type::FLOAT:
-                    stackPointer -= sizeof(unsigned int) + sizeof(double);
-                break;
-                case Register::Type::SHORT_STRING:
-                case Register::Type::LONG_STRING: {
-                    unsigned int len = type >> 8;
-                    stackPointer -= sizeof(unsigned int) + len + (len % 4);
-                } break;
-                case Register::Type::VARIABLE:
-                    stackPointer -= sizeof(unsigned int) + sizeof(void*);
-                break;
-                case Register::Type::EXTRA_LONG_STRING:
-                    assert(false);
-                break;
-            }
+            assert(stackPointer > stackBlock);
+            stackPointer -= stackEntrySize(*(unsigned int*)(stackPointer - sizeof(unsigned int)));
         }
     }
 
     void Interpreter::pushRegister(Register& reg, const Node& node) {
-        assert(!node.type);
+        if (node.type) {
+            reg.type = Register::Type::NIL;
+            return;
+        }
+        switch (node.variant.type) {
+            case Variant::Type::STRING:
+                pushRegister(reg, node.variant.s);
+            break;
+            case Variant::Type::STRING_VIEW:
+                pushRegister(reg, string(node.variant.view, node.variant.len));
+            break;
+            case Variant::Type::ARRAY:
+            case Variant::Type::POINTER:
+                heap.push_back(node.variant);
+                reg.type = Register::Type::VARIANT;
+                reg.pointer = &heap.back();
+            break;
+            default:
+                referenceRegister(reg, node.variant);
+            break;
+        }
+    }
+
+    void Interpreter::pushRegister(Register& reg, Node&& node) {
+        if (node.type) {
+            reg.type = Register::Type::NIL;
+            return;
+        }
         switch (node.variant.type) {
+            case Variant::Type::STRING:
+                pushRegister(reg, node.variant.s);
+            break;
+            case Variant::Type::ARRAY:
+            case Variant::Type::POINTER:
+                heap.push_back(move(node.variant));
+                reg.type = Register::Type::VARIANT;
+                reg.pointer = &heap.back();
+            break;
+            default:
+                pushRegister(reg, (const Node&)node);
+            break;
+        }
+    }
+
+    void Interpreter::pushRegister(Register& reg, const string& str) {
+        if (str.size() < SHORT_STRING_SIZE) {
+            reg.type = Register::Type::SHORT_STRING;
+            memcpy(reg.buffer, str.data(), str.size());
+            reg.buffer[str.size()] = 0;
+            reg.length = str.size();
+        } else
+            pushRegister(reg, string(str));
+    }
+
+    // Long strings are shared with the heap, rather than copied.
+    void Interpreter::pushRegister(Register& reg, const String& str) {
+        if (str.size() < SHORT_STRING_SIZE) {
+            reg.type = Register::Type::SHORT_STRING;
+            memcpy(reg.buffer, str.data(), str.size());
+            reg.buffer[str.size()] = 0;
+            reg.length = str.size();
+        } else {
+            heap.emplace_back(str);
+            reg.type = Register::Type::LONG_STRING;
+            reg.str = heap.back().s.data();
+            reg.size = heap.back().s.size();
+        }
+    }
+
+    void Interpreter::pushRegister(Register& reg, string&& str) {
+        if (str.size() < SHORT_STRING_SIZE) {
+            pushRegister(reg, (const string&)str);
+        } else {
+            heap.emplace_back(move(str));
+            reg.type = Register::Type::LONG_STRING;
+            reg.str = heap.back().s.data();
+            reg.size = heap.back().s.size();
+        }
+    }
+
+    void Interpreter::referenceRegister(Register& reg, const Variant& variant) {
+        switch (variant.type) {
             case Variant::Type::INT:
                 reg.type = Register::Type::INT;
-                reg.i = node.variant.i;
+                reg.i = variant.i;
             break;
             case Variant::Type::FLOAT:
                 reg.type = Register::Type::FLOAT;
-                reg.f = node.variant.f;
+                reg.f = variant.f;
+            break;
+            case Variant::Type::BOOL:
+                reg.type = Register::Type::BOOL;
+                reg.b = variant.b;
             break;
             case Variant::Type::NIL:
                 reg.type = Register::Type::NIL;
             break;
             case Variant::Type::STRING:
-                pushRegister(reg, node.variant.s);
+                if (variant.s.size() < SHORT_STRING_SIZE) {
+                    pushRegister(reg, variant.s);
+                } else {
+                    reg.type = Register::Type::LONG_STRING;
+                    reg.str = variant.s.data();
+                    reg.size = variant.s.size();
+                }
             break;
             case Variant::Type::STRING_VIEW:
-                assert(false);
+                // Not necessarily null terminated.
+                pushRegister(reg, string(variant.view, variant.len));
             break;
-            case Variant::Type::BOOL:
-                reg.type = Register::Type::BOOL;
-                reg.b = node.variant.b;
+            case Variant::Type::VARIABLE:
+                reg.type = Register::Type::VARIABLE;
+                reg.pointer = variant.v.pointer;
             break;
             case Variant::Type::ARRAY:
             case Variant::Type::POINTER:
-            case Variant::Type::VARIABLE:
-                assert(false);
+                reg.type = Register::Type::VARIANT;
+                reg.pointer = const_cast<Variant*>(&variant);
             break;
         }
     }
 
-    void Interpreter::pushRegister(Register& reg, const string& str) {
-        reg.type = Register::Type::SHORT_STRING;
-        assert(str.size() < SHORT_STRING_SIZE);
-        memcpy(reg.buffer, str.data(), str.size());
-        reg.buffer[str.size()] = 0;
-        reg.length = str.size();
+    void Interpreter::resolveRegister(Register& reg, Variable variable) {
+        reg.type = Register::Type::NIL;
+        switch (variableResolver.getType(*this, variable)) {
+            case LIQUID_VARIABLE_TYPE_OTHER:
+            case LIQUID_VARIABLE_TYPE_DICTIONARY:
+            case LIQUID_VARIABLE_TYPE_ARRAY:
+                reg.type = Register::Type::VARIABLE;
+                reg.pointer = variable.pointer;
+            break;
+            case LIQUID_VARIABLE_TYPE_BOOL:
+                if (variableResolver.getBool(*this, variable, &reg.b))
+                    reg.type = Register::Type::BOOL;
+            break;
+            case LIQUID_VARIABLE_TYPE_INT:
+                if (variableResolver.getInteger(*this, variable, &reg.i))
+                    reg.type = Register::Type::INT;
+            break;
+            case LIQUID_VARIABLE_TYPE_FLOAT:
+                if (variableResolver.getFloat(*this, variable, &reg.f))
+                    reg.type = Register::Type::FLOAT;
+            break;
+            case LIQUID_VARIABLE_TYPE_STRING: {
+                const char* view;
+                size_t size;
+                if (variableResolver.getStringView && variableResolver.getStringView(*this, variable, &view, &size)) {
+                    if (size < SHORT_STRING_SIZE) {
+                        reg.type = Register::Type::SHORT_STRING;
+                        reg.length = (unsigned char)size;
+                        memcpy(reg.buffer, view, size);
+                        reg.buffer[size] = 0;
+                    } else {
+                        reg.type = Register::Type::LONG_STRING;
+                        reg.str = view;
+                        reg.size = size;
+                    }
+                    break;
+                }
+                long long length = variableResolver.getStringLength(*this, variable);
+                if (length < 0)
+                    break;
+                if (length < SHORT_STRING_SIZE) {
+                    if (variableResolver.getString(*this, variable, reg.buffer)) {
+                        reg.type = Register::Type::SHORT_STRING;
+                        reg.length = (unsigned char)length;
+                        reg.buffer[length] = 0;
+                    }
+                } else {
+                    string s;
+                    s.resize(length);
+                    if (variableResolver.getString(*this, variable, const_cast<char*>(s.data())))
+                        pushRegister(reg, move(s));
+                }
+            } break;
+            case LIQUID_VARIABLE_TYPE_NIL:
+            break;
+        }
     }
 
-    void Interpreter::pushRegister(Register& reg, string&& str) {
-        reg.type = Register::Type::SHORT_STRING;
-        assert(str.size() < SHORT_STRING_SIZE);
-        memcpy(reg.buffer, str.data(), str.size());
-        reg.buffer[str.size()] = 0;
-        reg.length = str.size();
+    Node Interpreter::getNode(const Register& reg, bool borrow) {
+        switch (reg.type) {
+            case Register::Type::INT:
+                return Node(Variant(reg.i));
+            case Register::Type::FLOAT:
+                return Node(Variant(reg.f));
+            case Register::Type::BOOL:
+                return Node(Variant(reg.b));
+            case Register::Type::SHORT_STRING:
+                return Node(string(reg.buffer, reg.length));
+            case Register::Type::LONG_STRING:
+                return borrow ? Node(Variant(reg.str, reg.size)) : Node(string(reg.str, reg.size));
+            case Register::Type::VARIANT:
+                return Node(*static_cast<const Variant*>(reg.pointer));
+            case Register::Type::VARIABLE:
+                return Node(Variant(Variable({ reg.pointer })));
+            case Register::Type::NIL:
+            break;
+        }
+        return Node();
+    }
+
+    bool Interpreter::isTruthy(const Register& reg) const {
+        EFalsiness falsiness = context.falsiness;
+        switch (reg.type) {
+            case Register::Type::BOOL:
+                return reg.b;
+            case Register::Type::INT:
+                return !((falsiness & FALSY_0) && !reg.i);
+            case Register::Type::FLOAT:
+                return !((falsiness & FALSY_0) && !reg.f);
+            case Register::Type::NIL:
+                return !(falsiness & FALSY_NIL);
+            case Register::Type::SHORT_STRING:
+                return !((falsiness & FALSY_EMPTY_STRING) && reg.length == 0);
+            case Register::Type::LONG_STRING:
+                return !((falsiness & FALSY_EMPTY_STRING) && reg.size == 0);
+            case Register::Type::VARIANT:
+                return static_cast<const Variant*>(reg.pointer)->isTruthy(falsiness);
+            case Register::Type::VARIABLE:
+            break;
+        }
+        return true;
     }
 
     string Interpreter::renderTemplate(const Program& prog, Variable store) {
@@ -510,377 +1319,384 @@ namespace Liquid {
         return result;
     }
 
-    char* itoa(int value, char* result) {
-        char* ptr = result, *ptr1 = result, tmp_char;
-        int tmp_value;
-
-        do {
-            tmp_value = value;
-            value /= 10;
-            *ptr++ = "zyxwvutsrqponmlkjihgfedcba9876543210123456789abcdefghijklmnopqrstuvwxyz" [35 + (tmp_value - value * 10)];
-        } while ( value );
-
-        // Apply negative sign
-        if (tmp_value < 0) *ptr++ = '-';
-        *ptr-- = '\0';
-        while(ptr1 < ptr) {
-            tmp_char = *ptr;
-            *ptr--= *ptr1;
-            *ptr1++ = tmp_char;
-        }
-        return result;
-    }
-
-    bool Interpreter::run(const unsigned char* code, Variable store, void (*callback)(const char* chunk, size_t len, void* data), void* data, const unsigned char* iteration) {
+    bool Interpreter::run(const unsigned char* code, Variable store, void (*callback)(const char* chunk, size_t len, void* data), void* data) {
         unsigned int instruction, target;
         long long operand;
         Node node;
+        auto output = [this, data, callback](const char* str, size_t len) {
+            if (buffers.size())
+                buffers.top().append(str, len);
+            else {
+                callback(str, len, data);
+                if (profiler)
+                    profiler->output += len;
+            }
+        };
+        #ifdef LIQUID_INTERPRETER_COMPUTED_GOTO
+            // In the same order as OPCode.
+            static const void* dispatchTable[] = {
+                &&LABEL_OP_MOV, &&LABEL_OP_MOVSTR, &&LABEL_OP_MOVINT, &&LABEL_OP_MOVBOOL, &&LABEL_OP_MOVFLOAT, &&LABEL_OP_MOVNIL, &&LABEL_OP_STACK,
+                &&LABEL_OP_PUSH, &&LABEL_OP_POP, &&LABEL_OP_ADD, &&LABEL_OP_SUB, &&LABEL_OP_MOD, &&LABEL_OP_EQL, &&LABEL_OP_OUTPUT, &&LABEL_OP_OUTPUTMEM,
+                &&LABEL_OP_ASSIGN, &&LABEL_OP_JMP, &&LABEL_OP_JMPFALSE, &&LABEL_OP_JMPTRUE, &&LABEL_OP_EQLJMPFALSE, &&LABEL_OP_EQLJMPTRUE, &&LABEL_OP_CALL,
+                &&LABEL_OP_RESOLVE, &&LABEL_OP_RESOLVEPATH, &&LABEL_OP_LENGTH,
+                &&LABEL_OP_LOOP, &&LABEL_OP_ITERATE, &&LABEL_OP_BREAK, &&LABEL_OP_INVERT, &&LABEL_OP_PUSHBUFFER, &&LABEL_OP_POPBUFFER, &&LABEL_OP_EXIT
+            };
+            static_assert(sizeof(dispatchTable) / sizeof(void*) == OP_EXIT + 1, "dispatch table must cover every opcode");
+            // Every handler jumps straight to the next one, rather than going back through the switch.
+            #define LIQUID_OPCODE(op) case op: LABEL_##op
+            #define LIQUID_NEXT() { instruction = *instructionPointer++; target = instruction >> 8; goto *dispatchTable[instruction & 0xFF]; }
+        #else
+            #define LIQUID_OPCODE(op) case op
+            #define LIQUID_NEXT() continue
+        #endif
         while (true) {
             instruction = *instructionPointer++;
             target = instruction >> 8;
-            OPCode opCode = (OPCode)(instruction & 0xFF);
-            switch (opCode) {
-                case OP_MOVSTR: {
+            switch ((OPCode)(instruction & 0xFF)) {
+                LIQUID_OPCODE(OP_MOVSTR): {
+                    // Strings in the data segment are null terminated, and stay around for as long as the program does.
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    unsigned int length = *(unsigned int*)&code[operand];
-                    assert(length < SHORT_STRING_SIZE);
-                    registers[target].type = Register::Type::SHORT_STRING;
-                    registers[target].length = length;
-                    memcpy(registers[target].buffer, &code[operand+sizeof(unsigned int)], length);
-                    registers[target].buffer[length] = 0;
-                } break;
-                case OP_MOV: {
+                    registers[target].type = Register::Type::LONG_STRING;
+                    registers[target].size = *(unsigned int*)&code[operand];
+                    registers[target].str = (const char*)&code[operand+sizeof(unsigned int)];
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOV): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     registers[operand] = registers[target];
-                } break;
-                case OP_MOVBOOL: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOVBOOL): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     registers[target].type = Register::Type::BOOL;
                     registers[target].b = operand ? true : false;
-                } break;
-                case OP_MOVINT: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOVINT): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     registers[target].type = Register::Type::INT;
                     registers[target].i = operand;
-                } break;
-                case OP_MOVFLOAT: {
-                    operand = *((double*)instructionPointer); instructionPointer += 2;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOVFLOAT): {
                     registers[target].type = Register::Type::FLOAT;
-                    registers[target].f = operand;
-                } break;
-                case OP_MOVNIL: {
+                    memcpy(&registers[target].f, instructionPointer, sizeof(double));
+                    instructionPointer += 2;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOVNIL): {
                     registers[target].type = Register::Type::NIL;
                     registers[target].pointer = nullptr;
-                } break;
-                case OP_EQL: {
-                    bool isEqual = false;
-                    if (registers[target].type == registers[0].type) {
-                        switch (registers[0].type) {
-                            case Register::Type::INT:
-                                isEqual = registers[target].i == registers[0].i;
-                            break;
-                            case Register::Type::SHORT_STRING:
-                                isEqual = registers[target].length == registers[0].length && strncmp(registers[target].buffer, registers[0].buffer, registers[0].length) == 0;
-                            break;
-                            case Register::Type::NIL:
-                                isEqual = true;
-                            break;
-                            case Register::Type::BOOL:
-                                isEqual = registers[target].b == registers[0].b;
-                            break;
-                            case Register::Type::FLOAT:
-                                isEqual = registers[target].f == registers[0].f;
-                            break;
-                            case Register::Type::VARIABLE:
-                                isEqual = registers[target].pointer == registers[0].pointer;
-                            break;
-                            case Register::Type::LONG_STRING:
-                            case Register::Type::EXTRA_LONG_STRING:
-                                assert(false);
-                            break;
-                        }
-                    }
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_EQL): {
+                    bool isEqual = registersEqual(registers[target], registers[0]);
                     registers[0].type = Register::Type::BOOL;
                     registers[0].b = isEqual;
-                } break;
-                case OP_ADD: {
-                    if (registers[0].type == Register::Type::INT && registers[target].type == Register::Type::INT)
-                        registers[0].i += registers[target].i;
-                } break;
-                case OP_SUB: {
-                    if (registers[0].type == Register::Type::INT && registers[target].type == Register::Type::INT)
-                        registers[0].i -= registers[target].i;
-                } break;
-                case OP_STACK: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_ADD):
+                LIQUID_OPCODE(OP_SUB): {
+                    Register& a = registers[0];
+                    Register& b = registers[target];
+                    double sign = (instruction & 0xFF) == OP_ADD ? 1 : -1;
+                    if (a.type == Register::Type::INT && b.type == Register::Type::INT)
+                        a.i += (long long)sign * b.i;
+                    else if (a.type == Register::Type::FLOAT && b.type == Register::Type::INT)
+                        a.f += sign * b.i;
+                    else if (a.type == Register::Type::INT && b.type == Register::Type::FLOAT) {
+                        a.type = Register::Type::FLOAT;
+                        a.f = a.i + sign * b.f;
+                    } else if (a.type == Register::Type::FLOAT && b.type == Register::Type::FLOAT)
+                        a.f += sign * b.f;
+                    else
+                        a.type = Register::Type::NIL;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_MOD): {
+                    if (registers[0].type == Register::Type::INT && registers[target].type == Register::Type::INT && registers[target].i != 0)
+                        registers[0].i %= registers[target].i;
+                    else
+                        registers[0].type = Register::Type::NIL;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_STACK): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     getStack(registers[target], operand);
-                } break;
-                case OP_PUSH: {
-                    pushStack(registers[target]);
-                } break;
-                case OP_POP: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_PUSH): {
+                    if (!pushStack(registers[target])) {
+                        error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+                        return false;
+                    }
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_POP): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     popStack(operand);
-                } break;
-                case OP_JMP:
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_JMP):
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
-                break;
-                case OP_CALL: {
+                LIQUID_NEXT();
+                LIQUID_OPCODE(OP_CALL): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    unsigned int argCount = (unsigned int)registers[target].i;
-                    pushRegister(registers[0], ((NodeType*)operand)->render(*this, node, store));
+                    // Anything that runs unbounded goes through a call or an iteration, so that's where fuel's spent.
+                    if (budget.fuel-- <= 0 && !checkBudget())
+                        return false;
+                    int argCount = (int)target;
+                    callArguments = argCount;
+                    const NodeType* type = symbols[(unsigned int)operand];
+                    // The high half of the operand is where the call is in the source; see Compiler::addCall.
+                    if (profiler)
+                        profiler->enter(type, (unsigned long long)operand >> 44, ((unsigned long long)operand >> 32) & 0xFFF);
+                    Node result = type->render(*this, node, store);
+                    if (profiler)
+                        profiler->exit(result);
                     popStack(argCount);
-                } break;
-                case OP_RESOLVE: {
+                    pushRegister(registers[0], move(result));
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_RESOLVE): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    Variable var = operand == -1 || registers[operand].pointer == nullptr ? (void*)store : registers[operand].pointer;
+                    int source = (int)operand;
                     Register& reg = registers[target];
+                    Variable var;
                     bool success = false;
-                    switch (reg.type) {
-                        case Register::Type::INT:
-                            success = variableResolver.getArrayVariable(LiquidRenderer { this }, var, reg.i, var);
-                        break;
-                        case Register::Type::SHORT_STRING:
-                            success = variableResolver.getDictionaryVariable(LiquidRenderer { this }, var, reg.buffer, var);
-                        break;
-                        case Register::Type::NIL:
-                        case Register::Type::BOOL:
-                        case Register::Type::FLOAT:
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
-                        case Register::Type::VARIABLE:
-                            assert(false);
-                        break;
+                    // Anything that isn't a third party variable has nothing to dereference, same as the renderer.
+                    if (source == -1 || registers[source].type == Register::Type::VARIABLE) {
+                        Variable context = source == -1 ? store : Variable({ registers[source].pointer });
+                        const char* key;
+                        size_t length;
+                        if (reg.type == Register::Type::INT)
+                            success = variableResolver.getArrayVariable(*this, context, reg.i, var);
+                        else if (getStringRegister(reg, key, length)) {
+                            size_t hash = 0;
+                            // Keys from the data segment have their hash just ahead of their length.
+                            if (reg.type == Register::Type::LONG_STRING && reg.str > (const char*)code && reg.str < dataSegmentEnd)
+                                memcpy(&hash, reg.str - sizeof(unsigned int) - sizeof(size_t), sizeof(size_t));
+                            success = getDictionaryVariable(context, key, length, hash, inlineCaches[(unsigned long long)operand >> 32], var);
+                        }
                     }
-                    if (success) {
-                        registers[target].type = Register::Type::VARIABLE;
-                        switch (variableResolver.getType(LiquidRenderer { this }, var)) {
-                            case LIQUID_VARIABLE_TYPE_INT:
-                                reg.type = Register::Type::INT;
-                                variableResolver.getInteger(LiquidRenderer { this }, var, &reg.i);
-                            break;
-                            case LIQUID_VARIABLE_TYPE_BOOL:
-                                reg.type = Register::Type::BOOL;
-                                variableResolver.getBool(LiquidRenderer { this }, var, &reg.b);
-                            break;
-                            case LIQUID_VARIABLE_TYPE_FLOAT:
-                                reg.type = Register::Type::FLOAT;
-                                variableResolver.getFloat(LiquidRenderer { this }, var, &reg.f);
+                    if (success)
+                        resolveRegister(reg, var);
+                    else
+                        reg.type = Register::Type::NIL;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_RESOLVEPATH): {
+                    // The path is the data segment offsets of each of its keys.
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    unsigned int path = (unsigned int)operand;
+                    LiquidInlineCache* cache = &inlineCaches[(unsigned long long)operand >> 32];
+                    const unsigned char* keys = &code[path + sizeof(unsigned int)];
+                    const unsigned char* end = keys + *(unsigned int*)&code[path];
+                    Variable context = store;
+                    Register& reg = registers[target];
+                    reg.type = Register::Type::NIL;
+                    while (true) {
+                        Variable var;
+                        int key;
+                        size_t hash;
+                        memcpy(&key, keys, sizeof(key));
+                        memcpy(&hash, &code[key - sizeof(size_t)], sizeof(hash));
+                        if (!getDictionaryVariable(context, (const char*)&code[key + sizeof(unsigned int)], *(unsigned int*)&code[key], hash, *cache++, var))
                             break;
-                            case LIQUID_VARIABLE_TYPE_NIL:
-                                reg.type = Register::Type::NIL;
+                        keys += sizeof(int);
+                        if (keys >= end) {
+                            resolveRegister(reg, var);
                             break;
-                            case LIQUID_VARIABLE_TYPE_STRING: {
-                                reg.type = Register::Type::SHORT_STRING;
-                                long long length = variableResolver.getStringLength(LiquidRenderer { this }, var);
-                                assert(length < SHORT_STRING_SIZE);
-                                reg.length = (unsigned char)length;
-                                variableResolver.getString(LiquidRenderer { this }, var, reg.buffer);
-                                reg.buffer[length] = 0;
-                            } break;
-                            default:
-                                registers[target].pointer = var;
                         }
-                    } else {
-                        registers[target].type = Register::Type::VARIABLE;
-                        registers[target].pointer = nullptr;
+                        // Only third party variables carry on; the same as OP_RESOLVE.
+                        LiquidVariableType type = variableResolver.getType(*this, var);
+                        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY && type != LIQUID_VARIABLE_TYPE_ARRAY && type != LIQUID_VARIABLE_TYPE_OTHER)
+                            break;
+                        context = var;
                     }
-                } break;
-                case OP_ASSIGN: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_ASSIGN): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    Variable hash = registers[target].pointer ? registers[target].pointer : store.pointer;
-                    Variable varvalue;
-                    Register& value = registers[operand];
+                    Variable hash;
+                    if (target == 0)
+                        hash = store;
+                    else if (registers[target].type == Register::Type::VARIABLE)
+                        hash = Variable({ registers[target].pointer });
+                    else
+                        LIQUID_NEXT();
+                    Variable value;
+                    if (registers[operand].type == Register::Type::VARIANT)
+                        inject(value, *static_cast<const Variant*>(registers[operand].pointer));
+                    else
+                        inject(value, getNode(registers[operand]).variant);
                     Register& key = registers[0];
-                    switch (value.type) {
-                        case Register::Type::INT:
-                            inject(varvalue, value.i);
-                        break;
-                        case Register::Type::SHORT_STRING:
-                            inject(varvalue, string(value.buffer, value.length));
-                        break;
-                        case Register::Type::NIL:
-                            inject(varvalue, nullptr);
-                        break;
-                        case Register::Type::BOOL:
-                            inject(varvalue, value.b);
-                        break;
-                        case Register::Type::FLOAT:
-                            inject(varvalue, value.f);
-                        break;
-                        case Register::Type::VARIABLE:
-                            varvalue = value.pointer;
-                        break;
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
-                            assert(false);
-                        break;
+                    const char* str;
+                    size_t length;
+                    if (key.type == Register::Type::INT)
+                        variableResolver.setArrayVariable(*this, hash, key.i, value);
+                    else if (getStringRegister(key, str, length)) {
+                        // Long strings can be views of the resolver's own, which needn't be terminated.
+                        variableResolver.setDictionaryVariable(*this, hash, key.type == Register::Type::LONG_STRING ? std::string(str, length).c_str() : str, value);
                     }
-                    switch (key.type) {
-                        case Register::Type::INT:
-                            variableResolver.setArrayVariable(*this, hash, key.i, varvalue);
-                        break;
-                        case Register::Type::SHORT_STRING:
-                            variableResolver.setDictionaryVariable(*this, hash, key.buffer, varvalue);
-                        break;
-                        case Register::Type::NIL:
-                        case Register::Type::BOOL:
-                        case Register::Type::FLOAT:
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
-                        case Register::Type::VARIABLE:
-                            assert(false);
-                        break;
+                    else
+                        variableResolver.freeVariable(*this, value);
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_LENGTH): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    Register& reg = registers[target];
+                    const char* str;
+                    size_t length;
+                    long long size = -1;
+                    if (reg.type == Register::Type::VARIABLE)
+                        size = variableResolver.getArraySize(*this, reg.pointer);
+                    else if (reg.type == Register::Type::VARIANT && static_cast<const Variant*>(reg.pointer)->type == Variant::Type::ARRAY)
+                        size = static_cast<const Variant*>(reg.pointer)->a.size();
+                    else if (getStringRegister(reg, str, length))
+                        size = length;
+                    registers[0].type = size == -1 ? Register::Type::NIL : Register::Type::INT;
+                    registers[0].i = size;
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_LOOP): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    // The frame comes in as the sequence, the offset, the limit and whether we're reversed, with three empty slots. It's turned into
+                    // the sequence, the first and last index, whether we're reversed, the length, the index, and the current element; the
+                    // index starting just before the first one, for OP_ITERATE to bring up.
+                    Register sequence, reversed;
+                    getStack(sequence, -7);
+                    Node offset = getStack(-6);
+                    Node limitQualifier = getStack(-5);
+                    getStack(reversed, -4);
+
+                    const Variant* array = sequence.type == Register::Type::VARIANT && static_cast<const Variant*>(sequence.pointer)->type == Variant::Type::ARRAY ? static_cast<const Variant*>(sequence.pointer) : nullptr;
+                    if (!array && sequence.type != Register::Type::VARIABLE) {
+                        // Not iterable, so the else branch, if any, gets run.
+                        registers[0].type = Register::Type::BOOL;
+                        registers[0].b = true;
+                        instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
+                        LIQUID_NEXT();
                     }
-                } break;
-                case OP_ITERATE: {
-                    if (iteration == (const unsigned char*)instructionPointer) {
-                        instructionPointer += 2;
-                        return true;
+                    int start = offset.variant.isNumeric() ? std::max((int)offset.variant.getInt(), 0) : 0;
+                    long long length = array ? (long long)array->a.size() : variableResolver.getArraySize(*this, sequence.pointer);
+                    int limit = length;
+                    if (limitQualifier.variant.isNumeric()) {
+                        limit = (int)limitQualifier.variant.getInt();
+                        if (limit < 0)
+                            limit = std::max((int)(limit+length), 0);
                     }
-                    // TODO: This is a bit of a hack. Probably should allow for an iterator context which will allow us to call this non-recursively.
-                    operand = *((long long*)instructionPointer);
-                    Register& reg = registers[target];
-                    void* pointers[] = { this, const_cast<unsigned char*>(code), store.pointer, (void*)callback, data, const_cast<unsigned int*>(instructionPointer) };
-                    instructionPointer += 2;
-                    Variable var = reg.pointer == nullptr ? (void*)store : reg.pointer;
-                    variableResolver.iterate(LiquidRenderer { this }, var, +[](void* variable, void* data){
-                        void** pointers = (void**)data;
-                        Interpreter* interpreter = (Interpreter*)pointers[0];
-                        interpreter->registers[0].type = Register::Type::VARIABLE;
-                        interpreter->registers[0].pointer = variable;
-                        interpreter->run((const unsigned char*)pointers[1], Variable { pointers[2] }, (void (*)(const char*, size_t, void*))pointers[3], pointers[4], (const unsigned char*)pointers[5]);
-                        return true;
-                    }, pointers, 0, -1, false);
+                    Register frame[6];
+                    for (int i = 0; i < 6; ++i)
+                        frame[i].type = Register::Type::INT;
+                    frame[0].i = start;
+                    frame[1].i = std::min(limit+start-1, (int)length-1);
+                    frame[2] = reversed;
+                    frame[3].i = length;
+                    frame[4].i = start - 1;
+                    frame[5].type = Register::Type::NIL;
+                    popStack(6);
+                    for (int i = 0; i < 6; ++i)
+                        pushStack(frame[i]);
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_ITERATE): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    if (budget.fuel-- <= 0 && !checkBudget())
+                        return false;
+                    Register sequence, start, end, reversed, idx, element;
+                    getStack(idx, -2);
+                    if (control == Renderer::Control::BREAK) {
+                        control = Renderer::Control::NONE;
+                        registers[0].type = Register::Type::BOOL;
+                        registers[0].b = false;
+                        instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
+                        LIQUID_NEXT();
+                    }
+                    ++idx.i;
+                    getStack(end, -5);
+                    if (idx.i > end.i) {
+                        // Whether the else branch gets run; the same check as the renderer.
+                        registers[0].type = Register::Type::BOOL;
+                        registers[0].b = idx.i == 0;
+                        instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
+                        LIQUID_NEXT();
+                    }
+                    getStack(sequence, -7);
+                    getStack(start, -6);
+                    getStack(reversed, -4);
+                    long long position = reversed.b ? end.i - (idx.i - start.i) : idx.i;
+                    element.type = Register::Type::NIL;
+                    if (sequence.type == Register::Type::VARIANT) {
+                        referenceRegister(element, static_cast<const Variant*>(sequence.pointer)->a[position]);
+                    } else {
+                        void* variable;
+                        if (variableResolver.getArrayVariable(*this, sequence.pointer, position, &variable))
+                            resolveRegister(element, Variable({ variable }));
+                    }
+                    popStack(2);
+                    if (!pushStack(idx) || !pushStack(element)) {
+                        error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+                        return false;
+                    }
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_BREAK): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    control = Renderer::Control::BREAK;
                     instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
-                } break;
-                case OP_OUTPUTMEM: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_OUTPUTMEM): {
                     operand = *((long long*)instructionPointer); instructionPointer += 2;
                     unsigned int len = *(unsigned int*)&code[operand];
-                    if (buffers.size()) {
-                        buffers.top().append((const char*)&code[operand+sizeof(unsigned int)], len);
-                    } else
-                        callback((const char*)&code[operand+sizeof(unsigned int)], len, data);
-                } break;
-                case OP_INVERT: {
-                    bool isTrue = false;
-                    switch (registers[target].type) {
-                        case Register::Type::INT:
-                            isTrue = registers[target].i;
-                        break;
-                        case Register::Type::BOOL:
-                            isTrue = registers[target].b;
-                        break;
-                        case Register::Type::SHORT_STRING:
-                            isTrue = registers[target].length > 0;
-                        break;
-                        case Register::Type::NIL:
-                            isTrue = false;
-                        break;
-                        case Register::Type::FLOAT:
-                            isTrue = registers[target].f;
-                        break;
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
-                        case Register::Type::VARIABLE:
-                        break;
-                    }
+                    output((const char*)&code[operand+sizeof(unsigned int)], len);
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_INVERT): {
+                    bool isTrue = isTruthy(registers[target]);
                     registers[target].type = Register::Type::BOOL;
                     registers[target].b = !isTrue;
-                } break;
-                case OP_OUTPUT: {
-                    // This could potentially be made *way* more efficient.
-                    auto output = [this, data, callback](const char* str, size_t len){
-                        if (buffers.size())
-                            buffers.top().append(str, len);
-                        else
-                            callback(str, len, data);
-                    };
-                    switch (registers[target].type) {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_OUTPUT): {
+                    Register& reg = registers[target];
+                    switch (reg.type) {
                         case Register::Type::INT: {
                             char buffer[32];
-                            itoa(registers[target].i, buffer);
-                            output(buffer, strlen(buffer));
+                            int len = snprintf(buffer, sizeof(buffer), "%lld", reg.i);
+                            output(buffer, len);
                         } break;
                         case Register::Type::BOOL:
-                            if (registers[target].b)
+                            if (reg.b)
                                 output("true", 4);
                             else
                                 output("false", 5);
                         break;
                         case Register::Type::SHORT_STRING:
-                            output(registers[target].buffer, registers[target].length);
+                            output(reg.buffer, reg.length);
+                        break;
+                        case Register::Type::LONG_STRING:
+                            output(reg.str, reg.size);
                         break;
                         case Register::Type::FLOAT: {
-                            char buffer[32];
-                            size_t len = sprintf(buffer, "%g", registers[target].f);
-                            output(buffer, len);
+                            string s = Variant(reg.f).getString();
+                            output(s.data(), s.size());
                         } break;
+                        case Register::Type::VARIANT:
                         case Register::Type::VARIABLE: {
-                            if (registers[target].pointer) {
-                                long long len = variableResolver.getStringLength(LiquidRenderer { this }, registers[target].pointer);
-                                if (len > 0) {
-                                    if (len < 4096) {
-                                        char buffer[4096];
-                                        variableResolver.getString(LiquidRenderer { this }, registers[target].pointer, buffer);
-                                        output(buffer, len);
-                                    } else {
-                                        vector<char> buffer;
-                                        buffer.resize(len);
-                                        variableResolver.getString(LiquidRenderer { this }, registers[target].pointer, &buffer[0]);
-                                        output(buffer.data(), len);
-                                    }
-                                }
-                            }
+                            string s = getString(getNode(reg));
+                            output(s.data(), s.size());
                         } break;
-                        case Register::Type::NIL: break;
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
-                            assert(false);
-                        break;
-                    }
-                } break;
-                case OP_JMPTRUE: {
-                case OP_JMPFALSE:
-                    bool isTrue = true;
-                    operand = *((long long*)instructionPointer); instructionPointer += 2;
-                    switch (registers[target].type) {
-                        case Register::Type::INT:
-                            isTrue = registers[target].i;
-                        break;
-                        case Register::Type::BOOL:
-                            isTrue = registers[target].b;
-                        break;
-                        case Register::Type::SHORT_STRING:
-                            isTrue = registers[target].length > 0;
-                        break;
                         case Register::Type::NIL:
-                            isTrue = false;
-                        break;
-                        case Register::Type::FLOAT:
-                            isTrue = registers[target].f;
-                        break;
-                        case Register::Type::VARIABLE:
-                            isTrue = registers[target].pointer;
-                        break;
-                        case Register::Type::LONG_STRING:
-                        case Register::Type::EXTRA_LONG_STRING:
                         break;
                     }
-                    if (opCode == OP_JMPFALSE)
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_JMPTRUE):
+                LIQUID_OPCODE(OP_JMPFALSE): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    bool isTrue = isTruthy(registers[target]);
+                    if ((instruction & 0xFF) == OP_JMPFALSE)
                         isTrue = !isTrue;
                     if (isTrue)
                         instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
-                } break;
-                case OP_PUSHBUFFER: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_EQLJMPFALSE):
+                LIQUID_OPCODE(OP_EQLJMPTRUE): {
+                    operand = *((long long*)instructionPointer); instructionPointer += 2;
+                    bool isEqual = registersEqual(registers[target], registers[0]);
+                    registers[0].type = Register::Type::BOOL;
+                    registers[0].b = isEqual;
+                    if (isEqual == ((instruction & 0xFF) == OP_EQLJMPTRUE))
+                        instructionPointer = reinterpret_cast<const unsigned int*>(&code[operand]);
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_PUSHBUFFER): {
                     buffers.push(string());
-                } break;
-                case OP_POPBUFFER: {
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_POPBUFFER): {
                     pushRegister(registers[target], move(buffers.top()));
                     buffers.pop();
-                } break;
-                case OP_EXIT:
+                } LIQUID_NEXT();
+                LIQUID_OPCODE(OP_EXIT):
                     assert(stackPointer == stackBlock);
                     return false;
                 default:
@@ -888,88 +1704,120 @@ namespace Liquid {
                 break;
             }
         }
+        #undef LIQUID_OPCODE
+        #undef LIQUID_NEXT
     }
 
     void Interpreter::renderTemplate(const Program& prog, Variable store, void (*callback)(const char* chunk, size_t len, void* data), void* data) {
         mode = Renderer::ExecutionMode::INTERPRETER;
-        instructionPointer = reinterpret_cast<const unsigned int*>(&prog.code[prog.codeOffset]);
+        error = LIQUID_RENDERER_ERROR_TYPE_NONE;
+        control = Renderer::Control::NONE;
+        heap.clear();
+        // The C API keeps its output buffer at the bottom of this stack; anything above that belongs to this render.
+        size_t outerBuffers = buffers.size();
+        instructionPointer = reinterpret_cast<const unsigned int*>(&prog.getCode()[prog.codeOffset]);
         stackPointer = stackBlock;
-        run(prog.code.data(), store, callback, data);
+        symbols = prog.symbols.data();
+        symbolCount = prog.symbols.size();
+        dataSegmentEnd = (const char*)prog.getCode() + prog.codeOffset;
+        if (inlineCaches.size() < prog.inlineCaches)
+            inlineCaches.resize(prog.inlineCaches, LiquidInlineCache { 0, 0 });
+        BudgetScope budgetScope(*this);
+        bool profiling = profiler && !profiler->isRunning();
+        if (profiling)
+            profiler->start(*this);
+        try {
+            run(prog.getCode(), store, callback, data);
+        } catch (...) {
+            if (profiling)
+                profiler->stop(*this);
+            throw;
+        }
+        if (profiling)
+            profiler->stop(*this);
+        while (buffers.size() > outerBuffers)
+            buffers.pop();
+        if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+            throw Renderer::Exception(Renderer::Error(error, Node()));
     }
 
 
     void OperatorNodeType::compile(Compiler& compiler, const Node& node) const {
-        int freeRegister = compiler.freeRegister;
         for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
             compiler.compileBranch(**it);
-            compiler.add(OP_PUSH, freeRegister);
-            compiler.freeRegister = freeRegister;
+            compiler.addPush(0x0);
         }
-        compiler.add(OP_MOVINT, compiler.freeRegister, node.children.size());
-        compiler.add(OP_CALL, compiler.freeRegister, (long long)this);
-        compiler.freeRegister = 1;
+        compiler.addCall(this, node.children.size());
     }
 
     void Context::ConcatenationNode::compile(Compiler& compiler, const Node& node) const {
         for (auto& child : node.children) {
             if (child->type) {
                 compiler.compileBranch(*child.get());
-            } else {
-                assert(child->variant.type == Variant::Type::STRING);
+            } else if (child->variant.type == Variant::Type::STRING) {
                 int offset = compiler.add(child->variant.s.data(), child->variant.s.size());
                 compiler.add(OP_OUTPUTMEM, 0x0, offset);
+            } else {
+                compiler.compileBranch(*child.get());
+                compiler.add(OP_OUTPUT, 0x0);
             }
         }
     }
 
     void Context::ArgumentNode::compile(Compiler& compiler, const Node& node) const {
-        for (auto& child : node.children) {
-            compiler.compileBranch(*child.get());
-            compiler.add(OP_PUSH, compiler.freeRegister - 1);
+        // Backwards, so the first argument ends up nearest the top of the stack.
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+            compiler.compileBranch(**it);
+            compiler.addPush(0x0);
         }
     }
 
+    void Context::ArrayLiteralNode::compile(Compiler& compiler, const Node& node) const {
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+            compiler.compileBranch(**it);
+            compiler.addPush(0x0);
+        }
+        compiler.addCall(this, node.children.size());
+    }
+
+    void Context::UnknownFilterNode::compile(Compiler& compiler, const Node& node) const {
+        compiler.add(OP_MOVNIL, 0x0);
+    }
+
+    void FilterNodeType::QualifierNodeType::compile(Compiler& compiler, const Node& node) const {
+        compiler.add(OP_MOVNIL, 0x0);
+    }
+
 
     void Context::OutputNode::compile(Compiler& compiler, const Node& node) const {
         assert(node.children.size() == 1);
-        compiler.freeRegister = 0;
         compiler.compileBranch(*node.children[0].get()->children[0].get());
         compiler.add(OP_OUTPUT, 0x0);
-        compiler.freeRegister = 0;
     }
 
 
     void Context::VariableNode::compile(Compiler& compiler, const Node& node) const {
-        long long target = -1;
-
-        if (node.children.size() > 0 && node.children[0]->variant.type == Variant::Type::STRING) {
-            auto it = compiler.dropFrames.find(node.children[0]->variant.s);
+        if (node.children.size() > 0 && !node.children[0]->type && node.children[0]->variant.type == Variant::Type::STRING) {
+            auto it = compiler.dropFrames.find(node.children[0]->variant.getString());
             if (it != compiler.dropFrames.end() && it->second.size() > 0) {
                 it->second.back().first(compiler, it->second.back().second, node);
                 return;
             }
         }
-        for (size_t i = 0; i < node.children.size(); ++i) {
-            compiler.freeRegister = 0;
-            compiler.compileBranch(*node.children[i].get());
-            compiler.add(OP_RESOLVE, 0x0, target);
-            if (i < node.children.size() - 1) {
-                compiler.add(OP_MOV, 0x0, 0x1);
-                target = 0x1;
-            }
-        }
+        compiler.addResolve(node, 0, node.children.size());
     }
 
     void FilterNodeType::compile(Compiler& compiler, const Node& node) const {
         if (!userCompileFunction) {
-            for (int i = node.children.size() - 1; i >= 0; --i) {
-                compiler.compileBranch(*node.children[i].get());
-                if (i == 0)
-                    compiler.add(OP_PUSH, compiler.freeRegister - 1);
+            // The operand goes on top, with the arguments in order beneath it.
+            int arguments = 0;
+            if (node.children.size() > 1) {
+                arguments = node.children[1]->children.size();
+                compiler.compileBranch(*node.children[1].get());
             }
-            compiler.add(OP_MOVINT, compiler.freeRegister, node.children.size());
-            compiler.add(OP_CALL, compiler.freeRegister, (long long)this);
-            compiler.freeRegister = 1;
+            compiler.compileBranch(*node.children[0].get());
+            compiler.addPush(0x0);
+            compiler.addCall(this, arguments + 1);
         } else
             userCompileFunction(LiquidCompiler{&compiler}, LiquidNode{const_cast<Node*>(&node)}, userData);
     }
@@ -982,12 +1830,66 @@ namespace Liquid {
             userCompileFunction(LiquidCompiler{&compiler}, LiquidNode{const_cast<Node*>(&node)}, userData);
     }
 
+    void ContextBoundaryNode::compile(Compiler& compiler, const Node& node) const {
+        compiler.compileBody(*node.children[1].get());
+    }
+
+    // The hoisted values sit on the stack under the loop, for as long as it runs.
+    void Context::HoistNode::compile(Compiler& compiler, const Node& node) const {
+        size_t count = (node.children.size() - 1) / 2;
+        for (size_t i = 0; i < count; ++i) {
+            compiler.compileBranch(*node.children[i*2+1].get());
+            compiler.addPush(0x0);
+            compiler.addDropFrame(node.children[i*2]->children[0]->variant.getString(), +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
+                compiler.add(OP_STACK, 0x0, state.stackPoint - compiler.stackSize - 1);
+                compiler.addResolve(node, 1, node.children.size());
+                return 0;
+            });
+        }
+        compiler.compileBranch(*node.children.back().get());
+        for (size_t i = 0; i < count; ++i)
+            compiler.clearDropFrame(node.children[i*2]->children[0]->variant.getString());
+        compiler.addPop(count);
+    }
+
+    // The program has no tree to look at, so each filter goes on the stack beneath the operand, in the order they're applied; its
+    // symbol, then how many arguments it has, then the arguments themselves.
+    void Context::FilterChainNode::compile(Compiler& compiler, const Node& node) const {
+        int entries = 0;
+        for (size_t i = node.children.size() - 1; i > 0; --i) {
+            const Node& arguments = *node.children[i]->children[1].get();
+            compiler.compileBranch(arguments);
+            compiler.add(OP_MOVINT, 0x0, arguments.children.size());
+            compiler.addPush(0x0);
+            compiler.add(OP_MOVINT, 0x0, compiler.addSymbol(node.children[i]->type));
+            compiler.addPush(0x0);
+            entries += arguments.children.size() + 2;
+        }
+        compiler.compileBranch(*node.children[0].get());
+        compiler.addPush(0x0);
+        compiler.addCall(this, entries + 1);
+    }
+
     void NodeType::compile(Compiler& compiler, const Node& node) const {
         if (!userCompileFunction) {
-            for (auto& child : node.children)
-                compiler.compileBranch(*child.get());
-            compiler.add(OP_CALL, 0x0, (long long)this);
-            compiler.freeRegister = 1;
+            if (type == Type::TAG) {
+                // Tags only get their arguments, laid out the same way as a filter's, with nothing in the operand's place. Whatever they return is output.
+                int arguments = 0;
+                if (node.children.size() > 0 && node.children[0]->type && node.children[0]->type->type == Type::ARGUMENTS) {
+                    arguments = node.children[0]->children.size();
+                    compiler.compileBranch(*node.children[0].get());
+                }
+                compiler.add(OP_MOVNIL, 0x0);
+                compiler.addPush(0x0);
+                compiler.addCall(this, arguments + 1);
+                compiler.add(OP_OUTPUT, 0x0);
+            } else {
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                    compiler.compileBranch(**it);
+                    compiler.addPush(0x0);
+                }
+                compiler.addCall(this, node.children.size());
+            }
         } else
             userCompileFunction(LiquidCompiler{&compiler}, LiquidNode{const_cast<Node*>(&node)}, userData);
     }
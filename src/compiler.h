@@ -5,18 +5,22 @@
 #include <stack>
 #include <unordered_map>
 #include <string>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
 
 #include "common.h"
 #include "renderer.h"
 
 namespace Liquid {
-
+    struct Parser;
 
     // Liquid is primarily unary operations on things with filters. So we have a primary register which most things occupy, and then the stack where everything that is not in primary position is affecte dby.
     // When referring to an operand, the return register is always 0x0, and anything else is that 4-byte position in the code array.
     // Every OP code has 2 operands.
     // Register 0, is known as the "return" register. As much work as possible is done in this memory, and basically all operations will assume
-    // that this register is what's returning from any given thing.
+    // that this register is what's returning from any given thing. Every expression compiles down to code that leaves its value in 0x0.
     enum OPCode {
         OP_MOV,         // Copies one register to another.
         OP_MOVSTR,      // Pushes the operand from memory into the register.
@@ -29,6 +33,7 @@ namespace Liquid {
         OP_POP,         // Moves the stack point back to the preivous variable.
         OP_ADD,         // Adds regsiter 0x0 and the target register.
         OP_SUB,         // Subtracts the target register from 0x0.
+        OP_MOD,         // Takes 0x0 modulo the target register.
         OP_EQL,         // Checks whether the register is equal to register 0x0.
         OP_OUTPUT,      // Takes the return register, and appends it to the selected output buffer.
         OP_OUTPUTMEM,   // Takes the targeted memory address, and appends it to the selected output buffer. Optimized version of OP_OUTPUT to reduce copying.
@@ -36,10 +41,16 @@ namespace Liquid {
         OP_JMP,         // Unconditional jump.
         OP_JMPFALSE,    // Jumps to the instruction if primary register is false.
         OP_JMPTRUE,     // Jumps to the instruction if the priamry register is true.
-        OP_CALL,        // Calls the function specified with the amount of arugments on the stack.
-        OP_RESOLVE,     // Resovles the named variable in the register and places it into the same register. Operand is either 0x0, for the top-level context, or a register, which contains the context for the next deference.,
+        OP_EQLJMPFALSE, // OP_EQL, followed by an OP_JMPFALSE.
+        OP_EQLJMPTRUE,  // OP_EQL, followed by an OP_JMPTRUE.
+        OP_CALL,        // Calls the function specified with the amount of arugments on the stack; the count is the target. Pops the arguments.
+        OP_RESOLVE,     // Resovles the named variable in the register and places it into the same register. Operand is either -1, for the top-level context, or a register, which contains the context for the next deference.,
+        OP_RESOLVEPATH, // Resolves the list of keys at the operand, a list of the keys' offsets in memory, from the top-level context, into the target register.
+                        // For both, the top 32 bits of the operand are the instruction's first inline cache; OP_RESOLVEPATH has one for each key.
         OP_LENGTH,      // Gets the length of the specified variable held in the target register, and puts it into 0x0.
-        OP_ITERATE,     // Iterates through the variable in the specified register, and pops the value into 0x0. If iteration is over, JMPs to the specified instruction.
+        OP_LOOP,        // Sets up the loop frame on top of the stack for the OP_ITERATE that follows. JMPs to the specified instruction if there's nothing to iterate over.
+        OP_ITERATE,     // Moves the loop whose frame is on top of the stack on to its next element. JMPs to the specified instruction when done.
+        OP_BREAK,       // Ends the current iteration of the loop, and the loop itself; the operand is the loop's OP_ITERATE.
         OP_INVERT,      // Coerces to a boolean
         OP_PUSHBUFFER,  // Pushes a buffer onto to the buffer stack, with the contents of the target register.
         OP_POPBUFFER,   // Pops a buffer off the buffer stack, flushing the contents of the buffer to the target register.
@@ -47,21 +58,43 @@ namespace Liquid {
     };
 
     bool hasOperand(OPCode opcode);
+    bool isJump(OPCode opcode);
     const char* getSymbolicOpcode(OPCode opcode);
 
     // Entrypoint is always codeOffset.
     // Then comes the data segment, where all strings are located.
     // Then comes the actual code segment.
+    // OP_CALL refers to the node type it calls by its index in symbols, in the low half of its operand, so that a program can be written out,
+    // and loaded back into any context that has the same node types registered. The high half is where in the source it was called from.
     struct Program {
+        // Bumped whenever the instruction set or the layout of saved programs change; programs saved by other versions won't load.
+        static constexpr unsigned int VERSION = 4;
+
         unsigned int codeOffset;
         std::vector<unsigned char> code;
+        std::vector<const NodeType*> symbols;
+        // How many inline caches the interpreter needs to keep for the program.
+        unsigned int inlineCaches = 0;
+        // Loaded programs are run straight from the mapped file, and leave code empty.
+        shared_ptr<void> mapping;
+        const unsigned char* mappedCode = nullptr;
+        size_t mappedSize = 0;
+
+        const unsigned char* getCode() const { return mappedCode ? mappedCode : code.data(); }
+        size_t getSize() const { return mappedCode ? mappedSize : code.size(); }
+
+        // Both throw a Liquid::Exception describing what went wrong, if anything does.
+        void save(const Context& context, const std::string& path) const;
+        // Maps the file, rather than reading it; nothing's copied, other than the symbol table, which is looked up in the context.
+        static Program load(const Context& context, const std::string& path);
     };
 
     struct Compiler {
         std::vector<unsigned char> data;
         std::vector<unsigned char> code;
-        int freeRegister;
         std::unordered_map<long long, int> existingStrings;
+        std::vector<const NodeType*> symbols;
+        std::unordered_map<const NodeType*, int> symbolIndices;
 
         const Context& context;
         // For forloops, and the forloop vairables, amongst other things. Space should likely be allocated only when actually  needed.
@@ -81,6 +114,22 @@ namespace Liquid {
             dropFrames[name].pop_back();
         }
 
+        // The enclosing loops, innermost last; where their OP_ITERATE is, and how big the stack was there, for break and continue.
+        struct LoopState {
+            int iterateInstruction;
+            int stackSize;
+        };
+        std::vector<LoopState> loops;
+
+        // Fuses common sequences of instructions, and cleans up jumps, once a template's compiled.
+        bool peepholeOptimization = true;
+        // The node being compiled; calls are marked with where it is in the source.
+        const Node* compiling = nullptr;
+        // If set, includes of partials with static names are compiled in place, up to maximumInlinedPartialDepth partials deep.
+        PartialCache* partials = nullptr;
+        int maximumInlinedPartialDepth = 8;
+        int inlinedPartialDepth = 0;
+
         Compiler(const Context& context);
         ~Compiler();
 
@@ -90,12 +139,25 @@ namespace Liquid {
 
         int addPush(int target);
         int addPop(int amount);
+        // Calls the node type's render with the top `arguments` stack entries, popping them, and leaving the result in 0x0.
+        int addCall(const NodeType* type, int arguments);
+        // The index of the node type in the program's symbol table, adding it if it's not there yet.
+        int addSymbol(const NodeType* type);
+        // Resolves the parts of the variable node in [start, end); against the top-level store if start is 0, and otherwise against whatever
+        // variable is already in 0x0.
+        void addResolve(const Node& variableNode, size_t start, size_t end);
+        // Assigns the value on top of the stack to the variable the node describes, and pops it.
+        void addAssignment(const Node& variableNode);
 
         void modify(int offset, OPCode code, int target, long long operand);
         int currentOffset() const;
 
         // Called internally.
         int compileBranch(const Node& branch);
+        // Compiles the body of a tag, which is output. Bodies are concatenations, which output themselves, unless the optimizer has
+        // left one that was all literal as just the literal.
+        int compileBody(const Node& body);
+        void peephole();
         Program compile(const Node& tmpl);
 
         string disassemble(const Program& program);
@@ -111,8 +173,8 @@ namespace Liquid {
                 BOOL,
                 NIL,
                 SHORT_STRING,       // Inline, or in a register.
-                LONG_STRING,        // On stack. Up to 65k; short is multiplexed with the type info.
-                EXTRA_LONG_STRING,  // In memory.
+                LONG_STRING,        // Points into the program's data segment, the interpreter's heap, or a string borrowed from the variable resolver.
+                VARIANT,            // Points at a variant on the interpreter's heap, or inside one; arrays and the like.
                 VARIABLE            // 3rd party variable.
             };
 
@@ -126,6 +188,10 @@ namespace Liquid {
                     unsigned char length;
                     char buffer[SHORT_STRING_SIZE];
                 };
+                struct {
+                    const char* str;
+                    size_t size;
+                };
             };
         };
 
@@ -134,10 +200,40 @@ namespace Liquid {
         static constexpr int MAX_FRAMES = 128;
 
         stack<string> buffers;
+        // Anything a register points at that doesn't live in the program, or the variable store; cleared at the start of every render.
+        std::deque<Variant> heap;
 
         Register registers[TOTAL_REGISTERS];
         const unsigned int* instructionPointer;
         char* stackPointer;
+        // How many stack entries the OP_CALL in progress passed along.
+        int callArguments = 0;
+        // The symbol table of the program being run.
+        const NodeType* const* symbols = nullptr;
+        size_t symbolCount = 0;
+        // Where its data segment ends.
+        const char* dataSegmentEnd = nullptr;
+        // One for every lookup site in whatever program's being run; kept between renders, as whatever's in them is checked before it's used.
+        std::vector<LiquidInlineCache> inlineCaches;
+        size_t inlineCacheHits = 0;
+        size_t inlineCacheMisses = 0;
+
+        using Renderer::getDictionaryVariable;
+        bool getDictionaryVariable(Variable variable, const char* key, size_t length, size_t hash, LiquidInlineCache& cache, Variable& target) {
+            if (!variableResolver.getDictionaryVariableCached)
+                return Renderer::getDictionaryVariable(variable, key, length, hash, target);
+            switch (variableResolver.getDictionaryVariableCached(LiquidRenderer { this }, variable, key, length, hash ? hash : liquidHashKey(key, length), &cache, target)) {
+                case LIQUID_INLINE_CACHE_HIT:
+                    ++inlineCacheHits;
+                    return true;
+                case LIQUID_INLINE_CACHE_MISS:
+                    ++inlineCacheMisses;
+                    return true;
+                default:
+                    ++inlineCacheMisses;
+                    return false;
+            }
+        }
 
         int frames[MAX_FRAMES];
         char stackBlock[STACK_SIZE];
@@ -146,20 +242,117 @@ namespace Liquid {
         Interpreter(const Context& context, LiquidVariableResolver resolver);
         ~Interpreter();
 
-        // Should be used for conversions only, not for actual optimized code.
-        Node getStack(int i);
+        // Should be used for conversions only, not for actual optimized code. If borrow is set, long strings come back as views of wherever they are.
+        Node getStack(int i, bool borrow = false);
         void getStack(Register& reg, int i);
         void popStack(int i);
-        void pushStack(Register& reg);
+        bool pushStack(Register& reg);
         void pushRegister(Register& reg, const Node& node);
+        void pushRegister(Register& reg, Node&& node);
         void pushRegister(Register& reg, const string& str);
         void pushRegister(Register& reg, string&& str);
+        void pushRegister(Register& reg, const String& str);
+        // Points the register at a variant that will outlive it, rather than copying it.
+        void referenceRegister(Register& reg, const Variant& variant);
+        // Parses a third party variable into the register, the same way the renderer would; long strings are borrowed, if the resolver lets us.
+        void resolveRegister(Register& reg, Variable variable);
+        Node getNode(const Register& reg, bool borrow = false);
+        bool isTruthy(const Register& reg) const;
 
-        bool run(const unsigned char* code, Variable store, void (*callback)(const char* chunk, size_t len, void* data), void* data, const unsigned char* iteration = nullptr);
+        bool run(const unsigned char* code, Variable store, void (*callback)(const char* chunk, size_t len, void* data), void* data);
 
         void renderTemplate(const Program& tmpl, Variable store, void (*)(const char* chunk, size_t len, void* data), void* data);
         string renderTemplate(const Program& tmpl, Variable store);
     };
+
+    // Parsed templates (once optimized, if they're going to be), and compiled programs are never modified by rendering, so one copy can
+    // be shared between any number of threads, provided nothing parses into, optimizes, or frees it at the same time. Renderers and
+    // interpreters hold all of the state of a render in progress, and so must only ever be used by one thread at a time.
+    // The pool hands each thread its own interpreter, creating it the first time that thread asks, and freeing it when that thread exits.
+    struct RendererPool {
+        // What exiting threads free their interpreters through; cleared when the pool is destroyed, so that threads that outlive it
+        // leave it alone.
+        struct Registration {
+            std::mutex mutex;
+            RendererPool* pool;
+        };
+
+        const Context& context;
+        LiquidVariableResolver variableResolver;
+        // If set, called on every interpreter the pool creates; use it to set limits, strictness and the like.
+        void (*configure)(LiquidRenderer renderer, void* data) = nullptr;
+        void* configureData = nullptr;
+
+        std::mutex mutex;
+        std::unordered_map<std::thread::id, unique_ptr<Interpreter>> interpreters;
+        shared_ptr<Registration> registration;
+
+        RendererPool(const Context& context);
+        RendererPool(const Context& context, LiquidVariableResolver variableResolver);
+        RendererPool(const RendererPool&) = delete;
+        ~RendererPool();
+
+        // The calling thread's interpreter. Stays valid until the same thread calls release(), or exits, or the pool is destroyed.
+        Interpreter& get();
+        // Frees the calling thread's interpreter now, rather than when it exits.
+        void release();
+        size_t size();
+    };
+
+    // Parses and compiles each distinct template once, for as long as it stays among the most recently used. Entries are keyed on a hash of
+    // the source, the file name, and the context the parser belongs to, and are shared; holding one keeps it valid after it's been evicted.
+    // Lookups can come from any number of threads, each with its own parser and compiler.
+    struct TemplateCache {
+        struct Entry {
+            size_t hash;
+            const Context* context;
+            std::string file;
+            std::string source;
+            Node tmpl;
+            Program program;
+        };
+
+        size_t maxSize;
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<shared_ptr<const Entry>> entries;
+        std::unordered_map<size_t, std::list<shared_ptr<const Entry>>::iterator> index;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+
+        TemplateCache(size_t maxSize);
+
+        // Templates that don't parse aren't cached; this throws the parser's exception.
+        shared_ptr<const Entry> get(Parser& parser, Compiler& compiler, const char* source, size_t size, const std::string& file = "");
+        LiquidTemplateCacheStatistics getStatistics();
+        void clear();
+    };
+
+    // Where include, render and section get their partials; read through the file system the first time each is asked for, parsed, and
+    // kept until cleared, along with which weren't there. Shared by any number of renderers, optimizers and compilers, on any number of threads.
+    struct PartialCache {
+        struct Partial {
+            std::string name;
+            Node tmpl;
+            // How many nodes there are in it; the optimizer only inlines partials up to a certain size.
+            size_t size;
+        };
+
+        const Context& context;
+        LiquidFileSystem fileSystem;
+        std::mutex mutex;
+        // Null for partials the file system hasn't got.
+        std::unordered_map<std::string, shared_ptr<const Partial>> partials;
+        size_t hits = 0;
+        size_t misses = 0;
+
+        PartialCache(const Context& context, LiquidFileSystem fileSystem);
+
+        // Null if there's no such partial. Partials that don't parse aren't cached; this throws the parser's exception.
+        shared_ptr<const Partial> get(std::string_view name);
+        void clear();
+    };
 }
 
 #endif
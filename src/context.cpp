@@ -11,6 +11,8 @@ namespace Liquid {
     }
 
     bool Context::VariableNode::optimize(Optimizer& optimizer, Node& node, Variable store) const {
+        if (!optimizer.isFrozen(node))
+            return false;
         auto storePointer = optimizer.renderer.getVariable(node, store);
         if (!storePointer.first)
             return false;
@@ -27,51 +29,63 @@ namespace Liquid {
 
 
 
+    // Borrowed strings are copied out for anything that doesn't say it can deal with them.
+    static Node ownStrings(const NodeType* type, Node&& node) {
+        if (!type->borrowsStrings && !node.type && node.variant.type == Variant::Type::STRING_VIEW)
+            return Node(node.variant.getString());
+        return move(node);
+    }
+
     Node OperatorNodeType::getOperand(Renderer& renderer, const Node& node, Variable store, int idx) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
-            return static_cast<Interpreter&>(renderer).getStack(-1 - idx);
+            return static_cast<Interpreter&>(renderer).getStack(-1 - idx, borrowsStrings);
         } else {
-            return renderer.retrieveRenderedNode(*node.children[idx].get(), store);
+            return ownStrings(this, renderer.retrieveRenderedNode(*node.children[idx].get(), store));
         }
     }
 
 
     Node FilterNodeType::getOperand(Renderer& renderer, const Node& node, Variable store) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
-            return static_cast<Interpreter&>(renderer).getStack(-1);
+            return static_cast<Interpreter&>(renderer).getStack(-1, borrowsStrings);
         } else {
-            return renderer.retrieveRenderedNode(*node.children[0].get(), store);
+            return ownStrings(this, renderer.retrieveRenderedNode(*node.children[0].get(), store));
         }
     }
 
 
     Node FilterNodeType::getArgument(Renderer& renderer, const Node& node, Variable store, int idx) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
-            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1));
+            // The operand is the first thing passed along.
+            if (idx + 1 >= static_cast<Interpreter&>(renderer).callArguments)
+                return Node();
+            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1), borrowsStrings);
         } else {
             int offset = node.type->type == NodeType::Type::TAG ? 0 : 1;
             if (idx >= (int)node.children[offset]->children.size())
                 return Node();
             assert(node.children[offset]->type->type == NodeType::Type::ARGUMENTS);
-            return renderer.retrieveRenderedNode(*node.children[offset]->children[idx].get(), store);
+            return ownStrings(this, renderer.retrieveRenderedNode(*node.children[offset]->children[idx].get(), store));
         }
     }
 
     Node DotFilterNodeType::getOperand(Renderer& renderer, const Node& node, Variable store) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER)
-            return static_cast<Interpreter&>(renderer).getStack(-1);
-        return renderer.retrieveRenderedNode(*node.children[0].get(), store);
+            return static_cast<Interpreter&>(renderer).getStack(-1, borrowsStrings);
+        return ownStrings(this, renderer.retrieveRenderedNode(*node.children[0].get(), store));
     }
 
     Node NodeType::getArgument(Renderer& renderer, const Node& node, Variable store, int idx) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
-            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1));
+            if (idx + 1 >= static_cast<Interpreter&>(renderer).callArguments)
+                return Node();
+            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1), borrowsStrings);
         } else {
             int offset = node.type->type == NodeType::Type::TAG ? 0 : 1;
             if (idx >= (int)node.children[offset]->children.size())
                 return Node();
             assert(node.children[offset]->type->type == NodeType::Type::ARGUMENTS);
-            return renderer.retrieveRenderedNode(*node.children[offset]->children[idx].get(), store);
+            return ownStrings(this, renderer.retrieveRenderedNode(*node.children[offset]->children[idx].get(), store));
         }
     }
     int NodeType::getArgumentCount(const Node& node) const {
@@ -82,11 +96,12 @@ namespace Liquid {
 
     Node NodeType::getChild(Renderer& renderer, const Node& node, Variable store, int idx) const {
         if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
-            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1));
+            return static_cast<Interpreter&>(renderer).getStack(-1 - (idx+1), borrowsStrings);
         } else {
             if (idx >= (int)node.children.size())
                 return Node();
-            return renderer.retrieveRenderedNode(*node.children[idx].get(), store);
+            // Children are asked for by value, so make sure nothing gets streamed out from underneath the caller.
+            return ownStrings(this, renderer.retrieveBufferedNode(*node.children[idx].get(), store));
         }
     }
     int NodeType::getChildCount(const Node& node) const {
@@ -94,6 +109,166 @@ namespace Liquid {
     }
 
 
+    Node Context::ArrayLiteralNode::render(Renderer& renderer, const Node& node, Variable store) const {
+        Variant var { std::vector<Variant>() };
+        if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
+            Interpreter& interpreter = static_cast<Interpreter&>(renderer);
+            var.a.reserve(interpreter.callArguments);
+            for (int i = 0; i < interpreter.callArguments; ++i)
+                var.a.push_back(move(interpreter.getStack(-1 - i).variant));
+            return Node(move(var));
+        }
+        var.a.reserve(node.children.size());
+        for (size_t i = 0; i < node.children.size(); ++i)
+            var.a.push_back(move(renderer.retrieveRenderedNode(*node.children[i].get(), store).variant));
+        return Node(move(var));
+    }
+
+    Node Context::HoistNode::render(Renderer& renderer, const Node& node, Variable store) const {
+        size_t count = (node.children.size() - 1) / 2;
+        vector<Node> values;
+        values.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            values.push_back(renderer.retrieveRenderedNode(*node.children[i*2+1].get(), store));
+        for (size_t i = 0; i < count; ++i)
+            renderer.pushInternalDrop(node.children[i*2]->children[0]->variant.getString(), { &values[i], &HoistNode::bind });
+        Node result = renderer.retrieveRenderedNode(*node.children.back().get(), store);
+        for (size_t i = 0; i < count; ++i)
+            renderer.popInternalDrop(node.children[i*2]->children[0]->variant.getString());
+        return result;
+    }
+
+    Node Context::HoistNode::bind(Renderer& renderer, const Node& node, Variable store, void* data) {
+        const Node& value = *static_cast<Node*>(data);
+        if (!node.type || node.children.size() <= 1)
+            return value;
+        // Properties of anything that isn't a variable are nil.
+        if (value.type || value.variant.type != Variant::Type::VARIABLE)
+            return Node();
+        auto variableInfo = renderer.getVariable(node, value.variant.v, 1);
+        if (!variableInfo.first)
+            return Node();
+        return Variant(variableInfo.second);
+    }
+
+    bool Context::FilterChainNode::getFilters(Renderer& renderer, const Node& node, Variable store, Node& operand, vector<Filter>& filters) const {
+        if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
+            // Compiled chains have no tree; each filter's symbol, argument count, and arguments are beneath the operand, in order.
+            Interpreter& interpreter = static_cast<Interpreter&>(renderer);
+            operand = interpreter.getStack(-1, borrowsStrings);
+            for (int offset = -2; offset >= -interpreter.callArguments; ) {
+                long long symbol = interpreter.getStack(offset).variant.getInt();
+                long long count = interpreter.getStack(offset - 1).variant.getInt();
+                offset -= 2;
+                // Loaded programs only have their calls checked, so a bad symbol or count is caught here.
+                if (symbol < 0 || symbol >= (long long)interpreter.symbolCount || count < 0 || count > 2 || offset - count + 1 < -interpreter.callArguments)
+                    return false;
+                const NodeType* type = interpreter.symbols[symbol];
+                if (type->type != NodeType::Type::FILTER || !accepts(static_cast<const FilterNodeType*>(type), offset - count < -interpreter.callArguments))
+                    return false;
+                filters.push_back({ static_cast<const FilterNodeType*>(type), {} });
+                for (int j = 0; j < count; ++j)
+                    filters.back().arguments[j] = interpreter.getStack(offset - j, borrowsStrings);
+                offset -= count;
+            }
+        } else {
+            operand = ownStrings(this, renderer.retrieveRenderedNode(*node.children[0].get(), store));
+            filters.reserve(node.children.size() - 1);
+            for (size_t i = 1; i < node.children.size(); ++i) {
+                const Node& filter = *node.children[i].get();
+                filters.push_back({ static_cast<const FilterNodeType*>(filter.type), {} });
+                for (size_t j = 0; j < filter.children[1]->children.size() && j < 2; ++j)
+                    filters.back().arguments[j] = ownStrings(this, renderer.retrieveRenderedNode(*filter.children[1]->children[j].get(), store));
+            }
+        }
+        return !filters.empty();
+    }
+
+    Node Context::FilterChainNode::render(Renderer& renderer, const Node& node, Variable store) const {
+        Node operand;
+        vector<Filter> filters;
+        if (!getFilters(renderer, node, store, operand, filters))
+            return Node();
+        string str = renderer.getString(operand);
+        for (auto& filter : filters)
+            filter.type->transform(renderer, str, filter.arguments);
+        return Node(move(str));
+    }
+
+    Node Context::ArrayChainNode::render(Renderer& renderer, const Node& node, Variable store) const {
+        Node operand;
+        vector<Filter> filters;
+        if (!getFilters(renderer, node, store, operand, filters))
+            return Node();
+        const Filter& reducer = filters.back();
+        FilterNodeType::Reduction reduction;
+        bool iterated = renderer.forEachElement(operand.variant, [&renderer, &filters, &reducer, &reduction](Variant&& element) {
+            for (size_t i = 0; i < filters.size() - 1; ++i) {
+                if (!filters[i].type->step(renderer, element, filters[i].arguments))
+                    return true;
+            }
+            bool more = reducer.type->take(renderer, reduction, move(element), reducer.arguments);
+            ++reduction.count;
+            return more;
+        });
+        if (!iterated)
+            return Node();
+        reducer.type->finish(renderer, reduction, reducer.arguments);
+        return move(reduction.result);
+    }
+
+    static bool isBlock(const Node& node) {
+        return node.type && node.type->type == NodeType::Type::TAG && static_cast<const TagNodeType*>(node.type)->composition == TagNodeType::Composition::ENCLOSED;
+    }
+
+    // At the top level, runs of children that only read, with more than one block among them, are split up into pieces, each a block and
+    // whatever follows it up to the next, and rendered on the renderer's workers. Everything else is rendered here, in between, in order.
+    static Node renderParallelBlocks(Renderer& renderer, const Node& node, Variable store) {
+        string s;
+        size_t i = 0;
+        while (i < node.children.size() && renderer.error == LIQUID_RENDERER_ERROR_TYPE_NONE && renderer.control == Renderer::Control::NONE) {
+            vector<size_t> starts = { i };
+            size_t end = i;
+            bool hasBlock = false;
+            for (; end < node.children.size() && Renderer::isParallelizable(*node.children[end].get()); ++end) {
+                if (isBlock(*node.children[end].get())) {
+                    if (hasBlock)
+                        starts.push_back(end);
+                    hasBlock = true;
+                }
+            }
+            vector<string> output;
+            if (starts.size() > 1) {
+                starts.push_back(end);
+                output = renderer.renderParallel(starts.size() - 1, [&](Renderer& worker, size_t piece) {
+                    string s;
+                    for (size_t j = starts[piece]; j < starts[piece + 1] && worker.error == LIQUID_RENDERER_ERROR_TYPE_NONE; ++j)
+                        s.append(worker.retrieveRenderedNode(*node.children[j].get(), store).getString());
+                    return s;
+                });
+                i = end;
+            } else {
+                for (end = std::max(end, i + 1); i < end && renderer.error == LIQUID_RENDERER_ERROR_TYPE_NONE && renderer.control == Renderer::Control::NONE; ++i) {
+                    const Node& child = *node.children[i].get();
+                    if (renderer.sink)
+                        renderer.write(child.type ? renderer.retrieveRenderedNode(child, store) : child);
+                    else
+                        s.append(renderer.retrieveRenderedNode(child, store).getString());
+                }
+            }
+            for (auto& piece : output) {
+                if (renderer.sink)
+                    renderer.write(Node(move(piece)));
+                else
+                    s.append(piece);
+            }
+        }
+        --renderer.currentRenderingDepth;
+        if (renderer.sink || renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+            return Node();
+        return Node(move(s));
+    }
+
     Node Context::ConcatenationNode::render(Renderer& renderer, const Node& node, Variable store) const {
         if (++renderer.currentRenderingDepth > renderer.maximumRenderingDepth) {
             --renderer.currentRenderingDepth;
@@ -102,8 +277,24 @@ namespace Liquid {
         }
         if (node.children.size() == 1) {
             --renderer.currentRenderingDepth;
+            if (renderer.sink && !node.children.front()->type) {
+                renderer.write(*node.children.front().get());
+                return Node();
+            }
             return renderer.retrieveRenderedNode(*node.children.front().get(), store);
         }
+        if (renderer.currentRenderingDepth == 1 && renderer.canRenderParallel())
+            return renderParallelBlocks(renderer, node, store);
+        if (renderer.sink) {
+            // Streaming; literals go straight to the sink, and everything else writes whatever it doesn't stream itself.
+            for (auto& child : node.children) {
+                renderer.write(child->type ? renderer.retrieveRenderedNode(*child.get(), store) : *child.get());
+                if (renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE || renderer.control != Renderer::Control::NONE)
+                    break;
+            }
+            --renderer.currentRenderingDepth;
+            return Node();
+        }
         string s;
         for (auto& child : node.children) {
             s.append(renderer.retrieveRenderedNode(*child.get(), store).getString());
@@ -156,4 +347,44 @@ namespace Liquid {
             #endif
         }
     }
+
+    static void nameTagNodeTypes(std::unordered_map<const NodeType*, string>& names, const TagNodeType* type, const string& name) {
+        names[type] = name;
+        for (auto& it : type->intermediates)
+            nameTagNodeTypes(names, static_cast<const TagNodeType*>(it.second.get()), name + "/tag:" + it.first);
+        for (auto& it : type->qualifiers)
+            names[it.second.get()] = name + "/qualifier:" + it.first;
+        for (auto& it : type->operators)
+            names[it.second.get()] = name + "/operator:" + it.first;
+        for (auto& it : type->filters)
+            names[it.second.get()] = name + "/filter:" + it.first;
+    }
+
+    std::unordered_map<const NodeType*, string> Context::getNodeTypeNames() const {
+        std::unordered_map<const NodeType*, string> names;
+        for (auto& it : tagTypes)
+            nameTagNodeTypes(names, static_cast<const TagNodeType*>(it.second.get()), "tag:" + it.first);
+        for (auto& it : unaryOperatorTypes)
+            names[it.second.get()] = "unary:" + it.first;
+        for (auto& it : binaryOperatorTypes)
+            names[it.second.get()] = "binary:" + it.first;
+        for (auto& it : filterTypes)
+            names[it.second.get()] = "filter:" + it.first;
+        for (auto& it : dotFilterTypes)
+            names[it.second.get()] = "dot:" + it.first;
+        names[&concatenationNodeType] = "internal:concatenation";
+        names[&outputNodeType] = "internal:output";
+        names[&variableNodeType] = "internal:variable";
+        names[&groupNodeType] = "internal:group";
+        names[&groupDereferenceNodeType] = "internal:group_dereference";
+        names[&argumentNodeType] = "internal:arguments";
+        names[&unknownFilterNodeType] = "internal:unknown_filter";
+        names[&arrayLiteralNodeType] = "internal:array_literal";
+        names[&contextBoundaryNodeType] = "internal:context_boundary";
+        names[&hoistNodeType] = "internal:hoist";
+        names[&filterChainNodeType] = "internal:filter_chain";
+        names[&arrayChainNodeType] = "internal:array_chain";
+        names[&filterWildcardQualifierNodeType] = "internal:filter_wildcard_qualifier";
+        return names;
+    }
 }
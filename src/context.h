@@ -1,6 +1,8 @@
 #ifndef LIQUIDCONTEXT_H
 #define LIQUIDCONTEXT_H
 
+#include <algorithm>
+
 #include "common.h"
 #include "parser.h"
 #include "renderer.h"
@@ -9,6 +11,69 @@ namespace Liquid {
 
     struct Renderer;
 
+    // What the parser looks symbols up in, once for every tag, filter, operator and literal it comes across. Owns what's registered in
+    // it, like a map, and keeps a flat, open addressed table of it to one side, so that lookups are by view, and are a hash and, more often
+    // than not, a single probe, without a string being made, or a bucket chain being walked. Types are all registered while setting up
+    // dialects, and the table's only rebuilt then, as it grows; after that, it's only ever read, from any number of threads.
+    template <class T>
+    struct SymbolTable {
+        using Entries = std::unordered_map<string, unique_ptr<T>>;
+
+        struct Slot {
+            size_t hash = 0;
+            // Entries are nodes; they stay where they are as the map rehashes.
+            typename Entries::value_type* entry = nullptr;
+        };
+
+        Entries entries;
+        vector<Slot> slots;
+
+        static size_t hash(std::string_view symbol) { return std::hash<std::string_view>()(symbol); }
+
+        void insert(typename Entries::value_type* entry) {
+            size_t symbolHash = hash(entry->first);
+            size_t mask = slots.size() - 1;
+            size_t i = symbolHash & mask;
+            while (slots[i].entry)
+                i = (i + 1) & mask;
+            slots[i] = { symbolHash, entry };
+        }
+
+        // Kept at most half full.
+        void rebuild(size_t size) {
+            slots.assign(size, Slot());
+            for (auto& it : entries)
+                insert(&it);
+        }
+
+        unique_ptr<T>& operator [](const string& symbol) {
+            auto result = entries.try_emplace(symbol);
+            if (result.second) {
+                if (entries.size() * 2 > slots.size())
+                    rebuild(std::max<size_t>(16, slots.size() * 2));
+                else
+                    insert(&*result.first);
+            }
+            return result.first->second;
+        }
+
+        T* get(std::string_view symbol) const {
+            if (slots.empty())
+                return nullptr;
+            size_t symbolHash = hash(symbol);
+            size_t mask = slots.size() - 1;
+            for (size_t i = symbolHash & mask; slots[i].entry; i = (i + 1) & mask) {
+                if (slots[i].hash == symbolHash && slots[i].entry->first == symbol)
+                    return slots[i].entry->second.get();
+            }
+            return nullptr;
+        }
+
+        size_t size() const { return entries.size(); }
+        typename Entries::const_iterator begin() const { return entries.begin(); }
+        typename Entries::const_iterator end() const { return entries.end(); }
+    };
+
     struct LiteralType {
         string symbol;
         Variant value;
@@ -20,9 +85,9 @@ namespace Liquid {
         ContextualNodeType(NodeType::Type type, const std::string& symbol = "", int maxChildren = -1, LiquidOptimizationScheme scheme = LIQUID_OPTIMIZATION_SCHEME_NONE) : NodeType(type, symbol, maxChildren, scheme) { }
 
         // For operators that are internal to this tag.
-        unordered_map<string, unique_ptr<NodeType>> operators;
+        SymbolTable<NodeType> operators;
         // For filters specific to this tag.
-        unordered_map<string, unique_ptr<NodeType>> filters;
+        SymbolTable<NodeType> filters;
 
         // Used for registering intermedaites and qualiifers.
         template <class T>
@@ -54,7 +119,9 @@ namespace Liquid {
         struct QualifierNodeType : NodeType {
             enum class Arity {
                 NONARY,
-                UNARY
+                UNARY,
+                // Takes its operand straight after it, without a colon; like include's with.
+                UNARY_PREFIX
             };
             Arity arity;
 
@@ -63,13 +130,15 @@ namespace Liquid {
         };
 
         // For things like if/else, and whatnot. else is a free tag that sits inside the if statement.
-        unordered_map<string, unique_ptr<NodeType>> intermediates;
+        SymbolTable<NodeType> intermediates;
         // For things for the forloop; like reversed, limit, etc... Super stupid, but Shopify threw them in, and there you are.
-        unordered_map<string, unique_ptr<NodeType>> qualifiers;
+        SymbolTable<NodeType> qualifiers;
 
         Composition composition;
         int minArguments;
         int maxArguments;
+        // Whether the tag takes named arguments, like include's key: value; each is a wildcard qualifier, the same as a filter's.
+        bool allowsWildcardQualifiers = false;
 
         TagNodeType(Composition composition, string symbol, int minArguments = -1, int maxArguments = -1, LiquidOptimizationScheme optimization = LIQUID_OPTIMIZATION_SCHEME_FULL) : ContextualNodeType(NodeType::Type::TAG, symbol, -1, optimization), composition(composition), minArguments(minArguments), maxArguments(maxArguments) { }
 
@@ -150,6 +219,7 @@ namespace Liquid {
         struct QualifierNodeType : NodeType {
             QualifierNodeType() : NodeType(NodeType::Type::QUALIFIER, "", 1, LIQUID_OPTIMIZATION_SCHEME_NONE) { }
             Node render(Renderer& renderer, const Node& node, Variable store) const override { return Node(); }
+            void compile(Compiler& compiler, const Node& node) const override;
         };
         struct WildcardQualifierNodeType : QualifierNodeType {
             WildcardQualifierNodeType() { }
@@ -162,6 +232,28 @@ namespace Liquid {
         Node getArgument(Renderer& renderer, const Node& node, Variable store, int idx) const;
 
         void compile(Compiler& compiler, const Node& node) const override;
+
+        // Set by filters that only ever turn one string into another, and can do it to a string they're handed; runs of them are fused
+        // by the optimizer into a filter chain, which passes the one string down it. They take no more than two arguments, and get nil
+        // for any that weren't given.
+        bool transformsStrings = false;
+        virtual void transform(Renderer& renderer, string& str, const Node* arguments) const { }
+
+        // Set by array filters that go element by element; step is handed each element in turn, and returns whether it goes on, as it's
+        // been left. Runs of them that end in a filter that reduces an array are fused by the optimizer into an array chain, which hands
+        // each element straight down it, and so never gathers up the arrays in between.
+        bool streamsArrays = false;
+        virtual bool step(Renderer& renderer, Variant& element, const Node* arguments) const { return true; }
+        // Set by array filters that reduce an array to a single value. take is handed each element in turn, along with how many it's
+        // been handed before, and returns false once it's got all it needs; finish is called after the last.
+        struct Reduction {
+            Node result;
+            string str;
+            long long count = 0;
+        };
+        bool reducesArrays = false;
+        virtual bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const { return false; }
+        virtual void finish(Renderer& renderer, Reduction& reduction, const Node* arguments) const { }
     };
 
 
@@ -178,6 +270,7 @@ namespace Liquid {
             renderer.nodeContext = this;
             return renderer.retrieveRenderedNode(*node.children[1].get(), store);
         }
+        void compile(Compiler& compiler, const Node& node) const override;
     };
 
     struct Context {
@@ -196,6 +289,13 @@ namespace Liquid {
                 assert(node.children.size() == 1);
                 auto& argumentNode = node.children.front();
                 assert(argumentNode->children.size() == 1);
+                if (renderer.sink) {
+                    Node value = renderer.retrieveRenderedNode(*argumentNode->children[0].get(), store);
+                    if (value.variant.type == Variant::Type::VARIABLE)
+                        value = Variant(renderer.getString(value));
+                    renderer.write(value);
+                    return Node();
+                }
                 return Variant(renderer.getString(renderer.retrieveRenderedNode(*argumentNode->children[0].get(), store)));
             }
 
@@ -229,13 +329,41 @@ namespace Liquid {
         };
         struct ArrayLiteralNode : NodeType {
             ArrayLiteralNode() : NodeType(Type::ARRAY_LITERAL) { }
-            Node render(Renderer& renderer, const Node& node, Variable store) const override {
-                Variant var { std::vector<Variant>() };
-                var.a.reserve(node.children.size());
-                for (size_t i = 0; i < node.children.size(); ++i)
-                    var.a.push_back(move(renderer.retrieveRenderedNode(*node.children[i].get(), store).variant));
-                return Node(move(var));
-            }
+            Node render(Renderer& renderer, const Node& node, Variable store) const override;
+            void compile(Compiler& compiler, const Node& node) const override;
+        };
+        // Put in by the optimizer around a loop it's hoisted expressions out of. Its children are pairs of a variable and the expression it
+        // stands in for, followed by the loop; the expressions are worked out once, before the loop, and the variables read them back.
+        // Also put around inlined partials, to bind what they were included with.
+        struct HoistNode : NodeType {
+            HoistNode() : NodeType(Type::CONTEXTUAL, "", -1, LIQUID_OPTIMIZATION_SCHEME_NONE) { }
+            Node render(Renderer& renderer, const Node& node, Variable store) const override;
+            void compile(Compiler& compiler, const Node& node) const override;
+
+            // The drop for a variable bound to a worked out value, pointed to by data; anything past the variable's name is looked up in it.
+            static Node bind(Renderer& renderer, const Node& node, Variable store, void* data);
+        };
+        // Put in by the optimizer in place of a run of filters that transform strings. Its first child is the operand, and the rest are
+        // the filters, in the order they're applied, each with nil in place of its operand. Shielded, as the filters can't be rendered on their own.
+        struct FilterChainNode : NodeType {
+            FilterChainNode() : NodeType(Type::CONTEXTUAL, "", -1, LIQUID_OPTIMIZATION_SCHEME_SHIELD) { borrowsStrings = true; }
+            Node render(Renderer& renderer, const Node& node, Variable store) const override;
+            void compile(Compiler& compiler, const Node& node) const override;
+
+            struct Filter {
+                const FilterNodeType* type;
+                Node arguments[2];
+            };
+            // Works out the operand, and the arguments of each filter in the chain; false if a compiled chain isn't one this would've made.
+            bool getFilters(Renderer& renderer, const Node& node, Variable store, Node& operand, vector<Filter>& filters) const;
+            virtual bool accepts(const FilterNodeType* filter, bool last) const { return filter->transformsStrings; }
+        };
+        // The same, for a run of array filters that go element by element, and the filter that reduces what they leave. Arguments are
+        // owned, as they're read for every element.
+        struct ArrayChainNode : FilterChainNode {
+            ArrayChainNode() { borrowsStrings = false; }
+            Node render(Renderer& renderer, const Node& node, Variable store) const override;
+            bool accepts(const FilterNodeType* filter, bool last) const override { return last ? filter->reducesArrays : filter->streamsArrays; }
         };
 
         struct UnknownFilterNode : FilterNodeType {
@@ -246,6 +374,7 @@ namespace Liquid {
                     renderer.pushUnknownFilterWarning(node, store);
                 return Node();
             }
+            void compile(Compiler& compiler, const Node& node) const override;
         };
 
         EFalsiness falsiness = FALSY_FALSE;
@@ -261,12 +390,12 @@ namespace Liquid {
                     Node result = drop.second(renderer, node, store, drop.first);
                     if (result.type || result.variant.type != Variant::Type::VARIABLE)
                         return result;
-                    return Node(renderer.parseVariant(result.variant.v));
+                    return Node(renderer.parseVariant(result.variant.v, true));
                 } else {
                     auto variableInfo = renderer.getVariable(node, store);
                     if (!variableInfo.first)
                         return Node();
-                    return Node(renderer.parseVariant(variableInfo.second));
+                    return Node(renderer.parseVariant(variableInfo.second, true));
                 }
             }
 
@@ -274,12 +403,12 @@ namespace Liquid {
             void compile(Compiler& compiler, const Node& node) const override;
         };
 
-        unordered_map<string, unique_ptr<NodeType>> tagTypes;
-        unordered_map<string, unique_ptr<NodeType>> unaryOperatorTypes;
-        unordered_map<string, unique_ptr<NodeType>> binaryOperatorTypes;
-        unordered_map<string, unique_ptr<NodeType>> filterTypes;
-        unordered_map<string, unique_ptr<NodeType>> dotFilterTypes;
-        unordered_map<string, unique_ptr<LiteralType>> literalTypes;
+        SymbolTable<NodeType> tagTypes;
+        SymbolTable<NodeType> unaryOperatorTypes;
+        SymbolTable<NodeType> binaryOperatorTypes;
+        SymbolTable<NodeType> filterTypes;
+        SymbolTable<NodeType> dotFilterTypes;
+        SymbolTable<LiteralType> literalTypes;
 
         ConcatenationNode concatenationNodeType;
         OutputNode outputNodeType;
@@ -290,6 +419,9 @@ namespace Liquid {
         UnknownFilterNode unknownFilterNodeType;
         ArrayLiteralNode arrayLiteralNodeType;
         ContextBoundaryNode contextBoundaryNodeType;
+        HoistNode hoistNodeType;
+        FilterChainNode filterChainNodeType;
+        ArrayChainNode arrayChainNodeType;
         FilterNodeType::WildcardQualifierNodeType filterWildcardQualifierNodeType;
 
         const NodeType* getConcatenationNodeType() const { return &concatenationNodeType; }
@@ -301,6 +433,9 @@ namespace Liquid {
         const NodeType* getUnknownFilterNodeType() const { return &unknownFilterNodeType; }
         const NodeType* getArrayLiteralNodeType() const { return &arrayLiteralNodeType; }
         const NodeType* getContextBoundaryNodeType() const { return &contextBoundaryNodeType; }
+        const NodeType* getHoistNodeType() const { return &hoistNodeType; }
+        const NodeType* getFilterChainNodeType() const { return &filterChainNodeType; }
+        const NodeType* getArrayChainNodeType() const { return &arrayChainNodeType; }
         const NodeType* getFilterWildcardQualifierNodeType() const { return &filterWildcardQualifierNodeType; }
 
         NodeType* registerType(unique_ptr<NodeType> type) {
@@ -343,45 +478,17 @@ namespace Liquid {
         }
         template <class T> T* registerType() { return static_cast<T*>(registerType(make_unique<T>())); }
 
-        const TagNodeType* getTagType(string symbol) const {
-            auto it = tagTypes.find(symbol);
-            if (it == tagTypes.end())
-                return nullptr;
-            return static_cast<TagNodeType*>(it->second.get());
-        }
-        const OperatorNodeType* getBinaryOperatorType(string symbol) const {
-            auto it = binaryOperatorTypes.find(symbol);
-            if (it == binaryOperatorTypes.end())
-                return nullptr;
-            return static_cast<OperatorNodeType*>(it->second.get());
-        }
-
-        const OperatorNodeType* getUnaryOperatorType(string symbol) const {
-            auto it = unaryOperatorTypes.find(symbol);
-            if (it == unaryOperatorTypes.end())
-                return nullptr;
-            return static_cast<OperatorNodeType*>(it->second.get());
-        }
-
-        const FilterNodeType* getFilterType(string symbol) const {
-            auto it = filterTypes.find(symbol);
-            if (it == filterTypes.end())
-                return nullptr;
-            return static_cast<FilterNodeType*>(it->second.get());
-        }
-        const DotFilterNodeType* getDotFilterType(string symbol) const {
-            auto it = dotFilterTypes.find(symbol);
-            if (it == dotFilterTypes.end())
-                return nullptr;
-            return static_cast<DotFilterNodeType*>(it->second.get());
-        }
-
-        const LiteralType* getLiteralType(string symbol) const {
-            auto it = literalTypes.find(symbol);
-            if (it == literalTypes.end())
-                return nullptr;
-            return static_cast<LiteralType*>(it->second.get());
-        }
+        const TagNodeType* getTagType(std::string_view symbol) const { return static_cast<const TagNodeType*>(tagTypes.get(symbol)); }
+        const OperatorNodeType* getBinaryOperatorType(std::string_view symbol) const { return static_cast<const OperatorNodeType*>(binaryOperatorTypes.get(symbol)); }
+        const OperatorNodeType* getUnaryOperatorType(std::string_view symbol) const { return static_cast<const OperatorNodeType*>(unaryOperatorTypes.get(symbol)); }
+        const FilterNodeType* getFilterType(std::string_view symbol) const { return static_cast<const FilterNodeType*>(filterTypes.get(symbol)); }
+        const DotFilterNodeType* getDotFilterType(std::string_view symbol) const { return static_cast<const DotFilterNodeType*>(dotFilterTypes.get(symbol)); }
+        const LiteralType* getLiteralType(std::string_view symbol) const { return literalTypes.get(symbol); }
+
+        // Names every node type the context knows about, including the ones that only exist inside tags; i.e. "tag:for/operator:in".
+        // Any two contexts with the same dialects and extensions registered name their types the same way, so saved programs refer to
+        // node types by name, rather than by address.
+        std::unordered_map<const NodeType*, string> getNodeTypeNames() const;
 
         void optimize(Node& ast, Variable store);
 
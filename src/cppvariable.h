@@ -219,6 +219,14 @@ namespace Liquid {
             );
         }
 
+        bool getStringView(const char** view, size_t* length) const {
+            if (type != LIQUID_VARIABLE_TYPE_STRING)
+                return false;
+            *view = s.data();
+            *length = s.size();
+            return true;
+        }
+
         bool getString(std::string& s) const  {
             switch (type) {
                 case LIQUID_VARIABLE_TYPE_STRING:
@@ -260,6 +268,28 @@ namespace Liquid {
             *variable = it->second.get();
             return true;
         }
+        // Dictionaries with the same number of buckets put any given key into the same bucket, so that's the shape, and the bucket's the slot.
+        LiquidInlineCacheResult getDictionaryVariable(const CPPVariable** variable, const char* key, size_t length, LiquidInlineCache& cache) const {
+            if (type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+                return LIQUID_INLINE_CACHE_NOT_FOUND;
+            if (cache.shape == d.bucket_count() && cache.slot < d.bucket_count()) {
+                for (auto it = d.begin(cache.slot); it != d.end(cache.slot); ++it) {
+                    if (it->first.size() == length && memcmp(it->first.data(), key, length) == 0) {
+                        *variable = it->second.get();
+                        return LIQUID_INLINE_CACHE_HIT;
+                    }
+                }
+            }
+            // Either the shape's changed, or the slot was left there by some other key; go look properly.
+            std::string name(key, length);
+            cache.shape = d.bucket_count();
+            cache.slot = d.bucket(name);
+            auto it = d.find(name);
+            if (it == d.end())
+                return LIQUID_INLINE_CACHE_NOT_FOUND;
+            *variable = it->second.get();
+            return LIQUID_INLINE_CACHE_MISS;
+        }
 
 
         CPPVariable* setDictionaryVariable(const std::string& key, CPPVariable* target)  {
@@ -314,7 +344,7 @@ namespace Liquid {
                 limit = (int)a.size() + limit + 1;
             if (start < 0)
                 start = 0;
-            int endIndex = std::min(start+limit-1, (int)a.size());
+            int endIndex = std::min(start+limit-1, (int)a.size()-1);
             if (reverse) {
                 for (int i = endIndex; i >= start; --i) {
                     if (!callback(a[i].get(), data))
@@ -391,6 +421,12 @@ namespace Liquid {
             freeVariable = +[](LiquidRenderer renderer, void* variable) { delete (CPPVariable*)variable;  };
 
             compare = +[](void* a, void* b) { return *static_cast<CPPVariable*>(a) < *static_cast<CPPVariable*>(b) ? -1 : 0; };
+            // The map hashes the key itself; this at least saves the strlen.
+            getDictionaryVariableHashed = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target) { return static_cast<CPPVariable*>(variable)->getDictionaryVariable((const CPPVariable**)target, std::string(key, length)); };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** view, size_t* length) { return static_cast<CPPVariable*>(variable)->getStringView(view, length); };
+            getDictionaryVariableCached = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, LiquidInlineCache* cache, void** target) { return static_cast<CPPVariable*>(variable)->getDictionaryVariable((const CPPVariable**)target, key, length, *cache); };
+            // Nothing's changed by reading.
+            threadSafeReads = true;
         }
     };
 
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <unordered_set>
 #include <functional>
+#include <limits>
 
 namespace Liquid {
 
@@ -59,12 +60,11 @@ namespace Liquid {
             auto& assignmentNode = argumentNode->children.front();
             auto& variableNode = assignmentNode->children.front();
             auto& valueNode = assignmentNode->children.back();
+            if (variableNode->type->type != NodeType::VARIABLE)
+                return;
             compiler.compileBranch(*valueNode.get());
-            compiler.add(OP_MOV, 0x0, 0x2);
-            compiler.add(OP_MOVNIL, 0x1);
-            compiler.compileBranch(*variableNode.get());
-            // The last instruction should be RESOLVE here, on 0x0. We take that instruction, and overwrite it with an ASSIGN, which will assign 0x0 to the targeted register.
-            compiler.modify(compiler.currentOffset() - (sizeof(int) + sizeof(long long)), OP_ASSIGN, 0x1, 0x2);
+            compiler.addPush(0x0);
+            compiler.addAssignment(*variableNode.get());
         }
     };
 
@@ -76,7 +76,7 @@ namespace Liquid {
             auto& argumentNode = node.children.front();
             auto& variableNode = argumentNode->children.front();
             if (variableNode->type->type == NodeType::VARIABLE) {
-                Variable targetVariable = renderer.variableResolver.createString(renderer, renderer.retrieveRenderedNode(*node.children[1].get(), store).getString().data());
+                Variable targetVariable = renderer.variableResolver.createString(renderer, renderer.retrieveBufferedNode(*node.children[1].get(), store).getString().data());
                 renderer.setVariable(*variableNode.get(), store, targetVariable);
             }
             return Node();
@@ -85,15 +85,38 @@ namespace Liquid {
         void compile(Compiler& compiler, const Node& node) const override {
             auto& argumentNode = node.children.front();
             auto& variableNode = argumentNode->children.front();
+            if (variableNode->type->type != NodeType::VARIABLE)
+                return;
             compiler.add(OP_PUSHBUFFER, 0x0);
-            compiler.compileBranch(*node.children[1].get());
-            compiler.add(OP_POPBUFFER, 0x2);
-            compiler.add(OP_MOVNIL, 0x1);
-            compiler.compileBranch(*variableNode.get());
-            // The last instruction should be RESOLVE here, on 0x0. We take that instruction, and overwrite it with an ASSIGN, which will assign 0x0 to the targeted register.
-            compiler.modify(compiler.currentOffset() - (sizeof(int) + sizeof(long long)), OP_ASSIGN, 0x1, 0x2);
-        }
-    };
+            compiler.compileBody(*node.children[1].get());
+            compiler.add(OP_POPBUFFER, 0x0);
+            compiler.addPush(0x0);
+            compiler.addAssignment(*variableNode.get());
+        }
+    };
+
+    // Shared by increment and decrement; only ever touches variables that are already integers.
+    static void compileCounter(Compiler& compiler, const Node& node, long long delta) {
+        auto& argumentNode = node.children.front();
+        auto& variableNode = argumentNode->children.front();
+        if (variableNode->type->type != NodeType::VARIABLE)
+            return;
+        compiler.addResolve(*variableNode.get(), 0, variableNode->children.size());
+        compiler.addPush(0x0);
+        // Only integers come out of a modulo as anything other than nil.
+        compiler.add(OP_MOVINT, 0x1, 1);
+        compiler.add(OP_MOD, 0x1);
+        compiler.add(OP_MOVNIL, 0x1);
+        compiler.add(OP_EQL, 0x1);
+        int notInteger = compiler.add(OP_JMPTRUE, 0x0, 0x0);
+        compiler.add(OP_STACK, 0x0, -1);
+        compiler.add(OP_MOVINT, 0x1, delta);
+        compiler.add(OP_ADD, 0x1);
+        compiler.addPush(0x0);
+        compiler.addAssignment(*variableNode.get());
+        compiler.modify(notInteger, OP_JMPTRUE, 0x0, compiler.currentOffset());
+        compiler.addPop(1);
+    }
 
     struct IncrementNode : TagNodeType {
         IncrementNode() : TagNodeType(Composition::FREE, "increment", 1, 1, LIQUID_OPTIMIZATION_SCHEME_NONE) { }
@@ -106,11 +129,13 @@ namespace Liquid {
                 if (targetVariable.first) {
                     long long i = -1;
                     if (renderer.variableResolver.getInteger(renderer, targetVariable.second,&i))
-                        renderer.setVariable(*variableNode.get(), targetVariable.second, renderer.variableResolver.createInteger(renderer, i+1));
+                        renderer.setVariable(*variableNode.get(), store, renderer.variableResolver.createInteger(renderer, i+1));
                 }
             }
             return Node();
         }
+
+        void compile(Compiler& compiler, const Node& node) const override { compileCounter(compiler, node, 1); }
     };
 
      struct DecrementNode : TagNodeType {
@@ -124,11 +149,13 @@ namespace Liquid {
                 if (targetVariable.first) {
                     long long i = -1;
                     if (renderer.variableResolver.getInteger(renderer, targetVariable.second,&i))
-                        renderer.setVariable(*variableNode.get(), targetVariable.second, renderer.variableResolver.createInteger(renderer, i-1));
+                        renderer.setVariable(*variableNode.get(), store, renderer.variableResolver.createInteger(renderer, i-1));
                 }
             }
             return Node();
         }
+
+        void compile(Compiler& compiler, const Node& node) const override { compileCounter(compiler, node, -1); }
     };
 
     struct CommentNode : TagNodeType {
@@ -140,11 +167,14 @@ namespace Liquid {
     struct RawNode : TagNodeType {
         RawNode() : TagNodeType(Composition::LEXING_HALT, "raw", 0, 0, LIQUID_OPTIMIZATION_SCHEME_PARTIAL) { }
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            if (renderer.sink) {
+                renderer.write(renderer.retrieveRenderedNode(*node.children[1].get(), store));
+                return Node();
+            }
             return renderer.retrieveRenderedNode(*node.children[1].get(), store);
         }
         void compile(Compiler& compiler, const Node& node) const override {
-            int offset = compiler.add(node.children[1]->variant.s.data(), node.children[1]->variant.s.size());
-            compiler.add(OP_OUTPUTMEM, 0x0, offset);
+            compiler.compileBody(*node.children[1].get());
         }
     };
 
@@ -185,8 +215,8 @@ namespace Liquid {
             // If it's false, prune it from the list.
             size_t target = 0;
             const TagNodeType* nodeType = static_cast<const TagNodeType*>(node.type);
-            auto it = nodeType->intermediates.find("else");
-            for (size_t i = 2; i < node.children.size() && node.children[i].get()->type != it->second.get(); i += 2) {
+            auto elseNodeType = nodeType->intermediates.get("else");
+            for (size_t i = 2; i < node.children.size() && node.children[i].get()->type != elseNodeType; i += 2) {
                 Node& argumentNode = *node.children[i]->children[0]->children[0].get();
                 if (!argumentNode.type) {
                     bool truthy = argumentNode.variant.isTruthy(optimizer.renderer.context.falsiness);
@@ -207,7 +237,7 @@ namespace Liquid {
                 }
             }
             if (target == 0)
-                node = node.children[node.children.size()-2].get()->type == it->second.get() ? move(*node.children[node.children.size()-1].get()) : Node();
+                node = node.children[node.children.size()-2].get()->type == elseNodeType ? move(*node.children[node.children.size()-1].get()) : Node();
             else
                 node.children.resize(target + (node.children.size() % 2));
             return true;
@@ -217,18 +247,18 @@ namespace Liquid {
             vector<int> endJumps;
             for (size_t i = 0; i < node.children.size(); i += 2) {
                 if (node.children[i]->type->symbol == "else") {
-                    compiler.compileBranch(*node.children[i+1].get());
+                    compiler.compileBody(*node.children[i+1].get());
                 } else {
-                    compiler.freeRegister = 0;
                     // Obviously child 0 is arguments, but subsequent children are tags, so we want to bypass arguments in both cases.
                     compiler.compileBranch(i == 0 ?
                         *node.children[i].get()->children[0].get() :
                         *node.children[i].get()->children[0].get()->children[0].get()
                     );
-                    if (INVERSE)
+                    // Only the condition on the tag itself is inverted; elsifs read the same as they do under an if.
+                    if (INVERSE && i == 0)
                         compiler.add(OP_INVERT, 0x0);
                     int conditionalFalseJump = compiler.add(OP_JMPFALSE, 0x0, 0x0);
-                    compiler.compileBranch(*node.children[i+1].get());
+                    compiler.compileBody(*node.children[i+1].get());
                     endJumps.push_back(compiler.add(OP_JMP, 0x0, 0x0));
                     compiler.modify(conditionalFalseJump, OP_JMPFALSE, 0x0, compiler.currentOffset());
                 }
@@ -311,10 +341,17 @@ namespace Liquid {
             Node render(Renderer& renderer, const Node& node, Variable store) const override {
                 return renderer.retrieveRenderedNode(*node.children[0]->children[0].get(), store);
             }
+            // Left for the case to decide; folding it would lose track of which child is a when.
+            bool optimize(Optimizer& optimizer, Node& node, Variable store) const override {
+                return true;
+            }
         };
         struct ElseNode : TagNodeType {
             ElseNode() : TagNodeType(Composition::FREE, "else", 0, 0) { }
             Node render(Renderer& renderer, const Node& node, Variable store) const override { return Node(); }
+            bool optimize(Optimizer& optimizer, Node& node, Variable store) const override {
+                return true;
+            }
         };
 
         CaseNode() : TagNodeType(Composition::ENCLOSED, "case", 1, 1, LIQUID_OPTIMIZATION_SCHEME_PARTIAL) {
@@ -327,7 +364,7 @@ namespace Liquid {
             auto& arguments = node.children.front();
             auto result = renderer.retrieveRenderedNode(*arguments->children.front().get(), store);
             assert(result.type == nullptr);
-            auto whenNodeType = intermediates.find("when")->second.get();
+            auto whenNodeType = intermediates.get("when");
             // Loop through the whens and elses.
             // Skip the first concatenation; it's not needed.
             for (size_t i = 2; i < node.children.size()-1; i += 2) {
@@ -342,35 +379,69 @@ namespace Liquid {
             return Node();
         }
 
+        // If what's being switched on is known, picks out the branch it'll take, as long as every when before it is known too.
+        bool optimize(Optimizer& optimizer, Node& node, Variable store) const override {
+            auto& arguments = node.children.front();
+            if (arguments->children.front()->type)
+                return false;
+            Variant value = arguments->children.front()->variant;
+            auto whenNodeType = intermediates.get("when");
+            for (size_t i = 2; i < node.children.size()-1; i += 2) {
+                if (node.children[i]->type == whenNodeType) {
+                    const Node& condition = *node.children[i]->children[0]->children[0].get();
+                    if (condition.type)
+                        return false;
+                    if (!(condition.variant == value))
+                        continue;
+                }
+                unique_ptr<Node> ptr = move(node.children[i+1]);
+                node = move(*ptr.get());
+                return true;
+            }
+            node = Node();
+            return true;
+        }
+
         void compile(Compiler& compiler, const Node& node) const override {
             assert(node.children.size() >= 2 && node.children.front()->type->type == NodeType::Type::ARGUMENTS);
             auto& arguments = node.children.front();
+            // The value being switched on waits on the stack, as working out each of the whens could use any register.
             compiler.compileBranch(*arguments->children.front().get());
-            compiler.add(OP_MOV, 0x0, 0x1);
-            compiler.freeRegister = 0;
+            compiler.addPush(0x0);
             vector<int> outsideJmps;
-            int lastJmp = -1;
-            auto whenNodeType = intermediates.find("when")->second.get();
+            auto whenNodeType = intermediates.get("when");
             for (size_t i = 2; i < node.children.size()-1; i += 2) {
-                if (lastJmp != -1)
-                    compiler.modify(lastJmp, OP_JMPFALSE, 0x0, compiler.currentOffset());
                 if (node.children[i]->type == whenNodeType) {
-                    compiler.freeRegister = 0;
                     compiler.compileBranch(*node.children[i]->children[0]->children[0].get());
+                    compiler.add(OP_STACK, 0x1, -1);
                     compiler.add(OP_EQL, 0x1);
-                    lastJmp = compiler.add(OP_JMPFALSE, 0x0, 0x0);
-                    compiler.compileBranch(*node.children[i+1].get());
+                    int nextJmp = compiler.add(OP_JMPFALSE, 0x0, 0x0);
+                    compiler.compileBody(*node.children[i+1].get());
                     outsideJmps.push_back(compiler.add(OP_JMP, 0x0, 0x0));
+                    compiler.modify(nextJmp, OP_JMPFALSE, 0x0, compiler.currentOffset());
                 } else {
-                    compiler.compileBranch(*node.children[i+1].get());
+                    compiler.compileBody(*node.children[i+1].get());
+                    break;
                 }
             }
             for (int i : outsideJmps)
                 compiler.modify(i, OP_JMP, 0x0, compiler.currentOffset());
+            compiler.addPop(1);
         }
     };
 
     struct ForNode : TagNodeType {
+        // Unwinds anything pushed since the innermost loop started its iteration, and heads back to its OP_ITERATE. The pop isn't tracked,
+        // as anything following us in the branch still gets compiled as if it'd be run.
+        static void compileLoopExit(Compiler& compiler, OPCode code) {
+            if (compiler.loops.empty())
+                return;
+            auto& loop = compiler.loops.back();
+            if (compiler.stackSize > loop.stackSize)
+                compiler.add(OP_POP, 0x0, compiler.stackSize - loop.stackSize);
+            compiler.add(code, 0x0, loop.iterateInstruction);
+        }
+
         struct InOperatorNode : OperatorNodeType {
             InOperatorNode() :  OperatorNodeType("in", Arity::BINARY, 0, Fixness::INFIX, LIQUID_OPTIMIZATION_SCHEME_SHIELD) { }
             Node render(Renderer& renderer, const Node& node, Variable store) const override { return Node(); }
@@ -387,6 +458,8 @@ namespace Liquid {
                 renderer.control = Renderer::Control::BREAK;
                 return Node();
             }
+
+            void compile(Compiler& compiler, const Node& node) const override { compileLoopExit(compiler, OP_BREAK); }
         };
 
         struct ContinueNode : TagNodeType {
@@ -395,6 +468,8 @@ namespace Liquid {
                 renderer.control = Renderer::Control::CONTINUE;
                 return Node();
             }
+
+            void compile(Compiler& compiler, const Node& node) const override { compileLoopExit(compiler, OP_JMP); }
         };
 
         struct ReverseQualifierNode : TagNodeType::QualifierNodeType {
@@ -430,20 +505,160 @@ namespace Liquid {
                     return renderer.retrieveRenderedNode(*arguments->children[static_cast<ForLoopContext*>(internalDrop.first)->idx % arguments->children.size()].get(), store);
                 return Node();
             }
+
+            void compile(Compiler& compiler, const Node& node) const override {
+                auto& arguments = node.children.front();
+                auto it = compiler.dropFrames.find("forloop");
+                if (it == compiler.dropFrames.end() || it->second.size() == 0)
+                    return;
+                int negativeOffset = it->second.back().second.stackPoint - compiler.stackSize;
+                int count = arguments->children.size();
+                compiler.add(OP_STACK, 0x0, negativeOffset - 2);
+                compiler.add(OP_MOVINT, 0x1, count);
+                compiler.add(OP_MOD, 0x1);
+                compiler.addPush(0x0);
+                vector<int> endJmps;
+                for (int i = 0; i < count; ++i) {
+                    int nextJmp = -1;
+                    if (i < count - 1) {
+                        compiler.add(OP_STACK, 0x1, -1);
+                        compiler.add(OP_MOVINT, 0x0, i);
+                        compiler.add(OP_EQL, 0x1);
+                        nextJmp = compiler.add(OP_JMPFALSE, 0x0, 0x0);
+                    }
+                    compiler.compileBranch(*arguments->children[i].get());
+                    compiler.add(OP_OUTPUT, 0x0);
+                    if (nextJmp != -1) {
+                        endJmps.push_back(compiler.add(OP_JMP, 0x0, 0x0));
+                        compiler.modify(nextJmp, OP_JMPFALSE, 0x0, compiler.currentOffset());
+                    }
+                }
+                for (int i : endJmps)
+                    compiler.modify(i, OP_JMP, 0x0, compiler.currentOffset());
+                compiler.addPop(1);
+            }
         };
 
         const NodeType* reversedQualifier;
         const NodeType* limitQualifier;
         const NodeType* offsetQualifier;
 
-        ForNode() : TagNodeType(Composition::ENCLOSED, "for", 1, -1) {
+        ForNode() : TagNodeType(Composition::ENCLOSED, "for", 1, -1, LIQUID_OPTIMIZATION_SCHEME_PARTIAL) {
             registerType<ElseNode>();
             reversedQualifier = registerType<ReverseQualifierNode>();
             limitQualifier = registerType<LimitQualifierNode>();
             offsetQualifier = registerType<OffsetQualifierNode>();
         }
 
+        // Loops that read nothing but frozen variables, and their own, are rendered out whole; otherwise, whatever in the body doesn't
+        // change from one iteration to the next is worked out before the loop starts.
+        bool optimize(Optimizer& optimizer, Node& node, Variable store) const override {
+            if (!optimizer.isFrozenBranch(node)) {
+                optimizer.hoistInvariants(node, 1);
+                return true;
+            }
+            node = render(optimizer.renderer, node, store);
+            return true;
+        }
+
 
+        static Node forLoopDrop(Renderer& renderer, const Node& node, Variable store, void* data) {
+            ForLoopContext* forLoopContext = (ForLoopContext*)data;
+            // Literal properties, and the symbols of dot filters, are read where they are.
+            string rendered;
+            std::string_view property;
+            if (node.type) {
+                if (node.children.size() == 2) {
+                    const Node& key = *node.children[1].get();
+                    if (!key.type && key.variant.isString())
+                        property = key.variant.getStringView();
+                    else
+                        property = rendered = renderer.retrieveRenderedNode(key, store).getString();
+                }
+            } else if (node.variant.isString()) {
+                property = node.variant.getStringView();
+            }
+            if (!property.empty()) {
+                if (property == "index0")
+                    return Variant(forLoopContext->idx);
+                if (property == "index")
+                    return Variant(forLoopContext->idx+1);
+                if (property == "rindex")
+                    return Variant(forLoopContext->length - (forLoopContext->idx+1));
+                if (property == "rindex0")
+                    return Variant(forLoopContext->length - forLoopContext->idx);
+                if (property == "first")
+                    return Variant(forLoopContext->idx == 0);
+                if (property == "last")
+                    return Variant(forLoopContext->idx == forLoopContext->length-1);
+                if (property == "length")
+                    return Variant(forLoopContext->length);
+            }
+            return Node();
+        }
+        static Node elementDrop(Renderer& renderer, const Node& node, Variable store, void* data) {
+            ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
+            const Variant& element = *(Variant*)forLoopContext.variable;
+            // Arrays made by filters can hold the resolver's variables, whose properties are looked up the same way as any other element's.
+            if (element.type == Variant::Type::VARIABLE) {
+                auto variableInfo = renderer.getVariable(node, element.v, 1);
+                if (!variableInfo.first)
+                    return Node();
+                return Variant(variableInfo.second);
+            }
+            return Variant(element);
+        }
+        static Node variableElementDrop(Renderer& renderer, const Node& node, Variable store, void* data) {
+            ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
+            auto variableInfo = renderer.getVariable(node, Variable(forLoopContext.variable), 1);
+            // Properties the element doesn't have are nil.
+            if (!variableInfo.first)
+                return Node();
+            return Variant(variableInfo.second);
+        }
+
+        // Splits the iterations into runs of them, each rendered into its own output on one of the renderer's workers, with a forloop of its
+        // own, and puts the outputs back together in order.
+        Node renderParallel(Renderer& renderer, const Node& node, Variable store, const Variant& sequence, std::string_view variableName, int start, int limit, bool reversed, long long length) const {
+            vector<void*> elements;
+            if (sequence.type == Variant::Type::ARRAY) {
+                int endIndex = std::min(limit+start-1, (int)length-1);
+                for (int i = start; i <= endIndex; ++i)
+                    elements.push_back(const_cast<Variant*>(&sequence.a[i]));
+                if (reversed)
+                    std::reverse(elements.begin(), elements.end());
+            } else {
+                renderer.variableResolver.iterate(renderer, sequence.v.pointer, +[](void* variable, void* data) {
+                    static_cast<vector<void*>*>(data)->push_back(variable);
+                    return true;
+                }, &elements, start, limit, reversed);
+            }
+            // A few runs for each thread, so that those that finish early have something to steal.
+            size_t pieces = std::min(elements.size(), (renderer.workers->size() + 1) * 4);
+            bool array = sequence.type == Variant::Type::ARRAY;
+            vector<string> output = renderer.renderParallel(pieces, [&](Renderer& worker, size_t piece) {
+                size_t begin = elements.size() * piece / pieces, end = elements.size() * (piece + 1) / pieces;
+                ForLoopContext forLoopContext = { worker, node, store, nullptr, nullptr, length, "", start + (long long)begin };
+                worker.slots.push_back({ "forloop", { &forLoopContext, forLoopDrop } });
+                worker.slots.push_back({ variableName, { &forLoopContext, array ? elementDrop : variableElementDrop } });
+                for (size_t i = begin; i < end && worker.error == LIQUID_RENDERER_ERROR_TYPE_NONE; ++i) {
+                    forLoopContext.variable = elements[i];
+                    forLoopContext.result.append(worker.retrieveRenderedNode(*node.children[1].get(), store).getString());
+                    ++forLoopContext.idx;
+                }
+                worker.slots.resize(worker.slots.size() - 2);
+                return move(forLoopContext.result);
+            });
+            if (renderer.sink) {
+                for (auto& piece : output)
+                    renderer.write(Node(move(piece)));
+                return Node();
+            }
+            string result;
+            for (auto& piece : output)
+                result.append(piece);
+            return Node(move(result));
+        }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
             assert(node.children.size() >= 2 && node.children.front()->type->type == NodeType::Type::ARGUMENTS);
@@ -457,9 +672,9 @@ namespace Liquid {
 
             auto& variableNode = arguments->children[0]->children[0];
             // Can only ask for single top-level variables. Nothing nested.
-            if (variableNode->children.size() != 1)
+            if (variableNode->children.size() != 1 || variableNode->children[0]->type || !variableNode->children[0]->variant.isString())
                 return Node();
-            string variableName = variableNode->children[0]->getString();
+            std::string_view variableName = variableNode->children[0]->variant.getStringView();
 
             // TODO: Should have an optimization for when the operand from "in" ia s sequence; so that it doesn't render out to a ridiclous thing, it
             // simply loops through the existing stuff.
@@ -500,8 +715,14 @@ namespace Liquid {
 
 
             auto iterator = +[](ForLoopContext& forLoopContext) {
-                forLoopContext.result.append(forLoopContext.renderer.retrieveRenderedNode(*forLoopContext.node.children[1].get(), forLoopContext.store).getString());
+                Node iteration = forLoopContext.renderer.retrieveRenderedNode(*forLoopContext.node.children[1].get(), forLoopContext.store);
+                if (forLoopContext.renderer.sink)
+                    forLoopContext.renderer.write(iteration);
+                else
+                    forLoopContext.result.append(iteration.getString());
                 ++forLoopContext.idx;
+                if (forLoopContext.renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                    return false;
                 if (forLoopContext.renderer.control != Renderer::Control::NONE)  {
                     if (forLoopContext.renderer.control == Renderer::Control::BREAK) {
                         forLoopContext.renderer.control = Renderer::Control::NONE;
@@ -525,65 +746,37 @@ namespace Liquid {
 
             forLoopContext.idx = start;
 
-            renderer.pushInternalDrop("forloop", { &forLoopContext, +[](Renderer& renderer, const Node& node, Variable store, void* data)->Node {
-                ForLoopContext* forLoopContext = (ForLoopContext*)data;
-                string property;
-                if (node.type) {
-                    if (node.children.size() == 2)
-                        property = renderer.retrieveRenderedNode(*node.children[1].get(), store).getString();
-                } else {
-                    property = node.getString();
-                }
-                if (!property.empty()) {
-                    if (property == "index0")
-                        return Variant(forLoopContext->idx);
-                    if (property == "index")
-                        return Variant(forLoopContext->idx+1);
-                    if (property == "rindex")
-                        return Variant(forLoopContext->length - (forLoopContext->idx+1));
-                    if (property == "rindex0")
-                        return Variant(forLoopContext->length - forLoopContext->idx);
-                    if (property == "first")
-                        return Variant(forLoopContext->idx == 0);
-                    if (property == "last")
-                        return Variant(forLoopContext->idx == forLoopContext->length-1);
-                    if (property == "length")
-                        return Variant(forLoopContext->length);
-                }
-                return Node();
-            } });
+            // Loops long enough to be worth it, that only read, have their iterations split up between the renderer's workers.
+            long long iterations = std::min((long long)limit + start, forLoopContext.length) - start;
+            if (renderer.canRenderParallel() && iterations >= std::max((long long)renderer.minimumParallelIterations, 2LL) && Renderer::isParallelizable(*node.children[1].get()))
+                return renderParallel(renderer, node, store, result.variant, variableName, start, limit, reversed, forLoopContext.length);
+
+            renderer.slots.push_back({ "forloop", { &forLoopContext, forLoopDrop } });
             if (result.variant.type == Variant::Type::ARRAY) {
-                renderer.pushInternalDrop(variableName, { &forLoopContext, +[](Renderer& renderer, const Node& node, Variable store, void* data)->Node {
-                    ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
-                    return Variant(*(Variant*)forLoopContext.variable);
-                } });
+                renderer.slots.push_back({ variableName, { &forLoopContext, elementDrop } });
                 int endIndex = std::min(limit+start-1, (int)forLoopContext.length-1);
                 if (reversed) {
                     for (int i = endIndex; i >= start; --i) {
-                        forLoopContext.variable = &result.variant.a[i];
+                        forLoopContext.variable = const_cast<Variant*>(&result.variant.a[i]);
                         if (!forLoopContext.iterator(forLoopContext))
                             break;
                     }
                 } else {
                     for (int i = start; i <= endIndex; ++i) {
-                        forLoopContext.variable = &result.variant.a[i];
+                        forLoopContext.variable = const_cast<Variant*>(&result.variant.a[i]);
                         if (!forLoopContext.iterator(forLoopContext))
                             break;
                     }
                 }
             } else {
-                renderer.pushInternalDrop(variableName, { &forLoopContext, +[](Renderer& renderer, const Node& node, Variable store, void* data)->Node {
-                    ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
-                    return Variant(renderer.getVariable(node, Variable(forLoopContext.variable), 1).second);
-                } });
+                renderer.slots.push_back({ variableName, { &forLoopContext, variableElementDrop } });
                 resolver.iterate(renderer, result.variant.v, +[](void* variable, void* data) {
                     ForLoopContext& forLoopContext = *static_cast<ForLoopContext*>(data);
                     forLoopContext.variable = variable;
                     return forLoopContext.iterator(forLoopContext);
                 }, const_cast<void*>((void*)&forLoopContext), start, limit, reversed);
             }
-            renderer.popInternalDrop("forloop");
-            renderer.popInternalDrop(variableName);
+            renderer.slots.resize(renderer.slots.size() - 2);
             if (forLoopContext.idx == 0 && node.children.size() >= 4) {
                 // Run the else statement if there is one.
                 return renderer.retrieveRenderedNode(*node.children[3].get(), store);
@@ -593,108 +786,396 @@ namespace Liquid {
 
 
         void compile(Compiler& compiler, const Node& node) const override {
-            // Create loop index variable, (and reference to current variable in future), on the stack.
-            const Node& group = *node.children[0].get()->children[0]->children[1].get();
-            const Node& sequence = group.type && group.type->type == NodeType::Type::GROUP ? *group.children[0].get() : group;
-
-            if (sequence.type && sequence.type->type == NodeType::Type::VARIABLE) {
-                // First is the variable to iterate over
-                // Then comes the actual loop variable value.
-                // Then comes the index of the loop.
-                compiler.compileBranch(sequence);
-                compiler.addPush(0x0);
+            auto& arguments = node.children.front();
+            auto& variableNode = arguments->children[0]->children[0];
+            // Can only ask for single top-level variables. Nothing nested.
+            if (variableNode->children.size() != 1)
+                return;
+            string variableName = variableNode->children[0]->getString();
+
+            const Node* offset = nullptr;
+            const Node* limit = nullptr;
+            bool reversed = false;
+            for (size_t i = 1; i < arguments->children.size(); ++i) {
+                Node* child = arguments->children[i].get();
+                if (child->type && child->type->type == NodeType::Type::QUALIFIER) {
+                    if (reversedQualifier == child->type)
+                        reversed = true;
+                    else if (limitQualifier == child->type)
+                        limit = child->children[0].get();
+                    else if (offsetQualifier == child->type)
+                        offset = child->children[0].get();
+                }
+            }
+
+            // The loop's frame, which OP_LOOP sets up; the sequence, the offset, the limit, whether we're reversed, and then three slots that
+            // end up as the length, the index, and the current element.
+            compiler.compileBranch(*arguments->children[0]->children[1].get());
+            compiler.addPush(0x0);
+            if (offset)
+                compiler.compileBranch(*offset);
+            else
                 compiler.add(OP_MOVNIL, 0x0);
+            compiler.addPush(0x0);
+            if (limit)
+                compiler.compileBranch(*limit);
+            else
+                compiler.add(OP_MOVNIL, 0x0);
+            compiler.addPush(0x0);
+            compiler.add(OP_MOVBOOL, 0x0, reversed ? 1 : 0);
+            compiler.addPush(0x0);
+            compiler.add(OP_MOVNIL, 0x0);
+            for (int i = 0; i < 3; ++i)
                 compiler.addPush(0x0);
-                compiler.add(OP_MOVINT, 0x0, 0);
-                compiler.addPush(0x0);
-                compiler.freeRegister = 0;
-                const Node& variable = *node.children[0].get()->children[0]->children[0].get();
-                compiler.addDropFrame(variable.children[0].get()->variant.s, +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
-                    int negativeOffset = state.stackPoint - compiler.stackSize;
-                    compiler.add(OP_STACK, 0x0, negativeOffset - 2);
-                    return 0;
-                });
-                compiler.addDropFrame("forloop", +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
-                    int negativeOffset = state.stackPoint - compiler.stackSize;
-
-                    string property;
-                    if (node.type) {
-                        if (node.type->type == NodeType::Type::VARIABLE && node.children.size() == 2 && !node.children[1]->type && node.children[1]->variant.type == Variant::Type::STRING) {
-                            property = node.children[1]->variant.s;
-                        } else if (node.type) {
-                            property = node.type->symbol;
-                        }
-                    }
-                    if (!property.empty()) {
-                        if (property == "index0") {
-                            compiler.add(OP_STACK, 0x0, negativeOffset - 1);
-                            compiler.add(OP_MOVINT, 0x1, 0x1);
-                            compiler.add(OP_SUB, 0x1);
-                        } else if (property == "index") {
-                            compiler.add(OP_STACK, 0x0, negativeOffset - 1);
-                        } else if (property == "rindex") {
-
-                        } else if (property == "rindex0") {
-                        } else if (property == "first") {
-                            compiler.add(OP_STACK, 0x1, negativeOffset - 1);
-                            compiler.add(OP_MOVINT, 0x0, 0x1);
-                            compiler.add(OP_EQL, 0x1);
-                        } else if (property == "last") {
-                            compiler.add(OP_STACK, 0x1, negativeOffset - 1);
-                            compiler.add(OP_STACK, 0x0, negativeOffset - 3);
-                            compiler.add(OP_EQL, 0x1);
-                        } else if (property == "length") {
 
-                        }
-                    }
-                    return 0;
+            compiler.addDropFrame(variableName, +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
+                int negativeOffset = state.stackPoint - compiler.stackSize;
+                compiler.add(OP_STACK, 0x0, negativeOffset - 1);
+                if (node.type->type == NodeType::Type::VARIABLE)
+                    compiler.addResolve(node, 1, node.children.size());
+                return 0;
+            });
+            compiler.addDropFrame("forloop", +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
+                int negativeOffset = state.stackPoint - compiler.stackSize;
+                int idx = negativeOffset - 2;
+                int length = negativeOffset - 3;
+
+                string property;
+                if (node.type->type == NodeType::Type::VARIABLE) {
+                    if (node.children.size() == 2 && !node.children[1]->type && node.children[1]->variant.type == Variant::Type::STRING)
+                        property = node.children[1]->variant.s;
+                } else
+                    property = node.type->symbol;
+                if (property == "index0") {
+                    compiler.add(OP_STACK, 0x0, idx);
+                } else if (property == "index") {
+                    compiler.add(OP_STACK, 0x0, idx);
+                    compiler.add(OP_MOVINT, 0x1, 1);
+                    compiler.add(OP_ADD, 0x1);
+                } else if (property == "rindex") {
+                    compiler.add(OP_STACK, 0x0, length);
+                    compiler.add(OP_STACK, 0x1, idx);
+                    compiler.add(OP_SUB, 0x1);
+                    compiler.add(OP_MOVINT, 0x1, 1);
+                    compiler.add(OP_SUB, 0x1);
+                } else if (property == "rindex0") {
+                    compiler.add(OP_STACK, 0x0, length);
+                    compiler.add(OP_STACK, 0x1, idx);
+                    compiler.add(OP_SUB, 0x1);
+                } else if (property == "first") {
+                    compiler.add(OP_STACK, 0x1, idx);
+                    compiler.add(OP_MOVINT, 0x0, 0);
+                    compiler.add(OP_EQL, 0x1);
+                } else if (property == "last") {
+                    compiler.add(OP_STACK, 0x0, length);
+                    compiler.add(OP_MOVINT, 0x1, 1);
+                    compiler.add(OP_SUB, 0x1);
+                    compiler.add(OP_STACK, 0x1, idx);
+                    compiler.add(OP_EQL, 0x1);
+                } else if (property == "length") {
+                    compiler.add(OP_STACK, 0x0, length);
+                } else
+                    compiler.add(OP_MOVNIL, 0x0);
+                return 0;
+            });
+
+            // Everything from here to the jump back is run once per element; after that, OP_ITERATE goes past the jump, with 0x0
+            // telling us whether to run the else.
+            int loopInstruction = compiler.add(OP_LOOP, 0x0, 0x0);
+            int iterateInstruction = compiler.add(OP_ITERATE, 0x0, 0x0);
+            compiler.loops.push_back({ iterateInstruction, compiler.stackSize });
+            compiler.compileBody(*node.children[1].get());
+            compiler.add(OP_JMP, 0x0, iterateInstruction);
+            compiler.modify(loopInstruction, OP_LOOP, 0x0, compiler.currentOffset());
+            compiler.modify(iterateInstruction, OP_ITERATE, 0x0, compiler.currentOffset());
+            compiler.loops.pop_back();
+            compiler.clearDropFrame("forloop");
+            compiler.clearDropFrame(variableName);
+            compiler.addPop(7);
+            if (node.children.size() >= 4) {
+                int skipElse = compiler.add(OP_JMPFALSE, 0x0, 0x0);
+                compiler.compileBody(*node.children[3].get());
+                compiler.modify(skipElse, OP_JMPFALSE, 0x0, compiler.currentOffset());
+            }
+        }
+    };
+
+
+    // Partials, from the renderer's partial cache. include and section render theirs as though it were written out in their place, with
+    // the same variables; render gives its own an empty store, and it sees nothing but what it's given.
+    //
+    //     {% include 'card' %}, {% include 'card' with product %}, {% render 'card' for products as product %}, {% include 'card', size: 2 %}
+    //
+    // with binds its value, and for each element in turn, to the name given by as, or otherwise to the partial's own name, without any
+    // directories or extension. Named arguments are bound the same way. Sections are includes of the partials under sections/.
+    struct PartialNode : TagNodeType {
+        struct WithQualifierNode : TagNodeType::QualifierNodeType {
+            WithQualifierNode() : TagNodeType::QualifierNodeType("with", TagNodeType::QualifierNodeType::Arity::UNARY_PREFIX) { }
+        };
+        struct ForQualifierNode : TagNodeType::QualifierNodeType {
+            ForQualifierNode() : TagNodeType::QualifierNodeType("for", TagNodeType::QualifierNodeType::Arity::UNARY_PREFIX) { }
+        };
+        struct AsQualifierNode : TagNodeType::QualifierNodeType {
+            AsQualifierNode() : TagNodeType::QualifierNodeType("as", TagNodeType::QualifierNodeType::Arity::UNARY_PREFIX) { }
+        };
+
+        // Whether the partial gets a store of its own, and what goes in front of its name when it's looked up.
+        bool isolated;
+        string prefix;
+        const NodeType* withQualifier;
+        const NodeType* forQualifier;
+        const NodeType* asQualifier;
+
+        PartialNode(const string& symbol, bool isolated, const string& prefix = "") : TagNodeType(Composition::FREE, symbol, 1, -1, LIQUID_OPTIMIZATION_SCHEME_PARTIAL), isolated(isolated), prefix(prefix) {
+            withQualifier = registerType<WithQualifierNode>();
+            forQualifier = registerType<ForQualifierNode>();
+            asQualifier = registerType<AsQualifierNode>();
+            allowsWildcardQualifiers = true;
+            opaque = true;
+        }
+
+        // What the tag's been given past the partial's name; anything it can't make sense of is passed over, and the last of with and for wins.
+        struct Arguments {
+            const NodeType* qualifier = nullptr;
+            unique_ptr<Node>* value = nullptr;
+            string alias;
+            vector<pair<string, unique_ptr<Node>*>> named;
+        };
+
+        Arguments getArguments(const Node& node) const {
+            Arguments result;
+            auto& arguments = node.children.front();
+            for (size_t i = 1; i < arguments->children.size(); ++i) {
+                Node& child = *arguments->children[i].get();
+                if (!child.type || child.type->type != NodeType::Type::QUALIFIER || child.children.empty())
+                    continue;
+                if (child.type == withQualifier || child.type == forQualifier) {
+                    result.qualifier = child.type;
+                    result.value = &child.children[0];
+                } else if (child.type == asQualifier) {
+                    const Node& alias = *child.children[0].get();
+                    if (alias.type && alias.type->type == NodeType::Type::VARIABLE && alias.children.size() == 1 && !alias.children[0]->type && alias.children[0]->variant.isString())
+                        result.alias = alias.children[0]->variant.getString();
+                } else if (child.children.size() == 2 && !child.children[0]->type)
+                    result.named.emplace_back(child.children[0]->variant.getString(), &child.children[1]);
+            }
+            return result;
+        }
+
+        // What's bound when the partial's given nothing to call it.
+        static string getDefaultName(const string& name) {
+            size_t start = name.find_last_of('/');
+            start = start == string::npos ? 0 : start + 1;
+            size_t end = name.find('.', start);
+            return name.substr(start, end == string::npos ? string::npos : end - start);
+        }
+
+        shared_ptr<const PartialCache::Partial> getPartial(Renderer& renderer, const Node& node, const string& name) const {
+            shared_ptr<const PartialCache::Partial> partial;
+            if (renderer.partials)
+                partial = renderer.partials->get(prefix + name);
+            if (!partial)
+                renderer.pushUnknownPartialWarning(node, prefix + name);
+            return partial;
+        }
+
+        // Everything's been worked out by here; the qualifier is with, for, or null, for neither, and the value's what it was given.
+        Node renderPartial(Renderer& renderer, const PartialCache::Partial& partial, Variable store, const string& name, const NodeType* qualifier, const Node& value, const string& alias, vector<pair<string, Node>>& named) const {
+            std::vector<Renderer::Slot> slots;
+            std::unordered_map<std::string, std::vector<std::pair<void*, Renderer::DropFunction>>> internalDrops;
+            Variable partialStore = store;
+            if (isolated) {
+                std::swap(slots, renderer.slots);
+                std::swap(internalDrops, renderer.internalDrops);
+                partialStore = renderer.variableResolver.createHash(renderer);
+            }
+            for (auto& it : named)
+                renderer.pushInternalDrop(it.first, { &it.second, &Context::HoistNode::bind });
+            string variableName = alias.empty() ? getDefaultName(name) : alias;
+            Node result;
+            if (qualifier == forQualifier) {
+                string output;
+                Node element;
+                renderer.pushInternalDrop(variableName, { &element, &Context::HoistNode::bind });
+                renderer.forEachElement(value.variant, [&renderer, &partial, partialStore, &output, &element](Variant&& variant) {
+                    element = Node(move(variant));
+                    Node iteration = renderer.retrieveRenderedNode(partial.tmpl, partialStore);
+                    if (renderer.sink)
+                        renderer.write(iteration);
+                    else
+                        output.append(iteration.getString());
+                    if (renderer.error != LIQUID_RENDERER_ERROR_TYPE_NONE)
+                        return false;
+                    // The same as a for loop.
+                    bool stop = renderer.control == Renderer::Control::BREAK;
+                    renderer.control = Renderer::Control::NONE;
+                    return !stop;
                 });
-                // Counter
-                int topLoop = compiler.add(OP_STACK, 0x1, -1);
-                // Variable Context
-                compiler.add(OP_STACK, 0x2, -3);
-                int iterationInstruction = compiler.add(OP_ITERATE, 0x2, 0x0);
-                compiler.add(OP_POP, 0x0, 0x2);
-                compiler.add(OP_PUSH, 0x0);
-                compiler.add(OP_MOVINT, 0x0, 0x1);
-                compiler.add(OP_ADD, 0x1);
-                compiler.add(OP_PUSH, 0x1);
-                compiler.compileBranch(*node.children[1].get());
-                compiler.add(OP_JMP, 0x0, topLoop);
-                compiler.modify(iterationInstruction, OP_ITERATE, 0x2, compiler.currentOffset());
-                compiler.addPop(3);
+                renderer.popInternalDrop(variableName);
+                result = Node(move(output));
             } else {
-                assert(sequence.type && sequence.children.size() == 2);
-                compiler.compileBranch(*sequence.children[1].get());
-                compiler.add(OP_MOVINT, 0x1, 0x1);
-                compiler.add(OP_ADD, 0x1);
+                if (qualifier == withQualifier)
+                    renderer.pushInternalDrop(variableName, { const_cast<Node*>(&value), &Context::HoistNode::bind });
+                result = renderer.retrieveRenderedNode(partial.tmpl, partialStore);
+                if (qualifier == withQualifier)
+                    renderer.popInternalDrop(variableName);
+            }
+            for (auto& it : named)
+                renderer.popInternalDrop(it.first);
+            if (isolated) {
+                renderer.variableResolver.freeVariable(renderer, partialStore);
+                std::swap(slots, renderer.slots);
+                std::swap(internalDrops, renderer.internalDrops);
+                renderer.control = Renderer::Control::NONE;
+            }
+            return result;
+        }
+
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            vector<pair<string, Node>> named;
+            if (renderer.mode == Renderer::ExecutionMode::INTERPRETER) {
+                // Compiled includes have no tree; see compile for what's on the stack. Partials are always rendered from their tree.
+                Interpreter& interpreter = static_cast<Interpreter&>(renderer);
+                string name = interpreter.getStack(-1).getString();
+                long long type = interpreter.getStack(-2).variant.getInt();
+                Node value = interpreter.getStack(-3);
+                Node alias = interpreter.getStack(-4);
+                for (int i = 4; i + 1 < interpreter.callArguments; i += 2)
+                    named.emplace_back(interpreter.getStack(-1 - i).getString(), interpreter.getStack(-2 - i));
+                auto partial = getPartial(renderer, node, name);
+                if (!partial)
+                    return Node();
+                renderer.mode = Renderer::ExecutionMode::PARSE_TREE;
+                Node result = renderPartial(renderer, *partial.get(), store, name, type == 1 ? withQualifier : (type == 2 ? forQualifier : nullptr), value, alias.variant.isString() ? alias.getString() : "", named);
+                renderer.mode = Renderer::ExecutionMode::INTERPRETER;
+                renderer.control = Renderer::Control::NONE;
+                return result;
+            }
+            string name = renderer.retrieveRenderedNode(*node.children.front()->children[0].get(), store).getString();
+            Arguments arguments = getArguments(node);
+            Node value;
+            if (arguments.value)
+                value = renderer.retrieveRenderedNode(*arguments.value->get(), store);
+            for (auto& it : arguments.named)
+                named.emplace_back(it.first, renderer.retrieveRenderedNode(*it.second->get(), store));
+            auto partial = getPartial(renderer, node, name);
+            if (!partial)
+                return Node();
+            return renderPartial(renderer, *partial.get(), store, name, arguments.qualifier, value, arguments.alias, named);
+        }
+
+        // The partial, if its name can be worked out now, it's not too big to inline, and it's included, rather than rendered.
+        shared_ptr<const PartialCache::Partial> getInlinedPartial(PartialCache* partials, const Node& node, size_t maximumSize) const {
+            auto& arguments = node.children.front();
+            const Node& name = *arguments->children[0].get();
+            if (isolated || !partials || name.type || !name.variant.isString() || getArguments(node).qualifier == forQualifier)
+                return nullptr;
+            shared_ptr<const PartialCache::Partial> partial;
+            try {
+                partial = partials->get(prefix + name.variant.getString());
+            } catch (Parser::Exception&) {
+                // Left for rendering to throw.
+                return nullptr;
+            }
+            if (!partial || partial->size > maximumSize)
+                return nullptr;
+            return partial;
+        }
+
+        // What the partial's included with, moved out of the tag, in the order it's bound; so that with comes out on top, as it does when rendering.
+        vector<pair<string, unique_ptr<Node>>> getBindings(Node& node) const {
+            Arguments arguments = getArguments(node);
+            vector<pair<string, unique_ptr<Node>>> bindings;
+            for (auto& it : arguments.named)
+                bindings.emplace_back(it.first, move(*it.second));
+            if (arguments.value)
+                bindings.emplace_back(arguments.alias.empty() ? getDefaultName(node.children.front()->children[0]->variant.getString()) : arguments.alias, move(*arguments.value));
+            return bindings;
+        }
+
+        bool optimize(Optimizer& optimizer, Node& node, Variable store) const override {
+            if (optimizer.inlinedPartialDepth >= optimizer.maximumInlinedPartialDepth)
+                return false;
+            auto partial = getInlinedPartial(optimizer.renderer.partials, node, optimizer.maximumInlinedPartialSize);
+            if (!partial)
+                return false;
+            auto bindings = getBindings(node);
+            optimizer.inlinePartial(node, partial->tmpl, bindings, store);
+            return true;
+        }
+
+        // Includes of partials that can be are compiled in place, with what they're included with on the stack, the same as a hoist.
+        // Anything else is a call, which renders the partial from its tree; its name goes on top, then 1 for with, 2 for for, or 0, and
+        // the value for either, then the alias, or nil, then each named argument's name over its value. The tree can't see into the
+        // program's stack, so everything bound around an include, other than forloop, is passed in ahead of those, as though it were named.
+        void compile(Compiler& compiler, const Node& node) const override {
+            auto& arguments = node.children.front();
+            shared_ptr<const PartialCache::Partial> partial;
+            if (compiler.inlinedPartialDepth < compiler.maximumInlinedPartialDepth)
+                partial = getInlinedPartial(compiler.partials, node, std::numeric_limits<size_t>::max());
+            if (partial) {
+                Node copy = node;
+                auto bindings = getBindings(copy);
+                for (auto& binding : bindings) {
+                    compiler.compileBranch(*binding.second.get());
+                    compiler.addPush(0x0);
+                    compiler.addDropFrame(binding.first, +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
+                        compiler.add(OP_STACK, 0x0, state.stackPoint - compiler.stackSize - 1);
+                        compiler.addResolve(node, 1, node.children.size());
+                        return 0;
+                    });
+                }
+                ++compiler.inlinedPartialDepth;
+                compiler.compileBody(partial->tmpl);
+                --compiler.inlinedPartialDepth;
+                for (auto it = bindings.rbegin(); it != bindings.rend(); ++it)
+                    compiler.clearDropFrame(it->first);
+                if (bindings.size() > 0)
+                    compiler.addPop(bindings.size());
+                return;
+            }
+            Arguments parsed = getArguments(node);
+            int count = 4;
+            for (auto it = parsed.named.rbegin(); it != parsed.named.rend(); ++it) {
+                compiler.compileBranch(*it->second->get());
                 compiler.addPush(0x0);
-                compiler.compileBranch(*sequence.children[0].get());
+                compiler.compileBranch(Node(Variant(it->first)));
                 compiler.addPush(0x0);
-                const Node& variable = *node.children[0].get()->children[0]->children[0].get();
-                compiler.addDropFrame(variable.children[0].get()->variant.s, +[](Compiler& compiler, Compiler::DropFrameState& state, const Node& node) {
-                    int negativeOffset = state.stackPoint - compiler.stackSize;
-                    compiler.add(OP_STACK, 0x0, negativeOffset - 1);
-                    return 0;
-                });
-                int entryPointJmp = compiler.add(OP_JMP, 0x0, 0x0);
-                int topLoop = compiler.add(OP_STACK, 0x0, -1);
-                compiler.add(OP_MOVINT, 0x1, 1LL);
-                compiler.add(OP_ADD, 0x1);
-                compiler.add(OP_POP, 0x1, 0x1);
-                compiler.add(OP_PUSH, 0x0);
-                compiler.add(OP_STACK, 0x1, -2);
-                int entryPoint = compiler.add(OP_EQL, 0x1);
-                compiler.modify(entryPointJmp, OP_JMP, 0x0, entryPoint);
-                int endLoopJmp = compiler.add(OP_JMPTRUE, 0x0, 0x0);
-                compiler.compileBranch(*node.children[1].get());
-                compiler.add(OP_JMP, 0x0, topLoop);
-                compiler.modify(endLoopJmp, OP_JMPTRUE, 0x0, compiler.currentOffset());
-                compiler.addPop(2);
+                count += 2;
+            }
+            if (!isolated) {
+                for (auto& frame : compiler.dropFrames) {
+                    if (frame.second.empty() || frame.first == "forloop")
+                        continue;
+                    Node variable(compiler.context.getVariableNodeType());
+                    variable.children.push_back(make_unique<Node>(Variant(frame.first)));
+                    compiler.compileBranch(variable);
+                    compiler.addPush(0x0);
+                    compiler.compileBranch(Node(Variant(frame.first)));
+                    compiler.addPush(0x0);
+                    count += 2;
+                }
             }
+            compiler.compileBranch(parsed.alias.empty() ? Node() : Node(Variant(parsed.alias)));
+            compiler.addPush(0x0);
+            if (parsed.value)
+                compiler.compileBranch(*parsed.value->get());
+            else
+                compiler.add(OP_MOVNIL, 0x0);
+            compiler.addPush(0x0);
+            compiler.add(OP_MOVINT, 0x0, parsed.qualifier == withQualifier ? 1 : (parsed.qualifier == forQualifier ? 2 : 0));
+            compiler.addPush(0x0);
+            compiler.compileBranch(*arguments->children[0].get());
+            compiler.addPush(0x0);
+            compiler.addCall(this, count);
+            compiler.add(OP_OUTPUT, 0x0);
         }
     };
 
+    struct IncludeNode : PartialNode { IncludeNode() : PartialNode("include", false) { } };
+    struct RenderNode : PartialNode { RenderNode() : PartialNode("render", true) { } };
+    struct SectionNode : PartialNode { SectionNode() : PartialNode("section", false, "sections/") { } };
+
 
     template <class Function>
     struct ArithmeticOperatorNode : OperatorNodeType {
@@ -839,7 +1320,7 @@ namespace Liquid {
 
     template <class Function>
     struct QualitativeComparaisonOperatorNode : OperatorNodeType {
-        QualitativeComparaisonOperatorNode(const std::string& symbol, int priority) : OperatorNodeType(symbol, Arity::BINARY, priority) { }
+        QualitativeComparaisonOperatorNode(const std::string& symbol, int priority) : OperatorNodeType(symbol, Arity::BINARY, priority) { borrowsStrings = true; }
 
         template <class A, class B>
         bool operate(A a, B b) const { return Function()(a, b); }
@@ -864,6 +1345,7 @@ namespace Liquid {
                         case Variant::Type::FLOAT:
                             return Node(Variant(operate(op1.variant.i, op2.variant.f)));
                         case Variant::Type::STRING:
+                        case Variant::Type::STRING_VIEW:
                             return Node(Variant(operate(op1.variant.i, op2.variant.getInt())));
                         default:
                         break;
@@ -876,15 +1358,17 @@ namespace Liquid {
                         case Variant::Type::FLOAT:
                             return Node(Variant(operate(op1.variant.f, op2.variant.f)));
                         case Variant::Type::STRING:
+                        case Variant::Type::STRING_VIEW:
                             return Node(Variant(operate(op1.variant.i, op2.variant.getFloat())));
                         default:
                         break;
                     }
                 break;
                 case Variant::Type::STRING:
-                    if (op2.variant.type != Variant::Type::STRING)
-                        return Variant(operate(op1.variant.s, op2.variant.getString()));
-                    return Variant(operate(op1.variant.s, op2.variant.s));
+                case Variant::Type::STRING_VIEW:
+                    if (!op2.variant.isString())
+                        return Variant(operate(op1.variant.getStringView(), std::string_view(op2.variant.getString())));
+                    return Variant(operate(op1.variant.getStringView(), op2.variant.getStringView()));
                 case Variant::Type::POINTER:
                     if (op2.variant.type != Variant::Type::POINTER)
                         return Variant(false);
@@ -968,20 +1452,22 @@ namespace Liquid {
 
 
     struct ContainsOperatorNode : OperatorNodeType {
-        ContainsOperatorNode() : OperatorNodeType("contains", Arity::BINARY, 2) { }
+        ContainsOperatorNode() : OperatorNodeType("contains", Arity::BINARY, 2) { borrowsStrings = true; }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
             Node op1 = getOperand(renderer, node, store, 0);
             Node op2 = getOperand(renderer, node, store, 1);
 
-            if (op2.variant.type != Variant::Type::STRING)
+            if (!op2.variant.isString())
                 return Node();
+            std::string_view needle = op2.variant.getStringView();
             switch (op1.variant.type) {
                 case Variant::Type::STRING:
-                    return Variant(op1.variant.s.find(op2.getString()) != string::npos);
+                case Variant::Type::STRING_VIEW:
+                    return Variant(op1.variant.getStringView().find(needle) != std::string_view::npos);
                 case Variant::Type::ARRAY:
                     for (size_t i = 0; i < op1.variant.a.size(); ++i) {
-                        if (op1.variant.a[i].type == Variant::Type::STRING && op1.variant.a[i].s.find(op2.getString()) != string::npos)
+                        if (op1.variant.a[i].isString() && op1.variant.a[i].getStringView().find(needle) != std::string_view::npos)
                             return Variant(true);
                     }
                     return Variant(false);
@@ -1001,11 +1487,17 @@ namespace Liquid {
             if (op1.variant.type != Variant::Type::INT || op2.variant.type != Variant::Type::INT)
                 return Node();
             auto result = Node(Variant(vector<Variant>()));
-            // TODO: This can allocate a lot of memory. Short-circuit that; but should be plugge dinto the allocator.
             long long size = op2.variant.i - op1.variant.i + 1;
-            if (size > 10000)
+            // With a memory limit, that decides how big a range can be, before it's allocated. Without, it's kept to something reasonable.
+            if (renderer.maximumMemoryUsage) {
+                if (size > 0 && ((unsigned long long)size > renderer.maximumMemoryUsage || !renderer.hasMemoryFor(size * sizeof(Variant)))) {
+                    renderer.error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+                    return Node();
+                }
+            } else if (size > 10000)
                 return Node();
-            result.variant.a.reserve(size);
+            if (size > 0)
+                result.variant.a.reserve(size);
             for (long long i = op1.variant.i; i <= op2.variant.i; ++i)
                 result.variant.a.push_back(Variant(i));
             return result;
@@ -1214,12 +1706,26 @@ namespace Liquid {
         }
     };
 
-    struct AppendFilterNode : FilterNodeType {
-        AppendFilterNode() : FilterNodeType("append", 1, 1) { }
+    // Filters that work on the string they're given; rendered alone, they're handed a copy of their operand, and in a chain, whatever
+    // the filter before them left.
+    struct StringFilterNodeType : FilterNodeType {
+        StringFilterNodeType(const std::string& symbol, int minArguments = 0, int maxArguments = 0) : FilterNodeType(symbol, minArguments, maxArguments) {
+            assert(maxArguments <= 2);
+            transformsStrings = true;
+        }
+
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            return Variant(operand.getString() + argument.getString());
+            string str = renderer.getString(getOperand(renderer, node, store));
+            Node arguments[2] = { getArgument(renderer, node, store, 0), getArgument(renderer, node, store, 1) };
+            transform(renderer, str, arguments);
+            return Variant(move(str));
+        }
+    };
+
+    struct AppendFilterNode : StringFilterNodeType {
+        AppendFilterNode() : StringFilterNodeType("append", 1, 1) { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
+            str.append(renderer.getString(arguments[0]));
         }
     };
 
@@ -1240,13 +1746,10 @@ namespace Liquid {
             return Node(str);
         }
     };
-    struct DowncaseFilterNode : FilterNodeType {
-        DowncaseFilterNode() : FilterNodeType("downcase", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = operand.getString();
+    struct DowncaseFilterNode : StringFilterNodeType {
+        DowncaseFilterNode() : StringFilterNodeType("downcase") { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
             std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c){ return std::tolower(c); });
-            return Variant(str);
         }
     };
     struct HandleGenericFilterNode : FilterNodeType {
@@ -1284,12 +1787,10 @@ namespace Liquid {
         }
     };
 
-    struct PrependFilterNode : FilterNodeType {
-        PrependFilterNode() : FilterNodeType("prepend", 1, 1) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            return Variant(renderer.getString(argument) + renderer.getString(operand));
+    struct PrependFilterNode : StringFilterNodeType {
+        PrependFilterNode() : StringFilterNodeType("prepend", 1, 1) { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
+            str.insert(0, renderer.getString(arguments[0]));
         }
     };
     struct RemoveFilterNode : FilterNodeType {
@@ -1329,25 +1830,33 @@ namespace Liquid {
             return Variant(accumulator);
         }
     };
-    struct ReplaceFilterNode : FilterNodeType {
-        ReplaceFilterNode() : FilterNodeType("replace", 2, 2) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argumentPattern = getArgument(renderer, node, store, 0);
-            auto argumentReplacement = getArgument(renderer, node, store, 1);
-            string accumulator;
-            string str = operand.getString();
-            string pattern = argumentPattern.getString();
-            string replacement = argumentReplacement.getString();
+    struct ReplaceFilterNode : StringFilterNodeType {
+        ReplaceFilterNode() : StringFilterNodeType("replace", 2, 2) { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
+            string pattern = renderer.getString(arguments[0]);
+            string replacement = renderer.getString(arguments[1]);
+            if (pattern.empty())
+                return;
             size_t start = 0, idx;
-            while ((idx = str.find(pattern, start)) != string::npos) {
-                if (idx > start)
-                    accumulator.append(str, start, idx - start);
+            // Replacements that are the same length as what they replace can be written straight over it.
+            if (pattern.size() == replacement.size()) {
+                while ((idx = str.find(pattern, start)) != string::npos) {
+                    str.replace(idx, pattern.size(), replacement);
+                    start = idx + pattern.size();
+                }
+                return;
+            }
+            if ((idx = str.find(pattern)) == string::npos)
+                return;
+            string accumulator;
+            accumulator.reserve(str.size());
+            do {
+                accumulator.append(str, start, idx - start);
                 accumulator.append(replacement);
                 start = idx + pattern.size();
-            }
+            } while ((idx = str.find(pattern, start)) != string::npos);
             accumulator.append(str, start, str.size() - start);
-            return Variant(accumulator);
+            str.swap(accumulator);
         }
     };
     struct ReplaceFirstFilterNode : FilterNodeType {
@@ -1434,35 +1943,31 @@ namespace Liquid {
             return Variant(std::move(result));
         }
     };
-    struct StripFilterNode : FilterNodeType {
-        StripFilterNode() : FilterNodeType("strip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
-            size_t start, end;
+    struct StripFilterNode : StringFilterNodeType {
+        StripFilterNode() : StringFilterNodeType("strip") { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
+            size_t end;
+            for (end = str.size(); end > 0 && isblank(str[end-1]); --end);
+            str.erase(end);
+            size_t start;
             for (start = 0; start < str.size() && isblank(str[start]); ++start);
-            for (end = str.size()-1; end > 0 && isblank(str[end]); --end);
-            return Node(str.substr(start, end - start + 1));
+            str.erase(0, start);
         }
     };
-    struct LStripFilterNode : FilterNodeType {
-        LStripFilterNode() : FilterNodeType("lstrip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct LStripFilterNode : StringFilterNodeType {
+        LStripFilterNode() : StringFilterNodeType("lstrip") { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
             size_t start;
             for (start = 0; start < str.size() && isblank(str[start]); ++start);
-            return Node(str.substr(start, str.size() - start));
+            str.erase(0, start);
         }
     };
-    struct RStripFilterNode : FilterNodeType {
-        RStripFilterNode() : FilterNodeType("rstrip", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            string str = renderer.getString(operand);
+    struct RStripFilterNode : StringFilterNodeType {
+        RStripFilterNode() : StringFilterNodeType("rstrip") { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
             size_t end;
-            for (end = str.size()-1; end > 0 && isblank(str[end]); --end);
-            return Node(str.substr(0, end + 1));
+            for (end = str.size(); end > 0 && isblank(str[end-1]); --end);
+            str.erase(end);
         }
     };
     struct StripNewlinesFilterNode : FilterNodeType {
@@ -1479,21 +1984,18 @@ namespace Liquid {
             return Node(accumulator);
         }
     };
-    struct TruncateFilterNode : FilterNodeType {
-        TruncateFilterNode() : FilterNodeType("truncate", 1, 2) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto characterCount = getArgument(renderer, node, store, 0);
-            auto customEllipsis = getArgument(renderer, node, store, 1);
+    struct TruncateFilterNode : StringFilterNodeType {
+        TruncateFilterNode() : StringFilterNodeType("truncate", 1, 2) { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
             string ellipsis = "...";
-            if (customEllipsis.variant.type == Variant::Type::STRING)
-                ellipsis = customEllipsis.getString();
-            long long count = characterCount.variant.getInt();
+            if (!arguments[1].type && arguments[1].variant.isString())
+                ellipsis = arguments[1].getString();
+            long long count = arguments[0].variant.getInt();
             if (count > (long long)ellipsis.size()) {
-                string str = operand.getString();
-                return Variant(str.substr(0, std::min((long long)(count - ellipsis.size()), (long long)str.size())) + ellipsis);
-            }
-            return Variant(ellipsis.substr(0, std::min(count, (long long)ellipsis.size())));
+                str.resize(std::min((long long)(count - ellipsis.size()), (long long)str.size()));
+                str.append(ellipsis);
+            } else
+                str.assign(ellipsis, 0, std::min(count, (long long)ellipsis.size()));
         }
     };
     struct TruncateWordsFilterNode : FilterNodeType {
@@ -1522,14 +2024,10 @@ namespace Liquid {
             return Variant(str.substr(0, i-1));
         }
     };
-    struct UpcaseFilterNode : FilterNodeType {
-        UpcaseFilterNode() : FilterNodeType("upcase", 0, 0) { }
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            string str = operand.getString();
+    struct UpcaseFilterNode : StringFilterNodeType {
+        UpcaseFilterNode() : StringFilterNodeType("upcase") { }
+        void transform(Renderer& renderer, string& str, const Node* arguments) const override {
             std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c){ return std::toupper(c); });
-            return Variant(str);
         }
     };
 
@@ -1549,8 +2047,29 @@ namespace Liquid {
         }
     };
 
+    // Array filters that go element by element; rendered alone, they gather up whatever elements make it through, and in an array
+    // chain, hand them straight on.
+    struct StreamingArrayFilterNodeType : ArrayFilterNodeType {
+        StreamingArrayFilterNodeType(const std::string& symbol, int minArguments, int maxArguments) : ArrayFilterNodeType(symbol, minArguments, maxArguments) {
+            assert(maxArguments <= 2);
+            streamsArrays = true;
+        }
+
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            auto operand = getOperand(renderer, node, store);
+            Node arguments[2] = { getArgument(renderer, node, store, 0), getArgument(renderer, node, store, 1) };
+            Variant accumulator { vector<Variant>() };
+            bool iterated = renderer.forEachElement(operand.variant, [this, &renderer, &arguments, &accumulator](Variant&& element) {
+                if (step(renderer, element, arguments))
+                    accumulator.a.push_back(move(element));
+                return true;
+            });
+            return iterated ? Node(move(accumulator)) : Node();
+        }
+    };
+
     struct JoinFilterNode : ArrayFilterNodeType {
-        JoinFilterNode() : ArrayFilterNodeType("join", 0, 1) { }
+        JoinFilterNode() : ArrayFilterNodeType("join", 0, 1) { reducesArrays = true; }
 
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             struct JoinStruct {
@@ -1593,6 +2112,17 @@ namespace Liquid {
             }
             return Variant(accumulator);
         }
+
+        bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const override {
+            if (reduction.count > 0 && !arguments[0].type)
+                reduction.str.append(arguments[0].variant.isString() ? string(arguments[0].variant.getStringView()) : renderer.getString(arguments[0]));
+            reduction.str.append(renderer.getString(Node(move(element))));
+            return true;
+        }
+
+        void finish(Renderer& renderer, Reduction& reduction, const Node* arguments) const override {
+            reduction.result = Node(move(reduction.str));
+        }
     };
 
     struct ConcatFilterNode : ArrayFilterNodeType {
@@ -1600,7 +2130,7 @@ namespace Liquid {
 
         void accumulate(Renderer& renderer, Variant& accumulator, Variable v) const {
             renderer.variableResolver.iterate(renderer, v, +[](void* variable, void* data) {
-                static_cast<Variant*>(data)->a.push_back(Variant(static_cast<Variable*>(variable)));
+                static_cast<Variant*>(data)->a.push_back(Variable({variable}));
                 return true;
             }, &accumulator, 0, -1, false);
         }
@@ -1611,7 +2141,7 @@ namespace Liquid {
         }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
             auto operand = getOperand(renderer, node, store);
             auto argument = getArgument(renderer, node, store, 0);
             switch (operand.variant.type) {
@@ -1619,7 +2149,7 @@ namespace Liquid {
                     accumulate(renderer, accumulator, operand.variant.v);
                 break;
                 case Variant::Type::ARRAY:
-                    accumulate(renderer, accumulator, operand.variant.a);
+                    accumulate(renderer, accumulator, operand.variant);
                 break;
                 default:
                     return Node();
@@ -1631,7 +2161,7 @@ namespace Liquid {
                     accumulate(renderer, accumulator, argument.variant.v);
                 break;
                 case Variant::Type::ARRAY:
-                    accumulate(renderer, accumulator, argument.variant.a);
+                    accumulate(renderer, accumulator, argument.variant);
                 break;
                 default:
                     return accumulator;
@@ -1640,56 +2170,17 @@ namespace Liquid {
         }
     };
 
-    struct MapFilterNode : ArrayFilterNodeType {
-        MapFilterNode() : ArrayFilterNodeType("map", 1, 1) { }
-
-        struct MapStruct {
-            Renderer& renderer;
-            string property;
-            Variant accumulator;
-        };
-
-        void accumulate(Renderer& renderer, MapStruct& mapStruct, Variable v) const {
-            renderer.variableResolver.iterate(renderer, v, +[](void* variable, void* data) {
-                MapStruct& mapStruct = *static_cast<MapStruct*>(data);
-                Variable target;
-                if (mapStruct.renderer.variableResolver.getDictionaryVariable(mapStruct.renderer, variable, mapStruct.property.data(), target))
-                    mapStruct.accumulator.a.push_back(target);
-                else
-                    mapStruct.accumulator.a.push_back(Variant());
-                return true;
-            }, &mapStruct, 0, -1, false);
-        }
-
-        void accumulate(Renderer& renderer, MapStruct& mapStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (it->type == Variant::Type::VARIABLE) {
-                    Variable target;
-                    if (mapStruct.renderer.variableResolver.getDictionaryVariable(mapStruct.renderer, const_cast<Variable&>(it->v), mapStruct.property.data(), target))
-                        mapStruct.accumulator.a.push_back(target);
-                    else
-                        mapStruct.accumulator.a.push_back(Variant());
-                } else {
-                    mapStruct.accumulator.a.push_back(Variant());
-                }
-            }
-        }
+    struct MapFilterNode : StreamingArrayFilterNodeType {
+        MapFilterNode() : StreamingArrayFilterNodeType("map", 1, 1) { }
 
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto argument = getArgument(renderer, node, store, 0);
-            MapStruct mapStruct = { renderer, renderer.getString(argument), nullptr };
-            switch (operand.variant.type) {
-                case Variant::Type::VARIABLE:
-                    accumulate(renderer, mapStruct, operand.variant.v);
-                break;
-                case Variant::Type::ARRAY:
-                    accumulate(renderer, mapStruct, operand.variant.a);
-                break;
-                default:
-                    return Node();
-            }
-            return mapStruct.accumulator;
+        bool step(Renderer& renderer, Variant& element, const Node* arguments) const override {
+            Variable target;
+            if (element.type == Variant::Type::VARIABLE && !arguments[0].type && arguments[0].variant.type == Variant::Type::STRING &&
+                    renderer.variableResolver.getDictionaryVariable(renderer, element.v, arguments[0].variant.s.c_str(), target))
+                element = Variant(target);
+            else
+                element = Variant();
+            return true;
         }
     };
 
@@ -1697,7 +2188,7 @@ namespace Liquid {
         ReverseFilterNode() : ArrayFilterNodeType("reverse", 0, 0) { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
             auto operand = getOperand(renderer, node, store);
             auto& v = operand.variant;
             switch (operand.variant.type) {
@@ -1708,13 +2199,13 @@ namespace Liquid {
                     }, &accumulator, 0, -1, true);
                 break;
                 case Variant::Type::ARRAY:
+                    accumulator.a.reserve(v.a.size());
                     for (auto it = v.a.rbegin(); it != v.a.rend(); ++it)
                         accumulator.a.push_back(*it);
                 break;
                 default:
                     return Node();
             }
-            std::reverse(accumulator.a.begin(), accumulator.a.end());
             return accumulator;
         }
     };
@@ -1722,8 +2213,16 @@ namespace Liquid {
     struct SortFilterNode : ArrayFilterNodeType {
         SortFilterNode() : ArrayFilterNodeType("sort", 0, 1) { }
 
+        // Arrays that are already in order are left sharing the operand's items.
+        template <class T> static void sort(Variant& accumulator, T compare) {
+            if (std::is_sorted(accumulator.a.begin(), accumulator.a.end(), compare))
+                return;
+            auto& items = accumulator.a.modify();
+            std::sort(items.begin(), items.end(), compare);
+        }
+
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
             string property;
             auto operand = getOperand(renderer, node, store);
             auto argument = getArgument(renderer, node, store, 0);
@@ -1735,9 +2234,8 @@ namespace Liquid {
                     }, &accumulator, 0, -1, false);
                 } break;
                 case Variant::Type::ARRAY: {
-                    auto& v = operand.variant;
-                    for (auto it = v.a.begin(); it != v.a.end(); ++it)
-                        accumulator.a.push_back(*it);
+                    // Shares the operand's items until they're sorted.
+                    accumulator = operand.variant;
                 } break;
                 default:
                     return Node();
@@ -1745,92 +2243,40 @@ namespace Liquid {
 
             if (!argument.type && argument.variant.type == Variant::Type::STRING) {
                 property = renderer.getString(argument);
-                std::sort(accumulator.a.begin(), accumulator.a.end(), [&property, &renderer](Variant& a, Variant& b) -> bool {
+                sort(accumulator, [&property, &renderer](const Variant& a, const Variant& b) -> bool {
                     if (a.type != Variant::Type::VARIABLE || b.type != Variant::Type::VARIABLE)
                         return false;
                     Variable targetA, targetB;
-                    if (!renderer.variableResolver.getDictionaryVariable(renderer, a.v, property.data(), targetA))
+                    if (!renderer.variableResolver.getDictionaryVariable(renderer, const_cast<Variable&>(a.v), property.data(), targetA))
                         return false;
-                    if (!renderer.variableResolver.getDictionaryVariable(renderer, b.v, property.data(), targetB))
+                    if (!renderer.variableResolver.getDictionaryVariable(renderer, const_cast<Variable&>(b.v), property.data(), targetB))
                         return false;
                     return renderer.variableResolver.compare(targetA, targetB) < 0;
                 });
             } else {
-                std::sort(accumulator.a.begin(), accumulator.a.end(), [](Variant& a, Variant& b) -> bool { return a < b; });
+                sort(accumulator, [&renderer](const Variant& a, const Variant& b) -> bool {
+                    if (a.type == Variant::Type::VARIABLE && b.type == Variant::Type::VARIABLE)
+                        return renderer.variableResolver.compare(const_cast<Variable&>(a.v), const_cast<Variable&>(b.v)) < 0;
+                    return a < b;
+                });
             }
             return accumulator;
         }
     };
 
 
-    struct WhereFilterNode : ArrayFilterNodeType {
-        WhereFilterNode() : ArrayFilterNodeType("where", 1, 2) { }
-
-        struct WhereStruct {
-            Renderer& renderer;
-            string property;
-            Variant value;
-            Variant accumulator;
-        };
-
-        void accumulate(WhereStruct& whereStruct, Variable v) const {
-            whereStruct.renderer.variableResolver.iterate(whereStruct.renderer, v, +[](void* variable, void* data) {
-                WhereStruct& whereStruct = *static_cast<WhereStruct*>(data);
-                Variable target;
-                if (whereStruct.renderer.variableResolver.getDictionaryVariable(whereStruct.renderer, variable, whereStruct.property.data(), target)) {
-                    if (whereStruct.property.empty()) {
-                        if (whereStruct.renderer.variableResolver.getTruthy(whereStruct.renderer, target))
-                            whereStruct.accumulator.a.push_back(variable);
-                    } else {
-                        // std::string str;
-                        //if (whereStruct.resolver.getString(str)) {
-                            // TODO.
-                            // if (str == whereStruct.value)
-                            //    whereStruct.accumulator.a.push_back(variable);
-                        //}
-                    }
-                }
-                return true;
-            }, &whereStruct, 0, -1, false);
-        }
-
-        void accumulate(WhereStruct& whereStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (it->type == Variant::Type::VARIABLE) {
-                    Variable target;
-                    if (whereStruct.renderer.variableResolver.getDictionaryVariable(whereStruct.renderer, const_cast<Variable&>(it->v), whereStruct.property.data(), target)) {
-                        if (whereStruct.property.empty()) {
-                            if (whereStruct.renderer.variableResolver.getTruthy(whereStruct.renderer, target))
-                                whereStruct.accumulator.a.push_back(*it);
-                        } else {
-                            //std::string str;
-                            //if (target->getString(str)) {
-                                // TODO
-                                //if (str == whereStruct.value)
-                                //    whereStruct.accumulator.a.push_back(*it);
-                            //}
-                        }
-                    }
-                }
-            }
-        }
+    struct WhereFilterNode : StreamingArrayFilterNodeType {
+        WhereFilterNode() : StreamingArrayFilterNodeType("where", 1, 2) { }
 
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            auto operand = getOperand(renderer, node, store);
-            auto arg1 = getArgument(renderer, node, store, 0);
-            auto arg2 = getArgument(renderer, node, store, 1);
-            WhereStruct whereStruct = { renderer, renderer.getString(arg1), arg2.variant, nullptr };
-            switch (operand.variant.type) {
-                case Variant::Type::VARIABLE:
-                    accumulate(whereStruct, operand.variant.v);
-                break;
-                case Variant::Type::ARRAY:
-                    accumulate(whereStruct, operand.variant.a);
-                break;
-                default:
-                    return Node();
-            }
-            return whereStruct.accumulator;
+        // Elements whose property is truthy, or, given a value, equal to it.
+        bool step(Renderer& renderer, Variant& element, const Node* arguments) const override {
+            Variable target;
+            if (element.type != Variant::Type::VARIABLE || arguments[0].type || arguments[0].variant.type != Variant::Type::STRING ||
+                    !renderer.variableResolver.getDictionaryVariable(renderer, element.v, arguments[0].variant.s.c_str(), target))
+                return false;
+            if (arguments[1].type || arguments[1].variant.type == Variant::Type::NIL)
+                return renderer.variableResolver.getTruthy(renderer, target);
+            return renderer.parseVariant(target, true) == arguments[1].variant;
         }
     };
 
@@ -1840,23 +2286,34 @@ namespace Liquid {
         struct UniqStruct {
             Renderer& renderer;
             std::unordered_set<size_t> hashes;
-            Variant accumulator;
+            Variant accumulator { vector<Variant>() };
         };
 
         void accumulate(UniqStruct& uniqStruct, Variable v) const {
             uniqStruct.renderer.variableResolver.iterate(uniqStruct.renderer, v, +[](void* variable, void* data) {
                 UniqStruct& uniqStruct = *static_cast<UniqStruct*>(data);
                 Variant v = uniqStruct.renderer.parseVariant(Variable({variable}));
-                if (!uniqStruct.hashes.emplace(v.hash()).second)
-                    uniqStruct.accumulator.a.push_back(variable);
+                if (uniqStruct.hashes.emplace(v.hash()).second)
+                    uniqStruct.accumulator.a.push_back(Variable({variable}));
                 return true;
             }, &uniqStruct, 0, -1, false);
         }
 
+        // Nothing's copied until the first duplicate; arrays without any come back sharing the operand's items.
         void accumulate(UniqStruct& uniqStruct, const Variant& v) const {
-            for (auto it = v.a.begin(); it != v.a.end(); ++it) {
-                if (!uniqStruct.hashes.emplace(it->hash()).second)
-                    uniqStruct.accumulator.a.push_back(v);
+            auto first = v.a.begin();
+            while (first != v.a.end() && uniqStruct.hashes.emplace(first->hash()).second)
+                ++first;
+            if (first == v.a.end()) {
+                uniqStruct.accumulator = v;
+                return;
+            }
+            uniqStruct.accumulator.a.reserve(v.a.size() - 1);
+            for (auto it = v.a.begin(); it != first; ++it)
+                uniqStruct.accumulator.a.push_back(*it);
+            for (auto it = first + 1; it != v.a.end(); ++it) {
+                if (uniqStruct.hashes.emplace(it->hash()).second)
+                    uniqStruct.accumulator.a.push_back(*it);
             }
         }
 
@@ -1864,13 +2321,13 @@ namespace Liquid {
             auto operand = getOperand(renderer, node, store);
             auto arg1 = getArgument(renderer, node, store, 0);
             auto arg2 = getArgument(renderer, node, store, 1);
-            UniqStruct uniqStruct = { renderer, {}, nullptr };
+            UniqStruct uniqStruct = { renderer, {} };
             switch (operand.variant.type) {
                 case Variant::Type::VARIABLE:
                     accumulate(uniqStruct, operand.variant.v);
                 break;
                 case Variant::Type::ARRAY:
-                    accumulate(uniqStruct, operand.variant.a);
+                    accumulate(uniqStruct, operand.variant);
                 break;
                 default:
                     return Node();
@@ -1882,7 +2339,12 @@ namespace Liquid {
 
 
     struct FirstFilterNode : ArrayFilterNodeType {
-        FirstFilterNode() : ArrayFilterNodeType("first", 0, 0) { }
+        FirstFilterNode() : ArrayFilterNodeType("first", 0, 0) { reducesArrays = true; }
+
+        bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const override {
+            reduction.result = Node(move(element));
+            return false;
+        }
 
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             Variable v;
@@ -1899,15 +2361,43 @@ namespace Liquid {
 
     };
 
-    struct FirstDotFilterNode : DotFilterNodeType {
-        FirstDotFilterNode() : DotFilterNodeType("first") { }
+    // Dot filters that double as properties of the forloop drop; forloop.first is asking the loop, not the filter.
+    struct LoopPropertyDotFilterNodeType : DotFilterNodeType {
+        LoopPropertyDotFilterNodeType(const string& symbol) : DotFilterNodeType(symbol) { }
 
-        Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            if (node.type && node.children.size() == 1 && node.children[0]->type && node.children[0]->type->type == NodeType::Type::VARIABLE && node.children[0]->children.size() == 1) {
-                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(*node.children[0].get(), store);
-                if (drop.second)
-                    return drop.second(renderer, Variant("first"), store, drop.first);
+        static bool isLoopProperty(const Node& node) {
+            if (!node.type || node.children.size() != 1 || !node.children[0]->type || node.children[0]->type->type != NodeType::Type::VARIABLE || node.children[0]->children.size() != 1)
+                return false;
+            const Node& name = *node.children[0]->children[0].get();
+            return !name.type && name.variant.type == Variant::Type::STRING && name.variant.s == "forloop";
+        }
+
+        // The forloop drop, if the node's asking for one of its properties, and we're in a loop.
+        pair<void*, Renderer::DropFunction> getLoopDrop(Renderer& renderer, const Node& node) const {
+            if (!isLoopProperty(node))
+                return { nullptr, nullptr };
+            return renderer.getInternalDrop("forloop");
+        }
+
+        void compile(Compiler& compiler, const Node& node) const override {
+            if (isLoopProperty(node)) {
+                auto it = compiler.dropFrames.find("forloop");
+                if (it != compiler.dropFrames.end() && it->second.size() > 0) {
+                    it->second.back().first(compiler, it->second.back().second, node);
+                    return;
+                }
             }
+            DotFilterNodeType::compile(compiler, node);
+        }
+    };
+
+    struct FirstDotFilterNode : LoopPropertyDotFilterNodeType {
+        FirstDotFilterNode() : LoopPropertyDotFilterNodeType("first") { }
+
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            pair<void*, Renderer::DropFunction> drop = getLoopDrop(renderer, node);
+            if (drop.second)
+                return drop.second(renderer, Variant(symbol), store, drop.first);
             auto operand = getOperand(renderer, node, store);
             switch (operand.variant.type) {
                 case Variant::Type::ARRAY:
@@ -1919,18 +2409,6 @@ namespace Liquid {
             }
         }
 
-        void compile(Compiler& compiler, const Node& node) const override {
-            if (node.type && node.children.size() == 1 && node.children[0]->type && node.children[0]->type->type == NodeType::Type::VARIABLE && node.children[0]->children.size() == 1 && !node.children[0]->children[0]->type) {
-                string str = node.children[0]->children[0]->variant.s;
-                auto it = compiler.dropFrames.find(str);
-                if (it != compiler.dropFrames.end() && it->second.size() > 0) {
-                    it->second.back().first(compiler, it->second.back().second, node);
-                    return;
-                }
-            }
-            DotFilterNodeType::compile(compiler, node);
-        }
-
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const {
             Variable v;
             LiquidVariableType type = renderer.variableResolver.getType(renderer, operand);
@@ -1953,7 +2431,12 @@ namespace Liquid {
 
 
     struct LastFilterNode : ArrayFilterNodeType {
-        LastFilterNode() : ArrayFilterNodeType("last", 0, 0) { }
+        LastFilterNode() : ArrayFilterNodeType("last", 0, 0) { reducesArrays = true; }
+
+        bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const override {
+            reduction.result = Node(move(element));
+            return true;
+        }
 
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             Variable v;
@@ -1971,15 +2454,13 @@ namespace Liquid {
     };
 
 
-    struct LastDotFilterNode : DotFilterNodeType {
-        LastDotFilterNode() : DotFilterNodeType("last") { }
+    struct LastDotFilterNode : LoopPropertyDotFilterNodeType {
+        LastDotFilterNode() : LoopPropertyDotFilterNodeType("last") { }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            if (node.type && node.type->type == NodeType::Type::VARIABLE && node.children.size() == 1) {
-                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(*node.children[0].get(), store);
-                if (drop.second)
-                    return drop.second(renderer, Variant("first"), store, drop.first);
-            }
+            pair<void*, Renderer::DropFunction> drop = getLoopDrop(renderer, node);
+            if (drop.second)
+                return drop.second(renderer, Variant(symbol), store, drop.first);
             auto operand = getOperand(renderer, node, store);
             switch (operand.variant.type) {
                 case Variant::Type::ARRAY:
@@ -2013,7 +2494,16 @@ namespace Liquid {
 
 
     struct IndexFilterNode : ArrayFilterNodeType {
-        IndexFilterNode() : ArrayFilterNodeType("index", 1, 1) { }
+        IndexFilterNode() : ArrayFilterNodeType("index", 1, 1) { reducesArrays = true; }
+
+        bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const override {
+            long long idx = arguments[0].variant.getInt();
+            if (reduction.count < idx)
+                return true;
+            if (reduction.count == idx)
+                reduction.result = Node(move(element));
+            return false;
+        }
 
         Node variableOperate(Renderer& renderer, const Node& node, Variable store, Variable operand) const override {
             Variable v;
@@ -2035,7 +2525,15 @@ namespace Liquid {
 
 
     struct SizeFilterNode : FilterNodeType {
-        SizeFilterNode() : FilterNodeType("size", 0, 0) { }
+        SizeFilterNode() : FilterNodeType("size", 0, 0) {
+            borrowsStrings = true;
+            reducesArrays = true;
+        }
+
+        bool take(Renderer& renderer, Reduction& reduction, Variant&& element, const Node* arguments) const override { return true; }
+        void finish(Renderer& renderer, Reduction& reduction, const Node* arguments) const override {
+            reduction.result = Node(reduction.count);
+        }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
             auto operand = getOperand(renderer, node, store);
@@ -2045,7 +2543,8 @@ namespace Liquid {
                 case Variant::Type::VARIABLE:
                     return variableOperate(renderer, node, store, operand.variant.v);
                 case Variant::Type::STRING:
-                    return Variant((long long)operand.variant.s.size());
+                case Variant::Type::STRING_VIEW:
+                    return Variant((long long)operand.variant.getStringView().size());
                 default:
                     return Node();
             }
@@ -2064,15 +2563,13 @@ namespace Liquid {
     };
 
 
-    struct SizeDotFilterNode : DotFilterNodeType {
-        SizeDotFilterNode() : DotFilterNodeType("size") { }
+    struct SizeDotFilterNode : LoopPropertyDotFilterNodeType {
+        SizeDotFilterNode() : LoopPropertyDotFilterNodeType("size") { borrowsStrings = true; }
 
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            if (node.type && node.type->type == NodeType::Type::VARIABLE && node.children.size() == 1) {
-                pair<void*, Renderer::DropFunction> drop = renderer.getInternalDrop(*node.children[0].get(), store);
-                if (drop.second)
-                    return drop.second(renderer, Variant("size"), store, drop.first);
-            }
+            pair<void*, Renderer::DropFunction> drop = getLoopDrop(renderer, node);
+            if (drop.second)
+                return drop.second(renderer, Variant(symbol), store, drop.first);
             auto operand = getOperand(renderer, node, store);
             switch (operand.variant.type) {
                 case Variant::Type::ARRAY:
@@ -2080,7 +2577,8 @@ namespace Liquid {
                 case Variant::Type::VARIABLE:
                     return variableOperate(renderer, node, store, operand.variant.v);
                 case Variant::Type::STRING:
-                    return Variant((long long)operand.variant.s.size());
+                case Variant::Type::STRING_VIEW:
+                    return Variant((long long)operand.variant.getStringView().size());
                 default:
                     return Variant((long long)operand.variant.getString().size());
             }
@@ -2265,6 +2763,10 @@ namespace Liquid {
         context.registerType<CommentNode>();
         context.registerType<RawNode>();
 
+        context.registerType<IncludeNode>();
+        context.registerType<RenderNode>();
+        context.registerType<SectionNode>();
+
         // Standard set of operators.
         if (assignConditionalOperatorsOnly) {
             assignNode->registerType<PlusOperatorNode>();
@@ -12,7 +12,8 @@ namespace Liquid {
     // defaults that are least/least/most permissive.
     struct Dialect {};
 
-    // The only tags missing from the standard set of non-web tags is {% include %}.
+    // Includes the whole standard set of non-web tags; {% include %}, {% render %} and {% section %} need a partial cache on the renderer
+    // to find their partials in.
     struct StandardDialect :Dialect {
 
         static void implement(
@@ -3,6 +3,7 @@
 #include "context.h"
 #include "optimizer.h"
 #include "compiler.h"
+#include "snapshotvariable.h"
 #include <memory>
 
 using namespace Liquid;
@@ -28,9 +29,9 @@ void liquidImplementPermissiveStandardDialect(LiquidContext context) {
     }
 #endif
 
-LiquidRenderer liquidCreateRenderer(LiquidContext context) {
+static LiquidVariableResolver nullVariableResolver() {
     // Removed these specified initializers for compatibility with C++17 and MSVC.
-    Interpreter* interpreter = new Interpreter(*static_cast<Context*>(context.context), {
+    return {
         /* .getType = */+[](LiquidRenderer renderer, void* variable) { return LIQUID_VARIABLE_TYPE_NIL; },
         /* .getBool = */+[](LiquidRenderer renderer, void* variable, bool* target) { return false; },
         /* .getTruthy = */+[](LiquidRenderer renderer, void* variable) { return false; },
@@ -54,8 +55,26 @@ LiquidRenderer liquidCreateRenderer(LiquidContext context) {
         /* .createNil = */+[](LiquidRenderer renderer) { return (void*)NULL; },
         /* .createClone = */+[](LiquidRenderer renderer, void* value) { return (void*)NULL; },
         /* .freeVariable = */+[](LiquidRenderer renderer, void* value) { },
-        /* .compare = */+[](void* a, void* b) { return 0; }
-    });
+        /* .compare = */+[](void* a, void* b) { return 0; },
+        /* .getDictionaryVariableHashed = */nullptr,
+        /* .getDictionaryVariableCached = */nullptr,
+        /* .getStringView = */nullptr,
+        /* .threadSafeReads = */true
+    };
+}
+
+size_t liquidHashKey(const char* key, size_t length) {
+    // FNV-1a.
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ? (size_t)hash : 1;
+}
+
+LiquidRenderer liquidCreateRenderer(LiquidContext context) {
+    Interpreter* interpreter = new Interpreter(*static_cast<Context*>(context.context), nullVariableResolver());
     // So that we pre-allocate things.
     interpreter->buffers.push(string());
     return LiquidRenderer({ interpreter });
@@ -65,6 +84,35 @@ void liquidFreeRenderer(LiquidRenderer renderer) {
     delete (Interpreter*)renderer.renderer;
 }
 
+LiquidRendererPool liquidCreateRendererPool(LiquidContext context) {
+    return LiquidRendererPool({ new RendererPool(*static_cast<Context*>(context.context), nullVariableResolver()) });
+}
+
+void liquidRendererPoolRegisterVariableResolver(LiquidRendererPool pool, LiquidVariableResolver resolver) {
+    RendererPool* rendererPool = static_cast<RendererPool*>(pool.pool);
+    std::lock_guard<std::mutex> lock(rendererPool->mutex);
+    rendererPool->variableResolver = resolver;
+}
+
+void liquidRendererPoolSetConfigureFunction(LiquidRendererPool pool, LiquidRendererConfigureFunction configure, void* data) {
+    RendererPool* rendererPool = static_cast<RendererPool*>(pool.pool);
+    std::lock_guard<std::mutex> lock(rendererPool->mutex);
+    rendererPool->configure = configure;
+    rendererPool->configureData = data;
+}
+
+LiquidRenderer liquidRendererPoolGetRenderer(LiquidRendererPool pool) {
+    return LiquidRenderer({ &static_cast<RendererPool*>(pool.pool)->get() });
+}
+
+void liquidRendererPoolReleaseRenderer(LiquidRendererPool pool) {
+    static_cast<RendererPool*>(pool.pool)->release();
+}
+
+void liquidFreeRendererPool(LiquidRendererPool pool) {
+    delete (RendererPool*)pool.pool;
+}
+
 LiquidParser liquidCreateParser(LiquidContext context) {
     return LiquidParser({ new Parser(*static_cast<Context*>(context.context)) });
 }
@@ -76,6 +124,10 @@ LiquidOptimizer liquidCreateOptimizer(LiquidRenderer renderer) {
     return LiquidOptimizer({ new Optimizer(*static_cast<Renderer*>(renderer.renderer)) });
 }
 
+void liquidOptimizerFreezeVariable(LiquidOptimizer optimizer, const char* name) {
+    static_cast<Optimizer*>(optimizer.optimizer)->frozenVariables.insert(name);
+}
+
 void liquidOptimizeTemplate(LiquidOptimizer optimizer, LiquidTemplate tmpl, void* variableStore) {
     static_cast<Optimizer*>(optimizer.optimizer)->optimize(*static_cast<Node*>(tmpl.ast), Variable({ variableStore }));
 }
@@ -116,11 +168,217 @@ void liquidFreeProgram(LiquidProgram program) {
     delete static_cast<Program*>(program.program);
 }
 
+static void liquidCopyError(const Liquid::Exception& exception, char* buffer, size_t maxSize) {
+    if (!buffer || !maxSize)
+        return;
+    strncpy(buffer, exception.what(), maxSize);
+    buffer[maxSize-1] = 0;
+}
+
+int liquidSaveProgram(LiquidContext context, LiquidProgram program, const char* path, char* error, size_t maxSize) {
+    try {
+        static_cast<Program*>(program.program)->save(*static_cast<Context*>(context.context), path);
+    } catch (Liquid::Exception& exp) {
+        liquidCopyError(exp, error, maxSize);
+        return -1;
+    }
+    return 0;
+}
+
+LiquidProgram liquidLoadProgram(LiquidContext context, const char* path, char* error, size_t maxSize) {
+    try {
+        return LiquidProgram({ new Program(Program::load(*static_cast<Context*>(context.context), path)) });
+    } catch (Liquid::Exception& exp) {
+        liquidCopyError(exp, error, maxSize);
+        return LiquidProgram({ nullptr });
+    }
+}
+
+LiquidTemplateCache liquidCreateTemplateCache(size_t maxSize) {
+    return LiquidTemplateCache({ new TemplateCache(maxSize) });
+}
+
+void liquidFreeTemplateCache(LiquidTemplateCache cache) {
+    delete static_cast<TemplateCache*>(cache.cache);
+}
+
+LiquidCachedTemplate liquidTemplateCacheGet(LiquidTemplateCache cache, LiquidParser parser, LiquidCompiler compiler, const char* buffer, size_t size, const char* file, LiquidLexerError* lexerError, LiquidParserError* parserError) {
+    if (lexerError)
+        lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
+    if (parserError)
+        parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
+    try {
+        auto entry = static_cast<TemplateCache*>(cache.cache)->get(*static_cast<Parser*>(parser.parser), *static_cast<Compiler*>(compiler.compiler), buffer, size, file ? file : "");
+        return LiquidCachedTemplate({ new shared_ptr<const TemplateCache::Entry>(move(entry)) });
+    } catch (Parser::Exception& exp) {
+        if (lexerError)
+            *lexerError = exp.lexerError;
+        if (parserError && exp.parserErrors.size() > 0)
+            *parserError = exp.parserErrors[0];
+        return LiquidCachedTemplate({ NULL });
+    }
+}
+
+LiquidTemplateCacheStatistics liquidTemplateCacheGetStatistics(LiquidTemplateCache cache) {
+    return static_cast<TemplateCache*>(cache.cache)->getStatistics();
+}
+
+void liquidTemplateCacheClear(LiquidTemplateCache cache) {
+    static_cast<TemplateCache*>(cache.cache)->clear();
+}
+
+LiquidTemplate liquidCachedTemplateGetTemplate(LiquidCachedTemplate tmpl) {
+    return LiquidTemplate({ const_cast<Node*>(&(*static_cast<shared_ptr<const TemplateCache::Entry>*>(tmpl.entry))->tmpl) });
+}
+
+LiquidProgram liquidCachedTemplateGetProgram(LiquidCachedTemplate tmpl) {
+    return LiquidProgram({ const_cast<Program*>(&(*static_cast<shared_ptr<const TemplateCache::Entry>*>(tmpl.entry))->program) });
+}
+
+void liquidFreeCachedTemplate(LiquidCachedTemplate tmpl) {
+    delete static_cast<shared_ptr<const TemplateCache::Entry>*>(tmpl.entry);
+}
+
+LiquidPartialCache liquidCreatePartialCache(LiquidContext context, LiquidFileSystem fileSystem) {
+    return LiquidPartialCache({ new PartialCache(*static_cast<Context*>(context.context), fileSystem) });
+}
+
+void liquidFreePartialCache(LiquidPartialCache cache) {
+    delete static_cast<PartialCache*>(cache.cache);
+}
+
+void liquidPartialCacheClear(LiquidPartialCache cache) {
+    static_cast<PartialCache*>(cache.cache)->clear();
+}
+
+void liquidRendererSetPartialCache(LiquidRenderer renderer, LiquidPartialCache cache) {
+    static_cast<Renderer*>(renderer.renderer)->partials = static_cast<PartialCache*>(cache.cache);
+}
+
+void liquidCompilerSetPartialCache(LiquidCompiler compiler, LiquidPartialCache cache) {
+    static_cast<Compiler*>(compiler.compiler)->partials = static_cast<PartialCache*>(cache.cache);
+}
+
+LiquidWorkerPool liquidCreateWorkerPool(int threads) {
+    return LiquidWorkerPool { new WorkerPool(std::max(threads, 0)) };
+}
+
+void liquidFreeWorkerPool(LiquidWorkerPool pool) {
+    delete static_cast<WorkerPool*>(pool.pool);
+}
+
+void liquidRendererSetWorkerPool(LiquidRenderer renderer, LiquidWorkerPool pool, int minimumIterations) {
+    static_cast<Renderer*>(renderer.renderer)->workers = static_cast<WorkerPool*>(pool.pool);
+    static_cast<Renderer*>(renderer.renderer)->minimumParallelIterations = std::max(minimumIterations, 0);
+}
+
+LiquidSnapshot liquidCreateSnapshot(LiquidSnapshotExpandFunction expand, LiquidSnapshotReleaseFunction release, void* data) {
+    return LiquidSnapshot { &(new Snapshot(expand, release, data))->root };
+}
+
+void liquidFreeSnapshot(LiquidSnapshot root) {
+    delete static_cast<SnapshotValue*>(root.snapshot)->snapshot;
+}
+
+void liquidSnapshotSetNil(LiquidSnapshot value) { static_cast<SnapshotValue*>(value.snapshot)->setNil(); }
+void liquidSnapshotSetBool(LiquidSnapshot value, bool b) { static_cast<SnapshotValue*>(value.snapshot)->setBool(b); }
+void liquidSnapshotSetInteger(LiquidSnapshot value, long long i) { static_cast<SnapshotValue*>(value.snapshot)->setInteger(i); }
+void liquidSnapshotSetFloat(LiquidSnapshot value, double f) { static_cast<SnapshotValue*>(value.snapshot)->setFloat(f); }
+void liquidSnapshotSetString(LiquidSnapshot value, const char* str, size_t length) { static_cast<SnapshotValue*>(value.snapshot)->setString(std::string_view(str, length)); }
+void liquidSnapshotSetDictionary(LiquidSnapshot value, void* host) { static_cast<SnapshotValue*>(value.snapshot)->setDictionary(host); }
+void liquidSnapshotSetArray(LiquidSnapshot value, void* host) { static_cast<SnapshotValue*>(value.snapshot)->setArray(host); }
+
+LiquidSnapshot liquidSnapshotAddKey(LiquidSnapshot dictionary, const char* key, size_t length) {
+    return LiquidSnapshot { static_cast<SnapshotValue*>(dictionary.snapshot)->add(std::string_view(key, length)) };
+}
+
+LiquidSnapshot liquidSnapshotAddElement(LiquidSnapshot array) {
+    return LiquidSnapshot { static_cast<SnapshotValue*>(array.snapshot)->add() };
+}
+
+void liquidSnapshotExpand(LiquidSnapshot value) {
+    static_cast<SnapshotValue*>(value.snapshot)->expandAll();
+}
+
+void* liquidSnapshotGetHost(LiquidSnapshot value) {
+    return static_cast<SnapshotValue*>(value.snapshot)->host;
+}
+
+size_t liquidSnapshotGetSize(LiquidSnapshot container) {
+    return static_cast<SnapshotValue*>(container.snapshot)->expand().elements.size();
+}
+
+LiquidSnapshot liquidSnapshotGetElement(LiquidSnapshot container, size_t idx, const char** key, size_t* keyLength) {
+    SnapshotValue& value = static_cast<SnapshotValue*>(container.snapshot)->expand();
+    if (idx >= value.elements.size())
+        return LiquidSnapshot { nullptr };
+    if (key)
+        *key = idx < value.keys.size() ? value.keys[idx].data() : nullptr;
+    if (keyLength)
+        *keyLength = idx < value.keys.size() ? value.keys[idx].size() : 0;
+    return LiquidSnapshot { value.elements[idx].get() };
+}
+
+LiquidVariableResolver liquidGetSnapshotVariableResolver() {
+    return SnapshotVariableResolver();
+}
+
+LiquidInlineCacheStatistics liquidRendererGetInlineCacheStatistics(LiquidRenderer renderer) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    return LiquidInlineCacheStatistics { interpreter->inlineCacheHits, interpreter->inlineCacheMisses };
+}
+
+void liquidRendererResetInlineCacheStatistics(LiquidRenderer renderer) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    interpreter->inlineCacheHits = 0;
+    interpreter->inlineCacheMisses = 0;
+}
+
+void liquidRendererSetProfiling(LiquidRenderer renderer, bool enabled) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    if (!enabled)
+        interpreter->profiler.reset();
+    else if (!interpreter->profiler)
+        interpreter->profiler = make_unique<Profiler>();
+}
+
+void liquidRendererResetProfile(LiquidRenderer renderer) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    if (interpreter->profiler)
+        interpreter->profiler->clear();
+}
+
+size_t liquidRendererGetProfile(LiquidRenderer renderer, LiquidProfileEntry* entries, size_t maxEntries, bool bySymbol) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    if (!interpreter->profiler)
+        return 0;
+    vector<Profiler::Entry> profile = bySymbol ? interpreter->profiler->getSymbols() : interpreter->profiler->entries;
+    for (size_t i = 0; i < profile.size() && i < maxEntries; ++i) {
+        const Profiler::Entry& entry = profile[i];
+        entries[i] = LiquidProfileEntry { Profiler::getName(entry.type), entry.line, entry.column, entry.calls, entry.inclusiveTime, entry.exclusiveTime, entry.bytes, entry.resolverCalls, entry.allocations };
+    }
+    return profile.size();
+}
+
+size_t liquidRendererGetProfileFlameGraph(LiquidRenderer renderer, char* buffer, size_t maxSize) {
+    Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    string graph = interpreter->profiler ? interpreter->profiler->getFlameGraph() : string();
+    if (maxSize > 0) {
+        size_t copied = std::min(maxSize - 1, graph.size());
+        memcpy(buffer, graph.data(), copied);
+        buffer[copied] = 0;
+    }
+    return graph.size();
+}
+
 LiquidProgramRender liquidRendererRunProgram(LiquidRenderer renderer, void* variableStore, LiquidProgram program, LiquidRendererError* error) {
     if (error)
         error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
 
     Interpreter* interpreter = static_cast<Interpreter*>(renderer.renderer);
+    // Renderers handed out by a pool don't come with their output buffer.
+    if (interpreter->buffers.empty())
+        interpreter->buffers.push(string());
     interpreter->buffers.top().clear();
     try {
         interpreter->renderTemplate(*static_cast<Program*>(program.program), Variable({ variableStore }), +[](const char* chunk, size_t len, void* data) {
@@ -197,6 +455,46 @@ void liquidFreeTemplate(LiquidTemplate tmpl) {
     delete (Node*)tmpl.ast;
 }
 
+LiquidDocument liquidParserParseDocument(LiquidParser parser, const char* buffer, size_t size, LiquidLexerError* lexerError, LiquidParserError* parserError) {
+    if (lexerError)
+        lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
+    if (parserError)
+        parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
+    try {
+        return LiquidDocument({ new Parser::Document(static_cast<Parser*>(parser.parser)->parseDocument(buffer, size)) });
+    } catch (Parser::Exception& exp) {
+        if (lexerError)
+            *lexerError = exp.lexerError;
+        if (parserError && exp.parserErrors.size() > 0)
+            *parserError = exp.parserErrors[0];
+        return LiquidDocument({ NULL });
+    }
+}
+
+int liquidParserReparseDocument(LiquidParser parser, LiquidDocument document, size_t offset, size_t length, const char* replacement, size_t replacementLength, LiquidLexerError* lexerError, LiquidParserError* parserError) {
+    if (lexerError)
+        lexerError->type = LiquidLexerErrorType::LIQUID_LEXER_ERROR_TYPE_NONE;
+    if (parserError)
+        parserError->type = LiquidParserErrorType::LIQUID_PARSER_ERROR_TYPE_NONE;
+    try {
+        return static_cast<Parser*>(parser.parser)->reparse(*static_cast<Parser::Document*>(document.document), offset, length, replacement, replacementLength) ? 1 : 0;
+    } catch (Parser::Exception& exp) {
+        if (lexerError)
+            *lexerError = exp.lexerError;
+        if (parserError && exp.parserErrors.size() > 0)
+            *parserError = exp.parserErrors[0];
+        return -1;
+    }
+}
+
+LiquidTemplate liquidDocumentGetTemplate(LiquidDocument document) {
+    return LiquidTemplate({ &static_cast<Parser::Document*>(document.document)->tree });
+}
+
+void liquidFreeDocument(LiquidDocument document) {
+    delete static_cast<Parser::Document*>(document.document);
+}
+
 LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRendererError* error) {
     if (error)
         error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
@@ -211,6 +509,34 @@ LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void*
     return LiquidTemplateRender({ str });
 }
 
+size_t liquidRendererRenderTemplates(LiquidRenderer renderer, size_t count, void* const* variableStores, const LiquidTemplate* templates, LiquidTemplateRender* renders, LiquidRendererError* errors) {
+    size_t failed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        LiquidTemplateRender render = liquidRendererRenderTemplate(renderer, variableStores[i], templates[i], errors ? &errors[i] : nullptr);
+        if (!render.internal)
+            ++failed;
+        if (renders)
+            renders[i] = render;
+        else
+            liquidFreeTemplateRender(render);
+    }
+    return failed;
+}
+
+void liquidRendererStreamTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRenderOutputFunction callback, void* data, LiquidRendererError* error) {
+    if (error)
+        error->type = LIQUID_RENDERER_ERROR_TYPE_NONE;
+    LiquidRendererErrorType type = LIQUID_RENDERER_ERROR_TYPE_NONE;
+    try {
+        type = static_cast<Renderer*>(renderer.renderer)->render(*static_cast<Node*>(tmpl.ast), Variable({ variableStore }), callback, data);
+    } catch (Renderer::Exception& exp) {
+        if (error)
+            *error = exp.rendererError;
+        return;
+    }
+    if (error && type != LIQUID_RENDERER_ERROR_TYPE_NONE)
+        *error = Renderer::Error(type, Node());
+}
 
 void* liquidRendererRenderArgument(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRendererError* error) {
     if (error)
@@ -325,6 +651,17 @@ int liquidGetChildCount(LiquidNode parent) {
     return static_cast<const NodeType*>(node.type)->getChildCount(node);
 }
 
+void liquidRendererSetOutputChunkSize(LiquidRenderer renderer, size_t size) {
+    static_cast<Renderer*>(renderer.renderer)->outputChunkSize = size;
+}
+
+void liquidRendererSetLimits(LiquidRenderer renderer, unsigned int maximumMemoryUsage, unsigned int maximumRenderingTime, unsigned long long maximumRenderingFuel) {
+    Renderer* liquidRenderer = static_cast<Renderer*>(renderer.renderer);
+    liquidRenderer->maximumMemoryUsage = maximumMemoryUsage;
+    liquidRenderer->maximumRenderingTime = maximumRenderingTime;
+    liquidRenderer->maximumRenderingFuel = maximumRenderingFuel;
+}
+
 void liquidRendererSetCustomData(LiquidRenderer renderer, void* data) {
     static_cast<Renderer*>(renderer.renderer)->customData = data;
 }
@@ -59,7 +59,9 @@ extern "C" {
         LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME,
         LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_DEPTH,
         LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_VARIABLE,
-        LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER
+        LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER,
+        LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL,
+        LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_PARTIAL
     } LiquidRendererErrorType;
 
     typedef struct SLiquidRendererError {
@@ -94,6 +96,7 @@ extern "C" {
 
     typedef struct SLiquidContext { void* context; } LiquidContext;
     typedef struct SLiquidRenderer { void* renderer; } LiquidRenderer;
+    typedef struct SLiquidRendererPool { void* pool; } LiquidRendererPool;
     typedef struct SLiquidParser { void* parser; } LiquidParser;
     typedef struct SLiquidTemplate { void* ast; } LiquidTemplate;
     typedef struct SLiquidOptimizer { void* optimizer; } LiquidOptimizer;
@@ -103,6 +106,43 @@ extern "C" {
     typedef struct SLiquidNode { void* node; } LiquidNode;
     typedef struct SLiquidTemplateRender { void* internal; } LiquidTemplateRender;
     typedef struct SLiquidProgramRender { char* str; size_t len; } LiquidProgramRender;
+    typedef struct SLiquidTemplateCache { void* cache; } LiquidTemplateCache;
+    typedef struct SLiquidCachedTemplate { void* entry; } LiquidCachedTemplate;
+    typedef struct SLiquidDocument { void* document; } LiquidDocument;
+    typedef struct SLiquidTemplateCacheStatistics { size_t hits; size_t misses; size_t evictions; size_t size; } LiquidTemplateCacheStatistics;
+    typedef struct SLiquidPartialCache { void* cache; } LiquidPartialCache;
+    typedef struct SLiquidWorkerPool { void* pool; } LiquidWorkerPool;
+    typedef struct SLiquidSnapshot { void* snapshot; } LiquidSnapshot;
+    // Where the partials of include, render and section come from. readPartial writes out the source of the named partial through output,
+    // in as many chunks as it likes, and returns true; or returns false if there's no such partial.
+    typedef struct SLiquidFileSystem {
+        bool (*readPartial)(const char* name, size_t length, void (*output)(const char* chunk, size_t size, void* target), void* target, void* data);
+        void* data;
+    } LiquidFileSystem;
+    // What a resolver remembers about the last lookup at a particular place in a program; both start out as 0.
+    typedef struct SLiquidInlineCache { size_t shape; size_t slot; } LiquidInlineCache;
+    typedef struct SLiquidInlineCacheStatistics { size_t hits; size_t misses; } LiquidInlineCacheStatistics;
+    // What a profiled renderer recorded for nodes of one type, at one place in the source; see Liquid::Profiler. Times are in nanoseconds.
+    // The symbol belongs to the context.
+    typedef struct SLiquidProfileEntry {
+        const char* symbol;
+        size_t line;
+        size_t column;
+        size_t calls;
+        unsigned long long inclusiveTime;
+        unsigned long long exclusiveTime;
+        size_t bytes;
+        size_t resolverCalls;
+        size_t allocations;
+    } LiquidProfileEntry;
+
+    typedef enum ELiquidInlineCacheResult {
+        LIQUID_INLINE_CACHE_NOT_FOUND,
+        // Found, but not with what was in the cache; the cache should have been updated.
+        LIQUID_INLINE_CACHE_MISS,
+        // Found with what was in the cache.
+        LIQUID_INLINE_CACHE_HIT
+    } LiquidInlineCacheResult;
 
     typedef enum ELiquidVariableType {
         LIQUID_VARIABLE_TYPE_NIL,
@@ -147,8 +187,24 @@ extern "C" {
         void* (*createClone)(LiquidRenderer renderer, void* value);
         void (*freeVariable)(LiquidRenderer renderer, void* value);
         int (*compare)(void* a, void* b);
+        // Optional; if set, called instead of getDictionaryVariable for keys that are known ahead of time, with their length, and their
+        // liquidHashKey, so neither has to be worked out again.
+        bool (*getDictionaryVariableHashed)(LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target);
+        // Optional; if set, compiled programs call this instead, with a cache for the instruction doing the lookup. Resolvers that can tell
+        // a container is laid out like the one the cache was last filled in for can use it to skip the lookup. The cache is only ever a hint;
+        // it can be left over from some other container, or program entirely, and must be checked.
+        LiquidInlineCacheResult (*getDictionaryVariableCached)(LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, LiquidInlineCache* cache, void** target);
+        // Optional; if set, strings are read through this rather than copied out with getStringLength and getString. The string is borrowed
+        // as it is, and needn't be null terminated, but must stay where it is until the render's over, or the variable's assigned to.
+        bool (*getStringView)(LiquidRenderer renderer, void* variable, const char** view, size_t* length);
+        // Set if the getters, and iterate, can be called on the same variables from any number of threads at once; renderers only render
+        // in parallel with resolvers that are. See liquidRendererSetWorkerPool.
+        bool threadSafeReads;
     } LiquidVariableResolver;
 
+    // The hash getDictionaryVariableHashed is given; never 0.
+    size_t liquidHashKey(const char* key, size_t length);
+
     LiquidContext liquidCreateContext();
     const char* liquidGetContextError(LiquidContext context);
     void liquidFreeContext(LiquidContext context);
@@ -164,6 +220,10 @@ extern "C" {
     LiquidRenderer liquidCreateRenderer(LiquidContext context);
     void liquidRendererSetStrictVariables(LiquidRenderer renderer, bool strict);
     void liquidRendererSetStrictFilters(LiquidRenderer renderer, bool strict);
+    // Size of the chunks handed to the callback in liquidRendererStreamTemplate; 0 renders the whole template before calling the callback.
+    void liquidRendererSetOutputChunkSize(LiquidRenderer renderer, size_t size);
+    // Limits on a render; 0 for none. Memory is in bytes, time in milliseconds, and fuel in nodes rendered, or calls and iterations interpreted.
+    void liquidRendererSetLimits(LiquidRenderer renderer, unsigned int maximumMemoryUsage, unsigned int maximumRenderingTime, unsigned long long maximumRenderingFuel);
     void liquidRendererSetCustomData(LiquidRenderer renderer, void* data);
     void* liquidRendererGetCustomData(LiquidRenderer renderer);
     void liquidRendererSetReturnValueNil(LiquidRenderer renderer);
@@ -176,6 +236,18 @@ extern "C" {
     LiquidRendererWarning liquidGetRendererWarning(LiquidRenderer renderer, size_t index);
     void liquidFreeRenderer(LiquidRenderer renderer);
 
+    // Templates and programs can be shared between threads, but each thread needs its own renderer; a pool hands out one per calling thread.
+    // Renderers from the pool are owned by it, and are freed when their thread exits; never call liquidFreeRenderer on one. A thread that's done
+    // with its renderer, but carries on, can free it sooner with liquidRendererPoolReleaseRenderer.
+    LiquidRendererPool liquidCreateRendererPool(LiquidContext context);
+    // Only applies to renderers the pool creates after the call.
+    void liquidRendererPoolRegisterVariableResolver(LiquidRendererPool pool, LiquidVariableResolver resolver);
+    typedef void (*LiquidRendererConfigureFunction)(LiquidRenderer renderer, void* data);
+    void liquidRendererPoolSetConfigureFunction(LiquidRendererPool pool, LiquidRendererConfigureFunction configure, void* data);
+    LiquidRenderer liquidRendererPoolGetRenderer(LiquidRendererPool pool);
+    void liquidRendererPoolReleaseRenderer(LiquidRendererPool pool);
+    void liquidFreeRendererPool(LiquidRendererPool pool);
+
     LiquidParser liquidCreateParser(LiquidContext context);
     size_t liquidGetParserWarningCount(LiquidParser parser);
     LiquidParserWarning liquidGetParserWarning(LiquidParser parser, size_t index);
@@ -187,7 +259,18 @@ extern "C" {
 
     void liquidFreeTemplate(LiquidTemplate tmpl);
 
+    // For editors; keeps the source with the template, so that edits to it only re-parse the top-level blocks they touch.
+    LiquidDocument liquidParserParseDocument(LiquidParser parser, const char* buffer, size_t size, LiquidLexerError* lexer, LiquidParserError* error);
+    // Replaces length bytes at offset with the replacement. Returns 1 if only part of the document needed re-parsing, 0 if all of it did,
+    // and -1, leaving the document as it was, if it no longer parses. Warnings are for the re-parsed part only.
+    int liquidParserReparseDocument(LiquidParser parser, LiquidDocument document, size_t offset, size_t length, const char* replacement, size_t replacementLength, LiquidLexerError* lexer, LiquidParserError* error);
+    // Belongs to the document, and is only good until its next re-parse.
+    LiquidTemplate liquidDocumentGetTemplate(LiquidDocument document);
+    void liquidFreeDocument(LiquidDocument document);
+
     LiquidOptimizer liquidCreateOptimizer(LiquidRenderer renderer);
+    // Once any are frozen, only variables under frozen top-level names are optimized away; the rest are left for rendering.
+    void liquidOptimizerFreezeVariable(LiquidOptimizer optimizer, const char* name);
     void liquidOptimizeTemplate(LiquidOptimizer optimizer, LiquidTemplate tmpl, void* variableStore);
     void liquidFreeOptimizer(LiquidOptimizer optimizer);
 
@@ -195,11 +278,97 @@ extern "C" {
     void liquidFreeCompiler(LiquidCompiler compiler);
     LiquidProgram liquidCompilerCompileTemplate(LiquidCompiler compiler, LiquidTemplate tmpl);
     void liquidFreeProgram(LiquidProgram program);
+    // Saves the program to a file, for any process with a context with the same dialects and extensions registered to load. Returns 0 on
+    // success, or -1, in which case the reason is written into error, if there's one, in the same way as liquidCompilerDisassembleProgram.
+    int liquidSaveProgram(LiquidContext context, LiquidProgram program, const char* path, char* error, size_t maxSize);
+    // Maps a saved program into memory, and runs it from there. Free it with liquidFreeProgram, as usual. Returns a program with a NULL
+    // program on failure, with the reason written into error.
+    LiquidProgram liquidLoadProgram(LiquidContext context, const char* path, char* error, size_t maxSize);
     int liquidCompilerDisassembleProgram(LiquidCompiler compiler, LiquidProgram program, char* buffer, size_t maxSize);
     int liquidParserUnparseTemplate(LiquidParser parser, LiquidTemplate tmpl, char* buffer, size_t maxSize);
 
+    // Holds on to the maxSize most recently used templates, parsed and compiled. Safe to use from any number of threads at once, provided
+    // each passes its own parser and compiler.
+    LiquidTemplateCache liquidCreateTemplateCache(size_t maxSize);
+    void liquidFreeTemplateCache(LiquidTemplateCache cache);
+    // Returns the cached template for the source, parsing and compiling it first if it isn't there. Returns a NULL entry if it doesn't parse,
+    // with the errors filled in as with liquidParserParseTemplate. Free it with liquidFreeCachedTemplate, even after it's been evicted.
+    LiquidCachedTemplate liquidTemplateCacheGet(LiquidTemplateCache cache, LiquidParser parser, LiquidCompiler compiler, const char* buffer, size_t size, const char* file, LiquidLexerError* lexer, LiquidParserError* error);
+    LiquidTemplateCacheStatistics liquidTemplateCacheGetStatistics(LiquidTemplateCache cache);
+    void liquidTemplateCacheClear(LiquidTemplateCache cache);
+    // Both belong to the cached template, and must not be freed, modified, or optimized.
+    LiquidTemplate liquidCachedTemplateGetTemplate(LiquidCachedTemplate tmpl);
+    LiquidProgram liquidCachedTemplateGetProgram(LiquidCachedTemplate tmpl);
+    void liquidFreeCachedTemplate(LiquidCachedTemplate tmpl);
+
+    // Reads partials through the file system the first time each is asked for, and keeps them parsed from then on; partials that aren't
+    // there are remembered as not being there. The same cache can be given to any number of renderers and compilers, on any number of threads.
+    LiquidPartialCache liquidCreatePartialCache(LiquidContext context, LiquidFileSystem fileSystem);
+    void liquidFreePartialCache(LiquidPartialCache cache);
+    // Forgets everything that's been read, so each partial is read again the next time it's used.
+    void liquidPartialCacheClear(LiquidPartialCache cache);
+    // Optimizers use the cache of the renderer they're given; they inline small partials with static names in place.
+    void liquidRendererSetPartialCache(LiquidRenderer renderer, LiquidPartialCache cache);
+    // Programs have the partials their includes name statically compiled in place; they only need the renderer's cache for the rest.
+    void liquidCompilerSetPartialCache(LiquidCompiler compiler, LiquidPartialCache cache);
+
+    // A set of threads that renderers can split their renders up between. The same pool can be given to any number of renderers.
+    LiquidWorkerPool liquidCreateWorkerPool(int threads);
+    void liquidFreeWorkerPool(LiquidWorkerPool pool);
+    // Loops of at least minimumIterations iterations, and runs of top-level blocks, that only read from the store are rendered on the
+    // pool's threads, if the renderer's variable resolver is threadSafeReads. A null pool renders everything on the calling thread.
+    void liquidRendererSetWorkerPool(LiquidRenderer renderer, LiquidWorkerPool pool, int minimumIterations);
+
+    // A native copy of a store from a host language, like perl or ruby, for renderers with liquidGetSnapshotVariableResolver to read without
+    // calling back into the host for every lookup. Containers are copied a level at a time, the first time each is looked in; the expand
+    // function is called with the container, and the host value it was given, and fills it in with liquidSnapshotAddKey and
+    // liquidSnapshotAddElement, giving any containers under it their own host values in turn. Every host value given to the snapshot is
+    // passed to the release function, if there is one, when the snapshot's freed; until then, they must stay as they are. Renders write to
+    // the snapshot, never the host; like any store, what one render assigns is seen by the next that's given the same snapshot.
+    typedef void (*LiquidSnapshotExpandFunction)(LiquidSnapshot container, void* host, void* data);
+    typedef void (*LiquidSnapshotReleaseFunction)(void* host, void* data);
+    // Returns the root, which starts off nil; it, and everything under it, is also the variable to hand renders as their store.
+    LiquidSnapshot liquidCreateSnapshot(LiquidSnapshotExpandFunction expand, LiquidSnapshotReleaseFunction release, void* data);
+    void liquidFreeSnapshot(LiquidSnapshot root);
+    void liquidSnapshotSetNil(LiquidSnapshot value);
+    void liquidSnapshotSetBool(LiquidSnapshot value, bool b);
+    void liquidSnapshotSetInteger(LiquidSnapshot value, long long i);
+    void liquidSnapshotSetFloat(LiquidSnapshot value, double f);
+    void liquidSnapshotSetString(LiquidSnapshot value, const char* str, size_t length);
+    // A NULL host makes an empty container, to be filled in straight away.
+    void liquidSnapshotSetDictionary(LiquidSnapshot value, void* host);
+    void liquidSnapshotSetArray(LiquidSnapshot value, void* host);
+    // Both return the new value, nil, to be set; adding a key that's already there replaces what was there.
+    LiquidSnapshot liquidSnapshotAddKey(LiquidSnapshot dictionary, const char* key, size_t length);
+    LiquidSnapshot liquidSnapshotAddElement(LiquidSnapshot array);
+    // Copies everything under the value now, rather than as it's read.
+    void liquidSnapshotExpand(LiquidSnapshot value);
+    // For handing values from renders back to the host. The host value a container was given, or that of the container it was copied from; otherwise, NULL, and the
+    // container's contents can be read with these, which return a NULL value past the end.
+    void* liquidSnapshotGetHost(LiquidSnapshot value);
+    size_t liquidSnapshotGetSize(LiquidSnapshot container);
+    LiquidSnapshot liquidSnapshotGetElement(LiquidSnapshot container, size_t idx, const char** key, size_t* keyLength);
+    // Reads snapshots, and the values made from them while rendering; those are only ever read on the rendering thread.
+    LiquidVariableResolver liquidGetSnapshotVariableResolver();
+
+    // How often the renderer's lookups in compiled programs were answered from their inline caches, since it was created, or last reset.
+    LiquidInlineCacheStatistics liquidRendererGetInlineCacheStatistics(LiquidRenderer renderer);
+    void liquidRendererResetInlineCacheStatistics(LiquidRenderer renderer);
+    // Profiling records every render from when it's turned on, until it's turned off, which throws away what was recorded, or it's reset.
+    void liquidRendererSetProfiling(LiquidRenderer renderer, bool enabled);
+    void liquidRendererResetProfile(LiquidRenderer renderer);
+    // Fills in up to maxEntries entries, and returns how many there are altogether; the first is the renders themselves. If bySymbol is
+    // set, there's one entry for each type of node, with no line or column.
+    size_t liquidRendererGetProfile(LiquidRenderer renderer, LiquidProfileEntry* entries, size_t maxEntries, bool bySymbol);
+    // The profile as folded stacks, for flamegraph.pl; writes at most maxSize bytes, null terminated, and returns the length of the whole thing.
+    size_t liquidRendererGetProfileFlameGraph(LiquidRenderer renderer, char* buffer, size_t maxSize);
     LiquidProgramRender liquidRendererRunProgram(LiquidRenderer renderer, void* variableStore, LiquidProgram program, LiquidRendererError* error);
     LiquidTemplateRender liquidRendererRenderTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRendererError* error);
+    // Renders each template with the store at the same index, one after the other, filling in renders, and errors, if given, at the same
+    // index; a render that fails has a NULL render, and its error filled in. Returns how many failed. Warnings are those of the last render.
+    size_t liquidRendererRenderTemplates(LiquidRenderer renderer, size_t count, void* const* variableStores, const LiquidTemplate* templates, LiquidTemplateRender* renders, LiquidRendererError* errors);
+    typedef void (*LiquidRenderOutputFunction)(const char* chunk, size_t size, void* data);
+    void liquidRendererStreamTemplate(LiquidRenderer renderer, void* variableStore, LiquidTemplate tmpl, LiquidRenderOutputFunction callback, void* data, LiquidRendererError* error);
     void* liquidRendererRenderArgument(LiquidRenderer renderer, void* variableStore, LiquidTemplate argument, LiquidRendererError* error);
     typedef void (*LiquidWalkTemplateFunction)(LiquidTemplate tmpl, const LiquidNode node, void* data);
     void liquidWalkTemplate(LiquidTemplate tmpl, LiquidWalkTemplateFunction callback, void* data);
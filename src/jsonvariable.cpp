@@ -0,0 +1,558 @@
+#include "jsonvariable.h"
+
+#include <charconv>
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <fstream>
+    #include <sstream>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace Liquid {
+
+    JSONValue& JSONValue::operator = (JSONValue&& value) {
+        if (this == &value)
+            return *this;
+        type = value.type;
+        created = value.created;
+        readOnly = value.readOnly;
+        escaped = value.escaped;
+        start = value.start;
+        end = value.end;
+        memcpy(&i, &value.i, sizeof(i));
+        reference = value.reference;
+        storage = std::move(value.storage);
+        delete index.exchange(value.index.exchange(nullptr));
+        value.type = LIQUID_VARIABLE_TYPE_NIL;
+        value.escaped = value.readOnly = false;
+        value.start = value.end = nullptr;
+        value.reference = nullptr;
+        return *this;
+    }
+
+    JSONValue::~JSONValue() {
+        delete index.load();
+    }
+
+    JSONValue JSONValue::makeString(std::string_view str) {
+        JSONValue value;
+        value.type = LIQUID_VARIABLE_TYPE_STRING;
+        value.storage.reset(new char[str.size() + 1]);
+        memcpy(value.storage.get(), str.data(), str.size());
+        value.storage[str.size()] = 0;
+        value.start = value.storage.get();
+        value.end = value.start + str.size();
+        return value;
+    }
+
+    JSONValue JSONValue::makeReference(const JSONValue& target) {
+        JSONValue value;
+        value.reference = &target.resolve();
+        value.type = value.reference->type;
+        value.readOnly = true;
+        return value;
+    }
+
+    JSONValue JSONValue::makeScope(std::initializer_list<const JSONValue*> layers) {
+        JSONValue value;
+        value.type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+        value.getIndex().layers.assign(layers.begin(), layers.end());
+        return value;
+    }
+
+    JSONIndex& JSONValue::getIndex() const {
+        JSONIndex* existing = index.load(std::memory_order_acquire);
+        if (existing)
+            return *existing;
+        JSONIndex* built = new JSONIndex();
+        if (readOnly && start) {
+            switch (type) {
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    if (escaped)
+                        built->unescaped.push_back(JSONDocument::unescape(std::string_view(start, end - start)));
+                break;
+                case LIQUID_VARIABLE_TYPE_ARRAY: {
+                    const char* position = JSONDocument::skipWhitespace(start + 1, end);
+                    while (position && position < end && *position != ']') {
+                        JSONValue element;
+                        position = JSONDocument::parse(position, end, element);
+                        if (!position)
+                            break;
+                        built->values.push_back(std::move(element));
+                        position = JSONDocument::skipWhitespace(position, end);
+                        if (position >= end || *position != ',')
+                            break;
+                        ++position;
+                    }
+                } break;
+                case LIQUID_VARIABLE_TYPE_DICTIONARY: {
+                    const char* position = JSONDocument::skipWhitespace(start + 1, end);
+                    while (position < end && *position == '"') {
+                        bool escapedKey = false;
+                        const char* keyEnd = JSONDocument::skipString(position, end, escapedKey);
+                        if (!keyEnd)
+                            break;
+                        std::string_view key(position + 1, keyEnd - position - 2);
+                        if (escapedKey) {
+                            built->unescaped.push_back(JSONDocument::unescape(key));
+                            key = built->unescaped.back();
+                        }
+                        position = JSONDocument::skipWhitespace(keyEnd, end);
+                        if (position >= end || *position != ':')
+                            break;
+                        JSONValue member;
+                        position = JSONDocument::parse(position + 1, end, member);
+                        if (!position)
+                            break;
+                        built->add(key, std::move(member));
+                        position = JSONDocument::skipWhitespace(position, end);
+                        if (position >= end || *position != ',')
+                            break;
+                        position = JSONDocument::skipWhitespace(position + 1, end);
+                    }
+                } break;
+                default:
+                break;
+            }
+        }
+        // Whoever got here first wins; anyone else throws theirs away, and uses that.
+        if (!index.compare_exchange_strong(existing, built, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            delete built;
+            return *existing;
+        }
+        return *built;
+    }
+
+    const JSONValue* JSONIndex::find(std::string_view key) const {
+        if (!lookup.empty()) {
+            auto it = lookup.find(key);
+            return it != lookup.end() ? &values[it->second] : nullptr;
+        }
+        // The last of any duplicates wins, as it would for a lookup.
+        for (size_t i = keys.size(); i > 0; --i) {
+            if (keys[i - 1] == key)
+                return &values[i - 1];
+        }
+        return nullptr;
+    }
+
+    void JSONIndex::add(std::string_view key, JSONValue&& value) {
+        keys.push_back(key);
+        values.push_back(std::move(value));
+        if (!lookup.empty()) {
+            lookup[key] = keys.size() - 1;
+        } else if (keys.size() > LOOKUP_THRESHOLD) {
+            for (size_t i = 0; i < keys.size(); ++i)
+                lookup[keys[i]] = i;
+        }
+    }
+
+    JSONValue* JSONValue::set(std::string_view key, JSONValue&& value) {
+        if (readOnly)
+            return nullptr;
+        if (type == LIQUID_VARIABLE_TYPE_NIL)
+            type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return nullptr;
+        JSONIndex& index = getIndex();
+        value.created = false;
+        if (JSONValue* existing = const_cast<JSONValue*>(index.find(key))) {
+            *existing = std::move(value);
+            return existing;
+        }
+        index.unescaped.push_back(std::string(key));
+        index.add(index.unescaped.back(), std::move(value));
+        return &index.values.back();
+    }
+
+    JSONValue* JSONValue::set(long long idx, JSONValue&& value) {
+        if (readOnly || type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        JSONIndex& index = getIndex();
+        if (idx < 0)
+            idx += index.values.size();
+        if (idx < 0)
+            return nullptr;
+        if (idx >= (long long)index.values.size())
+            index.values.resize(idx + 1);
+        value.created = false;
+        index.values[idx] = std::move(value);
+        return &index.values[idx];
+    }
+
+    const JSONValue* JSONValue::get(std::string_view key) const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return nullptr;
+        const JSONIndex& index = value.getIndex();
+        if (const JSONValue* member = index.find(key))
+            return member;
+        for (const JSONValue* layer : index.layers) {
+            if (const JSONValue* member = layer->get(key))
+                return member;
+        }
+        return nullptr;
+    }
+
+    const JSONValue* JSONValue::get(long long idx) const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        const JSONIndex& index = value.getIndex();
+        if (idx < 0)
+            idx += index.values.size();
+        if (idx < 0 || idx >= (long long)index.values.size())
+            return nullptr;
+        return &index.values[idx];
+    }
+
+    long long JSONValue::size() const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_ARRAY && value.type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return -1;
+        return value.getIndex().values.size();
+    }
+
+    std::string_view JSONValue::getStringView() const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_STRING)
+            return std::string_view();
+        if (value.escaped)
+            return value.getIndex().unescaped.front();
+        return std::string_view(value.start, value.end - value.start);
+    }
+
+    bool JSONValue::getInteger(long long& target) const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_INT)
+            return false;
+        target = value.i;
+        return true;
+    }
+
+    bool JSONValue::getFloat(double& target) const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_FLOAT)
+            return false;
+        target = value.f;
+        return true;
+    }
+
+    bool JSONValue::getTruthy() const {
+        const JSONValue& value = resolve();
+        return !(
+            (value.type == LIQUID_VARIABLE_TYPE_BOOL && !value.b) ||
+            (value.type == LIQUID_VARIABLE_TYPE_INT && !value.i) ||
+            (value.type == LIQUID_VARIABLE_TYPE_FLOAT && !value.f) ||
+            (value.type == LIQUID_VARIABLE_TYPE_OTHER && !value.p) ||
+            (value.type == LIQUID_VARIABLE_TYPE_NIL)
+        );
+    }
+
+    JSONValue JSONValue::clone() const {
+        // Nothing can change what's in a document, so there's no need to copy it.
+        if (readOnly)
+            return makeReference(*this);
+        JSONValue value;
+        switch (type) {
+            case LIQUID_VARIABLE_TYPE_STRING:
+                return makeString(getStringView());
+            case LIQUID_VARIABLE_TYPE_ARRAY:
+            case LIQUID_VARIABLE_TYPE_DICTIONARY: {
+                value.type = type;
+                const JSONIndex& from = getIndex();
+                JSONIndex& to = value.getIndex();
+                to.layers = from.layers;
+                for (size_t i = 0; i < from.values.size(); ++i) {
+                    if (type == LIQUID_VARIABLE_TYPE_ARRAY) {
+                        to.values.push_back(from.values[i].clone());
+                    } else {
+                        to.unescaped.push_back(std::string(from.keys[i]));
+                        to.add(to.unescaped.back(), from.values[i].clone());
+                    }
+                }
+            } break;
+            default:
+                value.type = type;
+                memcpy(&value.i, &i, sizeof(i));
+            break;
+        }
+        return value;
+    }
+
+    bool JSONValue::iterate(bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) const {
+        const JSONValue& value = resolve();
+        if (value.type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return false;
+        const JSONIndex& index = value.getIndex();
+        int size = (int)index.values.size();
+        if (limit < 0)
+            limit = size + limit + 1;
+        if (start < 0)
+            start = 0;
+        int endIndex = std::min(start+limit-1, size-1);
+        if (reverse) {
+            for (int i = endIndex; i >= start; --i) {
+                if (!callback(const_cast<JSONValue*>(&index.values[i]), data))
+                    break;
+            }
+        } else {
+            for (int i = start; i <= endIndex; ++i) {
+                if (!callback(const_cast<JSONValue*>(&index.values[i]), data))
+                    break;
+            }
+        }
+        return true;
+    }
+
+    bool JSONValue::operator < (const JSONValue& other) const {
+        const JSONValue& a = resolve();
+        const JSONValue& b = other.resolve();
+        if (a.type != b.type)
+            return false;
+        switch (a.type) {
+            case LIQUID_VARIABLE_TYPE_INT:
+                return a.i < b.i;
+            case LIQUID_VARIABLE_TYPE_FLOAT:
+                return a.f < b.f;
+            case LIQUID_VARIABLE_TYPE_BOOL:
+                return a.b < b.b;
+            case LIQUID_VARIABLE_TYPE_STRING:
+                return a.getStringView() < b.getStringView();
+            case LIQUID_VARIABLE_TYPE_OTHER:
+                return a.p < b.p;
+            default:
+                return &a < &b;
+        }
+    }
+
+
+    JSONDocument::JSONDocument(const char* buffer, size_t size) : buffer(buffer), size(size) {
+        const char* end = parse(buffer, buffer + size, root);
+        valid = end && skipWhitespace(end, buffer + size) == buffer + size;
+        if (!valid)
+            root = JSONValue();
+    }
+
+    JSONDocument::JSONDocument(const std::string& path) {
+        #ifdef _WIN32
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                throw Exception("Can't read %s.", path.c_str());
+            std::stringstream stream;
+            stream << file.rdbuf();
+            std::string contents = stream.str();
+            char* copy = new char[contents.size() + 1];
+            memcpy(copy, contents.data(), contents.size() + 1);
+            buffer = copy;
+            size = contents.size();
+        #else
+            int descriptor = open(path.c_str(), O_RDONLY);
+            if (descriptor == -1)
+                throw Exception("Can't read %s.", path.c_str());
+            struct stat info;
+            if (fstat(descriptor, &info) == -1) {
+                close(descriptor);
+                throw Exception("Can't read %s.", path.c_str());
+            }
+            size = info.st_size;
+            if (size > 0) {
+                void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (mapping == MAP_FAILED) {
+                    close(descriptor);
+                    throw Exception("Can't map %s.", path.c_str());
+                }
+                buffer = static_cast<const char*>(mapping);
+            }
+            close(descriptor);
+        #endif
+        mapped = true;
+        const char* end = parse(buffer, buffer + size, root);
+        valid = end && skipWhitespace(end, buffer + size) == buffer + size;
+        if (!valid)
+            root = JSONValue();
+    }
+
+    JSONDocument::~JSONDocument() {
+        // Everything indexed points into the buffer, so it goes first.
+        root = JSONValue();
+        if (!mapped || !buffer)
+            return;
+        #ifdef _WIN32
+            delete[] buffer;
+        #else
+            munmap(const_cast<char*>(buffer), size);
+        #endif
+    }
+
+    const char* JSONDocument::skipWhitespace(const char* start, const char* end) {
+        while (start < end && (*start == ' ' || *start == '\n' || *start == '\r' || *start == '\t'))
+            ++start;
+        return start;
+    }
+
+    const char* JSONDocument::skipString(const char* start, const char* end, bool& escaped) {
+        for (const char* position = start + 1; position < end; ++position) {
+            if (*position == '\\') {
+                escaped = true;
+                ++position;
+            } else if (*position == '"') {
+                return position + 1;
+            }
+        }
+        return nullptr;
+    }
+
+    const char* JSONDocument::parse(const char* start, const char* end, JSONValue& value) {
+        start = skipWhitespace(start, end);
+        if (start >= end)
+            return nullptr;
+        value.readOnly = true;
+        value.start = start;
+        switch (*start) {
+            case '"': {
+                bool escaped = false;
+                const char* stringEnd = skipString(start, end, escaped);
+                if (!stringEnd)
+                    return nullptr;
+                value.type = LIQUID_VARIABLE_TYPE_STRING;
+                value.escaped = escaped;
+                value.start = start + 1;
+                value.end = stringEnd - 1;
+                return stringEnd;
+            }
+            case '{':
+            case '[': {
+                // Only the brackets are counted, to find where it ends; what's inside is left until something looks.
+                int depth = 0;
+                for (const char* position = start; position < end; ++position) {
+                    switch (*position) {
+                        case '"': {
+                            bool escaped = false;
+                            position = skipString(position, end, escaped);
+                            if (!position)
+                                return nullptr;
+                            --position;
+                        } break;
+                        case '{':
+                        case '[':
+                            ++depth;
+                        break;
+                        case '}':
+                        case ']':
+                            if (--depth == 0) {
+                                value.type = *start == '{' ? LIQUID_VARIABLE_TYPE_DICTIONARY : LIQUID_VARIABLE_TYPE_ARRAY;
+                                value.end = position + 1;
+                                return value.end;
+                            }
+                        break;
+                    }
+                }
+                return nullptr;
+            }
+            case 't':
+            case 'f':
+            case 'n': {
+                std::string_view literal = *start == 't' ? "true" : (*start == 'f' ? "false" : "null");
+                if ((size_t)(end - start) < literal.size() || std::string_view(start, literal.size()) != literal)
+                    return nullptr;
+                value.type = *start == 'n' ? LIQUID_VARIABLE_TYPE_NIL : LIQUID_VARIABLE_TYPE_BOOL;
+                value.b = *start == 't';
+                value.end = start + literal.size();
+                return value.end;
+            }
+            default: {
+                const char* position = start;
+                bool isFloat = false;
+                while (position < end && ((*position >= '0' && *position <= '9') || *position == '-' || *position == '+' || *position == '.' || *position == 'e' || *position == 'E')) {
+                    if (*position == '.' || *position == 'e' || *position == 'E')
+                        isFloat = true;
+                    ++position;
+                }
+                if (position == start)
+                    return nullptr;
+                value.end = position;
+                if (!isFloat) {
+                    auto result = std::from_chars(start, position, value.i);
+                    if (result.ec == std::errc() && result.ptr == position) {
+                        value.type = LIQUID_VARIABLE_TYPE_INT;
+                        return position;
+                    }
+                }
+                // Integers too big for a long long are kept as floats.
+                auto result = std::from_chars(start, position, value.f);
+                if (result.ec != std::errc() || result.ptr != position)
+                    return nullptr;
+                value.type = LIQUID_VARIABLE_TYPE_FLOAT;
+                return position;
+            }
+        }
+    }
+
+    static void appendUTF8(std::string& target, unsigned int codepoint) {
+        if (codepoint < 0x80) {
+            target.push_back((char)codepoint);
+        } else if (codepoint < 0x800) {
+            target.push_back((char)(0xC0 | (codepoint >> 6)));
+            target.push_back((char)(0x80 | (codepoint & 0x3F)));
+        } else if (codepoint < 0x10000) {
+            target.push_back((char)(0xE0 | (codepoint >> 12)));
+            target.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+            target.push_back((char)(0x80 | (codepoint & 0x3F)));
+        } else {
+            target.push_back((char)(0xF0 | (codepoint >> 18)));
+            target.push_back((char)(0x80 | ((codepoint >> 12) & 0x3F)));
+            target.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+            target.push_back((char)(0x80 | (codepoint & 0x3F)));
+        }
+    }
+
+    static bool readHex(std::string_view str, size_t offset, unsigned int& codepoint) {
+        if (offset + 4 > str.size())
+            return false;
+        auto result = std::from_chars(str.data() + offset, str.data() + offset + 4, codepoint, 16);
+        return result.ec == std::errc() && result.ptr == str.data() + offset + 4;
+    }
+
+    std::string JSONDocument::unescape(std::string_view str) {
+        std::string result;
+        result.reserve(str.size());
+        for (size_t i = 0; i < str.size(); ++i) {
+            if (str[i] != '\\' || i + 1 == str.size()) {
+                result.push_back(str[i]);
+                continue;
+            }
+            switch (str[++i]) {
+                case 'b': result.push_back('\b'); break;
+                case 'f': result.push_back('\f'); break;
+                case 'n': result.push_back('\n'); break;
+                case 'r': result.push_back('\r'); break;
+                case 't': result.push_back('\t'); break;
+                case 'u': {
+                    unsigned int codepoint;
+                    if (!readHex(str, i + 1, codepoint)) {
+                        result.push_back('u');
+                        break;
+                    }
+                    i += 4;
+                    // Characters outside the basic plane come as a pair of surrogates.
+                    unsigned int low;
+                    if (codepoint >= 0xD800 && codepoint < 0xDC00 && i + 2 < str.size() && str[i + 1] == '\\' && str[i + 2] == 'u' && readHex(str, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                    appendUTF8(result, codepoint);
+                } break;
+                default:
+                    result.push_back(str[i]);
+                break;
+            }
+        }
+        return result;
+    }
+}
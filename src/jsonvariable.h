@@ -0,0 +1,255 @@
+#ifndef LIQUIDJSONVARIABLE_H
+#define LIQUIDJSONVARIABLE_H
+
+#include "common.h"
+
+#include <deque>
+
+namespace Liquid {
+
+    struct JSONIndex;
+
+    // A value in a JSON document read in place, or one made while rendering. Values from documents are spans of its buffer; they're only
+    // picked apart once something asks for them, and objects and arrays are only indexed the first time something looks inside them. The
+    // index is published atomically, so any number of threads can read the same document at once. Values made while rendering, by assigns
+    // and the like, hold what they are themselves, and are the only ones that can be written to.
+    struct JSONValue {
+        LiquidVariableType type = LIQUID_VARIABLE_TYPE_NIL;
+        // Freed by the resolver's freeVariable; made by it, or by a clone.
+        bool created = false;
+        // From a document, or standing in for something that is.
+        bool readOnly = false;
+        // Strings with escapes in them; unescaped once, the first time they're read.
+        bool escaped = false;
+        // For strings, what's between the quotes; for everything else from a document, the whole of the value. Made strings point at storage.
+        // Numbers, and booleans, are read as soon as their container's indexed.
+        const char* start = nullptr;
+        const char* end = nullptr;
+        union {
+            long long i;
+            double f;
+            bool b;
+            void* p;
+        };
+        // Values that stand in for another, like a document mounted in a store, or a clone of something that can't change.
+        const JSONValue* reference = nullptr;
+        std::unique_ptr<char[]> storage;
+        mutable std::atomic<JSONIndex*> index;
+
+        JSONValue() : i(0), index(nullptr) { }
+        JSONValue(const JSONValue&) = delete;
+        JSONValue(JSONValue&& value) : i(0), index(nullptr) { *this = std::move(value); }
+        JSONValue& operator = (JSONValue&& value);
+        ~JSONValue();
+
+        static JSONValue makeString(std::string_view str);
+        static JSONValue makeReference(const JSONValue& value);
+        // A dictionary that can be given to a render as its store. Lookups that miss it fall through to each of the layers, in order, so a
+        // render can assign to its store without anything being written to the documents underneath.
+        static JSONValue makeScope(std::initializer_list<const JSONValue*> layers = { });
+
+        const JSONValue& resolve() const { return reference ? reference->resolve() : *this; }
+
+        // Both of these only ever touch values that were made; anything from a document is read-only.
+        // Takes the value, leaving value nil. Made nils turn into dictionaries the first time they're set.
+        JSONValue* set(std::string_view key, JSONValue&& value);
+        JSONValue* set(long long idx, JSONValue&& value);
+        // Puts a value from somewhere else, like another document, in a made dictionary, without copying it.
+        JSONValue* mount(std::string_view key, const JSONValue& value) { return set(key, makeReference(value)); }
+
+        const JSONValue* get(std::string_view key) const;
+        const JSONValue* get(long long idx) const;
+        long long size() const;
+        // For strings; views of the document, unless they had escapes in them.
+        std::string_view getStringView() const;
+        bool getInteger(long long& target) const;
+        bool getFloat(double& target) const;
+        bool getTruthy() const;
+        // Whether the object, array or escaped string's been picked apart yet.
+        bool isIndexed() const { return index.load(std::memory_order_acquire) != nullptr; }
+
+        JSONValue clone() const;
+        bool iterate(bool (*callback)(void* variable, void* data), void* data, int start = 0, int limit = -1, bool reverse = false) const;
+        bool operator < (const JSONValue& value) const;
+
+        // What's under an object, array or escaped string, working it out if it hasn't been yet.
+        JSONIndex& getIndex() const;
+    };
+
+    // What an object, or array has in it, in order; along with the keys, unescaped, for objects.
+    struct JSONIndex {
+        // Deques, so that what's been handed out stays where it is as values are added to made containers.
+        std::deque<JSONValue> values;
+        std::deque<std::string_view> keys;
+        // Keys, and strings, that had escapes in them, unescaped.
+        std::deque<std::string> unescaped;
+        // Only for larger objects; smaller ones are searched in order.
+        std::unordered_map<std::string_view, size_t> lookup;
+        // Looked in, in order, for keys that aren't here; see JSONValue::makeScope.
+        vector<const JSONValue*> layers;
+
+        static constexpr size_t LOOKUP_THRESHOLD = 8;
+
+        const JSONValue* find(std::string_view key) const;
+        void add(std::string_view key, JSONValue&& value);
+    };
+
+    // A document read out of a buffer it doesn't own, that has to stay put, and unchanged, for as long as the document's in use, or out of a
+    // file it maps itself. Nothing's checked up front, other than where the document's value ends; parts that aren't well formed read as nil.
+    // Once made, a document can be shared between any number of renders, on any number of threads; see JSONValue::makeScope.
+    struct JSONDocument {
+        const char* buffer = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        bool valid = false;
+        JSONValue root;
+
+        JSONDocument(const char* buffer, size_t size);
+        // Throws a Liquid::Exception if the file can't be read.
+        JSONDocument(const std::string& path);
+        JSONDocument(const JSONDocument&) = delete;
+        ~JSONDocument();
+
+        // Whether the buffer held a value, with nothing but whitespace after it; if not, the root's nil.
+        bool isValid() const { return valid; }
+
+        // Reads the value starting at, or after whitespace at, start. Returns where it ends, or nullptr if it isn't well formed.
+        static const char* parse(const char* start, const char* end, JSONValue& value);
+        static const char* skipWhitespace(const char* start, const char* end);
+        static const char* skipString(const char* start, const char* end, bool& escaped);
+        static std::string unescape(std::string_view str);
+    };
+
+    struct JSONVariableResolver : LiquidVariableResolver {
+        static JSONValue* create(JSONValue&& value) {
+            JSONValue* created = new JSONValue(std::move(value));
+            created->created = true;
+            return created;
+        }
+        static JSONValue* create(LiquidVariableType type) {
+            JSONValue value;
+            value.type = type;
+            return create(std::move(value));
+        }
+        static const JSONValue& read(void* variable) { return static_cast<const JSONValue*>(variable)->resolve(); }
+        static bool stringify(const JSONValue& value, std::string& target) {
+            switch (value.type) {
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    target = value.getStringView();
+                    return true;
+                case LIQUID_VARIABLE_TYPE_FLOAT:
+                    target = std::to_string(value.f);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_INT:
+                    target = std::to_string(value.i);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_BOOL:
+                    target = value.b ? "true" : "false";
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        JSONVariableResolver() {
+            getType = +[](LiquidRenderer renderer, void* variable) { return read(variable).type; };
+            getBool = +[](LiquidRenderer renderer, void* variable, bool* target) {
+                const JSONValue& value = read(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_BOOL)
+                    return false;
+                *target = value.b;
+                return true;
+            };
+            getTruthy = +[](LiquidRenderer renderer, void* variable) { return read(variable).getTruthy(); };
+            // Like CPPVariable, numbers and booleans read as strings too; only strings have views.
+            getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+                std::string str;
+                if (!stringify(read(variable), str))
+                    return false;
+                memcpy(target, str.data(), str.size());
+                target[str.size()] = 0;
+                return true;
+            };
+            getStringLength = +[](LiquidRenderer renderer, void* variable) {
+                std::string str;
+                if (!stringify(read(variable), str))
+                    return -1LL;
+                return (long long)str.size();
+            };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** view, size_t* length) {
+                const JSONValue& value = read(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_STRING)
+                    return false;
+                std::string_view str = value.getStringView();
+                *view = str.data();
+                *length = str.size();
+                return true;
+            };
+            getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) { return read(variable).getInteger(*target); };
+            getFloat = +[](LiquidRenderer renderer, void* variable, double* target) { return read(variable).getFloat(*target); };
+            getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+                const JSONValue* value = read(variable).get(std::string_view(key));
+                *target = const_cast<JSONValue*>(value);
+                return value != nullptr;
+            };
+            getDictionaryVariableHashed = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target) {
+                const JSONValue* value = read(variable).get(std::string_view(key, length));
+                *target = const_cast<JSONValue*>(value);
+                return value != nullptr;
+            };
+            getArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void** target) {
+                const JSONValue* value = read(variable).get(idx);
+                *target = const_cast<JSONValue*>(value);
+                return value != nullptr;
+            };
+            iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+                return read(variable).iterate(callback, data, start, limit, reverse);
+            };
+            getArraySize = +[](LiquidRenderer renderer, void* variable) { return read(variable).size(); };
+            // Only values that were made can be written to; setting a dictionary takes the value, and setting an array copies it.
+            setDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void* target) {
+                JSONValue* value = static_cast<JSONValue*>(variable)->set(std::string_view(key), std::move(*static_cast<JSONValue*>(target)));
+                delete static_cast<JSONValue*>(target);
+                return (void*)value;
+            };
+            setArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void* target) {
+                return (void*)static_cast<JSONValue*>(variable)->set(idx, static_cast<JSONValue*>(target)->clone());
+            };
+            createHash = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_DICTIONARY); };
+            createArray = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_ARRAY); };
+            createFloat = +[](LiquidRenderer renderer, double value) {
+                JSONValue* created = create(LIQUID_VARIABLE_TYPE_FLOAT);
+                created->f = value;
+                return (void*)created;
+            };
+            createBool = +[](LiquidRenderer renderer, bool value) {
+                JSONValue* created = create(LIQUID_VARIABLE_TYPE_BOOL);
+                created->b = value;
+                return (void*)created;
+            };
+            createInteger = +[](LiquidRenderer renderer, long long value) {
+                JSONValue* created = create(LIQUID_VARIABLE_TYPE_INT);
+                created->i = value;
+                return (void*)created;
+            };
+            createString = +[](LiquidRenderer renderer, const char* value) { return (void*)create(JSONValue::makeString(value)); };
+            createPointer = +[](LiquidRenderer renderer, void* value) {
+                JSONValue* created = create(LIQUID_VARIABLE_TYPE_OTHER);
+                created->p = value;
+                return (void*)created;
+            };
+            createNil = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_NIL); };
+            createClone = +[](LiquidRenderer renderer, void* variable) { return (void*)create(static_cast<JSONValue*>(variable)->clone()); };
+            freeVariable = +[](LiquidRenderer renderer, void* variable) {
+                if (static_cast<JSONValue*>(variable)->created)
+                    delete static_cast<JSONValue*>(variable);
+            };
+            compare = +[](void* a, void* b) { return read(a) < read(b) ? -1 : 0; };
+            getDictionaryVariableCached = nullptr;
+            // Documents are only ever added to, atomically, by being read.
+            threadSafeReads = true;
+        }
+    };
+}
+
+#endif
@@ -5,6 +5,14 @@
 #include <cstdlib>
 #include <cstring>
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
 namespace Liquid {
     struct Context;
 
@@ -95,6 +103,8 @@ namespace Liquid {
 
         bool openParenthesis() { return true; }
         bool closeParenthesis() { return true; }
+        // Called after each block ends, with where the text after it starts; lexing could be picked up again from there given only the line and column.
+        void boundary(size_t offset) { }
 
         std::string halt;
         bool beginHalt(const char* str, size_t len) {
@@ -204,6 +214,67 @@ namespace Liquid {
         Lexer(const Context& context) : context(context) { }
         ~Lexer() { }
 
+        // Finds the first target character at or after offset, or size if there isn't one, a block at a time where the processor lets us.
+        // Every newline on the way is passed on, and lastNewline is set to where the last of them was.
+        size_t scan(const char* str, size_t offset, size_t size, char target, size_t& lastNewline) {
+            #if defined(__AVX2__)
+                const __m256i targets = _mm256_set1_epi8(target), newlines = _mm256_set1_epi8('\n');
+                for (; offset + 32 <= size; offset += 32) {
+                    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&str[offset]));
+                    unsigned int found = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, targets));
+                    unsigned int lines = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines));
+                    if (found)
+                        lines &= (found & -found) - 1;
+                    for (; lines; lines &= lines - 1) {
+                        lastNewline = offset + __builtin_ctz(lines);
+                        static_cast<T*>(this)->newline();
+                    }
+                    if (found)
+                        return offset + __builtin_ctz(found);
+                }
+            #elif defined(__SSE2__)
+                const __m128i targets = _mm_set1_epi8(target), newlines = _mm_set1_epi8('\n');
+                for (; offset + 16 <= size; offset += 16) {
+                    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[offset]));
+                    unsigned int found = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, targets));
+                    unsigned int lines = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+                    if (found)
+                        lines &= (found & -found) - 1;
+                    for (; lines; lines &= lines - 1) {
+                        lastNewline = offset + __builtin_ctz(lines);
+                        static_cast<T*>(this)->newline();
+                    }
+                    if (found)
+                        return offset + __builtin_ctz(found);
+                }
+            #elif defined(__ARM_NEON)
+                // No movemask here; narrowing the comparison leaves four bits for each byte instead.
+                const uint8x16_t targets = vdupq_n_u8((uint8_t)target), newlines = vdupq_n_u8('\n');
+                for (; offset + 16 <= size; offset += 16) {
+                    uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(&str[offset]));
+                    uint64_t found = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, targets)), 4)), 0);
+                    uint64_t lines = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, newlines)), 4)), 0);
+                    if (found)
+                        lines &= (found & -found) - 1;
+                    for (; lines; lines &= ~((uint64_t)0xF << (__builtin_ctzll(lines) & ~3))) {
+                        lastNewline = offset + (__builtin_ctzll(lines) >> 2);
+                        static_cast<T*>(this)->newline();
+                    }
+                    if (found)
+                        return offset + (__builtin_ctzll(found) >> 2);
+                }
+            #endif
+            for (; offset < size; ++offset) {
+                if (str[offset] == target)
+                    return offset;
+                if (str[offset] == '\n') {
+                    lastNewline = offset;
+                    static_cast<T*>(this)->newline();
+                }
+            }
+            return size;
+        }
+
         bool processControlChunk(const char* chunk, size_t size, bool isNumber, bool hasPoint) {
             if (size > 0) {
                 if (!isNumber || (size == 1 && chunk[0] == '-'))
@@ -216,19 +287,32 @@ namespace Liquid {
         }
 
         // Must be a whole file, for now. Should be null-terminated. Treats it as UTF8.
-        Error parse(const char* str, size_t size, Lexer::State initialState = State::INITIAL) {
+        Error parse(const char* str, size_t size, Lexer::State initialState = State::INITIAL, size_t initialLine = 1, size_t initialColumn = 0) {
             size_t offset = 0;
             size_t lastInitial = 0;
             size_t i;
             bool ongoing = true;
-            line = 1;
+            line = initialLine;
             const char* end = str+size;
-            column = 0;
+            column = initialColumn;
             state = initialState;
             while (ongoing && offset < size) {
                 ++column;
                 switch (state) {
                     case State::INITIAL:
+                        // Plain text is skipped in bulk, up to the next '{'; unless the last character was one, as then this could be a '%'.
+                        if (offset == 0 || str[offset-1] != '{') {
+                            size_t lastNewline = size;
+                            size_t next = scan(str, offset, size, '{', lastNewline);
+                            if (next != offset) {
+                                // Two columns a character, as the switch below would have done, starting over at each newline.
+                                column = lastNewline != size ? 1 + 2*(next - lastNewline - 1) : column - 1 + 2*(next - offset);
+                                offset = next;
+                                if (offset >= size)
+                                    break;
+                                ++column;
+                            }
+                        }
                         switch (str[offset]) {
                             case '\n': {
                                 static_cast<T*>(this)->newline();
@@ -391,6 +475,8 @@ namespace Liquid {
                                             column += new_offset - offset;
                                             offset = new_offset;
                                             lastInitial = offset;
+                                            if (ongoing)
+                                                static_cast<T*>(this)->boundary(offset);
                                             processComplete = true;
                                         }
                                     } else {
@@ -403,6 +489,8 @@ namespace Liquid {
                                             column += new_offset - offset;
                                             offset = new_offset;
                                             lastInitial = offset;
+                                            if (ongoing)
+                                                static_cast<T*>(this)->boundary(offset);
                                             processComplete = true;
                                         } else if (offset < size - 1 && str[offset+1] != '}') {
                                             ongoing = processControlChunk(&str[startOfWord], offset - startOfWord - (str[offset-2] == '-' ? 2 : 1), isNumber, hasPoint) && static_cast<T*>(this)->literal(&str[offset], 1);
@@ -458,11 +546,15 @@ namespace Liquid {
                             ongoing = processControlChunk(&str[startOfWord], offset - startOfWord, isNumber, hasPoint);
                     } break;
                     case State::HALT: {
-                        // Go until the next raw tag;
+                        // Go until the next raw tag; nothing but a '}' can end one.
                         do {
-                            if (str[offset] == '\n') {
-                                static_cast<T*>(this)->newline();
-                            } else if (str[offset] == '}' && str[offset-1] == '%') {
+                            size_t lastNewline = size;
+                            size_t next = scan(str, offset, size, '}', lastNewline);
+                            column = lastNewline != size ? next - lastNewline : column + (next - offset);
+                            offset = next;
+                            if (offset >= size)
+                                break;
+                            if (str[offset-1] == '%') {
                                 size_t target = offset - 2, tagStart;
                                 if (str[target] == '-')
                                     --target;
@@ -487,6 +579,8 @@ namespace Liquid {
                                             offset = new_offset;
                                         }
                                         lastInitial = offset;
+                                        if (ongoing)
+                                            static_cast<T*>(this)->boundary(offset);
                                         break;
                                     }
                                 }
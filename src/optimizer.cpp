@@ -1,5 +1,6 @@
 #include "optimizer.h"
 #include "renderer.h"
+#include "context.h"
 
 namespace Liquid {
 
@@ -7,13 +8,107 @@ namespace Liquid {
         renderer.currentRenderingDepth = 0;
     }
 
+    // The top-level name of a variable, if it's a literal one.
+    static const Node* getVariableRoot(const Node& variableNode) {
+        if (variableNode.children.empty() || variableNode.children[0]->type || !variableNode.children[0]->variant.isString())
+            return nullptr;
+        return variableNode.children[0].get();
+    }
+
+    // The variable a tag writes to, or binds; the first thing in its arguments, or the left side of an operator that's first.
+    static const Node* getBoundVariable(const Context& context, const Node& node) {
+        if (!node.type || node.type->type != NodeType::Type::TAG || node.children.empty() || !node.children[0]->type || node.children[0]->type->type != NodeType::Type::ARGUMENTS)
+            return nullptr;
+        if (node.type->optimization != LIQUID_OPTIMIZATION_SCHEME_NONE && node.type != context.getTagType("for"))
+            return nullptr;
+        auto& arguments = node.children[0];
+        if (arguments->children.empty() || !arguments->children[0]->type)
+            return nullptr;
+        const Node* target = arguments->children[0].get();
+        if (target->type->type == NodeType::Type::OPERATOR && !target->children.empty())
+            target = target->children[0].get();
+        if (!target->type || target->type->type != NodeType::Type::VARIABLE)
+            return nullptr;
+        return getVariableRoot(*target);
+    }
+
+    bool Optimizer::isFrozen(const Node& variableNode) const {
+        if (!boundVariables.empty()) {
+            const Node* root = getVariableRoot(variableNode);
+            if (root && boundVariables.count(root->variant.getString()))
+                return false;
+        }
+        if (frozenVariables.empty())
+            return true;
+        const Node* root = getVariableRoot(variableNode);
+        if (!root)
+            return false;
+        std::string name = root->variant.getString();
+        return frozenVariables.count(name) && !writtenVariables.count(name);
+    }
+
+    bool Optimizer::isFrozenBranch(const Node& node) const {
+        std::unordered_set<string> bound;
+        return isFrozenBranch(node, bound);
+    }
+
+    bool Optimizer::isFrozenBranch(const Node& node, std::unordered_set<string>& bound) const {
+        if (!node.type)
+            return true;
+        if (frozenVariables.empty())
+            return false;
+        if (node.type->type == NodeType::Type::VARIABLE) {
+            const Node* root = getVariableRoot(node);
+            if (!root || (!isFrozen(node) && !bound.count(root->variant.getString())))
+                return false;
+        } else if ((node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE || node.type->opaque) && (node.type->type == NodeType::Type::TAG || node.type->type == NodeType::Type::FILTER)) {
+            return false;
+        }
+        // Loops bind their variable, and forloop, for their bodies.
+        const Node* boundVariable = getBoundVariable(renderer.context, node);
+        std::vector<string> binding;
+        if (boundVariable) {
+            for (auto name : { boundVariable->variant.getString(), string("forloop") }) {
+                if (bound.insert(name).second)
+                    binding.push_back(name);
+            }
+        }
+        bool frozen = true;
+        for (auto& child : node.children) {
+            if (!isFrozenBranch(*child.get(), bound)) {
+                frozen = false;
+                break;
+            }
+        }
+        for (auto& name : binding)
+            bound.erase(name);
+        return frozen;
+    }
+
     void Optimizer::optimize(Node& ast, Variable store) {
+        writtenVariables.clear();
+        if (!frozenVariables.empty()) {
+            const Context& context = renderer.context;
+            ast.walk([this, &context](const Node& node) {
+                const Node* root = getBoundVariable(context, node);
+                if (root && frozenVariables.count(root->variant.getString()))
+                    writtenVariables.insert(root->variant.getString());
+            });
+        }
+        optimizeBranch(ast, store);
+        fuseFilters(ast);
+    }
+
+    void Optimizer::optimizeBranch(Node& ast, Variable store) {
         bool hasAnyNonRendered = false;
         if (!ast.type || ast.type->optimization == LIQUID_OPTIMIZATION_SCHEME_SHIELD)
             return;
+        // Anything rendered here stays in the tree, so it can't borrow from the store.
+        bool borrowStrings = renderer.borrowStrings;
+        renderer.borrowStrings = false;
         for (size_t i = 0; i < ast.children.size(); ++i) {
             if (ast.children[i]->type)
-                optimize(*ast.children[i].get(), store);
+                optimizeBranch(*ast.children[i].get(), store);
             if (ast.children[i]->type) {
                 if (ast.children[i]->type->type == NodeType::Type::ARGUMENTS) {
                     for (auto& child : ast.children[i]->children) {
@@ -32,5 +127,210 @@ namespace Liquid {
         } else if (ast.type->optimization != LIQUID_OPTIMIZATION_SCHEME_NONE) {
             ast.type->optimize(*this, ast, store);
         }
+        renderer.borrowStrings = borrowStrings;
+    }
+
+    bool Optimizer::getDependencies(const Node& node, std::unordered_set<string>& reads) const {
+        if (!node.type)
+            return true;
+        if (node.type->type == NodeType::Type::VARIABLE) {
+            const Node* root = getVariableRoot(node);
+            if (!root)
+                return false;
+            reads.insert(root->variant.getString());
+        } else if ((node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE || node.type->opaque) && (node.type->type == NodeType::Type::TAG || node.type->type == NodeType::Type::FILTER)) {
+            return false;
+        }
+        for (auto& child : node.children) {
+            if (!getDependencies(*child.get(), reads))
+                return false;
+        }
+        return true;
+    }
+
+    // Only expressions that take some working out are worth a variable of their own.
+    static bool isHoistable(const Context& context, const Node& node) {
+        if (!node.type || node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE || node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_SHIELD)
+            return false;
+        switch (node.type->type) {
+            case NodeType::Type::FILTER:
+            case NodeType::Type::DOT_FILTER:
+                return true;
+            case NodeType::Type::OPERATOR:
+                return node.type != context.getConcatenationNodeType();
+            case NodeType::Type::VARIABLE:
+                return node.children.size() > 1;
+            default:
+                return false;
+        }
+    }
+
+    static void hoistBranch(Optimizer& optimizer, Node& node, const std::unordered_set<string>& changed, vector<unique_ptr<Node>>& hoisted);
+
+    static void hoistChild(Optimizer& optimizer, Node& node, size_t idx, const std::unordered_set<string>& changed, vector<unique_ptr<Node>>& hoisted) {
+        const Context& context = optimizer.renderer.context;
+        Node& child = *node.children[idx].get();
+        if (isHoistable(context, child)) {
+            std::unordered_set<string> reads;
+            bool invariant = optimizer.getDependencies(child, reads);
+            for (auto it = reads.begin(); invariant && it != reads.end(); ++it)
+                invariant = !changed.count(*it);
+            if (invariant) {
+                auto variable = make_unique<Node>(context.getVariableNodeType());
+                variable->children.push_back(make_unique<Node>(Variant("@hoisted" + std::to_string(optimizer.hoisted++))));
+                hoisted.push_back(make_unique<Node>(*variable.get()));
+                hoisted.push_back(move(node.children[idx]));
+                node.children[idx] = move(variable);
+                return;
+            }
+        }
+        hoistBranch(optimizer, child, changed, hoisted);
+    }
+
+    // Goes through everything under the node that's sure to be worked out whenever it is; so not the bodies of tags, and not anything
+    // past the first operand of an operator that can stop early.
+    static void hoistBranch(Optimizer& optimizer, Node& node, const std::unordered_set<string>& changed, vector<unique_ptr<Node>>& hoisted) {
+        const Context& context = optimizer.renderer.context;
+        if (!node.type || node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_SHIELD)
+            return;
+        size_t end = node.children.size();
+        switch (node.type->type) {
+            case NodeType::Type::TAG:
+                if (node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE) {
+                    // Only the value an assignment's given; nothing else in a tag that opts out is safe to touch.
+                    if (end == 0 || !node.children[0]->type || node.children[0]->children.empty() || !node.children[0]->children[0]->type || node.children[0]->children[0]->type->type != NodeType::Type::OPERATOR)
+                        return;
+                    Node& assignment = *node.children[0]->children[0].get();
+                    for (size_t i = 1; i < assignment.children.size(); ++i)
+                        hoistChild(optimizer, assignment, i, changed, hoisted);
+                    return;
+                }
+                end = std::min(end, (size_t)1);
+            break;
+            case NodeType::Type::OPERATOR:
+                if (node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_PARTIAL && node.type != context.getConcatenationNodeType())
+                    end = std::min(end, (size_t)1);
+            break;
+            case NodeType::Type::CONTEXTUAL:
+                if (node.type != context.getHoistNodeType())
+                    return;
+                end -= 1;
+            break;
+            case NodeType::Type::FILTER:
+                if (node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE)
+                    return;
+            break;
+            default:
+            break;
+        }
+        for (size_t i = 0; i < end; ++i)
+            hoistChild(optimizer, node, i, changed, hoisted);
+    }
+
+    void Optimizer::hoistInvariants(Node& loop, size_t body) {
+        const Context& context = renderer.context;
+        // Anything the loop binds or writes to, anywhere inside it, changes from one iteration to the next.
+        std::unordered_set<string> changed = { "forloop" };
+        bool opaque = false;
+        loop.walk([&context, &changed, &opaque](const Node& node) {
+            const Node* root = getBoundVariable(context, node);
+            if (root)
+                changed.insert(root->variant.getString());
+            if (node.type && node.type->opaque)
+                opaque = true;
+        });
+        if (opaque)
+            return;
+        vector<unique_ptr<Node>> hoisted;
+        hoistBranch(*this, *loop.children[body].get(), changed, hoisted);
+        if (hoisted.empty())
+            return;
+        // The loop's moved out from under itself, and what's left becomes the hoist.
+        auto inner = make_unique<Node>(move(loop));
+        loop.children = move(hoisted);
+        loop.children.push_back(move(inner));
+        loop.type = context.getHoistNodeType();
+    }
+
+    void Optimizer::inlinePartial(Node& node, const Node& partial, std::vector<std::pair<string, unique_ptr<Node>>>& bindings, Variable store) {
+        const Context& context = renderer.context;
+        Node body = partial;
+        // The partial can write to frozen variables as much as the template including it can.
+        if (!frozenVariables.empty()) {
+            body.walk([this, &context](const Node& node) {
+                const Node* root = getBoundVariable(context, node);
+                if (root && frozenVariables.count(root->variant.getString()))
+                    writtenVariables.insert(root->variant.getString());
+            });
+        }
+        if (bindings.empty())
+            node = move(body);
+        else {
+            vector<unique_ptr<Node>> children;
+            for (auto& binding : bindings) {
+                auto variable = make_unique<Node>(context.getVariableNodeType());
+                variable->children.push_back(make_unique<Node>(Variant(binding.first)));
+                children.push_back(move(variable));
+                children.push_back(move(binding.second));
+            }
+            children.push_back(make_unique<Node>(move(body)));
+            node = Node(context.getHoistNodeType());
+            node.children = move(children);
+        }
+        for (auto& binding : bindings)
+            boundVariables.insert(binding.first);
+        ++inlinedPartialDepth;
+        optimizeBranch(node, store);
+        --inlinedPartialDepth;
+        for (auto& binding : bindings)
+            boundVariables.erase(boundVariables.find(binding.first));
+    }
+
+    static bool isFusable(const Node& node, bool FilterNodeType::*kind) {
+        return node.type && node.type->type == NodeType::Type::FILTER && static_cast<const FilterNodeType*>(node.type)->*kind &&
+            !node.type->userRenderFunction && node.children.size() == 2 && node.children[1]->type && node.children[1]->type->type == NodeType::Type::ARGUMENTS;
+    }
+
+    void Optimizer::fuseFilters(Node& node) {
+        if (!node.type || node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_SHIELD)
+            return;
+        for (auto& child : node.children)
+            fuseFilters(*child.get());
+        const Context& context = renderer.context;
+        if (isFusable(node, &FilterNodeType::transformsStrings)) {
+            Node& operand = *node.children[0].get();
+            if (operand.type == context.getFilterChainNodeType()) {
+                // The chain's moved out from under the filter, which joins the end of it.
+                auto chain = move(node.children[0]);
+                node.children[0] = make_unique<Node>();
+                chain->children.push_back(make_unique<Node>(move(node)));
+                node = move(*chain.get());
+            } else if (isFusable(operand, &FilterNodeType::transformsStrings)) {
+                auto first = move(node.children[0]);
+                auto second = make_unique<Node>(move(node));
+                node.children.clear();
+                node.children.push_back(move(first->children[0]));
+                first->children[0] = make_unique<Node>();
+                second->children[0] = make_unique<Node>();
+                node.children.push_back(move(first));
+                node.children.push_back(move(second));
+                node.type = context.getFilterChainNodeType();
+            }
+        } else if (isFusable(node, &FilterNodeType::reducesArrays) && isFusable(*node.children[0].get(), &FilterNodeType::streamsArrays)) {
+            // Takes the reduction, and every filter that streams beneath it, last first.
+            vector<unique_ptr<Node>> filters;
+            filters.push_back(make_unique<Node>(move(node)));
+            while (isFusable(*filters.back()->children[0].get(), &FilterNodeType::streamsArrays)) {
+                auto next = move(filters.back()->children[0]);
+                filters.back()->children[0] = make_unique<Node>();
+                filters.push_back(move(next));
+            }
+            node.children.clear();
+            node.children.push_back(move(filters.back()->children[0]));
+            filters.back()->children[0] = make_unique<Node>();
+            for (auto it = filters.rbegin(); it != filters.rend(); ++it)
+                node.children.push_back(move(*it));
+            node.type = context.getArrayChainNodeType();
+        }
     }
 }
@@ -2,6 +2,7 @@
 #define LIQUIDOPTIMIZER_H
 
 #include "common.h"
+#include <unordered_set>
 
 namespace Liquid {
     struct Renderer;
@@ -9,9 +10,45 @@ namespace Liquid {
 
     struct Optimizer {
         Renderer& renderer;
+        // If any are given, only variables under these top-level names are taken from the store, and everything else is left to be
+        // resolved when rendering; the optimized template can then be rendered against any store that agrees with this one on them.
+        std::unordered_set<string> frozenVariables;
+        // Frozen variables the template being optimized writes to, or binds as a loop variable; these aren't frozen for it.
+        std::unordered_set<string> writtenVariables;
 
         Optimizer(Renderer& renderer);
         void optimize(Node& ast, Variable store);
+
+        // Whether a variable can be taken from the store.
+        bool isFrozen(const Node& variableNode) const;
+        // Whether a branch can be rendered out entirely; everything in it reads only frozen variables, or ones bound inside it, and
+        // nothing in it opts out of optimization.
+        bool isFrozenBranch(const Node& node) const;
+        bool isFrozenBranch(const Node& node, std::unordered_set<string>& bound) const;
+        void optimizeBranch(Node& ast, Variable store);
+
+        // Adds the top-level names of every variable a branch reads. False if there's anything in it that can't be accounted for; a
+        // variable whose name is worked out while rendering, or anything that opts out of optimization.
+        bool getDependencies(const Node& node, std::unordered_set<string>& reads) const;
+        // Moves expressions out of the body of a loop that are worked out on every iteration, but read nothing the loop changes, and
+        // wraps the loop in a hoist node that works them out once. The body is the loop's child at the given index.
+        void hoistInvariants(Node& loop, size_t body);
+        // Replaces runs of two or more filters that transform strings with a filter chain, which passes the one string down them, and
+        // runs of array filters that stream, ending in one that reduces, with an array chain.
+        void fuseFilters(Node& node);
+        // Hoisted expressions are given variables named for this, so they're unique for as long as this optimizer is.
+        int hoisted = 0;
+
+        // Includes of partials with static names, from the renderer's partial cache, are replaced with the partial itself, if it's no
+        // bigger than this many nodes; and so on, for the includes in it, up to the depth given.
+        size_t maximumInlinedPartialSize = 256;
+        int maximumInlinedPartialDepth = 8;
+        int inlinedPartialDepth = 0;
+        // What the inlined partials being optimized are included with; never frozen, as they aren't what's in the store under that name.
+        std::unordered_multiset<string> boundVariables;
+        // Replaces an include with a copy of its partial, and optimizes that. The bindings are the names the partial's included with,
+        // and their expressions, moved out of the include; if there are any, the copy's wrapped in a hoist node that binds them.
+        void inlinePartial(Node& node, const Node& partial, std::vector<std::pair<string, unique_ptr<Node>>>& bindings, Variable store);
     };
 }
 
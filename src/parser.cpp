@@ -33,7 +33,8 @@ namespace Liquid {
             parser.nodes.back() = move(qualifierNode);
         }
         if (parser.nodes.back()->type && parser.nodes.back()->type->type == NodeType::Type::QUALIFIER) {
-            if (static_cast<const TagNodeType::QualifierNodeType*>(parser.nodes.back()->type)->arity == TagNodeType::QualifierNodeType::Arity::NONARY) {
+            // Filters' wildcard qualifiers always take an operand, and aren't tag qualifiers, so have no arity to check.
+            if (parser.nodes.back()->type != context.getFilterWildcardQualifierNodeType() && static_cast<const TagNodeType::QualifierNodeType*>(parser.nodes.back()->type)->arity != TagNodeType::QualifierNodeType::Arity::UNARY) {
                 parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_OPERAND, parser.nodes.back()->type->symbol));
                 return false;
             }
@@ -44,6 +45,18 @@ namespace Liquid {
             parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_INVALID_SYMBOL, ":"));
             return false;
         }
+        // Named arguments to tags that take them; a plain name, straight in the tag's arguments. Unlike a filter's, the name's kept as a
+        // string, rather than a variable, so that the optimizer leaves it be.
+        if (parser.nodes.size() >= 3 && !parser.nodes.back()->children.front()->type && parser.nodes.back()->children.front()->variant.type == Variant::Type::STRING) {
+            const Node& arguments = *parser.nodes[parser.nodes.size()-2].get();
+            const Node& tag = *parser.nodes[parser.nodes.size()-3].get();
+            if (arguments.type == context.getArgumentsNodeType() && tag.type && tag.type->type == NodeType::Type::TAG && static_cast<const TagNodeType*>(tag.type)->allowsWildcardQualifiers) {
+                auto qualifierNode = make_unique<Node>(context.getFilterWildcardQualifierNodeType());
+                qualifierNode->children.push_back(move(parser.nodes.back()->children.front()));
+                qualifierNode->children.push_back(nullptr);
+                parser.nodes.back() = move(qualifierNode);
+            }
+        }
         return true;
     }
 
@@ -235,8 +248,7 @@ namespace Liquid {
                 switch (this->state) {
                     case SUPER::State::CONTROL: {
                         if (len > 3 && strncmp(str, "end", 3) == 0) {
-                            std::string typeName = std::string(&str[3], len - 3);
-                            const TagNodeType* type = static_cast<const TagNodeType*>(SUPER::context.getTagType(typeName));
+                            const TagNodeType* type = SUPER::context.getTagType(std::string_view(&str[3], len - 3));
 
                             if (!type || type->composition == TagNodeType::Composition::FREE) {
                                 parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_TAG, std::string(str, len)));
@@ -249,7 +261,7 @@ namespace Liquid {
                             parser.state = Parser::State::ARGUMENT;
                             parser.blockType = Parser::EBlockType::END;
                         } else {
-                            std::string typeName = std::string(str, len);
+                            std::string_view typeName(str, len);
                             if (typeName == "liquid") {
                                 parser.state = Parser::State::LIQUID_NODE;
                                 return true;
@@ -262,10 +274,8 @@ namespace Liquid {
                             if (!type && parser.nodes.size() > 0) {
                                 for (auto it = parser.nodes.rbegin(); it != parser.nodes.rend(); ++it) {
                                     if ((*it)->type && (*it)->type->type == NodeType::Type::TAG) {
-                                        auto& intermediates = static_cast<const TagNodeType*>((*it)->type)->intermediates;
-                                        auto it = intermediates.find(typeName);
-                                        if (it != intermediates.end()) {
-                                            type = static_cast<TagNodeType*>(it->second.get());
+                                        type = static_cast<const TagNodeType*>(static_cast<const TagNodeType*>((*it)->type)->intermediates.get(typeName));
+                                        if (type) {
                                             // Pop off the concatenation node, and apply this as the next arugment in the parent node.
                                             parser.popNode();
                                             parser.blockType = Parser::EBlockType::INTERMEDIATE;
@@ -275,11 +285,11 @@ namespace Liquid {
                                 }
                             }
                             if (!type) {
-                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_TAG, typeName));
+                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_TAG, std::string(typeName)));
                                 return false;
                             }
                             if (type->composition == TagNodeType::Composition::LEXING_HALT)
-                                beginHalt(typeName.c_str(), typeName.size());
+                                beginHalt(typeName.data(), typeName.size());
                             parser.state = parser.state == Parser::State::LIQUID_NODE ? Parser::State::LIQUID_ARGUMENT : Parser::State::ARGUMENT;
                             return parser.pushNode(std::make_unique<Node>(type), true) && parser.pushNode(std::make_unique<Node>(context.getArgumentsNodeType()), true);
                         }
@@ -295,7 +305,7 @@ namespace Liquid {
             } break;
             case Parser::State::LIQUID_ARGUMENT:
             case Parser::State::ARGUMENT: {
-                std::string opName = std::string(str, len);
+                std::string_view opName(str, len);
                 const LiteralType* type = SUPER::context.getLiteralType(opName);
                 if (type)
                     return parser.pushNode(make_unique<Node>(type->value));
@@ -306,34 +316,34 @@ namespace Liquid {
                     if (op) {
                         lastNode->children.pop_back();
                         auto operatorNode = make_unique<Node>(op);
+                        parser.markPosition(*operatorNode);
                         operatorNode->children.push_back(move(lastNode));
                         parser.nodes.back() = move(operatorNode);
                     } else {
-                        lastNode->children.back() = move(make_unique<Node>(Variant(move(opName))));
+                        lastNode->children.back() = move(make_unique<Node>(Variant(std::string(opName))));
                     }
                 } else {
                     if (lastNode->type && lastNode->children.size() > 0 && !lastNode->children.back().get()) {
                         // Check for unray operators.
-                        std::string opName = std::string(str, len);
                         const OperatorNodeType* op = context.getUnaryOperatorType(opName);
                         if (op) {
                             assert(op->fixness == OperatorNodeType::Fixness::PREFIX);
                             return parser.pushNode(make_unique<Node>(op), true);
                         } else {
                             unique_ptr<Node> node = make_unique<Node>(context.getVariableNodeType());
-                            node->children.push_back(make_unique<Node>(Variant(opName)));
+                            parser.markPosition(*node);
+                            node->children.push_back(make_unique<Node>(Variant(std::string(opName))));
                             parser.nodes.push_back(move(node));
                         }
                     } else {
                         // Check for operators.
-                        std::string opName = std::string(str, len);
                         if (opName == "|") {
                             // In the case where we're chaining filters, and there are no arguments; the precense of another | is enough to terminate this an popUntil the filter.
                             if (
                                 ((parser.filterState == Parser::EFilterState::COLON || parser.filterState == Parser::EFilterState::ARGUMENTS) && !parser.popNodeUntil(NodeType::Type::FILTER)) ||
                                 (parser.filterState != Parser::EFilterState::UNSET && parser.filterState != Parser::EFilterState::ARGUMENTS && parser.filterState != Parser::EFilterState::COLON)
                             ) {
-                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_INVALID_SYMBOL, opName));
+                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_INVALID_SYMBOL, std::string(opName)));
                                 return false;
                             }
                             parser.filterState = Parser::EFilterState::NAME;
@@ -344,12 +354,13 @@ namespace Liquid {
                             const FilterNodeType* op = context.getFilterType(opName);
                             bool unknown = !op;
                             if (unknown) {
-                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_FILTER, opName));
+                                parser.pushError(Parser::Error(*this, Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_FILTER, std::string(opName)));
                                 op = static_cast<const FilterNodeType*>(context.getUnknownFilterNodeType());
                             }
                             auto operatorNode = make_unique<Node>(op);
+                            parser.markPosition(*operatorNode);
                             if (unknown)
-                                operatorNode->children.push_back(make_unique<Node>(Variant(opName)));
+                                operatorNode->children.push_back(make_unique<Node>(Variant(std::string(opName))));
                             auto& parentNode = parser.nodes[parser.nodes.size()-2];
                             assert(parentNode->type);
                             unique_ptr<Node> variableNode = move(parser.nodes.back());
@@ -372,31 +383,28 @@ namespace Liquid {
                                         }
                                     }
                                 }
-                                auto it = contextualType->operators.find(opName);
-                                if (it == contextualType->operators.end()) {
+                                op = static_cast<const OperatorNodeType*>(contextualType->operators.get(opName));
+                                if (!op) {
                                     // If no operator found, check for a specified qualifier.
                                     const TagNodeType::QualifierNodeType* qualifier = nullptr;
-                                    if (contextualType && contextualType->type == NodeType::Type::TAG) {
-                                        auto it = static_cast<const TagNodeType*>(contextualType)->qualifiers.find(opName);
-                                        if (it != static_cast<const TagNodeType*>(contextualType)->qualifiers.end())
-                                            qualifier = static_cast<TagNodeType::QualifierNodeType*>(it->second.get());
-                                    }
+                                    if (contextualType && contextualType->type == NodeType::Type::TAG)
+                                        qualifier = static_cast<const TagNodeType::QualifierNodeType*>(static_cast<const TagNodeType*>(contextualType)->qualifiers.get(opName));
                                     if (!qualifier) {
-                                        parser.pushError(Parser::Error(*this, contextualType && contextualType->type == NodeType::Type::TAG ? Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR_OR_QUALIFIER : Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR, opName));
+                                        parser.pushError(Parser::Error(*this, contextualType && contextualType->type == NodeType::Type::TAG ? Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR_OR_QUALIFIER : Parser::Error::Type::LIQUID_PARSER_ERROR_TYPE_UNKNOWN_OPERATOR, std::string(opName)));
                                         parser.state = Parser::State::IGNORE_UNTIL_BLOCK_END;
                                         return true;
                                     }
                                     parser.popNodeUntil(NodeType::Type::ARGUMENTS);
                                     parser.nodes.back()->children.push_back(nullptr);
-                                    if (!parser.pushNode(std::make_unique<Node>(qualifier)))
+                                    if (!parser.pushNode(std::make_unique<Node>(qualifier), qualifier->arity == TagNodeType::QualifierNodeType::Arity::UNARY_PREFIX))
                                         return false;
                                     return true;
-                                } else
-                                    op = static_cast<const OperatorNodeType*>(it->second.get());
+                                }
                             }
 
                             assert(op->fixness == OperatorNodeType::Fixness::INFIX);
                             auto operatorNode = make_unique<Node>(op);
+                            parser.markPosition(*operatorNode);
                             auto& parentNode = parser.nodes[parser.nodes.size()-2];
 
                             assert(parentNode->type);
@@ -447,6 +455,11 @@ namespace Liquid {
     }
 
 
+    void Parser::Lexer::boundary(size_t offset) {
+        if (parser.boundaries && parser.nodes.size() == 1)
+            parser.boundaries->push_back({ offset, line, column, parser.nodes.back()->children.size() });
+    }
+
     bool Parser::Lexer::startOutputBlock(bool suppress) {
         SUPER::startOutputBlock(suppress);
         parser.state = Parser::State::ARGUMENT;
@@ -587,7 +600,55 @@ namespace Liquid {
         return true;
     }
 
+    // Literal keys in variable paths get their hash worked out once, here, rather than on every lookup.
+    static void hashVariableKeys(Node& node) {
+        if (!node.type)
+            return;
+        for (auto& child : node.children) {
+            if (!child)
+                continue;
+            if (child->type)
+                hashVariableKeys(*child.get());
+            else if (node.type->type == NodeType::Type::VARIABLE && child->variant.type == Variant::Type::STRING)
+                child->keyHash = liquidHashKey(child->variant.s.data(), child->variant.s.size());
+        }
+    }
+
+    // Variables in a loop's body that name its variable, or forloop, are given the slot the loop will put them in; each loop takes two
+    // more than the ones it's in, for its forloop and its variable. Only the body's in the loop; the collection and the else aren't.
+    static void bindLoopVariables(const NodeType* forType, Node& node, vector<std::string_view>& bound) {
+        if (!node.type)
+            return;
+        if (node.type->type == NodeType::Type::VARIABLE && !node.children.empty() && node.children[0] && !node.children[0]->type && node.children[0]->variant.type == Variant::Type::STRING) {
+            for (size_t i = bound.size(); i > 0; --i) {
+                if (bound[i-1] == node.children[0]->variant.s) {
+                    node.slot = i;
+                    break;
+                }
+            }
+        }
+        const Node* variable = nullptr;
+        if (node.type == forType && node.children.size() >= 2 && node.children[0]->type && !node.children[0]->children.empty()) {
+            const Node& in = *node.children[0]->children[0].get();
+            if (in.type && in.type->type == NodeType::Type::OPERATOR && in.children.size() == 2 && in.children[0]->type && in.children[0]->type->type == NodeType::Type::VARIABLE &&
+                    in.children[0]->children.size() == 1 && !in.children[0]->children[0]->type && in.children[0]->children[0]->variant.type == Variant::Type::STRING)
+                variable = in.children[0]->children[0].get();
+        }
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            if (!node.children[i])
+                continue;
+            if (variable && i == 1) {
+                bound.push_back("forloop");
+                bound.push_back(variable->variant.s);
+            }
+            bindLoopVariables(forType, *node.children[i].get(), bound);
+            if (variable && i == 1)
+                bound.resize(bound.size() - 2);
+        }
+    }
+
     Node Parser::parseArgument(const char* buffer, size_t len) {
+        NodeArena::Scope arena(arenaChunkSize);
         errors.clear();
         nodes.clear();
 
@@ -606,6 +667,7 @@ namespace Liquid {
         assert(nodes.size() == 1);
         Node node = move(*nodes.back()->children[0].get());
         nodes.clear();
+        hashVariableKeys(node);
         return node;
     }
 
@@ -621,7 +683,7 @@ namespace Liquid {
         return hasBraces ? parse(buffer, len, file) : parseArgument(buffer, len);
     }
 
-    Node Parser::parse(const char* buffer, size_t len, const string& file) {
+    Node Parser::parseBlocks(const char* buffer, size_t len, size_t line, size_t column) {
         errors.clear();
         nodes.clear();
         filterState = EFilterState::UNSET;
@@ -629,7 +691,7 @@ namespace Liquid {
         state = State::NODE;
 
         pushNode(make_unique<Node>(context.getConcatenationNodeType()), false);
-        Lexer::Error error = lexer.parse(buffer, len);
+        Lexer::Error error = lexer.parse(buffer, len, Lexer::State::INITIAL, line, column);
         if (error.type != Lexer::Error::Type::LIQUID_LEXER_ERROR_TYPE_NONE)
             throw Exception(error);
         if (nodes.size() > 1) {
@@ -642,18 +704,147 @@ namespace Liquid {
             throw Exception({ Liquid::Parser::Error(lexer, LIQUID_PARSER_ERROR_TYPE_UNEXPECTED_END) });
         }
         assert(nodes.size() == 1);
-        if (file.empty()) {
-            Node node = move(*nodes.back().get());
-            nodes.clear();
-            return node;
-        }
-        auto node = Node(context.getContextBoundaryNodeType());
-        node.children.push_back(make_unique<Node>(Variant(file)));
-        node.children.push_back(std::move(nodes.back()));
+        hashVariableKeys(*nodes.back().get());
+        vector<std::string_view> bound;
+        bindLoopVariables(context.getTagType("for"), *nodes.back().get(), bound);
+        Node node = move(*nodes.back().get());
         nodes.clear();
         return node;
     }
 
+    Node Parser::parse(const char* buffer, size_t len, const string& file) {
+        NodeArena::Scope arena(arenaChunkSize);
+        Node node = parseBlocks(buffer, len);
+        if (file.empty())
+            return node;
+        auto boundary = Node(context.getContextBoundaryNodeType());
+        boundary.children.push_back(make_unique<Node>(Variant(file)));
+        boundary.children.push_back(make_unique<Node>(move(node)));
+        return boundary;
+    }
+
+    Parser::Document Parser::parseDocument(const char* buffer, size_t len) {
+        NodeArena::Scope arena(arenaChunkSize);
+        Document document;
+        document.source = string(buffer, len);
+        document.boundaries.push_back({ 0, 1, 0, 0 });
+        boundaries = &document.boundaries;
+        try {
+            document.tree = parseBlocks(document.source.data(), len);
+        } catch (...) {
+            boundaries = nullptr;
+            throw;
+        }
+        boundaries = nullptr;
+        document.boundaries.push_back({ len, lexer.line, lexer.column, document.tree.children.size() });
+        return document;
+    }
+
+    static void moveLines(Node& node, long long lines) {
+        if (node.line)
+            node.line += lines;
+        if (node.type) {
+            for (auto& child : node.children) {
+                if (child)
+                    moveLines(*child.get(), lines);
+            }
+        }
+    }
+
+    // Whether all there is between here and the next block is whitespace that it'll strip; the lexer looks back past the start of the
+    // text for that, so a re-parse can't start here.
+    static bool isSuppressedWhitespace(const string& source, size_t offset) {
+        size_t i = offset;
+        while (i < source.size() && isspace((unsigned char)source[i]))
+            ++i;
+        return i > offset && i + 2 < source.size() && source[i] == '{' && (source[i+1] == '{' || source[i+1] == '%') && source[i+2] == '-';
+    }
+
+    bool Parser::reparse(Document& document, size_t offset, size_t length, const char* replacement, size_t replacementLength) {
+        string source = document.source.substr(0, offset) + string(replacement, replacementLength) + document.source.substr(offset + length);
+        long long delta = (long long)replacementLength - (long long)length;
+        auto& tree = document.tree.children;
+        auto& existing = document.boundaries;
+
+        // The nearest boundary before the edit, and the nearest after it; the text right up against either side of a boundary could change what it is.
+        size_t start = 0, end = existing.size() - 1;
+        while (start + 1 < existing.size() && existing[start+1].offset < offset)
+            ++start;
+        while (start > 0 && isSuppressedWhitespace(source, existing[start].offset))
+            --start;
+        for (size_t i = start + 1; i < existing.size(); ++i) {
+            if (existing[i].offset > offset + length) {
+                end = i;
+                break;
+            }
+        }
+        // Anything left on the line the re-parsed part ends on would need its column moved along too; it's simpler to take it in.
+        while (end + 1 < existing.size()) {
+            const Node* next = nullptr;
+            for (size_t i = existing[end].children; i < existing[end+1].children && !next; ++i) {
+                if (tree[i] && tree[i]->type)
+                    next = tree[i].get();
+            }
+            if (existing[end+1].line != existing[end].line && (!next || next->line != existing[end].line))
+                break;
+            ++end;
+        }
+
+        const Document::Boundary& from = existing[start];
+        const Document::Boundary& to = existing[end];
+        bool last = end == existing.size() - 1;
+        size_t regionSize = to.offset + delta - from.offset;
+        vector<Document::Boundary> region;
+        Node blocks;
+        bool spliceable = true;
+        try {
+            NodeArena::Scope arena(arenaChunkSize);
+            boundaries = &region;
+            blocks = parseBlocks(&source[from.offset], regionSize, from.line, from.column);
+            boundaries = nullptr;
+        } catch (Parser::Exception&) {
+            boundaries = nullptr;
+            spliceable = false;
+        }
+        // Unless it runs to the end, it has to finish on a block that finishes where the old one did; and one that strips the whitespace
+        // after it would have taken whatever whitespace comes next too.
+        if (spliceable && !last) {
+            spliceable = region.size() > 0 && region.back().offset == regionSize && !(regionSize >= 3 && source[from.offset + regionSize - 3] == '-' && isspace((unsigned char)source[from.offset + regionSize]));
+        }
+        if (!spliceable) {
+            document = parseDocument(source.data(), source.size());
+            return false;
+        }
+
+        if (last)
+            region.push_back({ regionSize, lexer.line, lexer.column, blocks.children.size() });
+        long long lines = (long long)region.back().line - (long long)to.line;
+        long long children = (long long)blocks.children.size() - (long long)(to.children - from.children);
+
+        vector<unique_ptr<Node>> spliced;
+        spliced.reserve(tree.size() + children);
+        for (size_t i = 0; i < from.children; ++i)
+            spliced.push_back(move(tree[i]));
+        for (auto& child : blocks.children)
+            spliced.push_back(move(child));
+        for (size_t i = to.children; i < tree.size(); ++i) {
+            if (tree[i])
+                moveLines(*tree[i].get(), lines);
+            spliced.push_back(move(tree[i]));
+        }
+
+        vector<Document::Boundary> updated(existing.begin(), existing.begin() + start + 1);
+        for (auto& boundary : region)
+            updated.push_back({ boundary.offset + from.offset, boundary.line, boundary.column, boundary.children + from.children });
+        for (size_t i = end + 1; i < existing.size(); ++i)
+            updated.push_back({ existing[i].offset + delta, existing[i].line + lines, existing[i].column, existing[i].children + children });
+
+        tree = move(spliced);
+        document.boundaries = move(updated);
+        document.source = move(source);
+        return true;
+    }
+
     void Parser::unparse(const Node& node, string& target, Parser::State state) {
         if (node.type) {
             switch (node.type->type) {
@@ -779,7 +970,23 @@ namespace Liquid {
                     }
                 } break;
                 case Liquid::NodeType::Type::CONTEXTUAL:
-                    unparse(*node.children[1].get(), target, state);
+                    // Hoisted loops come out with their hoisted variables in place of the expressions.
+                    if (node.type == context.getHoistNodeType())
+                        unparse(*node.children.back().get(), target, state);
+                    else if (node.type == context.getFilterChainNodeType() || node.type == context.getArrayChainNodeType()) {
+                        // Fused filters come back out as the run they were.
+                        unparse(*node.children[0].get(), target, Parser::State::ARGUMENT);
+                        for (size_t i = 1; i < node.children.size(); ++i) {
+                            const Node& filter = *node.children[i].get();
+                            target.append(" | ");
+                            target.append(filter.type->symbol);
+                            for (size_t j = 0; j < filter.children[1]->children.size(); ++j) {
+                                target.append(j > 0 ? ", " : ": ");
+                                unparse(*filter.children[1]->children[j].get(), target, Parser::State::ARGUMENT);
+                            }
+                        }
+                    } else
+                        unparse(*node.children[1].get(), target, state);
                 break;
                 default:
                     assert(false);
@@ -792,17 +999,18 @@ namespace Liquid {
                 switch (node.variant.type) {
                     case Variant::Type::STRING: {
                         target.push_back('"');
+                        std::string_view str = node.variant.s;
                         size_t start = 0;
                         while (true) {
-                            size_t i = node.variant.s.find('"', start);
+                            size_t i = str.find('"', start);
                             if (i == string::npos)
                                 break;
-                            target.append(node.variant.s, start, i - start);
+                            target.append(str, start, i - start);
                             target.push_back('\\');
                             target.push_back('"');
                             start = i+1;
                         }
-                        target.append(node.variant.s, start, node.variant.s.size() - start);
+                        target.append(str, start, str.size() - start);
                         target.push_back('"');
                     } break;
                     default:
@@ -122,6 +122,8 @@ namespace Liquid {
 
         // Any more depth than this, and we throw an error.
         unsigned int maximumParseDepth = 100;
+        // If set, the nodes of each parsed template are allocated out of their own arena, in chunks of this many bytes.
+        size_t arenaChunkSize = 16*1024;
 
         void pushError(const Error& error) {
             errors.push_back(error);
@@ -152,6 +154,7 @@ namespace Liquid {
 
             bool openParenthesis();
             bool closeParenthesis();
+            void boundary(size_t offset);
 
             Lexer(const Context& context, Parser& parser) : Liquid::Lexer<Lexer>(context), parser(parser) { }
         };
@@ -175,8 +178,26 @@ namespace Liquid {
         };
 
 
+        // For editors, which re-parse the same template after every change. Keeps the source alongside the tree, with the points between
+        // top-level blocks where lexing could be picked up again, so that an edit only needs what lies between the nearest two re-parsed.
+        struct Document {
+            struct Boundary {
+                size_t offset;
+                size_t line;
+                size_t column;
+                // How many of the tree's top-level nodes come before this point.
+                size_t children;
+            };
+
+            std::string source;
+            Node tree;
+            vector<Boundary> boundaries;
+        };
+
         Lexer lexer;
         string file;
+        // If set, where the boundaries of the template being parsed are recorded.
+        vector<Document::Boundary>* boundaries = nullptr;
 
         Parser(const Context& context) : context(context), lexer(context, *this) { }
 
@@ -184,6 +205,11 @@ namespace Liquid {
         Error validate(const Node& node) const;
 
         bool pushNode(unique_ptr<Node> node, bool expectingNode = false);
+        // Marks a node with where the lexer is in the source; pushNode does this for everything it's given.
+        void markPosition(Node& node) {
+            node.line = lexer.line;
+            node.column = lexer.column;
+        }
         // Pops the last node in the stack, and then applies it as the last child of the node prior to it.
         bool popNode();
         // Pops nodes until it reaches a node of the given type.
@@ -202,6 +228,16 @@ namespace Liquid {
         Node parse(const string& str, const std::string& file = "") {
             return parse(str.data(), str.size(), file);
         }
+        // Parses a run of top-level blocks, with the lexer starting off at the given line and column.
+        Node parseBlocks(const char* buffer, size_t len, size_t line = 1, size_t column = 0);
+
+        Document parseDocument(const char* buffer, size_t len);
+        Document parseDocument(const string& str) { return parseDocument(str.data(), str.size()); }
+        // Replaces length bytes at offset in the document's source, and re-parses only the top-level blocks around the edit, if it can.
+        // Returns false if the whole thing had to be re-parsed. Either way, errors only has what was found in the part that was.
+        // Throws as parse does, in which case the document is left as it was.
+        bool reparse(Document& document, size_t offset, size_t length, const char* replacement, size_t replacementLength);
+        bool reparse(Document& document, size_t offset, size_t length, const string& replacement) { return reparse(document, offset, length, replacement.data(), replacement.size()); }
 
         // Unparses the tree into text. Useful when used with optimization.
         void unparse(const Node& node, std::string& target, Parser::State state = Parser::State::NODE);
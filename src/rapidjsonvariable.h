@@ -53,7 +53,15 @@ namespace Liquid {
             getString = +[](LiquidRenderer renderer, void* variable, char* target) {
                 if (!static_cast<rapidjson::Value*>(variable)->IsString())
                     return false;
-                strcpy(target, static_cast<rapidjson::Value*>(variable)->GetString());
+                memcpy(target, static_cast<rapidjson::Value*>(variable)->GetString(), static_cast<rapidjson::Value*>(variable)->GetStringLength());
+                return true;
+            };
+            // Documents keep their strings null terminated, so they can be handed out as they are.
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** view, size_t* length) {
+                if (!static_cast<rapidjson::Value*>(variable)->IsString())
+                    return false;
+                *view = static_cast<rapidjson::Value*>(variable)->GetString();
+                *length = static_cast<rapidjson::Value*>(variable)->GetStringLength();
                 return true;
             };
             getStringLength = +[](LiquidRenderer renderer, void* variable) {
@@ -80,6 +88,38 @@ namespace Liquid {
                 *target = &value;
                 return true;
             };
+            // Members are searched in order; knowing the length means most of them can be skipped without comparing the key.
+            getDictionaryVariableHashed = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target) {
+                rapidjson::Value& object = *static_cast<rapidjson::Value*>(variable);
+                if (!object.IsObject())
+                    return false;
+                rapidjson::Value name(rapidjson::StringRef(key, length));
+                auto it = object.FindMember(name);
+                if (it == object.MemberEnd())
+                    return false;
+                *target = &it->value;
+                return true;
+            };
+            // Objects built from the same shape of document keep their members in the same order, so the slot's the member index.
+            getDictionaryVariableCached = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, LiquidInlineCache* cache, void** target) {
+                rapidjson::Value& object = *static_cast<rapidjson::Value*>(variable);
+                if (!object.IsObject())
+                    return LIQUID_INLINE_CACHE_NOT_FOUND;
+                if (cache->slot < object.MemberCount()) {
+                    auto it = object.MemberBegin() + cache->slot;
+                    if (it->name.GetStringLength() == length && memcmp(it->name.GetString(), key, length) == 0) {
+                        *target = &it->value;
+                        return LIQUID_INLINE_CACHE_HIT;
+                    }
+                }
+                rapidjson::Value name(rapidjson::StringRef(key, length));
+                auto it = object.FindMember(name);
+                if (it == object.MemberEnd())
+                    return LIQUID_INLINE_CACHE_NOT_FOUND;
+                cache->slot = it - object.MemberBegin();
+                *target = &it->value;
+                return LIQUID_INLINE_CACHE_MISS;
+            };
             getArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void** target) {
                 if (!static_cast<rapidjson::Value*>(variable)->IsArray())
                     return false;
@@ -122,6 +162,8 @@ namespace Liquid {
             freeVariable = +[](LiquidRenderer renderer, void* variable) { delete (CPPVariable*)variable;  };
 
             compare = +[](void* a, void* b) { return *static_cast<CPPVariable*>(a) < *static_cast<CPPVariable*>(b) ? -1 : 0; };
+            // Documents aren't changed by reading them.
+            threadSafeReads = true;
         }
     };
 
@@ -18,44 +18,329 @@ namespace Liquid {
         mode = Renderer::ExecutionMode::PARSE_TREE;
         errors.clear();
         unknownErrors.clear();
-        renderStartTime = std::chrono::system_clock::now();
-        currentMemoryUsage = 0;
         currentRenderingDepth = 0;
         error = Error::Type::LIQUID_RENDERER_ERROR_TYPE_NONE;
         internalRender = true;
+        BudgetScope budgetScope(*this);
         Node node = retrieveRenderedNode(ast, store);
         internalRender = false;
         assert(node.type == nullptr);
         if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
-            throw Error(error, Node());
+            throw Exception(Error(error, Node()));
         return node.variant;
     }
 
     LiquidRendererErrorType Renderer::render(const Node& ast, Variable store, void (*callback)(const char* chunk, size_t size, void* data), void* data) {
         if (internalRender) {
-            Node node = retrieveRenderedNode(ast, store);
+            Node node = retrieveBufferedNode(ast, store);
             assert(node.type == nullptr);
             auto s = node.getString();
             callback(s.data(), s.size(), data);
         } else {
             mode = Renderer::ExecutionMode::PARSE_TREE;
             nodeContext = nullptr;
+            sink = nullptr;
             errors.clear();
             unknownErrors.clear();
-            renderStartTime = std::chrono::system_clock::now();
-            currentMemoryUsage = 0;
             currentRenderingDepth = 0;
             error = Error::Type::LIQUID_RENDERER_ERROR_TYPE_NONE;
             internalRender = true;
-            Node node = retrieveRenderedNode(ast, store);
+            BudgetScope budgetScope(*this);
+            if (profiler)
+                profiler->start(*this);
+            if (outputChunkSize > 0) {
+                OutputSink outputSink(callback, data, outputChunkSize);
+                sink = &outputSink;
+                try {
+                    // Anything that bubbles all the way up to the top still has to be output.
+                    write(retrieveRenderedNode(ast, store));
+                } catch (...) {
+                    sink = nullptr;
+                    internalRender = false;
+                    if (profiler)
+                        profiler->stop(*this);
+                    throw;
+                }
+                sink = nullptr;
+                outputSink.flush();
+            } else {
+                Node node;
+                try {
+                    node = retrieveRenderedNode(ast, store);
+                } catch (...) {
+                    internalRender = false;
+                    if (profiler)
+                        profiler->stop(*this);
+                    throw;
+                }
+                assert(node.type == nullptr);
+                auto s = node.getString();
+                if (profiler)
+                    profiler->output += s.size();
+                callback(s.data(), s.size(), data);
+            }
+            if (profiler)
+                profiler->stop(*this);
             internalRender = false;
-            assert(node.type == nullptr);
-            auto s = node.getString();
-            callback(s.data(), s.size(), data);
         }
         return error;
     }
 
+    std::chrono::duration<unsigned int,std::milli> Renderer::getRenderedTime() const {
+        return std::chrono::duration_cast<std::chrono::duration<unsigned int,std::milli>>(std::chrono::steady_clock::now() - renderStartTime);
+    }
+
+    Budget* Renderer::startBudget() {
+        renderStartTime = std::chrono::steady_clock::now();
+        // Empty, so the first node fills it up.
+        budget.fuel = 0;
+        refuelled = 0;
+        currentRenderingFuel = 0;
+        budget.bytes = 0;
+        budget.maximumBytes = maximumMemoryUsage;
+        budget.exceeded = false;
+        budgeted = true;
+        return maximumMemoryUsage || profiler ? &budget : nullptr;
+    }
+
+    bool Renderer::checkBudget() {
+        if (!budgeted) {
+            budget.fuel = refuelled = std::numeric_limits<long long>::max();
+            return true;
+        }
+        // The fuel's one past empty now; anything less, and it was emptied out early for going over memory.
+        currentRenderingFuel += refuelled - budget.fuel - 1;
+        if (error == LIQUID_RENDERER_ERROR_TYPE_NONE) {
+            if (budget.exceeded)
+                error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY;
+            else if (maximumRenderingFuel && currentRenderingFuel >= maximumRenderingFuel)
+                error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL;
+            else if (maximumRenderingTime && getRenderedTime().count() > maximumRenderingTime)
+                error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME;
+        }
+        if (error != LIQUID_RENDERER_ERROR_TYPE_NONE) {
+            // Stays empty, so that everything after is turned away too.
+            budget.fuel = refuelled = 0;
+            return false;
+        }
+        // Without a clock to read, only a fuel limit needs checking again, and only once it's all spent.
+        refuelled = maximumRenderingTime ? FUEL_CHECK_INTERVAL : std::numeric_limits<long long>::max() / 2;
+        if (maximumRenderingFuel && maximumRenderingFuel - currentRenderingFuel < (unsigned long long)refuelled)
+            refuelled = maximumRenderingFuel - currentRenderingFuel;
+        // This check's on behalf of something that's about to be rendered; it's paid for out of what's just been put in.
+        budget.fuel = refuelled - 1;
+        return true;
+    }
+
+    // The pool thread, if any, that's running on this one, and its queue.
+    static thread_local WorkerPool* currentWorkerPool = nullptr;
+    static thread_local size_t currentWorkerQueue = 0;
+
+    WorkerPool::WorkerPool(size_t count) : nextQueue(0) {
+        for (size_t i = 0; i < count; ++i)
+            queues.push_back(make_unique<Queue>());
+        for (size_t i = 0; i < count; ++i) {
+            threads.emplace_back([this, i]() {
+                currentWorkerPool = this;
+                currentWorkerQueue = i;
+                while (true) {
+                    if (runTask(i))
+                        continue;
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this]() { return stopping || queued > 0; });
+                    if (stopping)
+                        return;
+                }
+            });
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    bool WorkerPool::runTask(size_t queue) {
+        Task task = { nullptr, nullptr };
+        for (size_t i = 0; i < queues.size() && !task.batch; ++i) {
+            Queue& victim = *queues[(queue + i) % queues.size()].get();
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty())
+                continue;
+            // Our own from the front, in the order they were dealt; anyone else's from the back, away from where they're working.
+            if (i == 0) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+            } else {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+            }
+        }
+        if (!task.batch)
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --queued;
+        }
+        try {
+            (*task.function)();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(task.batch->mutex);
+            if (!task.batch->exception)
+                task.batch->exception = std::current_exception();
+        }
+        // Under the lock, which run takes before it returns, so that the batch isn't gone before we're done with it.
+        std::lock_guard<std::mutex> lock(task.batch->mutex);
+        if (--task.batch->remaining == 0)
+            task.batch->done.notify_all();
+        return true;
+    }
+
+    void WorkerPool::run(const vector<std::function<void()>>& tasks) {
+        if (tasks.empty())
+            return;
+        if (queues.empty()) {
+            for (auto& task : tasks)
+                task();
+            return;
+        }
+        Batch batch;
+        batch.remaining = tasks.size();
+        size_t home = currentWorkerPool == this ? currentWorkerQueue : nextQueue++ % queues.size();
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            Queue& queue = *queues[(home + i) % queues.size()].get();
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({ &batch, &tasks[i] });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued += tasks.size();
+        }
+        wake.notify_all();
+        // Anything that's left in the queues is worked on here; once there's nothing, whatever's left of the batch is being run elsewhere.
+        while (batch.remaining.load() > 0) {
+            if (runTask(home))
+                continue;
+            std::unique_lock<std::mutex> lock(batch.mutex);
+            batch.done.wait(lock, [&batch]() { return batch.remaining.load() == 0; });
+        }
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (batch.exception)
+            std::rethrow_exception(batch.exception);
+    }
+
+    bool Renderer::isParallelizable(const Node& node, const NodeType* parent) {
+        if (!node.type)
+            return true;
+        if (node.type->userRenderFunction || node.type->opaque)
+            return false;
+        if (node.type->type == NodeType::Type::TAG && node.type->optimization == LIQUID_OPTIMIZATION_SCHEME_NONE) {
+            // Except else, and the like, which only mark where the branches of the tag they're in start.
+            if (!parent || parent->type != NodeType::Type::TAG)
+                return false;
+            if (static_cast<const TagNodeType*>(parent)->intermediates.get(node.type->symbol) != node.type)
+                return false;
+        }
+        for (auto& child : node.children) {
+            if (child && !isParallelizable(*child.get(), node.type))
+                return false;
+        }
+        return true;
+    }
+
+    static bool isSameError(const Renderer::Error& a, const Renderer::Error& b) {
+        return a.type == b.type && a.details.line == b.details.line && a.details.column == b.details.column && strcmp(a.details.args[0], b.details.args[0]) == 0;
+    }
+
+    vector<string> Renderer::renderParallel(size_t count, const std::function<string(Renderer& renderer, size_t piece)>& render) {
+        assert(canRenderParallel());
+        vector<string> output(count);
+        vector<unique_ptr<Renderer>> copies(count);
+        // The copies all spend at once, so each can have all that's left of the fuel, and time, but only its share of the memory.
+        size_t concurrency = std::min(count, workers->size() + 1);
+        unsigned long long spentFuel = getRenderingFuel();
+        unsigned int memory = 0;
+        if (maximumMemoryUsage)
+            memory = std::max((unsigned int)((budget.bytes < maximumMemoryUsage ? maximumMemoryUsage - budget.bytes : 0) / concurrency), 1U);
+        vector<std::function<void()>> tasks;
+        tasks.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            tasks.push_back([this, i, &copies, &output, &render, spentFuel, memory]() {
+                copies[i] = make_unique<Renderer>(context, variableResolver);
+                Renderer& copy = *copies[i].get();
+                copy.mode = mode;
+                copy.internalDrops = internalDrops;
+                copy.slots = slots;
+                copy.nodeContext = nodeContext;
+                copy.currentRenderingDepth = currentRenderingDepth;
+                copy.maximumRenderingDepth = maximumRenderingDepth;
+                copy.maximumRenderingTime = maximumRenderingTime;
+                copy.maximumRenderingFuel = maximumRenderingFuel ? std::max(maximumRenderingFuel - std::min(spentFuel, maximumRenderingFuel), 1ULL) : 0;
+                copy.maximumMemoryUsage = memory;
+                copy.logUnknownFilters = logUnknownFilters;
+                copy.logUnknownVariables = logUnknownVariables;
+                copy.borrowStrings = borrowStrings;
+                copy.partials = partials;
+                copy.workers = workers;
+                copy.minimumParallelIterations = minimumParallelIterations;
+                copy.customData = customData;
+                copy.internalRender = true;
+                Budget::Scope scope(copy.startBudget());
+                copy.renderStartTime = renderStartTime;
+                output[i] = render(copy, i);
+                copy.budgeted = false;
+            });
+        }
+        workers->run(tasks);
+
+        for (auto& copy : copies) {
+            for (auto& copyError : copy->errors) {
+                if (std::find_if(errors.begin(), errors.end(), [&copyError](const Error& error) { return isSameError(error, copyError); }) == errors.end())
+                    errors.push_back(copyError);
+            }
+            if (error == LIQUID_RENDERER_ERROR_TYPE_NONE)
+                error = copy->error;
+            currentRenderingFuel += copy->getRenderingFuel();
+        }
+        if (error == LIQUID_RENDERER_ERROR_TYPE_NONE && maximumRenderingFuel && getRenderingFuel() >= maximumRenderingFuel)
+            error = LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL;
+        if (error != LIQUID_RENDERER_ERROR_TYPE_NONE) {
+            // Emptied out, as checkBudget would have, so that everything after is turned away too.
+            currentRenderingFuel += refuelled - std::max(budget.fuel, 0LL);
+            budget.fuel = refuelled = 0;
+        }
+        return output;
+    }
+
+    void Renderer::write(const Node& node) {
+        assert(sink && node.type == nullptr);
+        switch (node.variant.type) {
+            case Variant::Type::STRING:
+                sink->write(node.variant.s.data(), node.variant.s.size());
+                if (profiler)
+                    profiler->output += node.variant.s.size();
+            break;
+            case Variant::Type::STRING_VIEW:
+                sink->write(node.variant.view, node.variant.len);
+                if (profiler)
+                    profiler->output += node.variant.len;
+            break;
+            case Variant::Type::NIL:
+            break;
+            default: {
+                string s = node.getString();
+                sink->write(s.data(), s.size());
+                if (profiler)
+                    profiler->output += s.size();
+            } break;
+        }
+    }
+
     string Renderer::render(const Node& ast, Variable store) {
         string accumulator;
         LiquidRendererErrorType error = render(ast, store, +[](const char* chunk, size_t size, void* data){
@@ -63,7 +348,7 @@ namespace Liquid {
             accumulator->append(chunk, size);
         }, &accumulator);
         if (error != LIQUID_RENDERER_ERROR_TYPE_NONE)
-            throw Error(error, Node());
+            throw Exception(Error(error, Node()));
         return accumulator;
     }
 
@@ -77,8 +362,14 @@ namespace Liquid {
         return result.substr(start, end - start + 1);
     }
 
-    pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(const string& key) {
-        auto it = internalDrops.find(key);
+    pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(std::string_view key) {
+        for (auto it = slots.rbegin(); it != slots.rend(); ++it) {
+            if (it->name == key)
+                return it->drop;
+        }
+        if (internalDrops.empty())
+            return { nullptr, nullptr };
+        auto it = internalDrops.find(string(key));
         if (it == internalDrops.end())
             return { nullptr, nullptr };
         return it->second.back();
@@ -86,8 +377,15 @@ namespace Liquid {
 
     pair<void*, Renderer::DropFunction> Renderer::getInternalDrop(const Node& node, Variable store) {
         assert(node.type && node.children.size() > 0);
-        string key = retrieveRenderedNode(*node.children[0].get(), store).getString();
-        return getInternalDrop(key);
+        if (slots.empty() && internalDrops.empty())
+            return { nullptr, nullptr };
+        const Node& root = *node.children[0].get();
+        if (root.type || root.variant.type != Variant::Type::STRING)
+            return getInternalDrop(retrieveRenderedNode(root, store).getString());
+        // The slot's checked, as this template could be being rendered from inside some other loop, and have its slots further along.
+        if (node.slot && node.slot <= slots.size() && slots[node.slot - 1].name == root.variant.s)
+            return slots[node.slot - 1].drop;
+        return getInternalDrop(root.variant.s);
     }
 
     void Renderer::pushInternalDrop(const std::string& key, std::pair<void*, DropFunction> func) {
@@ -109,6 +407,9 @@ namespace Liquid {
             case Variant::Type::STRING:
                 variable = variableResolver.createString(*this, variant.s.data());
             break;
+            case Variant::Type::STRING_VIEW:
+                variable = variableResolver.createString(*this, variant.getString().data());
+            break;
             case Variant::Type::INT:
                 variable = variableResolver.createInteger(*this, variant.i);
             break;
@@ -140,7 +441,7 @@ namespace Liquid {
         }
     }
 
-    Variant Renderer::parseVariant(Variable variable) {
+    Variant Renderer::parseVariant(Variable variable, bool borrow) {
         ELiquidVariableType type = variableResolver.getType(*this, variable);
         switch (type) {
             case LIQUID_VARIABLE_TYPE_OTHER:
@@ -164,6 +465,10 @@ namespace Liquid {
                     return Variant(f);
             } break;
             case LIQUID_VARIABLE_TYPE_STRING: {
+                const char* view;
+                size_t length;
+                if (variableResolver.getStringView && variableResolver.getStringView(*this, variable, &view, &length))
+                    return borrow && borrowStrings ? Variant(view, length) : Variant(string(view, length));
                 string s;
                 long long size = variableResolver.getStringLength(*this, variable);
                 if (size >= 0) {
@@ -183,12 +488,8 @@ namespace Liquid {
         if (!node.type) {
             if (node.variant.type == Variant::Type::VARIABLE) {
                 string s;
-                long long size = variableResolver.getStringLength(*this, node.variant.v.pointer);
-                if (size >= 0) {
-                    s.resize(size);
-                    if (variableResolver.getString(*this, node.variant.v.pointer, const_cast<char*>(s.data())))
-                        return s;
-                }
+                if (resolveVariableString(s, node.variant.v.pointer))
+                    return s;
             } else {
                 return node.variant.getString();
             }
@@ -203,6 +504,12 @@ namespace Liquid {
             errors.push_back(Error(LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER, node, node.type->symbol));
         }
     }
+    void Renderer::pushUnknownPartialWarning(const Node& node, const std::string& name) {
+        if (unknownErrors.find(&node) == unknownErrors.end()) {
+            unknownErrors.insert(&node);
+            errors.push_back(Error(LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_PARTIAL, node, name));
+        }
+    }
     void Renderer::pushUnknownVariableWarning(const Node& node, int offset, Variable store) {
         if (unknownErrors.find(&node) == unknownErrors.end()) {
             unknownErrors.insert(&node);
@@ -228,6 +535,14 @@ namespace Liquid {
         bool valid = true;
         for (size_t i = offset; valid && i < node.children.size(); ++i) {
             auto& link = node.children[i];
+            // Literal keys are used as they are, rather than copied.
+            if (!link->type && link->variant.type == Variant::Type::STRING) {
+                if (!getDictionaryVariable(storePointer, link->variant.s.data(), link->variant.s.size(), link->keyHash, storePointer)) {
+                    storePointer = Variable({ nullptr });
+                    valid = false;
+                }
+                continue;
+            }
             auto node = retrieveRenderedNode(*link.get(), store);
             switch (node.variant.type) {
                 case Variant::Type::INT:
@@ -236,8 +551,10 @@ namespace Liquid {
                         valid = false;
                     }
                 break;
-                case Variant::Type::STRING: {
-                    if (!variableResolver.getDictionaryVariable(*this, storePointer, node.variant.s.data(), storePointer)) {
+                case Variant::Type::STRING:
+                case Variant::Type::STRING_VIEW: {
+                    std::string_view key = node.variant.getStringView();
+                    if (!getDictionaryVariable(storePointer, key.data(), key.size(), 0, storePointer)) {
                         storePointer = Variable({ nullptr });
                         valid = false;
                     }
@@ -264,6 +581,8 @@ namespace Liquid {
                         return variableResolver.setArrayVariable(*this, storePointer, part.variant.i, value);
                     case Variant::Type::STRING:
                         return variableResolver.setDictionaryVariable(*this, storePointer, part.variant.s.data(), value);
+                    case Variant::Type::STRING_VIEW:
+                        return variableResolver.setDictionaryVariable(*this, storePointer, string(part.variant.view, part.variant.len).c_str(), value);
                     default:
                         return false;
                 }
@@ -277,6 +596,10 @@ namespace Liquid {
                         if (!variableResolver.getDictionaryVariable(*this, storePointer, part.variant.s.data(), storePointer))
                             return false;
                     break;
+                    case Variant::Type::STRING_VIEW:
+                        if (!getDictionaryVariable(storePointer, part.variant.view, part.variant.len, 0, storePointer))
+                            return false;
+                    break;
                     default:
                         return false;
                 }
@@ -286,4 +609,212 @@ namespace Liquid {
         }
         return false;
     }
+
+    Node Renderer::retrieveProfiledNode(const Node& node, Variable store) {
+        // Nodes rendered outside of a render, like while optimizing, aren't recorded.
+        if (!profiler->isRunning()) {
+            Node value = node.type->render(*this, node, store);
+            assert(!value.type);
+            return value;
+        }
+        profiler->enter(node.type, node.line, node.column);
+        Node value;
+        try {
+            value = node.type->render(*this, node, store);
+        } catch (...) {
+            profiler->exit(Node());
+            throw;
+        }
+        assert(!value.type);
+        profiler->exit(value);
+        return value;
+    }
+
+    // Stands in for one of the functions of the resolver a profiled renderer had, counting the call.
+    template <class T> struct CountedResolverCall;
+    template <class R, class... Args> struct CountedResolverCall<R (*)(LiquidRenderer, Args...)> {
+        template <R (*LiquidVariableResolver::*function)(LiquidRenderer, Args...)> static R call(LiquidRenderer renderer, Args... args) {
+            Profiler& profiler = *static_cast<Renderer*>(renderer.renderer)->profiler;
+            ++profiler.resolverCalls;
+            return (profiler.resolver.*function)(renderer, args...);
+        }
+    };
+    #define LIQUID_COUNT_RESOLVER_CALLS(function) if (resolver.function) \
+        renderer.variableResolver.function = CountedResolverCall<decltype(resolver.function)>::call<&LiquidVariableResolver::function>;
+
+    void Profiler::clear() {
+        assert(!isRunning());
+        entries.clear();
+        frames.clear();
+        entryIndices.clear();
+        entries.emplace_back(nullptr, 0, 0);
+        frames.emplace_back(0, 0);
+        resolverCalls = allocations = output = 0;
+    }
+
+    void Profiler::start(Renderer& renderer) {
+        resolver = renderer.variableResolver;
+        LIQUID_COUNT_RESOLVER_CALLS(getType);
+        LIQUID_COUNT_RESOLVER_CALLS(getBool);
+        LIQUID_COUNT_RESOLVER_CALLS(getTruthy);
+        LIQUID_COUNT_RESOLVER_CALLS(getString);
+        LIQUID_COUNT_RESOLVER_CALLS(getStringLength);
+        LIQUID_COUNT_RESOLVER_CALLS(getInteger);
+        LIQUID_COUNT_RESOLVER_CALLS(getFloat);
+        LIQUID_COUNT_RESOLVER_CALLS(getDictionaryVariable);
+        LIQUID_COUNT_RESOLVER_CALLS(getArrayVariable);
+        LIQUID_COUNT_RESOLVER_CALLS(iterate);
+        LIQUID_COUNT_RESOLVER_CALLS(getArraySize);
+        LIQUID_COUNT_RESOLVER_CALLS(setDictionaryVariable);
+        LIQUID_COUNT_RESOLVER_CALLS(setArrayVariable);
+        LIQUID_COUNT_RESOLVER_CALLS(createHash);
+        LIQUID_COUNT_RESOLVER_CALLS(createArray);
+        LIQUID_COUNT_RESOLVER_CALLS(createFloat);
+        LIQUID_COUNT_RESOLVER_CALLS(createBool);
+        LIQUID_COUNT_RESOLVER_CALLS(createInteger);
+        LIQUID_COUNT_RESOLVER_CALLS(createString);
+        LIQUID_COUNT_RESOLVER_CALLS(createPointer);
+        LIQUID_COUNT_RESOLVER_CALLS(createNil);
+        LIQUID_COUNT_RESOLVER_CALLS(createClone);
+        LIQUID_COUNT_RESOLVER_CALLS(freeVariable);
+        LIQUID_COUNT_RESOLVER_CALLS(getDictionaryVariableHashed);
+        LIQUID_COUNT_RESOLVER_CALLS(getDictionaryVariableCached);
+        LIQUID_COUNT_RESOLVER_CALLS(getStringView);
+        budget = &renderer.budget;
+        last = Clock::now();
+        lastResolverCalls = resolverCalls;
+        lastAllocations = budget->allocations;
+        ++entries[0].calls;
+        active.push_back({ 0, last, output });
+    }
+    #undef LIQUID_COUNT_RESOLVER_CALLS
+
+    void Profiler::stop(Renderer& renderer) {
+        Clock::time_point now = Clock::now();
+        charge(now);
+        entries[0].inclusiveTime += std::chrono::duration_cast<std::chrono::nanoseconds>(now - active.front().start).count();
+        entries[0].bytes += output - active.front().output;
+        active.clear();
+        renderer.variableResolver = resolver;
+        budget = nullptr;
+    }
+
+    void Profiler::charge(Clock::time_point now) {
+        unsigned long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        Frame& frame = frames[active.back().frame];
+        Entry& entry = entries[frame.entry];
+        frame.exclusiveTime += elapsed;
+        entry.exclusiveTime += elapsed;
+        entry.resolverCalls += resolverCalls - lastResolverCalls;
+        entry.allocations += budget->allocations - lastAllocations;
+        allocations += budget->allocations - lastAllocations;
+        last = now;
+        lastResolverCalls = resolverCalls;
+        lastAllocations = budget->allocations;
+    }
+
+    void Profiler::enter(const NodeType* type, size_t line, size_t column) {
+        Clock::time_point now = Clock::now();
+        charge(now);
+        size_t entry;
+        auto it = entryIndices.find(Key { type, line, column });
+        if (it != entryIndices.end())
+            entry = it->second;
+        else {
+            entry = entries.size();
+            entries.emplace_back(type, line, column);
+            entryIndices.emplace(Key { type, line, column }, entry);
+        }
+        size_t parent = active.back().frame, frame;
+        auto child = frames[parent].children.find(entry);
+        if (child != frames[parent].children.end())
+            frame = child->second;
+        else {
+            frame = frames.size();
+            frames[parent].children.emplace(entry, frame);
+            frames.emplace_back(entry, parent);
+        }
+        ++entries[entry].calls;
+        active.push_back({ frame, now, output });
+    }
+
+    void Profiler::exit(const Node& returned) {
+        Clock::time_point now = Clock::now();
+        charge(now);
+        Active& top = active.back();
+        Entry& entry = entries[frames[top.frame].entry];
+        entry.inclusiveTime += std::chrono::duration_cast<std::chrono::nanoseconds>(now - top.start).count();
+        entry.bytes += output - top.output;
+        if (!returned.type && returned.variant.type == Variant::Type::STRING)
+            entry.bytes += returned.variant.s.size();
+        else if (!returned.type && returned.variant.type == Variant::Type::STRING_VIEW)
+            entry.bytes += returned.variant.len;
+        active.pop_back();
+    }
+
+    vector<Profiler::Entry> Profiler::getSymbols() const {
+        vector<Entry> symbols;
+        unordered_map<const NodeType*, size_t> indices;
+        for (auto& entry : entries) {
+            auto it = indices.find(entry.type);
+            if (it == indices.end()) {
+                it = indices.emplace(entry.type, symbols.size()).first;
+                symbols.emplace_back(entry.type, 0, 0);
+            }
+            Entry& symbol = symbols[it->second];
+            symbol.calls += entry.calls;
+            symbol.inclusiveTime += entry.inclusiveTime;
+            symbol.exclusiveTime += entry.exclusiveTime;
+            symbol.bytes += entry.bytes;
+            symbol.resolverCalls += entry.resolverCalls;
+            symbol.allocations += entry.allocations;
+        }
+        return symbols;
+    }
+
+    const char* Profiler::getName(const NodeType* type) {
+        if (!type)
+            return "render";
+        if (!type->symbol.empty())
+            return type->symbol.c_str();
+        switch (type->type) {
+            case NodeType::Type::VARIABLE: return "variable";
+            case NodeType::Type::GROUP: return "group";
+            case NodeType::Type::GROUP_DEREFERENCE: return "dereference";
+            case NodeType::Type::ARRAY_LITERAL: return "array";
+            case NodeType::Type::ARGUMENTS: return "arguments";
+            // The concatenation's the only operator without a symbol.
+            case NodeType::Type::OPERATOR: return "concatenation";
+            default: return "unnamed";
+        }
+    }
+
+    string Profiler::getFlameGraph() const {
+        string result;
+        vector<size_t> path;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i].exclusiveTime == 0)
+                continue;
+            path.clear();
+            for (size_t frame = i; frame != 0; frame = frames[frame].parent)
+                path.push_back(frame);
+            path.push_back(0);
+            for (auto it = path.rbegin(); it != path.rend(); ++it) {
+                const Entry& entry = entries[frames[*it].entry];
+                if (it != path.rbegin())
+                    result.push_back(';');
+                result.append(getName(entry.type));
+                if (entry.line > 0) {
+                    result.push_back(':');
+                    result.append(std::to_string(entry.line));
+                    result.push_back(':');
+                    result.append(std::to_string(entry.column));
+                }
+            }
+            result.push_back(' ');
+            result.append(std::to_string(frames[i].exclusiveTime));
+            result.push_back('\n');
+        }
+        return result;
+    }
 }
@@ -3,11 +3,142 @@
 
 #include "parser.h"
 
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
 namespace Liquid {
     struct Context;
     struct ContextBoundaryNode;
+    struct PartialCache;
+
+    struct Renderer;
+
+    // Records where the time in a renderer's renders goes, for as long as it's set on the renderer. Everything's kept for each type of node
+    // at each place in the source it's rendered from, and for each path through the template it's reached by, for flame graphs. Compiled
+    // programs only record the nodes they call out to, with everything else going to the program itself.
+    struct Profiler {
+        // Times are in nanoseconds. Inclusive time counts everything under the node, and exclusive just the node; bytes are everything the
+        // node output, or returned, including what's under it. Resolver calls and allocations are only counted against the node that made them.
+        struct Entry {
+            const NodeType* type;
+            size_t line;
+            size_t column;
+            size_t calls = 0;
+            unsigned long long inclusiveTime = 0;
+            unsigned long long exclusiveTime = 0;
+            size_t bytes = 0;
+            size_t resolverCalls = 0;
+            size_t allocations = 0;
+
+            Entry(const NodeType* type, size_t line, size_t column) : type(type), line(line), column(column) { }
+        };
+        // Entry 0, and frame 0, are the renders themselves.
+        vector<Entry> entries;
+        struct Frame {
+            size_t entry;
+            size_t parent;
+            unsigned long long exclusiveTime = 0;
+            unordered_map<size_t, size_t> children;
+
+            Frame(size_t entry, size_t parent) : entry(entry), parent(parent) { }
+        };
+        vector<Frame> frames;
 
-    // One renderer per thread; though many renderers can be instantiated.
+        Profiler() { clear(); }
+
+        void clear();
+        // Called around every render; swaps in a variable resolver that counts calls to the renderer's, and reads allocations off its budget.
+        void start(Renderer& renderer);
+        void stop(Renderer& renderer);
+        bool isRunning() const { return !active.empty(); }
+        // Called around every node.
+        void enter(const NodeType* type, size_t line, size_t column);
+        void exit(const Node& returned);
+
+        // What's recorded, with an entry for each type rather than for each place.
+        vector<Entry> getSymbols() const;
+        // One line for each path, in the folded format flamegraph.pl reads, with the exclusive time spent at the end of it.
+        string getFlameGraph() const;
+        // A node type's symbol, or what it is if it hasn't got one.
+        static const char* getName(const NodeType* type);
+
+        // Counted by the renderer, as it goes; allocations by its budget, while the profiler's running.
+        size_t resolverCalls = 0;
+        size_t allocations = 0;
+        const Budget* budget = nullptr;
+        size_t output = 0;
+        // Whatever the renderer's resolver was before it was swapped out.
+        LiquidVariableResolver resolver;
+
+        // The nodes being rendered, outermost first.
+        typedef std::chrono::steady_clock Clock;
+        struct Active {
+            size_t frame;
+            Clock::time_point start;
+            size_t output;
+        };
+        vector<Active> active;
+        Clock::time_point last;
+        size_t lastResolverCalls = 0;
+        size_t lastAllocations = 0;
+        struct Key {
+            const NodeType* type;
+            size_t line;
+            size_t column;
+            bool operator == (const Key& key) const { return type == key.type && line == key.line && column == key.column; }
+        };
+        struct KeyHash {
+            size_t operator()(const Key& key) const { return std::hash<const void*>()(key.type) ^ (key.line * 0x9E3779B97F4A7C15ULL) ^ (key.column << 1); }
+        };
+        std::unordered_map<Key, size_t, KeyHash> entryIndices;
+        // Charges everything since the last time to the node on top.
+        void charge(Clock::time_point now);
+    };
+
+    // A fixed set of threads for renderers to render pieces of a template on at once; see Renderer::workers. Each thread has a queue of its
+    // own, which run deals a batch of tasks out across, and works from the front of; a thread that's run out steals from the back of the
+    // others'. The thread that called run works on the batch too, until it's done, so tasks can run batches of their own without deadlocking.
+    struct WorkerPool {
+        struct Batch {
+            std::atomic<size_t> remaining;
+            std::mutex mutex;
+            std::condition_variable done;
+            // The first exception any of the batch's tasks threw; rethrown by run.
+            std::exception_ptr exception;
+        };
+        struct Task {
+            Batch* batch;
+            const std::function<void()>* function;
+        };
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        vector<unique_ptr<Queue>> queues;
+        vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        // Tasks in the queues that no thread's taken yet.
+        size_t queued = 0;
+        bool stopping = false;
+        // Where batches from threads outside the pool start being dealt out.
+        std::atomic<size_t> nextQueue;
+
+        WorkerPool(size_t threads);
+        ~WorkerPool();
+
+        size_t size() const { return threads.size(); }
+        // Runs every task, and returns once all of them have finished.
+        void run(const vector<std::function<void()>>& tasks);
+        // Runs one task, from the given queue if it has any, or stolen from another; false if there were none anywhere.
+        bool runTask(size_t queue);
+    };
+
+    // One renderer per thread; though many renderers can be instantiated. See RendererPool for sharing templates between threads.
     struct Renderer {
         const Context& context;
 
@@ -28,8 +159,15 @@ namespace Liquid {
         // In order to have a more genericized version of forloop drops, that are not affected by assigns.
         typedef Node (*DropFunction)(Renderer& renderer, const Node& node, Variable store, void* data);
         std::unordered_map<std::string, std::vector<std::pair<void*, DropFunction>>> internalDrops;
+        // What the loops being rendered bind, outermost first; each pushes its forloop, then its variable. Variables the parser's
+        // found a loop for go straight to their slot, and anything else looking for a drop checks these by name before internalDrops.
+        struct Slot {
+            std::string_view name;
+            std::pair<void*, DropFunction> drop;
+        };
+        std::vector<Slot> slots;
         std::pair<void*, DropFunction> getInternalDrop(const Node& node, Variable store);
-        std::pair<void*, DropFunction> getInternalDrop(const std::string& str);
+        std::pair<void*, DropFunction> getInternalDrop(std::string_view str);
         void pushInternalDrop(const std::string& key, std::pair<void*, DropFunction> func);
         void popInternalDrop(const std::string& key);
 
@@ -74,6 +212,12 @@ namespace Liquid {
                     case Renderer::Error::Type::LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER:
                         sprintf(buffer, "Unknown filter '%s'.", rendererError.details.args[0]);
                     break;
+                    case Renderer::Error::Type::LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL:
+                        sprintf(buffer, "Exceeded rendering fuel.");
+                    break;
+                    case Renderer::Error::Type::LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_PARTIAL:
+                        sprintf(buffer, "Unknown partial '%s'.", rendererError.details.args[0]);
+                    break;
                 }
                 return string(buffer);
             }
@@ -92,31 +236,97 @@ namespace Liquid {
         };
 
 
-        // If set, this will stop rendering with an error if the limits here, in bytes are breached for this renderer. This is checked any time
-        // the variable resolver is used.
+        // If set, this will stop rendering with an error if the strings, arrays and nodes made while rendering, and still live, take up more
+        // than this many bytes of the heap. Checked at the first node rendered after it's breached.
         unsigned int maximumMemoryUsage = 0;
         // If set, this will stop rendering with an error if the limits here, in milisecnods, are breached for this renderer.
-        // This is checked between all concatenations.
+        // The clock's only read every FUEL_CHECK_INTERVAL nodes, so this is overshot by as long as those take.
         unsigned int maximumRenderingTime = 0;
+        // If set, this will stop rendering with an error after this many nodes have been rendered, or calls and loop iterations interpreted.
+        // A cheap bound on the work a render can do, whatever it does it on.
+        unsigned long long maximumRenderingFuel = 0;
         // How many concatenation nodes are allowed at any given time. This roughly corresponds to the amount of nested tags. In non-malicious code
         // this will probably rarely exceed 100.
         unsigned int maximumRenderingDepth = 100;
 
-        unsigned int currentMemoryUsage;
-        std::chrono::system_clock::time_point renderStartTime;
-        unsigned int currentRenderingDepth;
+        static constexpr long long FUEL_CHECK_INTERVAL = 1024;
+
+        // Made current for the length of a top-level render, if there's a memory limit, or a profiler, to count allocations against.
+        Budget budget;
+        // How much fuel the budget was last filled up with, and how much was spent before that; see getRenderingFuel for all of it.
+        long long refuelled = 0;
+        unsigned long long currentRenderingFuel = 0;
+        // Limits are only checked between startBudget and the end of the render; the optimizer renders without them.
+        bool budgeted = false;
+        std::chrono::steady_clock::time_point renderStartTime;
+        unsigned int currentRenderingDepth = 0;
+
+        // If set, render() with a callback streams output to the callback in chunks of roughly this size as the tree is walked, rather than
+        // building the whole document in memory, and handing it over at the end.
+        size_t outputChunkSize = 16*1024;
 
         bool logUnknownFilters = false;
         bool logUnknownVariables = false;
+        // If the variable resolver has getStringView, variables render out as borrowed views of its strings, rather than copies; never while
+        // optimizing, as whatever's rendered then is kept in the tree.
+        bool borrowStrings = true;
 
         bool internalRender = false;
 
+        // Where include, render and section find their partials. Without one, they render nothing, with an error for each.
+        PartialCache* partials = nullptr;
+
+        // If set, and the variable resolver's threadSafeReads is, loops of at least minimumParallelIterations iterations, and runs of top-level
+        // blocks, that only read are split up between the pool's threads, each rendering its pieces on its own copy of this renderer, and
+        // stitched back together in order. Never while optimizing, profiling, or running a compiled program. Not owned by the renderer.
+        WorkerPool* workers = nullptr;
+        unsigned int minimumParallelIterations = 32;
+
+        // If set, records every render; see Profiler. Unset, profiling costs a branch for every node.
+        unique_ptr<Profiler> profiler;
+
+        // Accumulates streamed output, and hands it to the render callback every time it grows past chunkSize.
+        struct OutputSink {
+            void (*callback)(const char* chunk, size_t size, void* data);
+            void* data;
+            size_t chunkSize;
+            string buffer;
+
+            OutputSink(void (*callback)(const char* chunk, size_t size, void* data), void* data, size_t chunkSize) : callback(callback), data(data), chunkSize(chunkSize) {
+                buffer.reserve(chunkSize);
+            }
+
+            void write(const char* chunk, size_t size) {
+                if (buffer.size() + size < chunkSize) {
+                    buffer.append(chunk, size);
+                    return;
+                }
+                flush();
+                if (size >= chunkSize)
+                    callback(chunk, size, data);
+                else
+                    buffer.append(chunk, size);
+            }
+
+            void flush() {
+                if (!buffer.empty()) {
+                    callback(buffer.data(), buffer.size(), data);
+                    buffer.clear();
+                }
+            }
+        };
+        // While streaming, this is the sink; concatenations, outputs, and loops write into it directly, and return nil nodes.
+        // Anything that needs the actual value of a block, like capture, should use retrieveBufferedNode.
+        OutputSink* sink = nullptr;
+        void write(const Node& node);
+
         const ContextBoundaryNode* nodeContext = nullptr;
 
         // Done so we don't repeat unknown errors if they're inloops.
         unordered_set<const Node*> unknownErrors;
         void pushUnknownVariableWarning(const Node& node, int offset, Variable store);
         void pushUnknownFilterWarning(const Node& node, Variable store);
+        void pushUnknownPartialWarning(const Node& node, const std::string& name);
 
 
         // Used for the C interface.
@@ -136,27 +346,99 @@ namespace Liquid {
         // a type still attached; otherwise, will always be a variant node.
         Node retrieveRenderedNode(const Node& node, Variable store) {
             if (node.type) {
+                if (budget.fuel-- <= 0 && !checkBudget())
+                    return Node();
+                if (profiler)
+                    return retrieveProfiledNode(node, store);
                 Node value = node.type->render(*this, node, store);
                 assert(!value.type);
                 return value;
             }
             return node;
         }
+        Node retrieveProfiledNode(const Node& node, Variable store);
+        // Like retrieveRenderedNode, but suspends streaming while rendering, so that the entire output of the node is returned as its value.
+        Node retrieveBufferedNode(const Node& node, Variable store) {
+            SinkScope scope(*this, nullptr);
+            return retrieveRenderedNode(node, store);
+        }
         std::chrono::duration<unsigned int,std::milli> getRenderedTime() const;
 
+        // Starts the clock, and fills up the budget, for a top-level render. Returns the budget if there's anything for it to count.
+        Budget* startBudget();
+        // Called whenever the budget's fuel runs out. If a limit's been breached, sets the error, and returns false; otherwise, fills it up again.
+        bool checkBudget();
+        // How much fuel's been spent on the current, or last, render.
+        unsigned long long getRenderingFuel() const { return currentRenderingFuel + (refuelled - std::max(budget.fuel, 0LL)); }
+        // Whether something that knows it's about to allocate this many bytes can do so, and stay inside maximumMemoryUsage.
+        bool hasMemoryFor(size_t bytes) const { return !maximumMemoryUsage || budget.bytes + bytes <= maximumMemoryUsage; }
+        // Whether there's anywhere to render in parallel, right now; see workers.
+        bool canRenderParallel() const { return workers && workers->size() && variableResolver.threadSafeReads && !profiler && budgeted && mode == ExecutionMode::PARSE_TREE; }
+        // Whether a node can be rendered at the same time as anything else that only reads; nothing under it assigns, counts, cycles, breaks
+        // out of a loop, renders a partial, or has a render function from outside.
+        static bool isParallelizable(const Node& node, const NodeType* parent = nullptr);
+        // Renders count pieces at once on the workers, each with a copy of this renderer, of its loops and drops, and a share of what's left of
+        // its budget, and returns what each rendered, in order. The copies' errors are added to this renderer's, in order, as is their fuel.
+        vector<string> renderParallel(size_t count, const std::function<string(Renderer& renderer, size_t piece)>& render);
+        // Around a top-level render; from startBudget to wherever it ends, however it ends.
+        struct BudgetScope {
+            Renderer& renderer;
+            Budget::Scope scope;
+
+            BudgetScope(Renderer& renderer) : renderer(renderer), scope(renderer.startBudget()) { }
+            ~BudgetScope() { renderer.budgeted = false; }
+        };
+        // Points output at another sink for the lifetime of the scope, and back at the one before it however the scope's left.
+        struct SinkScope {
+            Renderer& renderer;
+            OutputSink* previous;
+
+            SinkScope(Renderer& renderer, OutputSink* sink) : renderer(renderer), previous(renderer.sink) { renderer.sink = sink; }
+            ~SinkScope() { renderer.sink = previous; }
+        };
+
         operator LiquidRenderer() { return LiquidRenderer {this}; }
 
         void inject(Variable& variable, const Variant& variant);
-        Variant parseVariant(Variable variable);
+        // If borrow is set, strings may come back as views of the variable resolver's own; see borrowStrings.
+        Variant parseVariant(Variable variable, bool borrow = false);
         string getString(const Node& node);
 
 
 
         std::pair<bool, Variable> getVariable(const Node& node, Variable store, size_t offset = 0);
+        // Looks up a key that's known ahead of time, through getDictionaryVariableHashed if the resolver has it. A hash of 0 is worked out here.
+        bool getDictionaryVariable(Variable variable, const char* key, size_t length, size_t hash, Variable& target) {
+            if (!variableResolver.getDictionaryVariableHashed)
+                return variableResolver.getDictionaryVariable(LiquidRenderer { this }, variable, key, target);
+            return variableResolver.getDictionaryVariableHashed(LiquidRenderer { this }, variable, key, length, hash ? hash : liquidHashKey(key, length), target);
+        }
         bool setVariable(const Node& node, Variable store, Variable value, size_t offset = 0);
+        // Hands each element of an array, or of a variable that's one, to the callback in turn, until it returns false. False if the
+        // operand's neither.
+        template <class T> bool forEachElement(const Variant& operand, T callback) {
+            if (operand.type == Variant::Type::ARRAY) {
+                for (auto it = operand.a.begin(); it != operand.a.end(); ++it) {
+                    if (!callback(Variant(*it)))
+                        break;
+                }
+                return true;
+            }
+            if (operand.type != Variant::Type::VARIABLE)
+                return false;
+            return variableResolver.iterate(LiquidRenderer { this }, operand.v.pointer, +[](void* variable, void* data) {
+                return (*static_cast<T*>(data))(Variant(Variable({ variable })));
+            }, &callback, 0, -1, false);
+        }
 
         const LiquidVariableResolver& getVariableResolver() const { return variableResolver; }
         bool resolveVariableString(string& target, void* variable) {
+            const char* view;
+            size_t size;
+            if (variableResolver.getStringView && variableResolver.getStringView(LiquidRenderer { this }, variable, &view, &size)) {
+                target.assign(view, size);
+                return true;
+            }
             long long length = variableResolver.getStringLength(LiquidRenderer { this }, variable);
             if (length < 0)
                 return false;
@@ -0,0 +1,224 @@
+#include "snapshotvariable.h"
+
+#include <algorithm>
+
+namespace Liquid {
+
+    void SnapshotValue::reset(LiquidVariableType type) {
+        this->type = type;
+        pending = false;
+        i = 0;
+        s.clear();
+        elements.clear();
+        keys.clear();
+        lookup.clear();
+        host = nullptr;
+    }
+
+    void SnapshotValue::setContainer(LiquidVariableType type, void* host) {
+        reset(type);
+        // Values made while rendering have nothing to fill them in from.
+        if (host && snapshot) {
+            this->host = host;
+            pending = true;
+            snapshot->hosts.push_back(host);
+        }
+    }
+
+    SnapshotValue& SnapshotValue::expand() {
+        if (pending) {
+            // Cleared first, so the expand function can add to the container.
+            pending = false;
+            snapshot->expandFunction(LiquidSnapshot { this }, host, snapshot->data);
+        }
+        return *this;
+    }
+
+    void SnapshotValue::expandAll() {
+        expand();
+        for (auto& element : elements)
+            element->expandAll();
+    }
+
+    SnapshotValue* SnapshotValue::add(std::string_view key) {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY) {
+            if (type != LIQUID_VARIABLE_TYPE_NIL)
+                return nullptr;
+            type = LIQUID_VARIABLE_TYPE_DICTIONARY;
+        }
+        long long idx = indexOf(key);
+        if (idx >= 0) {
+            elements[idx]->setNil();
+            return elements[idx].get();
+        }
+        elements.push_back(make_unique<SnapshotValue>());
+        elements.back()->snapshot = snapshot;
+        keys.emplace_back(key);
+        if (lookup.size()) {
+            lookup[keys.back()] = keys.size() - 1;
+        } else if (keys.size() > LOOKUP_THRESHOLD) {
+            for (size_t i = 0; i < keys.size(); ++i)
+                lookup[keys[i]] = i;
+        }
+        return elements.back().get();
+    }
+
+    SnapshotValue* SnapshotValue::add() {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY) {
+            if (type != LIQUID_VARIABLE_TYPE_NIL)
+                return nullptr;
+            type = LIQUID_VARIABLE_TYPE_ARRAY;
+        }
+        elements.push_back(make_unique<SnapshotValue>());
+        elements.back()->snapshot = snapshot;
+        return elements.back().get();
+    }
+
+    SnapshotValue* SnapshotValue::set(std::string_view key, unique_ptr<SnapshotValue> value) {
+        SnapshotValue* target = add(key);
+        if (!target)
+            return nullptr;
+        long long idx = indexOf(key);
+        value->created = false;
+        elements[idx] = move(value);
+        return elements[idx].get();
+    }
+
+    SnapshotValue* SnapshotValue::set(long long idx, unique_ptr<SnapshotValue> value) {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        if (idx < 0)
+            idx += elements.size();
+        if (idx < 0)
+            return nullptr;
+        while ((long long)elements.size() <= idx) {
+            elements.push_back(make_unique<SnapshotValue>());
+            elements.back()->snapshot = snapshot;
+        }
+        value->created = false;
+        elements[idx] = move(value);
+        return elements[idx].get();
+    }
+
+    long long SnapshotValue::indexOf(std::string_view key) {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+            return -1;
+        if (lookup.size()) {
+            auto it = lookup.find(key);
+            return it != lookup.end() ? (long long)it->second : -1;
+        }
+        for (size_t i = keys.size(); i > 0; --i) {
+            if (keys[i - 1] == key)
+                return i - 1;
+        }
+        return -1;
+    }
+
+    SnapshotValue* SnapshotValue::get(std::string_view key) {
+        long long idx = indexOf(key);
+        return idx >= 0 ? elements[idx].get() : nullptr;
+    }
+
+    SnapshotValue* SnapshotValue::get(long long idx) {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return nullptr;
+        if (idx < 0)
+            idx += elements.size();
+        if (idx < 0 || idx >= (long long)elements.size())
+            return nullptr;
+        return elements[idx].get();
+    }
+
+    long long SnapshotValue::size() {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return -1;
+        return elements.size();
+    }
+
+    bool SnapshotValue::getTruthy() const {
+        return !(
+            (type == LIQUID_VARIABLE_TYPE_BOOL && !b) ||
+            (type == LIQUID_VARIABLE_TYPE_INT && !i) ||
+            (type == LIQUID_VARIABLE_TYPE_FLOAT && !f) ||
+            (type == LIQUID_VARIABLE_TYPE_OTHER && !p) ||
+            (type == LIQUID_VARIABLE_TYPE_NIL)
+        );
+    }
+
+    // Copies are made while rendering, and can outlive the snapshot, so they're filled in from the host as they're copied.
+    unique_ptr<SnapshotValue> SnapshotValue::clone() {
+        expand();
+        auto value = make_unique<SnapshotValue>();
+        value->type = type;
+        value->created = true;
+        value->i = i;
+        value->s = s;
+        // Kept, so what's handed to the host's callbacks can be what it was copied from; nothing's filled in from it again.
+        value->host = host;
+        value->elements.reserve(elements.size());
+        for (auto& element : elements) {
+            value->elements.push_back(element->clone());
+            value->elements.back()->created = false;
+        }
+        value->keys = keys;
+        if (lookup.size()) {
+            for (size_t i = 0; i < value->keys.size(); ++i)
+                value->lookup[value->keys[i]] = i;
+        }
+        return value;
+    }
+
+    bool SnapshotValue::iterate(bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+        expand();
+        if (type != LIQUID_VARIABLE_TYPE_ARRAY)
+            return false;
+        if (limit < 0)
+            limit = (int)elements.size() + limit + 1;
+        if (start < 0)
+            start = 0;
+        int endIndex = std::min(start + limit - 1, (int)elements.size() - 1);
+        if (reverse) {
+            for (int i = endIndex; i >= start; --i) {
+                if (!callback(elements[i].get(), data))
+                    break;
+            }
+        } else {
+            for (int i = start; i <= endIndex; ++i) {
+                if (!callback(elements[i].get(), data))
+                    break;
+            }
+        }
+        return true;
+    }
+
+    bool SnapshotValue::operator < (const SnapshotValue& value) const {
+        if (value.type != type)
+            return false;
+        switch (type) {
+            case LIQUID_VARIABLE_TYPE_INT:
+                return i < value.i;
+            case LIQUID_VARIABLE_TYPE_FLOAT:
+                return f < value.f;
+            case LIQUID_VARIABLE_TYPE_STRING:
+                return s < value.s;
+            case LIQUID_VARIABLE_TYPE_BOOL:
+                return b < value.b;
+            default:
+                return p < value.p;
+        }
+    }
+
+    Snapshot::~Snapshot() {
+        root.reset(LIQUID_VARIABLE_TYPE_NIL);
+        if (releaseFunction) {
+            for (void* host : hosts)
+                releaseFunction(host, data);
+        }
+    }
+}
@@ -0,0 +1,259 @@
+#ifndef LIQUIDSNAPSHOTVARIABLE_H
+#define LIQUIDSNAPSHOTVARIABLE_H
+
+#include "common.h"
+
+#include <deque>
+
+namespace Liquid {
+
+    struct Snapshot;
+
+    // A native copy of a value from a host language's store, like a perl hash, or a ruby array, or a value made while rendering one. Containers
+    // copied from the host are only filled in the first time something looks inside them, so that only what a render reads is ever copied.
+    struct SnapshotValue {
+        LiquidVariableType type = LIQUID_VARIABLE_TYPE_NIL;
+        // Freed by the resolver's freeVariable; made by it, or by a clone, and not yet put in a container.
+        bool created = false;
+        // Containers that have yet to be filled in from their host value.
+        bool pending = false;
+        union {
+            long long i;
+            double f;
+            bool b;
+            void* p;
+        };
+        string s;
+        // Array elements, or dictionary values, in the order they were added; along with the keys, for dictionaries, in the same order.
+        vector<unique_ptr<SnapshotValue>> elements;
+        // A deque, so that the lookup's views of the keys stay where they are as more are added.
+        std::deque<string> keys;
+        // Only for larger dictionaries; smaller ones are searched in order.
+        std::unordered_map<std::string_view, size_t> lookup;
+        // What the container was copied from, if it was.
+        void* host = nullptr;
+        // What the value's part of; null for values made while rendering.
+        Snapshot* snapshot = nullptr;
+
+        static constexpr size_t LOOKUP_THRESHOLD = 8;
+
+        SnapshotValue() : i(0) { }
+        SnapshotValue(const SnapshotValue&) = delete;
+
+        // Each of these throws away whatever the value was before. Containers with a host are left to be filled in from it, by the snapshot's
+        // expand function; those without are empty.
+        void setNil() { reset(LIQUID_VARIABLE_TYPE_NIL); }
+        void setBool(bool value) { reset(LIQUID_VARIABLE_TYPE_BOOL); b = value; }
+        void setInteger(long long value) { reset(LIQUID_VARIABLE_TYPE_INT); i = value; }
+        void setFloat(double value) { reset(LIQUID_VARIABLE_TYPE_FLOAT); f = value; }
+        void setString(std::string_view value) { reset(LIQUID_VARIABLE_TYPE_STRING); s = value; }
+        void setPointer(void* value) { reset(LIQUID_VARIABLE_TYPE_OTHER); p = value; }
+        void setDictionary(void* host) { setContainer(LIQUID_VARIABLE_TYPE_DICTIONARY, host); }
+        void setArray(void* host) { setContainer(LIQUID_VARIABLE_TYPE_ARRAY, host); }
+        void reset(LiquidVariableType type);
+        void setContainer(LiquidVariableType type, void* host);
+
+        // Fills in the container from its host, if it hasn't been already.
+        SnapshotValue& expand();
+        // Expands this, and everything under it.
+        void expandAll();
+
+        // Both of these expand the container first. Adding a key that's already there gives back what was there, as a nil.
+        SnapshotValue* add(std::string_view key);
+        SnapshotValue* add();
+        // Takes the value, which is no longer created.
+        SnapshotValue* set(std::string_view key, unique_ptr<SnapshotValue> value);
+        SnapshotValue* set(long long idx, unique_ptr<SnapshotValue> value);
+
+        // Where the key is in a dictionary, or -1; the last of them, if it was added more than once.
+        long long indexOf(std::string_view key);
+        SnapshotValue* get(std::string_view key);
+        SnapshotValue* get(long long idx);
+        long long size();
+        bool getTruthy() const;
+
+        unique_ptr<SnapshotValue> clone();
+        bool iterate(bool (*callback)(void* variable, void* data), void* data, int start = 0, int limit = -1, bool reverse = false);
+        bool operator < (const SnapshotValue& value) const;
+    };
+
+    // Owns the root of a snapshot, and everything that's added under it, along with the functions that fill in containers from the host.
+    // Everything is read on the thread it's rendered on; containers can be filled in as they're read, which calls back into the host.
+    struct Snapshot {
+        LiquidSnapshotExpandFunction expandFunction;
+        LiquidSnapshotReleaseFunction releaseFunction;
+        void* data;
+        SnapshotValue root;
+        // Every host value given to a container, to be passed to the release function.
+        vector<void*> hosts;
+
+        Snapshot(LiquidSnapshotExpandFunction expandFunction, LiquidSnapshotReleaseFunction releaseFunction, void* data) : expandFunction(expandFunction), releaseFunction(releaseFunction), data(data) {
+            root.snapshot = this;
+        }
+        Snapshot(const Snapshot&) = delete;
+        ~Snapshot();
+    };
+
+    struct SnapshotVariableResolver : LiquidVariableResolver {
+        static SnapshotValue* create(LiquidVariableType type) {
+            SnapshotValue* created = new SnapshotValue();
+            created->type = type;
+            created->created = true;
+            return created;
+        }
+        static SnapshotValue& read(void* variable) { return static_cast<SnapshotValue*>(variable)->expand(); }
+        // Like CPPVariable, numbers and booleans read as strings too.
+        static bool stringify(const SnapshotValue& value, std::string& target) {
+            switch (value.type) {
+                case LIQUID_VARIABLE_TYPE_STRING:
+                    target = value.s;
+                    return true;
+                case LIQUID_VARIABLE_TYPE_FLOAT:
+                    target = std::to_string(value.f);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_INT:
+                    target = std::to_string(value.i);
+                    return true;
+                case LIQUID_VARIABLE_TYPE_BOOL:
+                    target = value.b ? "true" : "false";
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        SnapshotVariableResolver() {
+            getType = +[](LiquidRenderer renderer, void* variable) { return static_cast<SnapshotValue*>(variable)->type; };
+            getBool = +[](LiquidRenderer renderer, void* variable, bool* target) {
+                const SnapshotValue& value = *static_cast<SnapshotValue*>(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_BOOL)
+                    return false;
+                *target = value.b;
+                return true;
+            };
+            getTruthy = +[](LiquidRenderer renderer, void* variable) { return static_cast<SnapshotValue*>(variable)->getTruthy(); };
+            getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+                std::string str;
+                if (!stringify(*static_cast<SnapshotValue*>(variable), str))
+                    return false;
+                memcpy(target, str.data(), str.size());
+                target[str.size()] = 0;
+                return true;
+            };
+            getStringLength = +[](LiquidRenderer renderer, void* variable) {
+                const SnapshotValue& value = *static_cast<SnapshotValue*>(variable);
+                if (value.type == LIQUID_VARIABLE_TYPE_STRING)
+                    return (long long)value.s.size();
+                std::string str;
+                if (!stringify(value, str))
+                    return -1LL;
+                return (long long)str.size();
+            };
+            getStringView = +[](LiquidRenderer renderer, void* variable, const char** view, size_t* length) {
+                const SnapshotValue& value = *static_cast<SnapshotValue*>(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_STRING)
+                    return false;
+                *view = value.s.data();
+                *length = value.s.size();
+                return true;
+            };
+            getInteger = +[](LiquidRenderer renderer, void* variable, long long* target) {
+                const SnapshotValue& value = *static_cast<SnapshotValue*>(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_INT)
+                    return false;
+                *target = value.i;
+                return true;
+            };
+            getFloat = +[](LiquidRenderer renderer, void* variable, double* target) {
+                const SnapshotValue& value = *static_cast<SnapshotValue*>(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_FLOAT)
+                    return false;
+                *target = value.f;
+                return true;
+            };
+            getDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void** target) {
+                SnapshotValue* value = read(variable).get(std::string_view(key));
+                *target = value;
+                return value != nullptr;
+            };
+            getDictionaryVariableHashed = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target) {
+                SnapshotValue* value = read(variable).get(std::string_view(key, length));
+                *target = value;
+                return value != nullptr;
+            };
+            // Keys stay at the index they were added at, so the number of keys is the shape, and the index is the slot.
+            getDictionaryVariableCached = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, LiquidInlineCache* cache, void** target) {
+                SnapshotValue& value = read(variable);
+                if (value.type != LIQUID_VARIABLE_TYPE_DICTIONARY)
+                    return LIQUID_INLINE_CACHE_NOT_FOUND;
+                std::string_view name(key, length);
+                if (cache->shape == value.keys.size() && cache->slot < value.keys.size() && value.keys[cache->slot] == name) {
+                    *target = value.elements[cache->slot].get();
+                    return LIQUID_INLINE_CACHE_HIT;
+                }
+                long long slot = value.indexOf(name);
+                if (slot < 0)
+                    return LIQUID_INLINE_CACHE_NOT_FOUND;
+                cache->shape = value.keys.size();
+                cache->slot = slot;
+                *target = value.elements[slot].get();
+                return LIQUID_INLINE_CACHE_MISS;
+            };
+            getArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void** target) {
+                SnapshotValue* value = read(variable).get(idx);
+                *target = value;
+                return value != nullptr;
+            };
+            iterate = +[](LiquidRenderer renderer, void* variable, bool (*callback)(void* variable, void* data), void* data, int start, int limit, bool reverse) {
+                return read(variable).iterate(callback, data, start, limit, reverse);
+            };
+            getArraySize = +[](LiquidRenderer renderer, void* variable) { return read(variable).size(); };
+            // Setting a dictionary takes the value, and setting an array copies it, as with CPPVariable.
+            setDictionaryVariable = +[](LiquidRenderer renderer, void* variable, const char* key, void* target) {
+                SnapshotValue* value = static_cast<SnapshotValue*>(target);
+                return (void*)static_cast<SnapshotValue*>(variable)->set(std::string_view(key), value->created ? unique_ptr<SnapshotValue>(value) : value->clone());
+            };
+            setArrayVariable = +[](LiquidRenderer renderer, void* variable, long long idx, void* target) {
+                return (void*)static_cast<SnapshotValue*>(variable)->set(idx, static_cast<SnapshotValue*>(target)->clone());
+            };
+            createHash = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_DICTIONARY); };
+            createArray = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_ARRAY); };
+            createFloat = +[](LiquidRenderer renderer, double value) {
+                SnapshotValue* created = create(LIQUID_VARIABLE_TYPE_FLOAT);
+                created->f = value;
+                return (void*)created;
+            };
+            createBool = +[](LiquidRenderer renderer, bool value) {
+                SnapshotValue* created = create(LIQUID_VARIABLE_TYPE_BOOL);
+                created->b = value;
+                return (void*)created;
+            };
+            createInteger = +[](LiquidRenderer renderer, long long value) {
+                SnapshotValue* created = create(LIQUID_VARIABLE_TYPE_INT);
+                created->i = value;
+                return (void*)created;
+            };
+            createString = +[](LiquidRenderer renderer, const char* value) {
+                SnapshotValue* created = create(LIQUID_VARIABLE_TYPE_STRING);
+                created->s = value;
+                return (void*)created;
+            };
+            createPointer = +[](LiquidRenderer renderer, void* value) {
+                SnapshotValue* created = create(LIQUID_VARIABLE_TYPE_OTHER);
+                created->p = value;
+                return (void*)created;
+            };
+            createNil = +[](LiquidRenderer renderer) { return (void*)create(LIQUID_VARIABLE_TYPE_NIL); };
+            createClone = +[](LiquidRenderer renderer, void* variable) { return (void*)static_cast<SnapshotValue*>(variable)->clone().release(); };
+            freeVariable = +[](LiquidRenderer renderer, void* variable) {
+                if (static_cast<SnapshotValue*>(variable)->created)
+                    delete static_cast<SnapshotValue*>(variable);
+            };
+            compare = +[](void* a, void* b) { return *static_cast<SnapshotValue*>(a) < *static_cast<SnapshotValue*>(b) ? -1 : 0; };
+            // Reading can call back into the host.
+            threadSafeReads = false;
+        }
+    };
+}
+
+#endif
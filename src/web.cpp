@@ -8,65 +8,144 @@
 #include <openssl/hmac.h>
 #include <cmath>
 
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
 namespace Liquid {
 
+    // The escaping filters only ever replace a handful of bytes, so they look for those 16 bytes at a time where the processor lets them;
+    // each match in a block comes back as a set bit in a mask, one every maskStride bits.
+    #if defined(__SSE2__)
+        typedef __m128i Block;
+        static constexpr int maskStride = 1;
+        static constexpr uint64_t fullMask = 0xFFFF;
+        static inline Block loadBlock(const char* str) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(str)); }
+        static inline Block matchByte(Block block, char c) { return _mm_cmpeq_epi8(block, _mm_set1_epi8(c)); }
+        // Only for ASCII ranges; the compare is signed, so nothing above 0x7F ever matches.
+        static inline Block matchRange(Block block, char low, char high) { return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), block)); }
+        static inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+        static inline uint64_t maskOf(Block matches) { return (unsigned int)_mm_movemask_epi8(matches); }
+    #elif defined(__ARM_NEON)
+        typedef uint8x16_t Block;
+        static constexpr int maskStride = 4;
+        static constexpr uint64_t fullMask = 0x8888888888888888ULL;
+        static inline Block loadBlock(const char* str) { return vld1q_u8(reinterpret_cast<const uint8_t*>(str)); }
+        static inline Block matchByte(Block block, char c) { return vceqq_u8(block, vdupq_n_u8((uint8_t)c)); }
+        static inline Block matchRange(Block block, char low, char high) { return vandq_u8(vcgeq_u8(block, vdupq_n_u8((uint8_t)low)), vcleq_u8(block, vdupq_n_u8((uint8_t)high))); }
+        static inline Block either(Block a, Block b) { return vorrq_u8(a, b); }
+        // No movemask here; narrowing leaves a nibble for each byte, of which we keep one bit.
+        static inline uint64_t maskOf(Block matches) { return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0) & fullMask; }
+    #endif
+
+    // Calls f with the offset of every byte that either the block or byte test picks out, in order.
+    template <class BlockTest, class ByteTest, class F>
+    static void forEachMatch(const char* str, size_t size, BlockTest blockTest, ByteTest byteTest, F f) {
+        size_t offset = 0;
+        #if defined(__SSE2__) || defined(__ARM_NEON)
+            for (; offset + 16 <= size; offset += 16) {
+                for (uint64_t mask = blockTest(loadBlock(&str[offset])); mask; mask &= mask - 1)
+                    f(offset + __builtin_ctzll(mask) / maskStride);
+            }
+        #endif
+        for (; offset < size; ++offset) {
+            if (byteTest((unsigned char)str[offset]))
+                f(offset);
+        }
+    }
+
+    // Replaces every matching byte with whatever write puts out, which is length bytes long. The size of the result is counted up first,
+    // and the runs between matches are copied over whole.
+    template <class BlockTest, class ByteTest, class Length, class Write>
+    static string replaceBytes(const string& incoming, BlockTest blockTest, ByteTest byteTest, Length length, Write write) {
+        size_t size = incoming.size();
+        bool matched = false;
+        forEachMatch(incoming.data(), incoming.size(), blockTest, byteTest, [&](size_t offset) {
+            size += length((unsigned char)incoming[offset]) - 1;
+            matched = true;
+        });
+        if (!matched)
+            return incoming;
+        string result;
+        result.resize(size);
+        char* target = &result[0];
+        size_t last = 0;
+        forEachMatch(incoming.data(), incoming.size(), blockTest, byteTest, [&](size_t offset) {
+            memcpy(target, &incoming[last], offset - last);
+            target = write(target + (offset - last), (unsigned char)incoming[offset]);
+            last = offset + 1;
+        });
+        memcpy(target, &incoming[last], incoming.size() - last);
+        return result;
+    }
+
     struct EscapeFilterNode : FilterNodeType {
-        static string htmlEscape(const string& incoming) {
-            string result;
-            result.reserve(int(incoming.size()*1.10));
-            for (size_t i = 0; i < incoming.size(); ++i) {
-                char c = incoming[i];
-                switch (c) {
-                    case '\'':
-                        result += "&apos;";
-                    break;
-                    case '"':
-                        result += "&quot;";
-                    break;
-                    case '<':
-                        result += "&lt;";
-                    break;
-                    case '>':
-                        result += "&gt;";
-                    break;
-                    case '&':
-                        result += "&amp;";
-                    break;
-                    default:
-                        result += c;
-                }
+        static const char* entity(unsigned char c) {
+            switch (c) {
+                case '\'': return "&apos;";
+                case '"': return "&quot;";
+                case '<': return "&lt;";
+                case '>': return "&gt;";
+                default: return "&amp;";
             }
-            return result;
+        }
+
+        static string htmlEscape(const string& incoming) {
+            return replaceBytes(incoming, [](auto block) {
+                #if defined(__SSE2__) || defined(__ARM_NEON)
+                    return maskOf(either(either(either(matchByte(block, '<'), matchByte(block, '>')), either(matchByte(block, '&'), matchByte(block, '"'))), matchByte(block, '\'')));
+                #else
+                    return 0;
+                #endif
+            }, [](unsigned char c) {
+                return c == '<' || c == '>' || c == '&' || c == '"' || c == '\'';
+            }, [](unsigned char c) {
+                return strlen(entity(c));
+            }, [](char* target, unsigned char c) {
+                const char* replacement = entity(c);
+                size_t length = strlen(replacement);
+                memcpy(target, replacement, length);
+                return target + length;
+            });
         }
 
         EscapeFilterNode() : FilterNodeType("escape", 0, 0) { }
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            return Variant(htmlEscape(renderer.retrieveRenderedNode(*node.children.front().get(), store).getString()));
+            return Variant(htmlEscape(getOperand(renderer, node, store).getString()));
         }
     };
 
     static const char hexDigits[] = "0123456789abcdef";
 
     struct URLEncodeFilterNode : FilterNodeType {
+        static bool isUnreserved(unsigned char c) {
+            return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z');
+        }
+
         static string paramEncode(const string& incoming) {
-            string result;
-            result.reserve(int(incoming.size()*1.10));
-            for (size_t i = 0; i < incoming.size(); ++i) {
-                char c = incoming[i];
-                if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z'))
-                    result += c;
-                else {
-                    result += '%';
-                    result += hexDigits[c >> 4];
-                    result += hexDigits[c & 0xF];
-                }
-            }
-            return result;
+            return replaceBytes(incoming, [](auto block) {
+                #if defined(__SSE2__) || defined(__ARM_NEON)
+                    return maskOf(either(either(matchRange(block, 'a', 'z'), matchRange(block, 'A', 'Z')), matchRange(block, '0', '9'))) ^ fullMask;
+                #else
+                    return 0;
+                #endif
+            }, [](unsigned char c) {
+                return !isUnreserved(c);
+            }, [](unsigned char c) {
+                return 3;
+            }, [](char* target, unsigned char c) {
+                target[0] = '%';
+                target[1] = hexDigits[c >> 4];
+                target[2] = hexDigits[c & 0xF];
+                return target + 3;
+            });
         }
 
         URLEncodeFilterNode() : FilterNodeType("url_encode", 0, 0) { }
         Node render(Renderer& renderer, const Node& node, Variable store) const override {
-            return Variant(paramEncode(renderer.retrieveRenderedNode(*node.children.front().get(), store).getString()));
+            return Variant(paramEncode(getOperand(renderer, node, store).getString()));
         }
     };
 
@@ -513,16 +592,23 @@ namespace Liquid {
             auto operand = getOperand(renderer, node, store);
             if (operand.type)
                 return Node();
-            string accumulator;
-            string str = operand.getString();
-            accumulator.reserve(str.size());
-            for (size_t i = 0; i < str.size(); ++i) {
-                if (str[i] == '\n')
-                    accumulator += "<br/>";
-                else if (str[i] != '\r')
-                    accumulator += str[i];
-            }
-            return Variant(accumulator);
+            // Carriage returns are dropped.
+            return Variant(replaceBytes(operand.getString(), [](auto block) {
+                #if defined(__SSE2__) || defined(__ARM_NEON)
+                    return maskOf(either(matchByte(block, '\n'), matchByte(block, '\r')));
+                #else
+                    return 0;
+                #endif
+            }, [](unsigned char c) {
+                return c == '\n' || c == '\r';
+            }, [](unsigned char c) {
+                return c == '\n' ? 5 : 0;
+            }, [](char* target, unsigned char c) {
+                if (c != '\n')
+                    return target;
+                memcpy(target, "<br/>", 5);
+                return target + 5;
+            }));
         }
     };
 
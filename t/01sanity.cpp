@@ -6,6 +6,8 @@
 #include "../src/optimizer.h"
 #include "../src/dialect.h"
 #include "../src/cppvariable.h"
+#include "../src/jsonvariable.h"
+#include "../src/snapshotvariable.h"
 
 #include <gtest/gtest.h>
 #include <sys/time.h>
@@ -48,11 +50,28 @@ Optimizer& getOptimizer() {
     return optimizer;
 }
 
+static double getTime() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+double rendererTime = 0, interpreterTime = 0;
+
+// Every template is run through both the renderer and the interpreter, and they have to agree; the interpreter gets its own copy of
+// the variables, as the template can assign to them.
 string renderTemplate(const Node& ast, Variable variable) {
-    // Whether these tests run on the interpreter or on the renderer.
-    return getRenderer().render(ast, variable);
+    CPPVariable copy(*static_cast<CPPVariable*>(variable.pointer));
     //fprintf(stderr, "DISASSEMBLY: \n%s\n", getCompiler().disassemble(getCompiler().compile(ast)).data());
-    //return getInterpreter().renderTemplate(getCompiler().compile(ast), variable);
+    Program program = getCompiler().compile(ast);
+    double start = getTime();
+    string interpreted = getInterpreter().renderTemplate(program, copy);
+    double middle = getTime();
+    string rendered = getRenderer().render(ast, variable);
+    double end = getTime();
+    interpreterTime += middle - start;
+    rendererTime += end - middle;
+    EXPECT_EQ(interpreted, rendered);
+    return rendered;
 }
 
 TEST(sanity, literal) {
@@ -396,10 +415,454 @@ TEST(sanity, forloop) {
     str = renderTemplate(ast, hash);
     ASSERT_EQ(str, "fdsfdf");
 
+    ast = getParser().parse("{% for i in list %}{% for j in list reversed offset: 1 %}{% if j == 5 %}{% break %}{% endif %}{{ i }}{{ j }},{% endfor %}{% endfor %}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "120,110,520,510,1020,1010,2020,2010,");
+
+    ast = getParser().parse("{% assign total = 0 %}{% for i in (1..10000) %}{% assign total = total | plus: i %}{% endfor %}{{ total }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "50005000");
+
+
+
+}
+
+TEST(sanity, loopproperties) {
+    CPPVariable array = { 1, 5, 10 };
+    CPPVariable hash = { };
+    hash["list"] = std::move(array);
+    Node ast;
+    std::string str;
+
+    ast = getParser().parse("{% for i in list %}{% if forloop.last %}[{{ i }}]{% endif %}{% endfor %}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "[10]");
 
+    // Outside of a loop, they're just filters.
+    ast = getParser().parse("{{ list.last }}{{ list.first }}{{ list.size }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "1013");
 
+    ast = getParser().parse("{% for i in list limit: 5 %}{{ i }}{% endfor %}|{% for i in list limit: 5 reversed %}{{ i }}{% endfor %}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "1510|1051");
 }
 
+TEST(sanity, counters) {
+    CPPVariable hash = { };
+    hash["a"] = 1;
+    Node ast;
+    std::string str;
+
+    ast = getParser().parse("{% increment a %}{% increment a %}{{ a }}{% decrement a %}{{ a }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "32");
+}
+
+TEST(sanity, peephole) {
+    CPPVariable hash, order, customer;
+    customer["name"] = "Bob";
+    order["customer"] = std::move(customer);
+    order["status"] = "paid";
+    hash["order"] = std::move(order);
+    hash["list"] = CPPVariable({ 1, 2, 3 });
+    Node ast = getParser().parse("Hi {{ order.customer.name }}, {% case order.status %}{% when 'paid' %}thanks{% when 'open' %}pay up{% endcase %}{% for i in list %}{% cycle 'a', 'b' %}{% break %}{{ i }}{% endfor %}");
+
+    auto countInstructions = [](const std::string& disassembly) {
+        size_t count = 0;
+        for (size_t i = disassembly.find(" OP_"); i != std::string::npos; i = disassembly.find(" OP_", i + 1))
+            ++count;
+        return count;
+    };
+    Compiler compiler(getContext());
+    compiler.peepholeOptimization = false;
+    Program unoptimized = compiler.compile(ast);
+    std::string before = compiler.disassemble(unoptimized);
+    compiler.peepholeOptimization = true;
+    Program optimized = compiler.compile(ast);
+    std::string after = compiler.disassemble(optimized);
+
+    ASSERT_LT(countInstructions(after), countInstructions(before));
+    ASSERT_NE(after.find("OP_RESOLVEPATH"), std::string::npos);
+    ASSERT_NE(after.find("OP_EQLJMPFALSE"), std::string::npos);
+
+    CPPVariable copy(hash);
+    ASSERT_EQ(getInterpreter().renderTemplate(optimized, hash), "Hi Bob, thanksa");
+    ASSERT_EQ(getInterpreter().renderTemplate(unoptimized, copy), "Hi Bob, thanksa");
+
+    // Strings that are joined into others don't stay behind in the data segment.
+    ast = getParser().parse("first{{ 'second' }}third");
+    optimized = compiler.compile(ast);
+    after = compiler.disassemble(optimized);
+    ASSERT_NE(after.find("\"firstsecondthird\""), std::string::npos);
+    ASSERT_EQ(after.find("\"first\""), std::string::npos);
+    ASSERT_EQ(after.find("\"third\""), std::string::npos);
+    ASSERT_EQ(getInterpreter().renderTemplate(optimized, hash), "firstsecondthird");
+
+    // Long runs of branches.
+    std::string source;
+    for (int i = 0; i < 1000; ++i)
+        source += "{% if order.status == 'paid' %}" + std::to_string(i % 10) + "{% endif %}";
+    optimized = compiler.compile(getParser().parse(source));
+    ASSERT_EQ(getInterpreter().renderTemplate(optimized, hash).size(), 1000);
+}
+
+static int hashedLookups = 0, mismatchedHashes = 0;
+TEST(sanity, hashedKeys) {
+    CPPVariable hash, product, inner;
+    product["price"] = 3;
+    inner["b"] = "x";
+    hash["a"] = inner;
+    hash["list"] = CPPVariable({ product, product });
+
+    CPPVariableResolver resolver;
+    resolver.getDictionaryVariableHashed = +[](LiquidRenderer renderer, void* variable, const char* key, size_t length, size_t hash, void** target) {
+        ++hashedLookups;
+        if (hash != liquidHashKey(key, length) || strlen(key) != length)
+            ++mismatchedHashes;
+        return static_cast<CPPVariable*>(variable)->getDictionaryVariable((const CPPVariable**)target, std::string(key, length));
+    };
+    resolver.getDictionaryVariableCached = nullptr;
+    Renderer renderer(getContext(), resolver);
+    Interpreter interpreter(getContext(), resolver);
+
+    auto ast = getParser().parse("{{ a.b }}{{ a['b'] }}{% for i in list %}{{ i.price }}{% endfor %}");
+    ASSERT_EQ(renderer.render(ast, hash), "xx33");
+    ASSERT_GT(hashedLookups, 0);
+    hashedLookups = 0;
+    Program program = getCompiler().compile(ast);
+    ASSERT_NE(getCompiler().disassemble(program).find("; a.b"), std::string::npos);
+    ASSERT_EQ(interpreter.renderTemplate(program, hash), "xx33");
+    ASSERT_GT(hashedLookups, 0);
+    ASSERT_EQ(mismatchedHashes, 0);
+}
+
+TEST(sanity, savedPrograms) {
+    CPPVariable hash;
+    hash["list"] = CPPVariable({ 3, 1, 2 });
+    hash["name"] = "bob";
+    auto ast = getParser().parse("{% for i in list reversed %}{{ i | plus: 1 }}{% if i > 1 %}!{% endif %}{% endfor %} {{ name | upcase | append: '.' }} {{ list | size }}");
+    Program program = getCompiler().compile(ast);
+    std::string path = testing::TempDir() + "liquid-saved-program";
+    program.save(getContext(), path);
+
+    // A context put together separately has the same node types, at different addresses.
+    Context context;
+    StandardDialect::implementPermissive(context);
+    #ifdef LIQUID_INCLUDE_WEB_DIALECT
+        WebDialect::implement(context);
+    #endif
+    Interpreter interpreter(context, CPPVariableResolver());
+    Program loaded = Program::load(context, path);
+    ASSERT_TRUE(loaded.code.empty());
+    ASSERT_EQ(loaded.symbols.size(), program.symbols.size());
+    ASSERT_EQ(interpreter.renderTemplate(loaded, hash), "3!24! BOB. 3");
+
+    // Contexts that don't know about what the program calls can't load it.
+    Context empty;
+    ASSERT_THROW(Program::load(empty, path), Liquid::Exception);
+
+    std::vector<unsigned char> bytes;
+    FILE* file = fopen(path.c_str(), "rb");
+    ASSERT_TRUE(file);
+    int c;
+    while ((c = fgetc(file)) != EOF)
+        bytes.push_back(c);
+    fclose(file);
+    auto write = [&path](const std::vector<unsigned char>& contents) {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(contents.data(), 1, contents.size(), file);
+        fclose(file);
+    };
+    std::vector<unsigned char> truncated(bytes.begin(), bytes.end() - 12);
+    write(truncated);
+    ASSERT_THROW(Program::load(context, path), Liquid::Exception);
+    std::vector<unsigned char> otherVersion = bytes;
+    otherVersion[8]++;
+    write(otherVersion);
+    ASSERT_THROW(Program::load(context, path), Liquid::Exception);
+    remove(path.c_str());
+    ASSERT_THROW(Program::load(context, path), Liquid::Exception);
+}
+
+TEST(sanity, templateCache) {
+    CPPVariable hash;
+    hash["a"] = 2;
+    TemplateCache cache(2);
+    auto first = cache.get(getParser(), getCompiler(), "{{ a + 1 }}", 11);
+    ASSERT_EQ(cache.get(getParser(), getCompiler(), "{{ a + 1 }}", 11), first);
+    // The same source from another file is a different template.
+    ASSERT_NE(cache.get(getParser(), getCompiler(), "{{ a + 1 }}", 11, "other.liquid"), first);
+    cache.get(getParser(), getCompiler(), "{{ a + 2 }}", 11);
+    auto statistics = cache.getStatistics();
+    ASSERT_EQ(statistics.hits, 1);
+    ASSERT_EQ(statistics.misses, 3);
+    ASSERT_EQ(statistics.evictions, 1);
+    ASSERT_EQ(statistics.size, 2);
+
+    // Evicted entries stay valid for whoever has them.
+    ASSERT_EQ(getInterpreter().renderTemplate(first->program, hash), "3");
+    ASSERT_EQ(getRenderer().render(first->tmpl, hash), "3");
+    ASSERT_NE(cache.get(getParser(), getCompiler(), "{{ a + 1 }}", 11), first);
+
+    ASSERT_THROW(cache.get(getParser(), getCompiler(), "{% if a %}", 10), Parser::Exception);
+    ASSERT_EQ(cache.getStatistics().size, 2);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> rendered(0);
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&cache, &rendered]() {
+            Parser parser(getContext());
+            Compiler compiler(getContext());
+            Interpreter interpreter(getContext(), CPPVariableResolver());
+            for (int j = 0; j < 50; ++j) {
+                CPPVariable variables;
+                variables["a"] = j % 3;
+                std::string source = "{{ a + " + std::to_string(j % 3) + " }}";
+                auto entry = cache.get(parser, compiler, source.data(), source.size());
+                if (interpreter.renderTemplate(entry->program, variables) == std::to_string(2 * (j % 3)))
+                    ++rendered;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    ASSERT_EQ(rendered, 200);
+    statistics = cache.getStatistics();
+    ASSERT_EQ(statistics.hits + statistics.misses, 206);
+    ASSERT_LE(statistics.size, 2);
+}
+
+TEST(sanity, inlineCaches) {
+    CPPVariable hash;
+    std::vector<CPPVariable> products;
+    hash["list"] = CPPVariable({});
+    for (int i = 0; i < 100; ++i) {
+        CPPVariable product;
+        product["price"] = i % 10;
+        product["title"] = "a";
+        hash["list"].a.push_back(make_unique<CPPVariable>(product));
+    }
+    std::string expected;
+    for (int i = 0; i < 100; ++i)
+        expected += std::to_string(i % 10) + "a";
+
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    Program program = getCompiler().compile(getParser().parse("{% for i in list %}{{ i.price }}{{ i.title }}{% endfor %}{{ list.missing }}"));
+    ASSERT_EQ(interpreter.renderTemplate(program, hash), expected);
+    auto statistics = liquidRendererGetInlineCacheStatistics(LiquidRenderer { &interpreter });
+    ASSERT_GT(statistics.hits, 150);
+    ASSERT_LT(statistics.misses, 10);
+
+    // Another program has different keys at the same sites; whatever the first one left behind can't get in the way.
+    CPPVariable other;
+    other["title"] = "b";
+    ASSERT_EQ(interpreter.renderTemplate(getCompiler().compile(getParser().parse("{{ title }}")), other), "b");
+
+    // Resolvers that don't opt in still resolve everything, and don't count anything.
+    CPPVariableResolver resolver;
+    resolver.getDictionaryVariableCached = nullptr;
+    Interpreter uncached(getContext(), resolver);
+    ASSERT_EQ(uncached.renderTemplate(program, hash), expected);
+    ASSERT_EQ(liquidRendererGetInlineCacheStatistics(LiquidRenderer { &uncached }).hits, 0);
+}
+
+static int copiedStrings = 0;
+TEST(sanity, borrowedStrings) {
+    CPPVariable hash;
+    std::string description = "The quick brown fox jumps over the lazy dog, and keeps on running for quite a while.";
+    hash["desc"] = description;
+    hash["other"] = description;
+    hash["key"] = "desc";
+    hash["h"]["desc"] = description;
+
+    CPPVariableResolver resolver;
+    resolver.getString = +[](LiquidRenderer renderer, void* variable, char* target) {
+        ++copiedStrings;
+        std::string s;
+        if (!static_cast<CPPVariable*>(variable)->getString(s))
+            return false;
+        memcpy(target, s.data(), s.size());
+        return true;
+    };
+    Renderer renderer(getContext(), resolver);
+    Interpreter interpreter(getContext(), resolver);
+
+    auto ast = getParser().parse("{{ desc }}|{% if desc == other %}same{% endif %}|{% if desc contains 'fox' %}fox{% endif %}|{{ desc | size }}|{% case desc %}{% when other %}when{% endcase %}|{{ h[key] | size }}");
+    std::string expected = description + "|same|fox|84|when|84";
+    ASSERT_EQ(renderer.render(ast, hash), expected);
+    ASSERT_EQ(interpreter.renderTemplate(getCompiler().compile(ast), hash), expected);
+    ASSERT_EQ(copiedStrings, 0);
+
+    // Everything else gets its own copy, and so does the store.
+    ast = getParser().parse("{% assign copy = desc %}{{ copy | upcase | size }}{{ desc | append: '!' | size }}");
+    ASSERT_EQ(renderer.render(ast, hash), "8485");
+    ASSERT_EQ(interpreter.renderTemplate(getCompiler().compile(ast), hash), "8485");
+    ASSERT_EQ(hash["copy"].s, description);
+
+    // Without getStringView, it's copies all the way.
+    resolver.getStringView = nullptr;
+    Renderer copying(getContext(), resolver);
+    ASSERT_EQ(copying.render(getParser().parse("{{ desc }}"), hash), description);
+    ASSERT_GT(copiedStrings, 0);
+}
+
+TEST(sanity, arrayFilters) {
+    CPPVariable hash;
+    hash["list"] = CPPVariable({ 3, 1, 2, 1 });
+    Node ast;
+
+    ast = getParser().parse("{% assign a = '3,1,2,1' | split: ',' %}{{ a | reverse | join: ',' }}|{{ a | sort | reverse | join: ',' }}|{{ a | concat: list | join: ',' }}|{{ a | uniq | join: ',' }}|{{ a | join: ',' }}");
+    ASSERT_EQ(renderTemplate(ast, hash), "1,2,1,3|3,2,1,1|3,1,2,1,3,1,2,1|3,1,2|3,1,2,1");
+
+    // Arrays from the resolver are sorted by value, not by where their items are.
+    ast = getParser().parse("{{ list | sort | join: ',' }}|{{ list | reverse | join: ',' }}|{{ list | uniq | join: ',' }}");
+    ASSERT_EQ(renderTemplate(ast, hash), "1,1,2,3|1,2,1,3|3,1,2");
+
+    // Looping over what a filter returns still looks into each element.
+    CPPVariable products;
+    for (int i = 0; i < 4; ++i) {
+        products[(size_t)i]["title"] = "p" + std::to_string(i);
+        products[(size_t)i]["available"] = i % 2 == 0;
+    }
+    hash["products"] = std::move(products);
+    ast = getParser().parse("{% for p in products | where: 'available' %}{{ p.title }}{% endfor %}|{% for p in products | reverse %}{{ p.title }}{{ p.missing }}{% endfor %}");
+    ASSERT_EQ(renderTemplate(ast, hash), "p0p2|p3p2p1p0");
+
+    // Assigning an element to the array that holds it.
+    Variant array { std::vector<Variant>({ Variant((long long)1), Variant(std::string(100, 'a')) }) };
+    array = array.a[1];
+    ASSERT_EQ(array.type, Variant::Type::STRING);
+    ASSERT_EQ(array.getString(), std::string(100, 'a'));
+
+    Node node(array);
+    Node child(Variant("child"));
+    node = child;
+    ASSERT_EQ(node.variant.getString(), "child");
+    node = getParser().parse("{{ a }}");
+    ASSERT_NE(node.type, nullptr);
+    node = child;
+    ASSERT_EQ(node.type, nullptr);
+    ASSERT_EQ(node.variant.getString(), "child");
+}
+
+TEST(sanity, variants) {
+    ASSERT_LE(sizeof(Variant), 24);
+
+    // Short strings are kept inline; long ones are shared between copies.
+    Variant shortString("short");
+    Variant copy = shortString;
+    ASSERT_NE(copy.s.data(), shortString.s.data());
+    ASSERT_EQ(copy.getString(), "short");
+    Variant longString(std::string(100, 'a'));
+    copy = longString;
+    ASSERT_EQ(copy.s.data(), longString.s.data());
+    ASSERT_EQ(copy.getString(), std::string(100, 'a'));
+
+    // Arrays are shared until one of them's written to.
+    Variant array { std::vector<Variant>({ Variant((long long)1), longString }) };
+    Variant other = array;
+    ASSERT_EQ(&other.a[0], &array.a[0]);
+    other.a.push_back(shortString);
+    ASSERT_EQ(array.a.size(), 2);
+    ASSERT_EQ(other.a.size(), 3);
+    ASSERT_EQ(other.a[1].s.data(), longString.s.data());
+}
+
+TEST(sanity, streaming) {
+    CPPVariable array = { 1, 5, 10, 20 };
+    CPPVariable hash = { };
+    hash["list"] = std::move(array);
+    Renderer renderer(getContext(), CPPVariableResolver());
+    Node ast;
+    std::string str;
+    std::vector<std::string> chunks;
+    auto callback = +[](const char* chunk, size_t size, void* data) {
+        static_cast<std::vector<std::string>*>(data)->push_back(std::string(chunk, size));
+    };
+
+    renderer.outputChunkSize = 8;
+    ast = getParser().parse("header {% for i in list %}{% capture a %}<{{ i }}>{% endcapture %}{{ a }}{{ a }} {% raw %}{{ raw }}{% endraw %}{% endfor %} footer");
+    ASSERT_EQ(renderer.render(ast, hash, callback, &chunks), LIQUID_RENDERER_ERROR_TYPE_NONE);
+    str.clear();
+    for (auto& chunk : chunks)
+        str.append(chunk);
+    ASSERT_EQ(str, "header <1><1> {{ raw }}<5><5> {{ raw }}<10><10> {{ raw }}<20><20> {{ raw }} footer");
+    ASSERT_GT(chunks.size(), 1);
+
+    renderer.outputChunkSize = 0;
+    chunks.clear();
+    ASSERT_EQ(renderer.render(ast, hash, callback, &chunks), LIQUID_RENDERER_ERROR_TYPE_NONE);
+    ASSERT_EQ(chunks.size(), 1);
+    ASSERT_EQ(chunks[0], str);
+}
+
+TEST(sanity, arena) {
+    CPPVariable array = { 1, 5, 10, 20 };
+    CPPVariable hash = { };
+    hash["list"] = std::move(array);
+    Parser parser(getContext());
+    Node copy;
+    std::string str;
+
+    {
+        Node ast = parser.parse("{% for i in list %}{% if i > 1 %}{{ i | plus: 1 }}{% else %}a{% endif %}{% endfor %}");
+        copy = ast;
+        str = renderTemplate(ast, hash);
+        ASSERT_EQ(str, "a61121");
+        // Nodes survive the parser moving on to other templates.
+        parser.parse("{{ 1 }}");
+        ASSERT_EQ(renderTemplate(ast, hash), str);
+    }
+    ASSERT_EQ(renderTemplate(copy, hash), str);
+
+    parser.arenaChunkSize = 0;
+    Node ast = parser.parse("{% for i in list %}{% if i > 1 %}{{ i | plus: 1 }}{% else %}a{% endif %}{% endfor %}");
+    ASSERT_EQ(renderTemplate(ast, hash), str);
+}
+
+
+TEST(sanity, rendererPool) {
+    CPPVariable array = { 1, 5, 10, 20 };
+    CPPVariable hash = { };
+    hash["list"] = std::move(array);
+    hash["a"] = 1;
+    Node ast = getParser().parse("{% for i in list %}{% if i > 1 %}{{ i | plus: 1 }}{% else %}a{% endif %}{% endfor %}");
+    Program program = Compiler(getContext()).compile(getParser().parse("b {{ a + 1 }} c"));
+    RendererPool pool(getContext());
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches(0);
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&]() {
+            Interpreter& interpreter = pool.get();
+            ASSERT_EQ(&interpreter, &pool.get());
+            for (int j = 0; j < 200; ++j) {
+                if (interpreter.render(ast, hash) != "a61121" || interpreter.renderTemplate(program, hash) != "b 2 c")
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    ASSERT_EQ(mismatches, 0);
+    // Each thread's interpreter went with it.
+    ASSERT_EQ(pool.size(), 0);
+    pool.get();
+    ASSERT_EQ(pool.size(), 1);
+    pool.release();
+    ASSERT_EQ(pool.size(), 0);
+
+    // Threads can outlive the pools they've used.
+    std::thread([&]() {
+        RendererPool shortLived(getContext());
+        shortLived.get();
+        pool.get();
+        pool.release();
+        pool.get();
+    }).join();
+    ASSERT_EQ(pool.size(), 0);
+}
 
 TEST(sanity, negation) {
     CPPVariable hash, internal;
@@ -755,6 +1218,774 @@ TEST(sanity, optimizer) {
     hash["a"] = nullptr;
 }
 
+TEST(sanity, partialEvaluation) {
+    CPPVariable hash, settings, cart;
+    settings["title"] = "Shop";
+    settings["currency"] = "USD";
+    settings["banner"] = true;
+    settings["links"] = CPPVariable({ "a", "b" });
+    cart["count"] = 3;
+    hash["settings"] = settings;
+    hash["cart"] = cart;
+
+    Optimizer optimizer(getRenderer());
+    optimizer.frozenVariables.insert("settings");
+    Node ast = getParser().parse("{% if settings.banner %}<b>{{ settings.title | upcase }}</b>{% endif %}"
+        "{% case settings.currency %}{% when 'EUR' %}E{% when 'USD' %}D{% else %}?{% endcase %}"
+        "{% for link in settings.links %}{{ link }}{{ forloop.index }}{% endfor %}|"
+        "{{ cart.count }}{% if cart.count > 0 %}!{% endif %}{% for link in settings.links %}{{ cart.count }}{% endfor %}"
+    );
+    optimizer.optimize(ast, hash);
+
+    int branches = 0, loops = 0;
+    ast.walk([&](const Node& node) {
+        if (node.type == getContext().getTagType("if") || node.type == getContext().getTagType("case"))
+            ++branches;
+        if (node.type == getContext().getTagType("for"))
+            ++loops;
+    });
+    ASSERT_EQ(branches, 1);
+    ASSERT_EQ(loops, 1);
+
+    // Everything under settings is baked in; the cart is still read when rendering.
+    settings["title"] = "Other";
+    cart["count"] = 0;
+    hash["settings"] = settings;
+    hash["cart"] = cart;
+    ASSERT_EQ(renderTemplate(ast, hash), "<b>SHOP</b>Da1b2|000");
+    // Bodies left as a bare literal are still output by the interpreter.
+    cart["count"] = 2;
+    hash["cart"] = cart;
+    ASSERT_EQ(renderTemplate(ast, hash), "<b>SHOP</b>Da1b2|2!22");
+
+    // Anything the template writes to isn't frozen.
+    ast = getParser().parse("{% assign settings = cart %}{{ settings.title }}{% for settings in cart %}{% endfor %}");
+    optimizer.optimize(ast, hash);
+    ASSERT_EQ(renderTemplate(ast, hash), "");
+}
+
+TEST(sanity, loopInvariants) {
+    CPPVariable hash, settings, shop, a, b;
+    settings["currency"] = "usd";
+    settings["suffix"] = "!";
+    settings["offset"] = 10;
+    shop["url"] = "http://shop";
+    a["title"] = "a";
+    b["title"] = "b";
+    hash["settings"] = settings;
+    hash["shop"] = shop;
+    hash["products"] = CPPVariable({ a, b, a });
+
+    Node ast = getParser().parse("{% for product in products %}{{ settings.currency | upcase }}{{ product.title | append: settings.suffix }}"
+        "{% if product.title == 'b' %}{{ shop.url | append: '/c' }}{% endif %}{% assign last = product.title %}{{ last | upcase }}"
+        "{{ forloop.index | plus: settings.offset }},{% endfor %}{{ last }}");
+    std::string expected = "USDa!A11,USDb!http://shop/cB12,USDa!A13,a";
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    // Optimized against nothing, so all that changes is what's hoisted.
+    Optimizer optimizer(getRenderer());
+    optimizer.optimize(ast, CPPVariable());
+    const Node* hoist = nullptr;
+    ast.walk([&hoist](const Node& node) {
+        if (node.type == getContext().getHoistNodeType())
+            hoist = &node;
+    });
+    ASSERT_TRUE(hoist);
+    // The currency, the suffix and the offset; not the url, as it's only needed sometimes, and nothing that reads the product, the
+    // forloop, or what's assigned in the loop.
+    ASSERT_EQ(hoist->children.size(), 7);
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+
+    // What's invariant for an inner loop can still change with the outer one.
+    ast = getParser().parse("{% for a in products %}{% for b in products %}{{ a.title | append: settings.suffix | upcase }}{% if forloop.index == 2 %}{% break %}{% endif %}{% endfor %};{% endfor %}");
+    expected = "A!A!;B!B!;A!A!;";
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    optimizer.optimize(ast, CPPVariable());
+    int hoists = 0;
+    ast.walk([&hoists](const Node& node) {
+        if (node.type == getContext().getHoistNodeType())
+            ++hoists;
+    });
+    ASSERT_EQ(hoists, 2);
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+}
+
+TEST(sanity, filterChains) {
+    CPPVariable hash;
+    hash["title"] = "  Hello Big  World\t";
+    hash["sep"] = "-";
+
+    Node ast = getParser().parse("{{ title | strip | downcase | replace: ' ', sep | truncate: 12 }},{{ title | upcase | replace: 'L', 'l' | lstrip | append: '!' }},{{ title | size }}");
+    std::string expected = "hello-big...,HEllO BIG  WORlD\t!,19";
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    std::string source = getParser().unparse(ast);
+    Optimizer optimizer(getRenderer());
+    optimizer.optimize(ast, CPPVariable());
+    std::vector<const Node*> chains;
+    ast.walk([&chains](const Node& node) {
+        if (node.type == getContext().getFilterChainNodeType())
+            chains.push_back(&node);
+    });
+    ASSERT_EQ(chains.size(), 2);
+    ASSERT_EQ(chains[0]->children.size(), 5);
+    ASSERT_EQ(chains[1]->children.size(), 5);
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    ASSERT_EQ(getParser().unparse(ast), source);
+
+    // Nothing that isn't a string filter is pulled in.
+    ast = getParser().parse("{{ title | strip | size | append: 'x' | upcase }}");
+    optimizer.optimize(ast, CPPVariable());
+    chains.clear();
+    ast.walk([&chains](const Node& node) {
+        if (node.type == getContext().getFilterChainNodeType())
+            chains.push_back(&node);
+    });
+    ASSERT_EQ(chains.size(), 1);
+    ASSERT_EQ(chains[0]->children.size(), 3);
+    ASSERT_EQ(renderTemplate(ast, hash), "16X");
+}
+
+TEST(sanity, arrayChains) {
+    CPPVariable hash, a, b, c, d;
+    a["title"] = "Shirt"; a["type"] = "top"; a["available"] = false;
+    b["title"] = "Hat"; b["type"] = "hat"; b["available"] = true;
+    c["title"] = "Vest"; c["type"] = "top"; c["available"] = true;
+    d["title"] = "Sock"; d["type"] = "sock"; d["available"] = true;
+    hash["products"] = CPPVariable({ a, b, c, d });
+
+    Node ast = getParser().parse("{{ products | where: 'available' | map: 'title' | first }},{{ products | where: 'available' | map: 'title' | last }},"
+        "{{ products | where: 'available' | size }},{{ products | where: 'type', 'top' | map: 'title' | join: '+' | upcase }},"
+        "{{ products | map: 'type' | index: 2 }},{{ products | where: 'type', 'none' | first }},{{ products | map: 'title' | sort | first }}");
+    std::string expected = "Hat,Sock,3,SHIRT+VEST,top,,Hat";
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    std::string source = getParser().unparse(ast);
+    Optimizer optimizer(getRenderer());
+    optimizer.optimize(ast, CPPVariable());
+    std::vector<size_t> chains;
+    ast.walk([&chains](const Node& node) {
+        if (node.type == getContext().getArrayChainNodeType())
+            chains.push_back(node.children.size());
+    });
+    // Sort has to see everything before it can say what's first.
+    ASSERT_EQ(chains, std::vector<size_t>({ 4, 4, 3, 4, 3, 3 }));
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+    ASSERT_EQ(getParser().unparse(ast), source);
+}
+
+TEST(sanity, loopSlots) {
+    CPPVariable hash;
+    hash["a"] = "x";
+    hash["list"] = CPPVariable({ 1, 2 });
+
+    Node ast = getParser().parse("{% for a in list %}{% for b in list %}{{ a }}{{ b }}{{ forloop.index }}{% endfor %}{{ forloop.index }}{% endfor %}{{ a }}");
+    std::vector<size_t> slots;
+    ast.walk([&slots](const Node& node) {
+        if (node.type == getContext().getVariableNodeType())
+            slots.push_back(node.slot);
+    });
+    // Neither loop's variable, nor its collection, is inside it; the inner forloop shadows the outer one.
+    ASSERT_EQ(slots, std::vector<size_t>({ 0, 0, 0, 0, 2, 4, 3, 1, 0 }));
+    ASSERT_EQ(renderTemplate(ast, hash), "11112212112222x");
+
+    ast = getParser().parse("{% for a in list %}{% for a in list %}{{ a }}{% endfor %}{{ a }}{% if forloop.first %},{% endif %}{% endfor %}");
+    ASSERT_EQ(renderTemplate(ast, hash), "121,122");
+
+    CPPVariable item;
+    item["image"] = "i.png";
+    hash["items"] = CPPVariable({ item, CPPVariable() });
+    hash["items"][1ul]["title"] = "t";
+    ast = getParser().parse("{% for item in items %}{{ item.image | default: 'none' }},{% endfor %}");
+    ASSERT_EQ(renderTemplate(ast, hash), "i.png,none,");
+}
+
+TEST(sanity, profiling) {
+    CPPVariable hash;
+    hash["list"] = CPPVariable({ "a", "b", "c" });
+    Node ast = getParser().parse("{% for p in list %}{{ p | upcase }}{% endfor %}\n{{ list | size }}");
+
+    auto find = [](const std::vector<Profiler::Entry>& entries, const char* symbol) {
+        for (auto& entry : entries) {
+            if (strcmp(Profiler::getName(entry.type), symbol) == 0)
+                return &entry;
+        }
+        return (const Profiler::Entry*)nullptr;
+    };
+    // Everything in a render is charged to exactly one node.
+    auto check = [](const Profiler& profiler) {
+        unsigned long long exclusiveTime = 0;
+        size_t resolverCalls = 0, allocations = 0;
+        for (auto& entry : profiler.entries) {
+            exclusiveTime += entry.exclusiveTime;
+            resolverCalls += entry.resolverCalls;
+            allocations += entry.allocations;
+        }
+        ASSERT_EQ(exclusiveTime, profiler.entries[0].inclusiveTime);
+        ASSERT_EQ(resolverCalls, profiler.resolverCalls);
+        ASSERT_EQ(allocations, profiler.allocations);
+        ASSERT_GT(profiler.resolverCalls, 0U);
+    };
+
+    Renderer renderer(getContext(), CPPVariableResolver());
+    renderer.profiler = make_unique<Profiler>();
+    ASSERT_EQ(renderer.render(ast, hash), "ABC\n3");
+    const Profiler& profile = *renderer.profiler.get();
+    check(profile);
+    ASSERT_EQ(profile.entries[0].calls, 1U);
+    ASSERT_EQ(profile.entries[0].bytes, 5U);
+    const Profiler::Entry* loop = find(profile.entries, "for");
+    const Profiler::Entry* upcase = find(profile.entries, "upcase");
+    const Profiler::Entry* size = find(profile.entries, "size");
+    ASSERT_TRUE(loop && upcase && size);
+    ASSERT_EQ(loop->calls, 1U);
+    ASSERT_EQ(loop->line, 1U);
+    ASSERT_EQ(upcase->calls, 3U);
+    ASSERT_EQ(upcase->bytes, 3U);
+    ASSERT_EQ(size->line, 2U);
+    ASSERT_GE(loop->inclusiveTime, upcase->inclusiveTime);
+    ASSERT_EQ(find(profile.getSymbols(), "upcase")->calls, 3U);
+    std::string graph = profile.getFlameGraph();
+    ASSERT_NE(graph.find("render;"), std::string::npos);
+    ASSERT_NE(graph.find(";for:1:"), std::string::npos);
+    ASSERT_NE(graph.find(";upcase:1:" + std::to_string(upcase->column)), std::string::npos);
+
+    // Programs only see the calls they make, but know where they're from.
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    interpreter.profiler = make_unique<Profiler>();
+    Program program = getCompiler().compile(ast);
+    ASSERT_EQ(interpreter.renderTemplate(program, hash), "ABC\n3");
+    ASSERT_EQ(interpreter.renderTemplate(program, hash), "ABC\n3");
+    check(*interpreter.profiler.get());
+    ASSERT_EQ(interpreter.profiler->entries[0].calls, 2U);
+    ASSERT_EQ(interpreter.profiler->entries[0].bytes, 10U);
+    const Profiler::Entry* interpreted = find(interpreter.profiler->entries, "upcase");
+    ASSERT_TRUE(interpreted);
+    ASSERT_EQ(interpreted->calls, 6U);
+    ASSERT_EQ(interpreted->line, upcase->line);
+    ASSERT_EQ(interpreted->column, upcase->column);
+
+    // Nothing's recorded once it's off, and the resolver's back to what it was.
+    interpreter.profiler.reset();
+    ASSERT_EQ(interpreter.renderTemplate(program, hash), "ABC\n3");
+    ASSERT_EQ(interpreter.variableResolver.getType, CPPVariableResolver().getType);
+}
+
+TEST(sanity, budgets) {
+    CPPVariable hash;
+    auto render = [](Renderer& renderer, const Node& ast, CPPVariable& store) {
+        std::string output;
+        LiquidRendererErrorType error = renderer.render(ast, store, +[](const char* chunk, size_t size, void* data) {
+            static_cast<std::string*>(data)->append(chunk, size);
+        }, &output);
+        return error;
+    };
+    Renderer renderer(getContext(), CPPVariableResolver());
+    Node ast = getParser().parse("{% for i in (1..100) %}{{ i }}{% endfor %}");
+
+    // Every node rendered costs a unit of fuel; and each render starts with a full tank.
+    renderer.maximumRenderingFuel = 50;
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+    renderer.maximumRenderingFuel = 1000;
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_NONE);
+    unsigned long long spent = renderer.getRenderingFuel();
+    ASSERT_GT(spent, 100U);
+    ASSERT_LE(spent, 1000U);
+    renderer.maximumRenderingFuel = spent;
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_NONE);
+    renderer.maximumRenderingFuel = spent - 1;
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+
+    // Programs spend theirs on calls and iterations.
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    Program program = getCompiler().compile(ast);
+    interpreter.maximumRenderingFuel = 50;
+    try {
+        interpreter.renderTemplate(program, hash);
+        FAIL();
+    } catch (Renderer::Exception& exception) {
+        ASSERT_EQ(exception.rendererError.type, LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+    }
+    interpreter.maximumRenderingFuel = 0;
+    ASSERT_EQ(interpreter.renderTemplate(program, hash).size(), 192U);
+
+    // The clock's read every so often, rather than at every node.
+    renderer.maximumRenderingFuel = 0;
+    renderer.maximumRenderingTime = 1;
+    ast = getParser().parse("{% for i in (1..5000) %}{% for j in (1..5000) %}{{ j }}{% endfor %}{% endfor %}");
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_TIME);
+    renderer.maximumRenderingTime = 0;
+
+    // Memory's counted on what strings, arrays and nodes take while rendering, not just what goes through the resolver.
+    std::string list;
+    for (int i = 0; i < 50000; ++i)
+        list.append("a,");
+    hash["list"] = list;
+    ast = getParser().parse("{% assign parts = list | split: ',' %}{{ parts | size }}");
+    ASSERT_EQ(renderer.render(ast, hash), "50001");
+    renderer.maximumMemoryUsage = 100000;
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY);
+    // Ranges are turned away before they're allocated; and within a limit, a range can be as big as it fits.
+    ast = getParser().parse("{{ (1..1000000000) | size }}");
+    ASSERT_EQ(render(renderer, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_MEMORY);
+    ASSERT_LT(renderer.budget.bytes, 100000U);
+    renderer.maximumMemoryUsage = 10000000;
+    ast = getParser().parse("{{ (1..20000) | size }}");
+    ASSERT_EQ(renderer.render(ast, hash), "20000");
+    renderer.maximumMemoryUsage = 0;
+    ASSERT_EQ(renderer.render(ast, hash), "");
+
+    // The optimizer renders without limits.
+    renderer.maximumRenderingFuel = 1;
+    Optimizer optimizer(renderer);
+    ast = getParser().parse("{{ 1 | plus: 2 }}{{ 3 | plus: 4 }}{{ 5 | plus: 6 }}");
+    optimizer.optimize(ast, hash);
+    ASSERT_EQ(renderer.error, LIQUID_RENDERER_ERROR_TYPE_NONE);
+    ASSERT_FALSE(ast.type && ast.children.size() > 1);
+}
+
+TEST(sanity, partials) {
+    static std::map<std::string, std::string> files;
+    static int reads = 0;
+    files = {
+        { "greeting", "Hello {{ name }}!" },
+        { "card", "[{{ card.title }}]" },
+        { "sum", "{{ a | plus: b }}" },
+        { "setter", "{% assign x = 5 %}" },
+        { "nested", "<{% include 'card' %}>" },
+        { "sections/header", "<h1>{{ title }}</h1>" },
+        { "broken", "{% if %}" }
+    };
+    LiquidFileSystem fileSystem = { +[](const char* name, size_t length, void (*output)(const char* chunk, size_t size, void* target), void* target, void* data) {
+        ++reads;
+        auto it = files.find(std::string(name, length));
+        if (it == files.end())
+            return false;
+        output(it->second.data(), it->second.size(), target);
+        return true;
+    }, nullptr };
+    PartialCache cache(getContext(), fileSystem);
+
+    CPPVariable hash;
+    hash["name"] = "World";
+    hash["title"] = "Shop";
+    hash["product"]["title"] = "A";
+    hash["products"][0ul]["title"] = "B";
+    hash["products"][1ul]["title"] = "C";
+    hash["partial"] = "greeting";
+
+    Renderer renderer(getContext(), CPPVariableResolver());
+    renderer.partials = &cache;
+    auto render = [&renderer](const std::string& source, CPPVariable& store) {
+        return renderer.render(getParser().parse(source), store);
+    };
+
+    ASSERT_EQ(render("{% include 'greeting' %}", hash), "Hello World!");
+    ASSERT_EQ(render("{% include partial %}", hash), "Hello World!");
+    ASSERT_EQ(render("{% include 'card' with product %}", hash), "[A]");
+    ASSERT_EQ(render("{% include 'card' with products[1] %}", hash), "[C]");
+    ASSERT_EQ(render("{% include 'card' for products %}", hash), "[B][C]");
+    ASSERT_EQ(render("{% include 'greeting' with product.title as name %}", hash), "Hello A!");
+    ASSERT_EQ(render("{% include 'sum', a: 1, b: 2 %}", hash), "3");
+    ASSERT_EQ(render("{% for card in products %}{% include 'nested' %}{% endfor %}", hash), "<[B]><[C]>");
+    ASSERT_EQ(render("{% section 'header' %}", hash), "<h1>Shop</h1>");
+    // Anything else is passed over; and the last of with and for wins.
+    ASSERT_EQ(render("{% include 'card', product %}", hash), "[]");
+    ASSERT_EQ(render("{% include 'card' with product for products %}", hash), "[B][C]");
+
+    // Includes write to the store they're included from; rendered partials only see what they're given.
+    CPPVariable store;
+    ASSERT_EQ(render("{% include 'setter' %}{{ x }}", store), "5");
+    store = CPPVariable();
+    store["name"] = "World";
+    ASSERT_EQ(render("{% render 'setter' %}{{ x }}", store), "");
+    ASSERT_EQ(render("{% render 'greeting' %}", store), "Hello !");
+    ASSERT_EQ(render("{% render 'greeting', name: 'You' %}", store), "Hello You!");
+    ASSERT_EQ(render("{% for card in products %}{% render 'card' %}{% endfor %}", hash), "[][]");
+    ASSERT_EQ(render("{% render 'card' for products as card %}", hash), "[B][C]");
+
+    // Partials that aren't there render nothing, with an error; ones that don't parse throw when they're first read.
+    ASSERT_EQ(render("a{% include 'missing' %}b", hash), "ab");
+    ASSERT_EQ(renderer.errors.size(), 1U);
+    ASSERT_EQ(renderer.errors[0].type, LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_PARTIAL);
+    ASSERT_EQ(Renderer::Error::english(renderer.errors[0]), "Unknown partial 'missing'.");
+    ASSERT_ANY_THROW(render("{% include 'broken' %}", hash));
+
+    // Each partial's only read once, whether it's there or not.
+    int before = reads;
+    ASSERT_EQ(render("{% include 'greeting' %}{% include 'missing' %}", hash), "Hello World!");
+    ASSERT_EQ(reads, before);
+    ASSERT_GT(cache.hits, 0U);
+    cache.clear();
+    ASSERT_EQ(render("{% include 'greeting' %}", hash), "Hello World!");
+    ASSERT_EQ(reads, before + 1);
+
+    // The optimizer inlines partials with static names; what they're included with is never taken from the store under that name.
+    auto countPartials = [](const Node& ast) {
+        int count = 0;
+        ast.walk([&count](const Node& node) { count += node.type && node.type->type == NodeType::Type::TAG && (node.type->symbol == "include" || node.type->symbol == "section"); });
+        return count;
+    };
+    Optimizer optimizer(renderer);
+    hash["card"]["title"] = "Wrong";
+    Node ast = getParser().parse("{% include 'card' with product %}{% include 'nested' %}{% include partial %}");
+    optimizer.optimize(ast, hash);
+    // With nothing frozen, the whole store is; so the last name's known too.
+    ASSERT_EQ(countPartials(ast), 0);
+    ASSERT_EQ(renderer.render(ast, hash), "[A]<[Wrong]>Hello World!");
+    optimizer.frozenVariables.insert("title");
+    ast = getParser().parse("{% include 'greeting' %}{% section 'header' %}{% include partial %}");
+    optimizer.optimize(ast, hash);
+    ASSERT_EQ(countPartials(ast), 1);
+    store = CPPVariable();
+    store["name"] = "There";
+    store["partial"] = "card";
+    ASSERT_EQ(renderer.render(ast, store), "Hello There!<h1>Shop</h1>[]");
+    // Loops with includes that can't be inlined aren't rendered out, or hoisted out of.
+    ast = getParser().parse("{% for i in (1..2) %}{% include partial %}{{ title | upcase }}{% endfor %}");
+    optimizer.optimize(ast, hash);
+    ASSERT_EQ(renderer.render(ast, store), "[]SHOP[]SHOP");
+
+    // Programs have the partials with static names compiled in; anything else is rendered when it's called.
+    Compiler compiler(getContext());
+    compiler.partials = &cache;
+    Interpreter interpreter(getContext(), CPPVariableResolver());
+    interpreter.partials = &cache;
+    for (auto source : {
+        "{% include 'card' with product %}|{% include 'sum', a: 1, b: 2 %}",
+        "{% for card in products %}{% include 'nested' %}{{ forloop.index }}{% endfor %}",
+        "{% include partial %}|{% render 'card' for products as card %}|{% render 'greeting', name: 'You' %}|{% include 'card' for products %}",
+        "{% section 'header' %}{% include 'setter' %}{{ x }}{% include 'missing' %}"
+    }) {
+        ast = getParser().parse(source);
+        CPPVariable rendererStore = hash, interpreterStore = hash;
+        std::string expected = renderer.render(ast, rendererStore);
+        ASSERT_EQ(interpreter.renderTemplate(compiler.compile(ast), interpreterStore), expected);
+        ASSERT_EQ(interpreter.renderTemplate(getCompiler().compile(ast), interpreterStore), expected);
+    }
+}
+
+TEST(sanity, parallel) {
+    static std::mutex mutex;
+    static std::unordered_set<std::thread::id> threads;
+    struct SlowFilter : FilterNodeType {
+        SlowFilter() : FilterNodeType("slow", 0, 0) { }
+        Node render(Renderer& renderer, const Node& node, Variable store) const override {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }
+            return getOperand(renderer, node, store);
+        }
+    };
+    getContext().registerType<SlowFilter>();
+
+    CPPVariable hash;
+    for (int i = 0; i < 100; ++i) {
+        CPPVariable& product = hash["products"][(size_t)i];
+        product["title"] = "Product " + std::to_string(i);
+        product["price"] = (i * 37) % 100;
+        product["tags"][0ul] = "t" + std::to_string(i % 3);
+        product["tags"][1ul] = "u" + std::to_string(i % 5);
+    }
+    hash["csv"] = "a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z,0,1,2,3,4,5,6,7,8,9";
+
+    WorkerPool pool(3);
+    Renderer serial(getContext(), CPPVariableResolver());
+    Renderer parallel(getContext(), CPPVariableResolver());
+    parallel.workers = &pool;
+    parallel.minimumParallelIterations = 8;
+
+    const char* templates[] = {
+        "{% for p in products %}{{ forloop.index }}:{{ p.title | upcase | slow }}{% if p.price > 50 %}!{% else %}?{% endif %}{% if forloop.last %}L{% endif %},{% endfor %}",
+        "{% for p in products reversed limit: 70 offset: 5 %}{{ forloop.index0 }}/{{ forloop.rindex }}/{{ p.price }};{% endfor %}",
+        "{% for p in products %}{% for t in p.tags %}{{ t }}{{ forloop.index }}{% endfor %}|{% endfor %}",
+        "{% assign xs = csv | split: ',' %}{% for x in xs reversed %}{{ x }}{{ forloop.first }}-{% endfor %}",
+        "{% for p in products %}{% cycle 'a', 'b' %}{% increment n %}{% assign last = p.title %}{% endfor %}{{ last }}",
+        "{% for p in products %}{% if p.price > 90 %}{% break %}{% endif %}{{ p.price }}{% endfor %}",
+        "{% if products %}A{% endif %} x {% for p in products limit: 3 %}{{ p.title }}{% endfor %} y {% unless b %}B{% endunless %}{% assign q = 1 %}{{ q }}{% if q == 1 %}one{% endif %}{% for p in products %}{{ q }}{% endfor %}"
+    };
+    for (auto source : templates) {
+        Node ast = getParser().parse(source);
+        CPPVariable serialStore = hash, parallelStore = hash;
+        std::string expected = serial.render(ast, serialStore);
+        ASSERT_EQ(parallel.render(ast, parallelStore), expected);
+        ASSERT_EQ(parallel.getRenderingFuel(), serial.getRenderingFuel());
+        parallel.outputChunkSize = 0;
+        parallelStore = hash;
+        ASSERT_EQ(parallel.render(ast, parallelStore), expected);
+        parallel.outputChunkSize = 16*1024;
+    }
+
+    // Only what can be read from more than one thread at once is.
+    Node ast = getParser().parse("{% for p in products %}{{ p.title | slow }}{% endfor %}");
+    threads.clear();
+    parallel.render(ast, hash);
+    ASSERT_GT(threads.size(), 1U);
+    threads.clear();
+    ast = getParser().parse("{% if true %}{{ 'a' | slow }}{% endif %} {% if true %}{{ 'b' | slow }}{% endif %} {% unless false %}{{ 'c' | slow }}{% endunless %} {% if true %}{{ 'd' | slow }}{% endif %}");
+    ASSERT_EQ(parallel.render(ast, hash), "a b c d");
+    ASSERT_GT(threads.size(), 1U);
+    threads.clear();
+    parallel.variableResolver.threadSafeReads = false;
+    parallel.render(ast, hash);
+    ASSERT_EQ(threads.size(), 1U);
+    parallel.variableResolver.threadSafeReads = true;
+
+    // Warnings come back once, as they would have, and limits hold across all the workers.
+    ast = getParser().parse("{% for p in products %}{{ p.title | nosuchfilter }}{% endfor %}");
+    serial.logUnknownFilters = parallel.logUnknownFilters = true;
+    serial.render(ast, hash);
+    parallel.render(ast, hash);
+    ASSERT_EQ(parallel.errors.size(), 1U);
+    ASSERT_EQ(parallel.errors.size(), serial.errors.size());
+    ASSERT_EQ(parallel.errors[0].type, LIQUID_RENDERER_ERROR_TYPE_UNKNOWN_FILTER);
+    serial.logUnknownFilters = parallel.logUnknownFilters = false;
+
+    auto render = [](Renderer& renderer, const Node& ast, CPPVariable& store) {
+        return renderer.render(ast, store, +[](const char* chunk, size_t size, void* data) { }, nullptr);
+    };
+    ast = getParser().parse("{% for p in products %}{{ p.title }}{{ p.price }}{% endfor %}");
+    parallel.maximumRenderingFuel = 100;
+    ASSERT_EQ(render(parallel, ast, hash), LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+    parallel.maximumRenderingFuel = 100000;
+    ASSERT_EQ(render(parallel, ast, hash), LIQUID_RENDERER_ERROR_TYPE_NONE);
+    parallel.maximumRenderingFuel = 0;
+
+    // Batches can be run from inside other batches' tasks, and exceptions make their way back out.
+    std::atomic<int> total(0);
+    std::vector<std::function<void()>> inner = { [&total]() { total += 1; }, [&total]() { total += 2; } };
+    std::vector<std::function<void()>> outer;
+    for (int i = 0; i < 8; ++i)
+        outer.push_back([&pool, &inner]() { pool.run(inner); });
+    pool.run(outer);
+    ASSERT_EQ(total.load(), 24);
+    ASSERT_THROW(pool.run({ []() { throw Liquid::Exception("failed"); } }), Liquid::Exception);
+}
+
+TEST(sanity, registry) {
+    Context& context = getContext();
+    // Looked up by view, without the symbol having to be a string of its own.
+    std::string_view source = "endfor|upcase|contains|true";
+    ASSERT_TRUE(context.getTagType(source.substr(3, 3)));
+    ASSERT_EQ(context.getTagType(source.substr(3, 3)), context.getTagType("for"));
+    ASSERT_EQ(context.getFilterType(source.substr(7, 6))->symbol, "upcase");
+    ASSERT_EQ(context.getBinaryOperatorType(source.substr(14, 8))->symbol, "contains");
+    ASSERT_EQ(context.getLiteralType(source.substr(23))->symbol, "true");
+    ASSERT_FALSE(context.getFilterType(source.substr(7, 5)));
+    ASSERT_FALSE(context.getTagType(""));
+    ASSERT_EQ(context.getTagType("if")->intermediates.get("else")->symbol, "else");
+    ASSERT_FALSE(context.getTagType("if")->intermediates.get("when"));
+
+    // Everything registered is found, through however many times the table's grown.
+    SymbolTable<LiteralType> table;
+    for (int i = 0; i < 1000; ++i)
+        table[std::to_string(i)] = make_unique<LiteralType>(std::to_string(i), Variant((long long)i));
+    ASSERT_EQ(table.size(), 1000);
+    for (int i = 0; i < 1000; ++i)
+        ASSERT_EQ(table.get(std::to_string(i))->value.i, i);
+    ASSERT_FALSE(table.get("1000"));
+    // Registering a symbol again replaces what was there.
+    table["5"] = make_unique<LiteralType>("5", Variant(50LL));
+    ASSERT_EQ(table.size(), 1000);
+    ASSERT_EQ(table.get("5")->value.i, 50);
+}
+
+TEST(sanity, json) {
+    std::string source = R"({
+        "shop": { "name": "Northwind", "currency": "$", "tagline": "Say \"hi\"\né😀" },
+        "products": [
+            { "title": "Shirt", "price": 1500, "weight": 0.5, "available": true, "tags": ["cotton", "sale"] },
+            { "title": "Shoes", "price": 4000, "weight": 1.25, "available": false, "tags": [] },
+            { "title": "Bag", "price": 2500, "weight": 2e0, "available": true, "tags": ["leather"], "note": null }
+        ],
+        "untouched": { "deep": [1, 2, {"a": "}]"}] },
+        "count": 3,
+        "big": 123456789012345678901234567890
+    })";
+    JSONDocument document(source.data(), source.size());
+    ASSERT_TRUE(document.isValid());
+    ASSERT_FALSE(document.root.isIndexed());
+
+    JSONValue store = JSONValue::makeScope({ &document.root });
+    Renderer renderer(getContext(), JSONVariableResolver());
+    auto render = [&renderer, &store](const std::string& source) {
+        return renderer.render(getParser().parse(source), Variable({ &store }));
+    };
+
+    ASSERT_EQ(render("{{ shop.name }} {{ count }} {{ products.size }} {{ products[1].title }} {{ products[-1].title }}"), "Northwind 3 3 Shoes Bag");
+    ASSERT_EQ(render("{{ shop.tagline }}"), "Say \"hi\"\n\xc3\xa9\xf0\x9f\x98\x80");
+    ASSERT_EQ(render("{% for p in products %}{{ p.title }}:{{ p.price | plus: 1 }}:{{ p.weight }}:{% if p.available %}Y{% else %}N{% endif %}:{{ p.tags | join: ',' }}:{{ p.note }};{% endfor %}"),
+        "Shirt:1501:0.5:Y:cotton,sale:;Shoes:4001:1.25:N::;Bag:2501:2:Y:leather:;");
+    ASSERT_EQ(render("{{ products | map: 'price' | sort | join: ',' }}"), "1500,2500,4000");
+    ASSERT_EQ(render("{% if big > 1000 %}big{% endif %}"), "big");
+    // Only what's been looked at is indexed.
+    ASSERT_TRUE(document.root.isIndexed());
+    ASSERT_FALSE(document.root.get("untouched")->isIndexed());
+    ASSERT_EQ(render("{{ untouched.deep[2].a }}"), "}]");
+
+    // Strings without escapes are the document's own.
+    std::string_view name = document.root.get("shop")->get("name")->getStringView();
+    ASSERT_GE(name.data(), source.data());
+    ASSERT_LT(name.data(), source.data() + source.size());
+
+    // Assigns go into the scope, and leave the document as it was.
+    ASSERT_EQ(render("{% assign count = 10 %}{% assign first = products.first %}{% capture greeting %}Hi {{ shop.name }}{% endcapture %}{{ count }} {{ first.title }} {{ greeting }}"), "10 Shirt Hi Northwind");
+    ASSERT_EQ(store.get("count")->i, 10);
+    ASSERT_EQ(document.root.get("count")->i, 3);
+    ASSERT_EQ(render("{% assign xs = 'a,b,c' | split: ',' %}{% for x in xs reversed %}{{ x }}{% endfor %}{{ xs.size }}"), "cba3");
+
+    // A shared document, mounted under a key, and read from a number of threads at once.
+    std::string settingsSource = R"({ "currency": "EUR", "threshold": 5000 })";
+    JSONDocument settings(settingsSource.data(), settingsSource.size());
+    JSONValue shared = JSONValue::makeScope({ &document.root });
+    shared.mount("settings", settings.root);
+    Node tmpl = getParser().parse("{{ settings.currency }}{% for p in products %}{{ p.title }}{{ p.tags.size }}{% endfor %}{{ settings.threshold }}");
+    std::vector<std::thread> threads;
+    std::vector<std::string> outputs(4);
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        threads.emplace_back([&outputs, &tmpl, &shared, i]() {
+            Renderer renderer(getContext(), JSONVariableResolver());
+            outputs[i] = renderer.render(tmpl, Variable({ &shared }));
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (auto& output : outputs)
+        ASSERT_EQ(output, "EURShirt2Shoes0Bag15000");
+
+    // Documents can be mapped from files.
+    std::string path = testing::TempDir() + "liquid-json-test.json";
+    FILE* file = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(file);
+    fwrite(settingsSource.data(), 1, settingsSource.size(), file);
+    fclose(file);
+    {
+        JSONDocument mapped(path);
+        ASSERT_TRUE(mapped.isValid());
+        JSONValue scope = JSONValue::makeScope({ &mapped.root });
+        ASSERT_EQ(renderer.render(getParser().parse("{{ currency }} {{ threshold | divided_by: 100 }}"), Variable({ &scope })), "EUR 50");
+    }
+    remove(path.c_str());
+    ASSERT_THROW(JSONDocument("/nonexistent/liquid.json"), Liquid::Exception);
+
+    std::string broken = "{ \"a\": [1, 2 }";
+    ASSERT_FALSE(JSONDocument(broken.data(), broken.size()).isValid());
+    std::string trailing = "{} x";
+    ASSERT_FALSE(JSONDocument(trailing.data(), trailing.size()).isValid());
+}
+
+// Stands in for a host language's store, copying CPPVariables into snapshots a level at a time.
+struct SnapshotHost {
+    int expansions = 0;
+    int releases = 0;
+
+    static void copy(LiquidSnapshot target, const CPPVariable& value) {
+        switch (value.type) {
+            case LIQUID_VARIABLE_TYPE_STRING: liquidSnapshotSetString(target, value.s.data(), value.s.size()); break;
+            case LIQUID_VARIABLE_TYPE_INT: liquidSnapshotSetInteger(target, value.i); break;
+            case LIQUID_VARIABLE_TYPE_FLOAT: liquidSnapshotSetFloat(target, value.f); break;
+            case LIQUID_VARIABLE_TYPE_BOOL: liquidSnapshotSetBool(target, value.b); break;
+            case LIQUID_VARIABLE_TYPE_DICTIONARY: liquidSnapshotSetDictionary(target, (void*)&value); break;
+            case LIQUID_VARIABLE_TYPE_ARRAY: liquidSnapshotSetArray(target, (void*)&value); break;
+            default: liquidSnapshotSetNil(target); break;
+        }
+    }
+    static void expand(LiquidSnapshot container, void* host, void* data) {
+        ++static_cast<SnapshotHost*>(data)->expansions;
+        const CPPVariable& value = *static_cast<CPPVariable*>(host);
+        if (value.type == LIQUID_VARIABLE_TYPE_DICTIONARY) {
+            for (auto& it : value.d)
+                copy(liquidSnapshotAddKey(container, it.first.data(), it.first.size()), *it.second.get());
+        } else {
+            for (auto& it : value.a)
+                copy(liquidSnapshotAddElement(container), *it.get());
+        }
+    }
+    static void release(void* host, void* data) { ++static_cast<SnapshotHost*>(data)->releases; }
+};
+
+TEST(sanity, snapshot) {
+    CPPVariable store;
+    store["shop"]["name"] = "Northwind";
+    for (int i = 0; i < 3; ++i) {
+        store["products"][i]["title"] = std::string("Product ") + std::to_string(i);
+        store["products"][i]["price"] = (i + 1) * 500;
+    }
+    for (int i = 0; i < 20; ++i)
+        store["untouched"]["key" + std::to_string(i)]["deep"] = i;
+
+    SnapshotHost host;
+    LiquidSnapshot snapshot = liquidCreateSnapshot(SnapshotHost::expand, SnapshotHost::release, &host);
+    SnapshotHost::copy(snapshot, store);
+    ASSERT_EQ(host.expansions, 0);
+
+    LiquidRenderer renderer = liquidCreateRenderer(LiquidContext { &getContext() });
+    liquidRegisterVariableResolver(renderer, liquidGetSnapshotVariableResolver());
+    auto render = [&renderer](const std::string& source, LiquidSnapshot store) {
+        Node ast = getParser().parse(source);
+        LiquidTemplateRender render = liquidRendererRenderTemplate(renderer, store.snapshot, LiquidTemplate { &ast }, nullptr);
+        std::string result(liquidTemplateRenderGetBuffer(render), liquidTemplateRenderGetSize(render));
+        liquidFreeTemplateRender(render);
+        return result;
+    };
+
+    // Only what's read is copied; the root, shop, products, and the one product.
+    ASSERT_EQ(render("{{ shop.name }} {{ products.size }} {{ products[1].title }} {{ products[-1].price }}", snapshot), "Northwind 3 Product 1 1500");
+    ASSERT_EQ(host.expansions, 5);
+    ASSERT_EQ(render("{% for p in products %}{{ p.title }}:{{ p.price | plus: 1 }};{% endfor %}", snapshot), "Product 0:501;Product 1:1001;Product 2:1501;");
+    ASSERT_EQ(host.expansions, 6);
+    ASSERT_EQ(render("{{ products | map: 'price' | sort | join: ',' }} {{ untouched.key12.deep }}", snapshot), "500,1000,1500 12");
+    ASSERT_EQ(host.expansions, 8);
+
+    // Assigns land in the snapshot, and not the host.
+    ASSERT_EQ(render("{% assign total = 0 %}{% for p in products %}{% assign total = total | plus: p.price %}{% endfor %}{% capture name %}{{ shop.name | upcase }}{% endcapture %}{{ total }} {{ name }}", snapshot), "3000 NORTHWIND");
+    ASSERT_EQ(render("{{ total }} {{ name }}", snapshot), "3000 NORTHWIND");
+    ASSERT_EQ(store.d.count("total"), 0);
+    const char* key = nullptr;
+    size_t keyLength = 0;
+    LiquidSnapshot last = liquidSnapshotGetElement(snapshot, liquidSnapshotGetSize(snapshot) - 1, &key, &keyLength);
+    ASSERT_EQ(std::string(key, keyLength), "name");
+    ASSERT_EQ(liquidGetSnapshotVariableResolver().getType(renderer, last.snapshot), LIQUID_VARIABLE_TYPE_STRING);
+    ASSERT_FALSE(liquidSnapshotGetElement(snapshot, liquidSnapshotGetSize(snapshot), nullptr, nullptr).snapshot);
+    // Containers copied from the host can be handed back as they were.
+    ASSERT_EQ(liquidSnapshotGetHost(snapshot), &store);
+    ASSERT_EQ(liquidSnapshotGetHost(liquidSnapshotGetElement(snapshot, 0, nullptr, nullptr)), store.d.begin()->second.get());
+
+    // Renders in a batch each get their own store, and fail on their own.
+    LiquidSnapshot other = liquidCreateSnapshot(SnapshotHost::expand, SnapshotHost::release, &host);
+    liquidSnapshotSetDictionary(other, nullptr);
+    liquidSnapshotSetString(liquidSnapshotAddKey(other, "shop", 4), "Contoso", 7);
+    LiquidSnapshot tags = liquidSnapshotAddKey(other, "tags", 4);
+    liquidSnapshotSetArray(tags, nullptr);
+    liquidSnapshotSetString(liquidSnapshotAddElement(tags), "a", 1);
+    liquidSnapshotSetString(liquidSnapshotAddElement(tags), "b", 1);
+    Node first = getParser().parse("{{ shop.name }}");
+    Node second = getParser().parse("{{ shop }}:{{ tags | join: '+' }}");
+    Node third = getParser().parse("{% for i in (1..1000) %}{{ i }}{% endfor %}");
+    void* stores[] = { snapshot.snapshot, other.snapshot, snapshot.snapshot };
+    LiquidTemplate templates[] = { LiquidTemplate { &first }, LiquidTemplate { &second }, LiquidTemplate { &third } };
+    LiquidTemplateRender renders[3];
+    LiquidRendererError errors[3];
+    liquidRendererSetLimits(renderer, 0, 0, 200);
+    ASSERT_EQ(liquidRendererRenderTemplates(renderer, 3, stores, templates, renders, errors), 1);
+    ASSERT_EQ(std::string(liquidTemplateRenderGetBuffer(renders[0]), liquidTemplateRenderGetSize(renders[0])), "Northwind");
+    ASSERT_EQ(std::string(liquidTemplateRenderGetBuffer(renders[1]), liquidTemplateRenderGetSize(renders[1])), "Contoso:a+b");
+    ASSERT_EQ(errors[0].type, LIQUID_RENDERER_ERROR_TYPE_NONE);
+    ASSERT_FALSE(renders[2].internal);
+    ASSERT_EQ(errors[2].type, LIQUID_RENDERER_ERROR_TYPE_EXCEEDED_FUEL);
+    liquidFreeTemplateRender(renders[0]);
+    liquidFreeTemplateRender(renders[1]);
+
+    // Everything given a host is released with the snapshot; the rest of untouched was never looked at.
+    int expanded = host.expansions;
+    liquidFreeSnapshot(other);
+    ASSERT_EQ(host.releases, 0);
+    liquidFreeSnapshot(snapshot);
+    ASSERT_EQ(host.releases, 1 + 1 + 1 + 3 + 1 + 20);
+    ASSERT_EQ(host.expansions, expanded);
+    liquidFreeRenderer(renderer);
+}
+
 TEST(sanity, composite) {
     CPPVariable hash, order, transaction, event, variant, product;
     Node ast;
@@ -1112,6 +2343,134 @@ TEST(sanity, error) {
     liquidFreeContext(context);
 }
 
+TEST(sanity, lexerPositions) {
+    CPPVariable hash = { };
+    hash["i"] = 3;
+    Node ast;
+
+    // Long enough runs of text that the lexer skips through them a block at a time, with newlines, stray braces and raw blocks along the way.
+    string text, expected;
+    for (int i = 0; i < 200; ++i) {
+        text += "<div class=\"x\">50% off { not a tag } ünïcödé " + std::to_string(i);
+        expected += "<div class=\"x\">50% off { not a tag } ünïcödé " + std::to_string(i);
+        if (i % 7 == 0) {
+            text += "\n";
+            expected += "\n";
+        }
+        if (i % 13 == 0) {
+            text += "{{ i }}";
+            expected += "3";
+        }
+        if (i % 29 == 0) {
+            text += "{% raw %}{{ raw }} 100% {\n} {% endraw %}";
+            expected += "{{ raw }} 100% {\n} ";
+        }
+    }
+    ast = getParser().parse(text);
+    ASSERT_EQ(renderTemplate(ast, hash), expected);
+
+    ast = getParser().parse(text + "\n\n  {% bogus %}");
+    ASSERT_EQ(getParser().errors.size(), 1);
+    ASSERT_EQ(getParser().errors[0].details.line, 39);
+    ASSERT_EQ(getParser().errors[0].details.column, 16);
+
+    ast = getParser().parse(text + "\n x {{ i | bogus_! }}");
+    ASSERT_EQ(getParser().errors.size(), 2);
+    ASSERT_EQ(getParser().errors[0].details.line, 38);
+    ASSERT_EQ(getParser().errors[0].details.column, 25);
+    ASSERT_EQ(getParser().errors[1].details.column, 27);
+
+    try {
+        ast = getParser().parse(text + "\n {% raw %} abc \n def }");
+        FAIL();
+    } catch (Parser::Exception& e) {
+        ASSERT_EQ(string(e.what()), "Unexpected end to block 'raw' on line 39, column 7.");
+    }
+}
+
+static bool sameTree(const Node& a, const Node& b) {
+    if (a.type != b.type || a.line != b.line || a.column != b.column)
+        return false;
+    if (!a.type)
+        return a.variant.getString() == b.variant.getString();
+    if (a.children.size() != b.children.size())
+        return false;
+    for (size_t i = 0; i < a.children.size(); ++i) {
+        if (!a.children[i] || !b.children[i]) {
+            if (a.children[i] || b.children[i])
+                return false;
+        } else if (!sameTree(*a.children[i].get(), *b.children[i].get()))
+            return false;
+    }
+    return true;
+}
+
+TEST(sanity, reparse) {
+    Parser parser(getContext());
+    Parser reference(getContext());
+    string text;
+    for (int i = 0; i < 20; ++i)
+        text += "<li>{{ product.title | upcase }}</li>\n{% if product.available %}\n    {%- assign a = " + std::to_string(i) + " -%} in stock {% else %}{{ a }}{% endif %} {% raw %}{{ }}{% endraw %}\n";
+    Parser::Document document = parser.parseDocument(text);
+    ASSERT_EQ(parser.errors.size(), 0);
+
+    // Each is made just before the first occurrence of its target after the given offset, replacing length bytes from there.
+    struct Edit { const char* target; size_t after; size_t length; const char* replacement; bool incremental; };
+    Edit edits[] = {
+        { "upcase", 0, 6, "downcase", true },
+        { "\n{% if", 0, 0, "{{ a }}", true },
+        { "in stock", 400, 0, "\n\n\n", true },
+        { "{{ }}", 600, 5, "", true },
+        { "<li>", 800, 0, " {% for %}{% endfor %} ", true },
+        // Swallows everything up to the next raw block's end, so there's nowhere short of the end for a re-parse to stop.
+        { "<li>", 1000, 0, "{% raw %}", false },
+        { "{% else %}", 1200, 10, "{% for i in (1..3) %}{{ i }}{% endfor %}{% else %}", true }
+    };
+    for (auto& edit : edits) {
+        size_t offset = document.source.find(edit.target, edit.after);
+        ASSERT_NE(offset, string::npos);
+        ASSERT_EQ(parser.reparse(document, offset, edit.length, edit.replacement), edit.incremental) << edit.replacement;
+        if (edit.replacement[0] == ' ') {
+            ASSERT_EQ(parser.errors.size(), 2);
+        }
+        Parser::Document expected = reference.parseDocument(document.source);
+        ASSERT_TRUE(sameTree(document.tree, expected.tree));
+        ASSERT_EQ(document.boundaries.size(), expected.boundaries.size());
+        for (size_t i = 0; i < document.boundaries.size(); ++i) {
+            ASSERT_EQ(document.boundaries[i].offset, expected.boundaries[i].offset);
+            ASSERT_EQ(document.boundaries[i].line, expected.boundaries[i].line);
+            ASSERT_EQ(document.boundaries[i].column, expected.boundaries[i].column);
+            ASSERT_EQ(document.boundaries[i].children, expected.boundaries[i].children);
+        }
+    }
+    // Only the errors from the part that was re-parsed are reported.
+    ASSERT_TRUE(parser.reparse(document, 5, 0, "y"));
+    ASSERT_EQ(parser.errors.size(), 0);
+
+    string source = document.source;
+    ASSERT_THROW({
+        parser.reparse(document, 100, 0, "{% if a %}");
+    }, Parser::Exception);
+    ASSERT_EQ(document.source, source);
+
+    auto context = liquidCreateContext();
+    liquidImplementPermissiveStandardDialect(context);
+    auto cparser = liquidCreateParser(context);
+    LiquidLexerError lexerError;
+    LiquidParserError parserError;
+    LiquidDocument cdocument = liquidParserParseDocument(cparser, "a{{ b }}c{{ d }}", sizeof("a{{ b }}c{{ d }}")-1, &lexerError, &parserError);
+    ASSERT_TRUE(cdocument.document);
+    ASSERT_EQ(liquidParserReparseDocument(cparser, cdocument, 9, 0, "e", 1, &lexerError, &parserError), 1);
+    ASSERT_EQ(liquidParserReparseDocument(cparser, cdocument, 9, 0, "{% if b %}", 10, &lexerError, &parserError), -1);
+    LiquidTemplate tmpl = liquidDocumentGetTemplate(cdocument);
+    char buffer[64];
+    int copied = liquidParserUnparseTemplate(cparser, tmpl, buffer, sizeof(buffer));
+    ASSERT_EQ(string(buffer, copied), "a{{ b }}ce{{ d }}");
+    liquidFreeDocument(cdocument);
+    liquidFreeParser(cparser);
+    liquidFreeContext(context);
+}
+
 #ifdef LIQUID_INCLUDE_RAPIDJSON_VARIABLE
 
 #include "../src/rapidjsonvariable.h"
@@ -1170,6 +2529,24 @@ TEST(sanity, web) {
     str = renderTemplate(ast, hash);
     ASSERT_EQ(str, "&lt;html&gt;&lt;/html&gt;");
 
+    // Long enough to be escaped a block at a time, with things to replace on either side of the blocks' edges.
+    hash["description"] = "<p class=\"lead\">Tom & Jerry's \"best\" mugs</p>\r\n<ul><li>12oz</li>\n<li>Dishwasher safe & microwave safe</li></ul>";
+    ast = getParser().parse("{{ description | escape }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "&lt;p class=&quot;lead&quot;&gt;Tom &amp; Jerry&apos;s &quot;best&quot; mugs&lt;/p&gt;\r\n&lt;ul&gt;&lt;li&gt;12oz&lt;/li&gt;\n&lt;li&gt;Dishwasher safe &amp; microwave safe&lt;/li&gt;&lt;/ul&gt;");
+
+    ast = getParser().parse("{{ description | newline_to_br }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "<p class=\"lead\">Tom & Jerry's \"best\" mugs</p><br/><ul><li>12oz</li><br/><li>Dishwasher safe & microwave safe</li></ul>");
+
+    ast = getParser().parse("{{ 'Nothing here needs escaping at all, however long it goes on for.' | escape }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "Nothing here needs escaping at all, however long it goes on for.");
+
+    ast = getParser().parse("{{ 'Caf\xC3\xA9 au lait, 2 for $5 & more' | url_encode }}");
+    str = renderTemplate(ast, hash);
+    ASSERT_EQ(str, "Caf%c3%a9%20au%20lait%2c%202%20for%20%245%20%26%20more");
+
     ast = getParser().parse("{{ 1608524371 | date: \"%B %d, %Y\" }}");
     str = renderTemplate(ast, hash);
     ASSERT_EQ(str, "December 20, 2020");
@@ -1266,5 +2643,7 @@ TEST(sanity, unparser) {
 
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
-    return RUN_ALL_TESTS();
+    int result = RUN_ALL_TESTS();
+    fprintf(stderr, "Renderer: %fs, interpreter: %fs\n", rendererTime, interpreterTime);
+    return result;
 }